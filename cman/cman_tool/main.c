@@ -201,6 +201,7 @@ static void show_status(void)
 	char tmpbuf[1024];
 	cman_extra_info_t *einfo = (cman_extra_info_t *)info_buf;
 	cman_qdev_info_t qinfo;
+	cman_reply_stats_t rstats;
 	int quorate;
 	int i;
 	int j;
@@ -284,6 +285,21 @@ static void show_status(void)
 	}
 	printf("\n");
 
+	/* Older daemons don't keep these */
+	if (cman_get_reply_stats(h, &rstats) == 0) {
+		printf("Client replies: %llu queued, %llu shared, %u waiting "
+		       "(max %u), %u overflows\n",
+		       (unsigned long long)rstats.rs_replies_queued,
+		       (unsigned long long)rstats.rs_buffers_shared,
+		       rstats.rs_queue_depth, rstats.rs_max_queue_depth,
+		       rstats.rs_overflows);
+		printf("Client reply bytes: %llu sent, %llu flushed in %llu "
+		       "sends\n",
+		       (unsigned long long)rstats.rs_bytes_sent,
+		       (unsigned long long)rstats.rs_bytes_flushed,
+		       (unsigned long long)rstats.rs_flushes);
+	}
+
 	if (einfo->ei_flags & CMAN_EXTRA_FLAG_DISALLOWED) {
 		int count;
 		int numnodes;
@@ -288,6 +288,7 @@ static void cman_deliver_fn(unsigned int nodeid, const void *msg, unsigned int m
 				 buf + sizeof(struct cl_protheader), msg_len - sizeof(struct cl_protheader),
 				 endian_conversion_required);
 	}
+	flush_status_page();
 }
 
 static void cman_confchg_fn(enum totem_configuration_type configuration_type,
@@ -307,6 +308,7 @@ static void cman_confchg_fn(enum totem_configuration_type configuration_type,
 	memcpy(&cman_ring_id, ring_id, sizeof(*ring_id));
 	incarnation = ring_id->seq;
 	num_ais_nodes = member_list_entries;
+	status_page_changed();
 
 	/* Tell the cman membership layer */
 	for (i=0; i<left_list_entries; i++)
@@ -349,6 +351,7 @@ static void cman_confchg_fn(enum totem_configuration_type configuration_type,
 				  saved_left_list, saved_left_list_entries,
 				  joined_list, joined_list_entries);
 	}
+	flush_status_page();
 }
 
 void corosync_shutdown(void)
@@ -24,6 +24,7 @@
 #include <corosync/engine/coroapi.h>
 #include <corosync/engine/logsys.h>
 #include "list.h"
+#include "fnvhash.h"
 #include "cnxman-socket.h"
 #include "cnxman-private.h"
 #include "daemon.h"
@@ -38,7 +39,9 @@ LOGSYS_DECLARE_SUBSYS (CMAN_NAME);
 
 /* A barrier */
 struct cl_barrier {
-	struct list list;
+	struct list list;	/* on its barrier_hash chain */
+	struct list pending;	/* on pending_list, or empty */
+	struct list con_list;	/* on its connection's barriers */
 
 	char name[MAX_BARRIER_NAME_LEN];
 	unsigned int flags;
@@ -57,8 +60,37 @@ struct cl_barrier {
 };
 extern struct corosync_api_v1 *corosync;
 
-/* A list of all current barriers */
-static struct list barrier_list;
+/* All current barriers, hashed by name */
+#define BARRIER_HASH_SIZE 1024
+static struct list barrier_hash[BARRIER_HASH_SIZE];
+
+/* Barriers with a client waiting on them that a node leaving would wake */
+static struct list pending_list;
+
+static struct list *barrier_chain(char *name)
+{
+	return &barrier_hash[fnv_hash(name) % BARRIER_HASH_SIZE];
+}
+
+static void set_pending(struct cl_barrier *barrier)
+{
+	if (list_empty(&barrier->pending))
+		list_add(&pending_list, &barrier->pending);
+}
+
+static void clear_pending(struct cl_barrier *barrier)
+{
+	list_del(&barrier->pending);
+	list_init(&barrier->pending);
+}
+
+static void free_barrier(struct cl_barrier *barrier)
+{
+	list_del(&barrier->list);
+	list_del(&barrier->pending);
+	list_del(&barrier->con_list);
+	free(barrier);
+}
 
 static void send_barrier_complete_msg(struct cl_barrier *barrier)
 {
@@ -72,14 +104,16 @@ static void send_barrier_complete_msg(struct cl_barrier *barrier)
 			send_status_return(barrier->con, CMAN_CMD_BARRIER, barrier->endreason);
 		barrier->client_complete = 1;
 	}
+	clear_pending(barrier);
 }
 
 static struct cl_barrier *find_barrier(char *name)
 {
 	struct list *blist;
+	struct list *chain = barrier_chain(name);
 	struct cl_barrier *bar;
 
-	list_iterate(blist, &barrier_list) {
+	list_iterate(blist, chain) {
 		bar = list_item(blist, struct cl_barrier);
 
 		if (strcmp(name, bar->name) == 0)
@@ -127,8 +161,7 @@ static int barrier_complete_phase2(struct cl_barrier *barrier, int status)
 
 	/* Delete barrier if autodelete */
 	if (barrier->flags & BARRIER_ATTR_AUTODELETE) {
-		list_del(&barrier->list);
-		free(barrier);
+		free_barrier(barrier);
 		return 1;
 	}
 
@@ -149,7 +182,7 @@ static void barrier_timer_fn(void *arg)
 	barrier_complete_phase2(barrier, -ETIMEDOUT);
 }
 
-static struct cl_barrier *alloc_barrier(char *name, int nodes)
+static struct cl_barrier *alloc_barrier(struct connection *con, char *name, int nodes)
 {
 	struct cl_barrier *barrier;
 
@@ -167,7 +200,11 @@ static struct cl_barrier *alloc_barrier(char *name, int nodes)
 	barrier->endreason = 0;
 	barrier->state = BARRIER_STATE_INACTIVE;
 
-	list_add(&barrier_list, &barrier->list);
+	barrier->con = con;
+
+	list_add(barrier_chain(barrier->name), &barrier->list);
+	list_add(&con->barriers, &barrier->con_list);
+	list_init(&barrier->pending);
 	return barrier;
 }
 
@@ -238,17 +275,18 @@ static int barrier_register(struct connection *con, char *name, unsigned int fla
 		}
 		else {
 			/* Fill this is as it may have been remote registered */
+			list_del(&barrier->con_list);
+			list_add(&con->barriers, &barrier->con_list);
 			barrier->con = con;
 			return 0;
 		}
 	}
 
-	barrier = alloc_barrier(name, nodes);
+	barrier = alloc_barrier(con, name, nodes);
 	if (!barrier)
 		return -ENOMEM;
 
 	barrier->flags = flags;
-	barrier->con = con;
 	return 0;
 }
 
@@ -353,8 +391,7 @@ static int barrier_delete(char *name)
 	}
 
 	/* Delete it */
-	list_del(&barrier->list);
-	free(barrier);
+	free_barrier(barrier);
 	return 0;
 }
 
@@ -376,6 +413,8 @@ static int barrier_wait(char *name)
 	}
 	else {
 		barrier->state = BARRIER_STATE_WAITING;
+		if (barrier->waitsent)
+			set_pending(barrier);
 	}
 
 	/* User will wait */
@@ -389,34 +428,22 @@ static int barrier_wait(char *name)
  * case */
 void check_barrier_returns()
 {
-	struct list *blist;
+	struct list *blist, *tmp;
 	struct cl_barrier *barrier;
-	int status = 0;
-
-	list_iterate(blist, &barrier_list) {
-		barrier = list_item(blist, struct cl_barrier);
-
-		if (barrier->waitsent) {
-			int wakeit = 0;
-
-			/* Check for a dynamic member barrier */
-			if (barrier->expected_nodes == 0) {
-				status = 0;
-				wakeit = 1;
-			}
-			else {
-				status = ESRCH;
-				wakeit = 1;
-			}
-
-			/* Do we need to tell the barrier? */
-			if (wakeit) {
-				if (barrier->state == BARRIER_STATE_WAITING) {
-					barrier->endreason = status;
-					send_barrier_complete_msg(barrier);
-				}
-			}
-		}
+	int status;
+
+	/* Only waiting barriers are on the list, and they all get woken */
+	list_iterate_safe(blist, tmp, &pending_list) {
+		barrier = list_struct_base(blist, struct cl_barrier, pending);
+
+		/* Check for a dynamic member barrier */
+		if (barrier->expected_nodes == 0)
+			status = 0;
+		else
+			status = ESRCH;
+
+		barrier->endreason = status;
+		send_barrier_complete_msg(barrier);
 	}
 }
 
@@ -455,17 +482,17 @@ void remove_barriers(struct connection *con)
 	struct list *blist, *tmp;
 	struct cl_barrier *bar;
 
-	list_iterate_safe(blist, tmp, &barrier_list) {
-		bar = list_item(blist, struct cl_barrier);
-
-		if (con == bar->con) {
-			list_del(&bar->list);
-			free(bar);
-		}
+	list_iterate_safe(blist, tmp, &con->barriers) {
+		bar = list_struct_base(blist, struct cl_barrier, con_list);
+		free_barrier(bar);
 	}
 }
 
 void barrier_init()
 {
-	list_init(&barrier_list);
+	int i;
+
+	for (i = 0; i < BARRIER_HASH_SIZE; i++)
+		list_init(&barrier_hash[i]);
+	list_init(&pending_list);
 }
@@ -105,10 +105,14 @@ struct connection
 	enum {SHUTDOWN_REPLY_UNK=0, SHUTDOWN_REPLY_YES, SHUTDOWN_REPLY_NO} shutdown_reply;
 	uint32_t   events;      /* Registered for events */
 	uint32_t   confchg;     /* Registered for confchg */
-	struct list write_msgs; /* Queued messages to go to data clients */
+	struct reply_buf **write_msgs; /* Ring of queued messages to go to data clients */
+	uint32_t    write_msgs_size; /* Slots in the ring, a power of 2 */
+	uint32_t    write_msgs_head; /* Slot of the oldest */
+	uint32_t    write_offset;   /* How much of the oldest has been sent */
 	uint32_t    num_write_msgs; /* Count of messages */
 	struct connection *next;
 	struct list list;       /* when on the client_list */
+	struct list barriers;   /* Barriers registered by this client */
 };
 
 /* Parameters for RECONFIG command */
@@ -133,9 +137,14 @@ struct connection
 #define NODE_FLAGS_DIRTY             16
 #define NODE_FLAGS_REREAD            32
 
+/* Buckets in the nodeid and node name hashes */
+#define NODE_HASH_SIZE 256
+
 /* There's one of these for each node in the cluster */
 struct cluster_node {
 	struct list list;
+	struct cluster_node *id_next;	/* nodeid hash chain */
+	struct cluster_node *name_next;	/* node name hash chain */
 	char *name;		/* Node/host name of node */
 	struct list addr_list;
 	int us;			/* This node is us */
@@ -43,6 +43,8 @@
 #define CMAN_CMD_SET_DEBUGLOG       0x800000c3
 #define CMAN_CMD_DUMP_OBJDB         0x800000c4
 #define CMAN_CMD_GETNODE_EXTRA      0x000000c5
+#define CMAN_CMD_GETMEMBERS_SINCE   0x000000c6
+#define CMAN_CMD_GET_REPLY_STATS    0x800000c7
 
 #define CMAN_CMD_DATA               0x00000100
 #define CMAN_CMD_BIND               0x00000101
@@ -195,6 +197,27 @@ struct cl_cluster_node {
 	unsigned char votes;
 };
 
+/* Passed to CMAN_CMD_GETMEMBERS_SINCE with the generation the caller last
+ * saw, or 0. The reply has the current generation and, if that is
+ * different, the same nodes as CMAN_CMD_GETALLMEMBERS */
+struct cl_members_generation {
+	uint32_t generation;
+	struct cl_cluster_node nodes[];
+};
+
+/* Returned from CMAN_CMD_GET_REPLY_STATS. Counts are since cman started */
+struct cl_reply_stats {
+	uint32_t connections;
+	uint32_t queue_depth;		/* replies waiting to go, all clients */
+	uint32_t max_queue_depth;	/* most ever waiting for one client */
+	uint32_t overflows;		/* clients dropped for too many waiting */
+	uint64_t replies_queued;
+	uint64_t buffers_shared;	/* extra clients given a queued event */
+	uint64_t bytes_sent;		/* sent as soon as they were ready */
+	uint64_t bytes_flushed;		/* sent later from the queue */
+	uint64_t flushes;		/* calls to sendmsg() to do that */
+};
+
 struct cl_node_extra
 {
 	int nodeid;
@@ -38,6 +38,8 @@
 #include "nodelist.h"
 #include "commands.h"
 #include "ais.h"
+#include "fnvhash.h"
+#include "statuspage.h"
 
 #define max(a,b) (((a) > (b)) ? (a) : (b))
 LOGSYS_DECLARE_SUBSYS (CMAN_NAME);
@@ -51,11 +53,16 @@ static struct connection *port_array[256];
 
 // Stuff that was more global
 static LIST_INIT(cluster_members_list);
+static struct cluster_node *nodeid_hash[NODE_HASH_SIZE];
+static struct cluster_node *nodename_hash[NODE_HASH_SIZE];
+static int node_count;
        int cluster_members;
        int we_are_a_cluster_member;
        unsigned int config_version;
 static struct cluster_node *us;
 static int quorum;
+static unsigned int quorum_total_votes;
+static int status_page_dirty;
 extern int two_node;
        unsigned int quorumdev_poll=DEFAULT_QUORUMDEV_POLL;
        unsigned int shutdown_timeout=DEFAULT_SHUTDOWN_TIMEOUT;
@@ -86,10 +93,18 @@ static int shutdown_yes;
 static int shutdown_no;
 static int shutdown_expected;
 
+/* What GETALLMEMBERS returns, built the first time it is asked for after
+ * something in it has changed. members_generation goes up with each change,
+ * so clients can ask whether anything is different from what they have. */
+static struct cl_cluster_node *members_snapshot;
+static int members_snapshot_count;
+static int members_snapshot_alloc;
+static int members_snapshot_valid;
+static uint32_t members_generation = 1;
+
 static struct cluster_node *find_node_by_nodeid(int nodeid);
 static struct cluster_node *find_node_by_name(char *name);
 static int get_node_count(void);
-static int get_highest_nodeid(void);
 static int send_port_open_msg(unsigned char port);
 static int send_port_enquire(int nodeid);
 static void process_internal_message(char *data, int nodeid, int byteswap);
@@ -248,6 +263,115 @@ static void node_add_ordered(struct cluster_node *newnode)
         }
 }
 
+/* Something in the status page has changed. It isn't rewritten until
+   flush_status_page() is called, once we have finished with whatever caused
+   the change, so that nobody sees the votes from one membership against the
+   members of another */
+void status_page_changed(void)
+{
+	status_page_dirty = 1;
+}
+
+/* Copy what clients ask for most into the status page */
+void flush_status_page(void)
+{
+	struct cman_status_page *page;
+
+	if (!status_page_dirty)
+		return;
+	status_page_dirty = 0;
+
+	page = status_page_begin();
+	if (!page)
+		return;
+
+	page->active = ais_running;
+	page->quorate = cluster_is_quorate;
+	page->member = we_are_a_cluster_member;
+	page->node_count = get_node_count();
+	if (quorum_device)
+		page->node_count++;
+	page->members = cluster_members;
+	page->quorum = quorum;
+	page->total_votes = quorum_total_votes;
+	page->config_version = config_version;
+	page->members_generation = members_generation;
+	page->cluster.number = cluster_id;
+	page->cluster.generation = incarnation;
+	memcpy(page->cluster.name, cluster_name, sizeof(page->cluster.name));
+
+	status_page_end(page);
+}
+
+/* Call this whenever something that copy_to_usernode() reports changes */
+static void members_changed(void)
+{
+	/* 0 is what clients pass when they have never seen a snapshot */
+	if (!++members_generation)
+		members_generation = 1;
+
+	members_snapshot_valid = 0;
+	status_page_changed();
+}
+
+/* Nodes are hashed by nodeid and by name as well as being on
+ * cluster_members_list, so that looking one up doesn't mean walking
+ * the whole list. nodeids can be anything up to 32 bits so they are
+ * mixed rather than used as an index */
+static unsigned int nodeid_hashval(unsigned int nodeid)
+{
+	return ((nodeid * 2654435761U) >> 16) % NODE_HASH_SIZE;
+}
+
+static unsigned int nodename_hashval(char *name)
+{
+	return fnv_hash(name) % NODE_HASH_SIZE;
+}
+
+static void hash_node_name(struct cluster_node *node)
+{
+	unsigned int h = nodename_hashval(node->name);
+
+	node->name_next = nodename_hash[h];
+	nodename_hash[h] = node;
+}
+
+static void unhash_node_name(struct cluster_node *node)
+{
+	struct cluster_node **np;
+
+	for (np = &nodename_hash[nodename_hashval(node->name)]; *np; np = &(*np)->name_next) {
+		if (*np == node) {
+			*np = node->name_next;
+			break;
+		}
+	}
+}
+
+static void hash_node(struct cluster_node *node)
+{
+	unsigned int h = nodeid_hashval(node->node_id);
+
+	node->id_next = nodeid_hash[h];
+	nodeid_hash[h] = node;
+	hash_node_name(node);
+	node_count++;
+}
+
+static void unhash_node(struct cluster_node *node)
+{
+	struct cluster_node **np;
+
+	for (np = &nodeid_hash[nodeid_hashval(node->node_id)]; *np; np = &(*np)->id_next) {
+		if (*np == node) {
+			*np = node->id_next;
+			break;
+		}
+	}
+	unhash_node_name(node);
+	node_count--;
+}
+
 static struct cluster_node *add_new_node(char *name, int nodeid, int votes, int expected_votes,
 					 nodestate_t state)
 {
@@ -293,19 +417,24 @@ static struct cluster_node *add_new_node(char *name, int nodeid, int votes, int
 		newname = strdup(name);
 		if (newname) {
 			log_printf(LOGSYS_LEVEL_DEBUG, "memb: replacing old node name %s with %s\n", newnode->name, name);
+			unhash_node_name(newnode);
 			free(newnode->name);
 			newnode->name = newname;
+			hash_node_name(newnode);
 		}
 	}
 
-	if (newalloc)
+	if (newalloc) {
 		node_add_ordered(newnode);
+		hash_node(newnode);
+	}
 
 	newnode->flags |= NODE_FLAGS_REREAD;
 
 	log_printf(LOGSYS_LEVEL_DEBUG, "memb: add_new_node: %s, (id=%d, votes=%d) newalloc=%d\n",
 	       name, nodeid, votes, newalloc);
 
+	members_changed();
 	return newnode;
 }
 
@@ -382,7 +511,10 @@ static void recalculate_quorum(int allow_decrease, int by_current_nodes)
 	unsigned int total_votes;
 
 	quorum = calculate_quorum(allow_decrease, by_current_nodes?cluster_members:0, &total_votes);
+	quorum_total_votes = total_votes;
 	set_quorate(total_votes);
+	status_page_changed();
+
 	notify_listeners(NULL, EVENT_REASON_STATECHANGE, cluster_is_quorate);
 }
 
@@ -465,6 +597,7 @@ int cman_join_cluster(struct corosync_api_v1 *api,
 			  NODESTATE_DEAD);
 	set_port_bit(us, 0);
 	us->us = 1;
+	members_changed();
 
 	return 0;
 }
@@ -618,60 +751,113 @@ static int do_cmd_get_extrainfo(char *cmdbuf, char **retbuf, int retsize, int *r
 	return 0;
 }
 
-static int do_cmd_get_all_members(char *cmdbuf, char **retbuf, int retsize, int *retlen, int offset)
+static int build_members_snapshot(void)
 {
 	struct cluster_node *node;
 	struct cl_cluster_node *user_node;
-	struct list *nodelist;
-	char *outbuf = *retbuf + offset;
-	int num_nodes = 0;
-	int total_nodes = 0;
-	int highest_node;
-
-	if (!we_are_a_cluster_member)
-		return -ENOENT;
+	int total_nodes;
 
-	highest_node = get_highest_nodeid();
+	if (members_snapshot_valid)
+		return 0;
 
-	/* Count nodes */
-	list_iterate(nodelist, &cluster_members_list) {
-		total_nodes++;
-	}
+	total_nodes = get_node_count();
 	if (quorum_device)
 		total_nodes++;
 
-	/* if retsize == 0 then don't return node information */
-	if (retsize) {
-		/* If there is not enough space in the default buffer, allocate some more. */
-		if ((retsize / sizeof(struct cl_cluster_node)) < total_nodes) {
-			*retbuf = malloc(sizeof(struct cl_cluster_node) * total_nodes + offset);
-			if (!*retbuf)
-				return -ENOMEM;
-			outbuf = *retbuf + offset;
-			log_printf(LOGSYS_LEVEL_DEBUG, "memb: get_all_members: allocated new buffer (retsize=%d)\n", retsize);
-		}
+	if (total_nodes > members_snapshot_alloc) {
+		user_node = realloc(members_snapshot, sizeof(struct cl_cluster_node) * total_nodes);
+		if (!user_node)
+			return -ENOMEM;
+		members_snapshot = user_node;
+		members_snapshot_alloc = total_nodes;
 	}
-	user_node = (struct cl_cluster_node *)outbuf;
 
-	/* This returns the full list */
+	user_node = members_snapshot;
 	list_iterate_items(node, &cluster_members_list) {
-		if (retsize) {
-			copy_to_usernode(node, user_node);
+		copy_to_usernode(node, user_node);
+		user_node++;
+	}
+	if (quorum_device)
+		copy_to_usernode(quorum_device, user_node);
 
-			user_node++;
-			num_nodes++;
-		}
+	members_snapshot_count = total_nodes;
+	members_snapshot_valid = 1;
+	log_printf(LOGSYS_LEVEL_DEBUG, "memb: built members snapshot, generation %u, %d nodes\n",
+		   members_generation, total_nodes);
+	return 0;
+}
+
+static int do_cmd_get_all_members(char *cmdbuf, char **retbuf, int retsize, int *retlen, int offset)
+{
+	int len;
+	int ret;
+
+	if (!we_are_a_cluster_member)
+		return -ENOENT;
+
+	ret = build_members_snapshot();
+	if (ret)
+		return ret;
+
+	/* if retsize == 0 then don't return node information */
+	if (!retsize) {
+		*retlen = 0;
+		return members_snapshot_count;
 	}
 
-	if (quorum_device) {
-		copy_to_usernode(quorum_device, user_node);
-		user_node++;
-		num_nodes++;
+	len = sizeof(struct cl_cluster_node) * members_snapshot_count;
+
+	/* If there is not enough space in the default buffer, allocate some more. */
+	if (retsize - offset < len) {
+		*retbuf = malloc(len + offset);
+		if (!*retbuf)
+			return -ENOMEM;
+		log_printf(LOGSYS_LEVEL_DEBUG, "memb: get_all_members: allocated new buffer (retsize=%d)\n", retsize);
 	}
+	memcpy(*retbuf + offset, members_snapshot, len);
 
-	*retlen = sizeof(struct cl_cluster_node) * num_nodes;
+	*retlen = len;
 	log_printf(LOGSYS_LEVEL_DEBUG, "memb: get_all_members: retlen = %d\n", *retlen);
-	return num_nodes;
+	return members_snapshot_count;
+}
+
+/* As GETALLMEMBERS, but only if the membership has changed since the
+ * generation the caller passes in. Otherwise just the generation comes back */
+static int do_cmd_get_members_since(char *cmdbuf, char **retbuf, int retsize, int *retlen, int offset)
+{
+	struct cl_members_generation *gen = (struct cl_members_generation *)cmdbuf;
+	struct cl_members_generation *reply;
+	int len;
+	int ret;
+
+	if (!we_are_a_cluster_member)
+		return -ENOENT;
+
+	if (gen->generation == members_generation) {
+		reply = (struct cl_members_generation *)(*retbuf + offset);
+		reply->generation = members_generation;
+		*retlen = sizeof(struct cl_members_generation);
+		return 0;
+	}
+
+	ret = build_members_snapshot();
+	if (ret)
+		return ret;
+
+	len = sizeof(struct cl_members_generation) +
+		sizeof(struct cl_cluster_node) * members_snapshot_count;
+
+	if (retsize - offset < len) {
+		*retbuf = malloc(len + offset);
+		if (!*retbuf)
+			return -ENOMEM;
+	}
+	reply = (struct cl_members_generation *)(*retbuf + offset);
+	reply->generation = members_generation;
+	memcpy(reply->nodes, members_snapshot, len - sizeof(struct cl_members_generation));
+
+	*retlen = len;
+	return members_snapshot_count;
 }
 
 
@@ -839,6 +1025,7 @@ static int do_cmd_kill_node(char *cmdbuf, int *retlen)
 
 	node->leave_reason = CLUSTER_LEAVEFLAG_KILLED;
 	node->state = NODESTATE_LEAVING;
+	members_changed();
 
 	/* Send a KILL message */
 	send_kill(nodeid, CLUSTER_KILL_CMANTOOL);
@@ -928,6 +1115,7 @@ static int do_cmd_set_votes(char *cmdbuf, int *retlen)
 		return -EINVAL;
 	}
 
+	members_changed();
 	recalculate_quorum(1, 0);
 
 	send_reconfigure(arg.nodeid, RECONFIG_PARAM_NODE_VOTES, arg.newvotes);
@@ -977,6 +1165,7 @@ static int do_cmd_leave_cluster(char *cmdbuf, int *retlen)
 	}
 
 	us->leave_reason = leave_flags;
+	members_changed();
 	quit_threads = 1;
 
 	/* No messaging available yet, just die */
@@ -1149,6 +1338,7 @@ static int do_cmd_register_quorum_device(char *cmdbuf, int *retlen)
 
 	/* Update votes even if it existed before */
         quorum_device->votes = votes;
+	members_changed();
 
         return 0;
 }
@@ -1165,6 +1355,7 @@ static int do_cmd_unregister_quorum_device(char *cmdbuf, int *retlen)
 	free(quorum_device);
 
         quorum_device = NULL;
+	members_changed();
 
 	log_printf(LOG_INFO, "quorum device unregistered\n");
         return 0;
@@ -1205,6 +1396,7 @@ static int reread_config(int new_version)
 		send_transition_msg(0,0);
 	}
 
+	status_page_changed();
 	return read_err;
 }
 
@@ -1236,6 +1428,7 @@ static void ccsd_timer_fn(void *arg)
 		  corosync_shutdown();
 	      }
 	}
+	flush_status_page();
 }
 
 
@@ -1250,6 +1443,7 @@ static void quorum_device_timer_fn(void *arg)
 	if (quorum_device->last_hello.tv_sec + quorumdev_poll/1000 < now.tv_sec) {
 		quorum_device->state = NODESTATE_DEAD;
 		log_printf(LOG_INFO, "lost contact with quorum device\n");
+		members_changed();
 		recalculate_quorum(0, 0);
 	}
 	else {
@@ -1271,6 +1465,7 @@ static int do_cmd_poll_quorum_device(char *cmdbuf, int *retlen)
 		gettimeofday(&quorum_device->last_hello, NULL);
                 if (quorum_device->state == NODESTATE_DEAD) {
                         quorum_device->state = NODESTATE_MEMBER;
+			members_changed();
                         recalculate_quorum(0, 0);
 
 			corosync->timer_add_duration((unsigned long long)quorumdev_poll*1000000, quorum_device,
@@ -1280,6 +1475,7 @@ static int do_cmd_poll_quorum_device(char *cmdbuf, int *retlen)
         else {
                 if (quorum_device->state == NODESTATE_MEMBER) {
                         quorum_device->state = NODESTATE_DEAD;
+			members_changed();
                         recalculate_quorum(0, 0);
 			corosync->timer_delete(quorum_device_timer);
                 }
@@ -1464,6 +1660,11 @@ int process_command(struct connection *con, int cmd, char *cmdbuf,
 		err = do_cmd_get_all_members(cmdbuf, retbuf, retsize, retlen, offset);
 		break;
 
+		/* The same, unless nothing has changed since a given generation */
+	case CMAN_CMD_GETMEMBERS_SINCE:
+		err = do_cmd_get_members_since(cmdbuf, retbuf, retsize, retlen, offset);
+		break;
+
 	case CMAN_CMD_GETNODECOUNT:
 		err = get_node_count();
 		break;
@@ -1552,6 +1753,12 @@ int process_command(struct connection *con, int cmd, char *cmdbuf,
 	case CMAN_CMD_GET_NODEADDRS:
 		err = do_cmd_get_node_addrs(cmdbuf, retbuf, retsize, retlen, offset);
 		break;
+
+	case CMAN_CMD_GET_REPLY_STATS:
+		get_reply_stats((struct cl_reply_stats *)(outbuf+offset));
+		*retlen = sizeof(struct cl_reply_stats);
+		err = 0;
+		break;
 	}
 	log_printf(LOGSYS_LEVEL_DEBUG, "memb: command return code is %d\n", err);
 	return err;
@@ -1754,6 +1961,7 @@ void send_transition_msg(int last_memb_count, int first_trans)
 
 	we_are_a_cluster_member = 1;
 	local_first_trans = first_trans;
+	status_page_changed();
 
 	log_printf(LOGSYS_LEVEL_DEBUG, "memb: sending TRANSITION message. cluster_name = %s\n", cluster_name);
 	msg->cmd = CLUSTER_MSG_TRANSITION;
@@ -1878,6 +2086,7 @@ static void do_reconfigure_msg(void *data)
 
 	case RECONFIG_PARAM_NODE_VOTES:
 		node->votes = msg->value;
+		members_changed();
 		recalculate_quorum(1, 0);  /* Allow decrease */
 		break;
 
@@ -1966,6 +2175,7 @@ static void do_process_transition(int nodeid, char *data)
 					log_printf(LOG_CRIT, "Node %s not joined to cman because it has existing state", node->name);
 					node->state = NODESTATE_AISONLY;
 				}
+				members_changed();
 			}
 			return;
 		}
@@ -1985,6 +2195,7 @@ static void do_process_transition(int nodeid, char *data)
 					log_printf(LOG_CRIT, "Node %s not joined to cman because it has rejoined an inquorate cluster", node->name);
 					node->state = NODESTATE_AISONLY;
 				}
+				members_changed();
 			}
 			return;
 		}
@@ -2001,8 +2212,10 @@ static void do_process_transition(int nodeid, char *data)
 	   nodes then we can't make sense of the membership.
 	   So the new node has to also be AISONLY until we are consistent again */
 	if (enable_disallowed &&
-	    msg->first_trans && !node->us && have_disallowed())
+	    msg->first_trans && !node->us && have_disallowed()) {
 		node->state = NODESTATE_AISONLY;
+		members_changed();
+	}
 
 	node->flags = msg->flags; /* This will clear the BEENDOWN flag of course */
 
@@ -2117,8 +2330,10 @@ static void process_internal_message(char *data, int nodeid, int need_byteswap)
 		}
 
 		/* Someone else, make a note of the reason for leaving */
-		if (node)
+		if (node) {
 			node->leave_reason = leavemsg->reason;
+			members_changed();
+		}
 
 		/* Mark it as leaving, and remove it when we get an AIS node down event for it */
 		if (node && (node->state == NODESTATE_MEMBER || node->state == NODESTATE_AISONLY))
@@ -2181,8 +2396,10 @@ void remove_unread_nodes()
 		if (!(node->flags & NODE_FLAGS_REREAD) &&
 		    node->state == NODESTATE_DEAD) {
 
+			unhash_node(node);
 			list_del(&node->list);
 			free(node);
+			members_changed();
 		}
 	}
 }
@@ -2221,6 +2438,7 @@ void add_ais_node(int nodeid, uint64_t incar, int total_members)
 		node->incarnation = incar;
 		node->state = NODESTATE_MEMBER;
 		cluster_members++;
+		members_changed();
 		recalculate_quorum(0, 0);
 	}
 }
@@ -2251,6 +2469,7 @@ void del_ais_node(int nodeid)
 	switch (node->state) {
 	case NODESTATE_MEMBER:
 		node->state = NODESTATE_DEAD;
+		members_changed();
 		memset(&node->port_bits, 0, sizeof(node->port_bits));
 		cluster_members--;
 		recalculate_quorum(0, 0);
@@ -2258,10 +2477,12 @@ void del_ais_node(int nodeid)
 
 	case NODESTATE_AISONLY:
 		node->state = NODESTATE_DEAD;
+		members_changed();
 		break;
 
 	case NODESTATE_LEAVING:
 		node->state = NODESTATE_DEAD;
+		members_changed();
 		memset(&node->port_bits, 0, sizeof(node->port_bits));
 		cluster_members--;
 
@@ -2278,35 +2499,16 @@ void del_ais_node(int nodeid)
 	}
 }
 
-static int get_highest_nodeid()
-{
-	int highest = 0;
-	struct cluster_node *node;
-
-	list_iterate_items(node, &cluster_members_list) {
-		if (node->node_id > highest)
-			highest = node->node_id;
-	}
-	return highest;
-}
-
 static int get_node_count()
 {
-	int count = 0;
-
-	struct cluster_node *node;
-
-	list_iterate_items(node, &cluster_members_list) {
-		count++;
-	}
-	return count;
+	return node_count;
 }
 
 static struct cluster_node *find_node_by_nodeid(int nodeid)
 {
 	struct cluster_node *node;
 
-	list_iterate_items(node, &cluster_members_list) {
+	for (node = nodeid_hash[nodeid_hashval(nodeid)]; node; node = node->id_next) {
 		if (node->node_id == nodeid)
 			return node;
 	}
@@ -2318,8 +2520,8 @@ static struct cluster_node *find_node_by_name(char *name)
 {
 	struct cluster_node *node;
 
-	list_iterate_items(node, &cluster_members_list) {
-		if (node->name && strcmp(node->name, name) == 0)
+	for (node = nodename_hash[nodename_hashval(name)]; node; node = node->name_next) {
+		if (strcmp(node->name, name) == 0)
 			return node;
 	}
 	return NULL;
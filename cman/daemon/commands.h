@@ -23,6 +23,8 @@ extern void cman_send_confchg(const unsigned int *member_list, size_t member_lis
 			      const unsigned int *joined_list, size_t joined_list_entries);
 
 
+extern void status_page_changed(void);
+extern void flush_status_page(void);
 extern void clear_reread_flags(void);
 extern void remove_unread_nodes(void);
 
@@ -12,6 +12,7 @@
 #include <sys/stat.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/signal.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -34,16 +35,22 @@
 #include "barrier.h"
 #include "ais.h"
 #include "cman.h"
+#include "statuspage.h"
 
 LOGSYS_DECLARE_SUBSYS (CMAN_NAME);
 
-struct queued_reply
+/* A message that couldn't be sent straight away. An event that is queued
+   for more than one client is only copied once, and each of them holds a
+   reference to it. */
+struct reply_buf
 {
-	struct list list;
-	int offset;
+	int refcount;
 	char buf[1];
 };
 
+/* Most queued messages sent in one go */
+#define REPLY_IOV_MAX 64
+
 /* We need to keep these in a list so we can notify of
    cluster events */
 static LIST_INIT(client_list);
@@ -55,11 +62,79 @@ int num_connections = 0;
 hdb_handle_t cs_poll_handle;
 uint32_t max_outstanding_messages = DEFAULT_MAX_QUEUED;
 
+static struct cl_reply_stats reply_stats;
+
 static int process_client(hdb_handle_t handle, int fd, int revent, void *data);
 static void remove_client(hdb_handle_t handle, struct connection *con);
 
-/* Send it, or queue it for later if the socket is busy */
-static int send_reply_message(struct connection *con, struct sock_header *msg)
+static struct reply_buf *alloc_reply_buf(struct sock_header *msg)
+{
+	struct reply_buf *rb;
+
+	rb = malloc(sizeof(struct reply_buf) + msg->length);
+	if (!rb)
+		return NULL;
+
+	rb->refcount = 1;
+	memcpy(rb->buf, msg, msg->length);
+	return rb;
+}
+
+static void put_reply_buf(struct reply_buf *rb)
+{
+	if (rb && !--rb->refcount)
+		free(rb);
+}
+
+/* Add a message to the end of the connection's ring, making it bigger if
+   it is full */
+static int queue_reply(struct connection *con, struct reply_buf *rb)
+{
+	struct reply_buf **newring;
+	uint32_t newsize;
+	uint32_t i;
+
+	if (con->num_write_msgs == con->write_msgs_size) {
+		newsize = con->write_msgs_size ? con->write_msgs_size * 2 : 16;
+		newring = malloc(newsize * sizeof(struct reply_buf *));
+		if (!newring)
+			return -1;
+
+		for (i = 0; i < con->num_write_msgs; i++)
+			newring[i] = con->write_msgs[(con->write_msgs_head + i) & (con->write_msgs_size - 1)];
+		free(con->write_msgs);
+		con->write_msgs = newring;
+		con->write_msgs_size = newsize;
+		con->write_msgs_head = 0;
+	}
+
+	con->write_msgs[(con->write_msgs_head + con->num_write_msgs) & (con->write_msgs_size - 1)] = rb;
+	con->num_write_msgs++;
+	rb->refcount++;
+
+	reply_stats.replies_queued++;
+	if (rb->refcount > 2)
+		reply_stats.buffers_shared++;
+	if (con->num_write_msgs > reply_stats.max_queue_depth)
+		reply_stats.max_queue_depth = con->num_write_msgs;
+	return 0;
+}
+
+/* Take the oldest message off the ring once it has all gone */
+static void dequeue_reply(struct connection *con)
+{
+	put_reply_buf(con->write_msgs[con->write_msgs_head]);
+	con->write_msgs_head = (con->write_msgs_head + 1) & (con->write_msgs_size - 1);
+	con->write_offset = 0;
+	con->num_write_msgs--;
+}
+
+/* Send it, or queue it for later if the socket is busy. *shared is the
+   queued copy of msg, made the first time one is needed; a broadcast
+   passes the same one in for each connection so they can all share it.
+   The caller must put_reply_buf() it when it has finished. */
+static int send_shared_reply(struct connection *con, struct sock_header *msg,
+			     struct reply_buf **shared)
 {
 	int ret;
 
@@ -67,50 +142,57 @@ static int send_reply_message(struct connection *con, struct sock_header *msg)
 
 	/* If there are already queued messages then don't send this one
 	   out of order */
-	if (!list_empty(&con->write_msgs)) {
+	if (con->num_write_msgs) {
 		ret = -1;
 		errno = EAGAIN;
 	}
 	else {
 		ret = send(con->fd, (char *)msg, msg->length, MSG_DONTWAIT);
+		if (ret > 0)
+			reply_stats.bytes_sent += ret;
 	}
 
 	if ((ret > 0 && ret != msg->length) ||
 	    (ret == -1 && errno == EAGAIN)) {
-		struct queued_reply *qm;
 
 		/* Have we exceeded the allowed number of queued messages ? */
 		if (con->num_write_msgs > max_outstanding_messages) {
 			log_printf(LOGSYS_LEVEL_DEBUG, "daemon: Disconnecting. client has more that %d replies outstanding (%d)\n", max_outstanding_messages, con->num_write_msgs);
+			reply_stats.overflows++;
 			remove_client(cs_poll_handle, con);
 			return -1;
 		}
 
 		/* Queue it */
-		qm = malloc(sizeof(struct queued_reply) + msg->length);
-		if (!qm)
+		if (!*shared)
+			*shared = alloc_reply_buf(msg);
+		if (!*shared || queue_reply(con, *shared))
 		{
 			perror("Error allocating queued message");
 			return -1;
 		}
-		memcpy(qm->buf, msg, msg->length);
 		if (ret > 0)
-			qm->offset = ret;
-		else
-			qm->offset = 0;
-		list_add(&con->write_msgs, &qm->list);
-		con->num_write_msgs++;
+			con->write_offset = ret;
 		log_printf(LOGSYS_LEVEL_DEBUG, "daemon: queued last message, count is %d\n", con->num_write_msgs);
-		poll_dispatch_modify(cs_poll_handle, con->fd, POLLIN | POLLOUT, process_client);
+		if (con->num_write_msgs == 1)
+			poll_dispatch_modify(cs_poll_handle, con->fd, POLLIN | POLLOUT, process_client);
 	}
 	return 0;
 }
 
+static int send_reply_message(struct connection *con, struct sock_header *msg)
+{
+	struct reply_buf *rb = NULL;
+	int ret;
+
+	ret = send_shared_reply(con, msg, &rb);
+	put_reply_buf(rb);
+	return ret;
+}
+
 static void remove_client(hdb_handle_t handle, struct connection *con)
 {
-	struct list *tmp, *qmh;
-	struct queued_reply *qm;
-	int msgs=0;
+	int msgs = con->num_write_msgs;
 
 	poll_dispatch_delete(handle, con->fd);
 	close(con->fd);
@@ -120,45 +202,67 @@ static void remove_client(hdb_handle_t handle, struct connection *con)
 	unbind_con(con);
 	remove_barriers(con);
 
-	list_iterate_safe(qmh, tmp, &con->write_msgs) {
-		qm = list_item(qmh, struct queued_reply);
-
-		list_del(&qm->list);
-		free(qm);
-		msgs++;
-	}
+	while (con->num_write_msgs)
+		dequeue_reply(con);
+	free(con->write_msgs);
 
 	log_printf(LOGSYS_LEVEL_DEBUG, "daemon: Freed %d queued messages\n", msgs);
 	free(con);
 	num_connections--;
 }
 
-/* Send as many as we can */
+/* Send as many as we can, several at a time */
 static void send_queued_reply(struct connection *con)
 {
-	struct queued_reply *qm;
+	struct iovec iov[REPLY_IOV_MAX];
+	struct msghdr mh;
+	struct reply_buf *rb;
 	struct sock_header *msg;
-	struct list *tmp, *qmh;
-	int ret;
-
-	list_iterate_safe(qmh, tmp, &con->write_msgs) {
-		qm = list_item(qmh, struct queued_reply);
-		msg = (struct sock_header *)qm->buf;
-		ret = send(con->fd, qm->buf + qm->offset, msg->length - qm->offset, MSG_DONTWAIT);
-		if (ret == msg->length - qm->offset)
-		{
-			list_del(&qm->list);
-			free(qm);
-			con->num_write_msgs--;
+	ssize_t ret;
+	size_t len;
+	uint32_t i, n;
+
+	while (con->num_write_msgs) {
+		n = con->num_write_msgs;
+		if (n > REPLY_IOV_MAX)
+			n = REPLY_IOV_MAX;
+
+		len = 0;
+		for (i = 0; i < n; i++) {
+			rb = con->write_msgs[(con->write_msgs_head + i) & (con->write_msgs_size - 1)];
+			msg = (struct sock_header *)rb->buf;
+			iov[i].iov_base = rb->buf;
+			iov[i].iov_len = msg->length;
+			if (i == 0) {
+				iov[i].iov_base = rb->buf + con->write_offset;
+				iov[i].iov_len -= con->write_offset;
+			}
+			len += iov[i].iov_len;
 		}
-		else
-		{
-			if (ret > 0)
-				qm->offset += ret;
+
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_iov = iov;
+		mh.msg_iovlen = n;
+
+		ret = sendmsg(con->fd, &mh, MSG_DONTWAIT);
+		reply_stats.flushes++;
+		if (ret <= 0)
 			break;
+		reply_stats.bytes_flushed += ret;
+
+		/* Drop the ones that have gone and note how far we got with
+		   the next */
+		for (i = 0; i < n && ret >= iov[i].iov_len; i++) {
+			ret -= iov[i].iov_len;
+			dequeue_reply(con);
 		}
+		if (ret)
+			con->write_offset += ret;
+
+		if (i < n)
+			break;
 	}
-	if (list_empty(&con->write_msgs)) {
+	if (!con->num_write_msgs) {
 		/* Remove POLLOUT callback */
 		log_printf(LOGSYS_LEVEL_DEBUG, "daemon: Removing POLLOUT from fd %d\n", con->fd);
 		poll_dispatch_modify(cs_poll_handle, con->fd, POLLIN, process_client);
@@ -297,6 +401,7 @@ static int process_client(hdb_handle_t handle, int fd, int revent, void *data)
 			ret = process_command(con, msg->command, cmdbuf,
 					      &retbuf, &retlen, sizeof(small_retbuf),
 					      sizeof(struct sock_reply_header));
+			flush_status_page();
 
 			/* Reply message will come later on */
 			if (ret == -EWOULDBLOCK)
@@ -342,7 +447,11 @@ static int process_rendezvous(hdb_handle_t handle, int fd, int revent, void *dat
 		newcon->port = 0;
 		newcon->events = 0;
 		newcon->num_write_msgs = 0;
-		list_init(&newcon->write_msgs);
+		newcon->write_msgs = NULL;
+		newcon->write_msgs_size = 0;
+		newcon->write_msgs_head = 0;
+		newcon->write_offset = 0;
+		list_init(&newcon->barriers);
 		fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL, 0) | O_NONBLOCK);
 
 		poll_dispatch_add(handle, client_fd, POLLIN, newcon, process_client);
@@ -445,6 +554,8 @@ void notify_listeners(struct connection *con, int event, int arg)
 {
 	struct sock_event_message msg;
 	struct connection *thiscon;
+	struct reply_buf *shared = NULL;
+	struct list *tmp, *next;
 
 	msg.header.magic = CMAN_MAGIC;
 	msg.header.command = CMAN_CMD_EVENT;
@@ -453,27 +564,48 @@ void notify_listeners(struct connection *con, int event, int arg)
 	msg.reason = event;
 	msg.arg = arg;
 
+	/* So that clients woken by this see the new state */
+	flush_status_page();
+
 	/* Unicast message */
 	if (con) {
 		send_reply_message(con, (struct sock_header *)&msg);
 		return;
 	}
 
-	/* Broadcast message */
-	list_iterate_items(thiscon, &client_list) {
+	/* Broadcast message, any clients that are behind share one copy */
+	list_iterate_safe(tmp, next, &client_list) {
+		thiscon = list_item(tmp, struct connection);
 		if (thiscon->events)
-			send_reply_message(thiscon, (struct sock_header *)&msg);
+			send_shared_reply(thiscon, (struct sock_header *)&msg, &shared);
 	}
+	put_reply_buf(shared);
 }
 
 void notify_confchg(struct sock_header *message)
 {
 	struct connection *thiscon;
+	struct reply_buf *shared = NULL;
+	struct list *tmp, *next;
 
-	list_iterate_items(thiscon, &client_list) {
+	list_iterate_safe(tmp, next, &client_list) {
+		thiscon = list_item(tmp, struct connection);
 		if (thiscon->confchg)
-			send_reply_message(thiscon, message);
+			send_shared_reply(thiscon, message, &shared);
 	}
+	put_reply_buf(shared);
+}
+
+void get_reply_stats(struct cl_reply_stats *stats)
+{
+	struct connection *thiscon;
+
+	reply_stats.connections = num_connections;
+	reply_stats.queue_depth = 0;
+	list_iterate_items(thiscon, &client_list)
+		reply_stats.queue_depth += thiscon->num_write_msgs;
+
+	memcpy(stats, &reply_stats, sizeof(*stats));
 }
 
 int num_listeners(void)
@@ -513,6 +645,14 @@ int cman_init(struct corosync_api_v1 *api)
 	if (fd < 0)
 		return -2;
 
+	/* Clients can manage without this, they just have to ask us instead */
+	if (status_page_open(STATUS_PAGE_FILE, 0660))
+		log_printf(LOG_ERR, "Can't create status page %s: %s\n", STATUS_PAGE_FILE, strerror(errno));
+	else {
+		status_page_changed();
+		flush_status_page();
+	}
+
 	/* Shutdown trap */
 	sa.sa_handler = sigint_handler;
 	sigaction(SIGINT, &sa, NULL);
@@ -529,6 +669,7 @@ int cman_finish()
 	/* Stop */
 	unlink(CLIENT_SOCKNAME);
  	unlink(ADMIN_SOCKNAME);
+	status_page_close(STATUS_PAGE_FILE);
 
 	return 0;
 }
@@ -7,6 +7,7 @@ extern void cman_set_realtime(void);
 extern int cman_init(struct corosync_api_v1 *api);
 extern int cman_finish(void);
 extern void notify_confchg(struct sock_header *message);
+extern void get_reply_stats(struct cl_reply_stats *stats);
 
 extern volatile sig_atomic_t quit_threads;
 extern int num_connections;
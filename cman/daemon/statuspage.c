@@ -0,0 +1,91 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "cnxman-socket.h"
+#include "statuspage.h"
+
+static struct cman_status_page *status_page;
+
+/* Create the page, replacing any left behind by an earlier cman */
+int status_page_open(const char *path, mode_t mode)
+{
+	struct cman_status_page *page;
+	int fd;
+	int saved_errno;
+
+	unlink(path);
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL, mode);
+	if (fd < 0)
+		return -1;
+
+	/* Don't let umask decide who can read it */
+	if (fchmod(fd, mode) || ftruncate(fd, sizeof(struct cman_status_page)))
+		goto fail;
+
+	page = mmap(NULL, sizeof(struct cman_status_page), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+	if (page == MAP_FAILED)
+		goto fail;
+	close(fd);
+
+	page->seq++;
+	__sync_synchronize();
+	page->magic = STATUS_PAGE_MAGIC;
+	page->version = STATUS_PAGE_VERSION;
+	page->pid = getpid();
+	__sync_synchronize();
+	page->seq++;
+
+	status_page = page;
+	return 0;
+
+ fail:
+	saved_errno = errno;
+	close(fd);
+	unlink(path);
+	errno = saved_errno;
+	return -1;
+}
+
+/* Readers that still have it mapped will see that we have gone */
+void status_page_close(const char *path)
+{
+	struct cman_status_page *page = status_page_begin();
+
+	if (!page)
+		return;
+
+	page->pid = 0;
+	status_page_end(page);
+
+	status_page = NULL;
+	munmap(page, sizeof(struct cman_status_page));
+	unlink(path);
+}
+
+/* Returns the page to be updated, or NULL if there isn't one. Every
+ * status_page_begin() must be followed by a status_page_end() */
+struct cman_status_page *status_page_begin(void)
+{
+	if (!status_page)
+		return NULL;
+
+	status_page->seq++;
+	__sync_synchronize();
+	return status_page;
+}
+
+void status_page_end(struct cman_status_page *page)
+{
+	__sync_synchronize();
+	page->seq++;
+}
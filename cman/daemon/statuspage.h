@@ -0,0 +1,72 @@
+#ifndef __STATUSPAGE_H
+#define __STATUSPAGE_H
+
+/*
+ * The state that clients ask cman for most often, kept in a file under
+ * /dev/shm so that libcman can read it without a round trip to the daemon.
+ * Only the daemon writes it. seq is odd while it is being updated; readers
+ * copy the page and try again if seq was odd or has moved on.
+ *
+ * Should only be used by cman and libcman.
+ */
+
+#define STATUS_PAGE_MAGIC   0x434d5350
+#define STATUS_PAGE_VERSION 1
+
+static const char STATUS_PAGE_FILE[] = "/dev/shm/cman_status";
+
+struct cman_status_page {
+	uint32_t magic;
+	uint32_t version;
+	volatile uint32_t seq;
+	pid_t    pid;		/* of the daemon, 0 once it has gone */
+
+	int      active;	/* as CMAN_CMD_ISACTIVE */
+	int      quorate;	/* as CMAN_CMD_ISQUORATE */
+	int      member;	/* we_are_a_cluster_member */
+	int      node_count;	/* as CMAN_CMD_GETALLMEMBERS, when a member */
+	unsigned int members;
+	unsigned int quorum;
+	unsigned int total_votes;
+	unsigned int config_version;
+	uint32_t members_generation;
+	struct cl_cluster_info cluster;	/* as CMAN_CMD_GETCLUSTER */
+};
+
+#define STATUS_PAGE_READ_TRIES 100
+
+/* Take a consistent copy of the page. Returns -1 if there isn't one, or
+ * the daemon has gone, or it is being updated too often to get a copy */
+static inline int status_page_read(const struct cman_status_page *page,
+				   struct cman_status_page *copy)
+{
+	uint32_t seq;
+	int tries;
+
+	for (tries = 0; tries < STATUS_PAGE_READ_TRIES; tries++) {
+		seq = page->seq;
+		if (seq & 1)
+			continue;
+		__sync_synchronize();
+
+		memcpy(copy, (const void *)page, sizeof(*copy));
+
+		__sync_synchronize();
+		if (page->seq != seq)
+			continue;
+
+		if (copy->magic != STATUS_PAGE_MAGIC ||
+		    copy->version != STATUS_PAGE_VERSION || !copy->pid)
+			return -1;
+		return 0;
+	}
+	return -1;
+}
+
+/* Daemon side */
+extern int status_page_open(const char *path, mode_t mode);
+extern void status_page_close(const char *path);
+extern struct cman_status_page *status_page_begin(void);
+extern void status_page_end(struct cman_status_page *page);
+
+#endif
@@ -1,5 +1,7 @@
 #include <sys/types.h>
 #include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -9,7 +11,9 @@
 #include <string.h>
 #include <errno.h>
 #include <limits.h>
+#include <signal.h>
 #include "cnxman-socket.h"
+#include "statuspage.h"
 #include "libcman.h"
 
 /* List of saved messages */
@@ -37,6 +41,8 @@ struct cman_handle
 	struct saved_message *saved_data_msg;
 	struct saved_message *saved_event_msg;
 	struct saved_message *saved_reply_msg;
+
+	struct cman_status_page *status_page;
 };
 
 #define VALIDATE_HANDLE(h) do {if (!(h) || (h)->magic != CMAN_MAGIC) {errno = EINVAL; return -1;}} while (0)
@@ -266,6 +272,53 @@ static int info_call(struct cman_handle *h, int msgtype, const void *inbuf, int
 	return wait_for_reply(h, outbuf, outlen);
 }
 
+/* The status page is only a shortcut, so any failure here just means we
+   ask the daemon instead */
+static struct cman_status_page *map_status_page(void)
+{
+	struct stat st;
+	void *page;
+	int fd;
+
+	fd = open(STATUS_PAGE_FILE, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || st.st_size < sizeof(struct cman_status_page))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	page = mmap(NULL, sizeof(struct cman_status_page), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED)
+		return NULL;
+
+	return page;
+}
+
+/* Returns 0 with a copy of the status page if it is there and the daemon
+   that wrote it is still running */
+static int read_status_page(struct cman_handle *h, struct cman_status_page *status)
+{
+	int saved_errno = errno;
+	int ret;
+
+	if (!h->status_page)
+		return -1;
+
+	if (status_page_read(h->status_page, status))
+		return -1;
+
+	ret = kill(status->pid, 0);
+	if (ret && errno == EPERM)
+		ret = 0;
+
+	errno = saved_errno;
+	return ret;
+}
+
 static cman_handle_t open_socket(const char *name, int namelen, void *privdata)
 {
 	struct cman_handle *h;
@@ -321,6 +374,8 @@ static cman_handle_t open_socket(const char *name, int namelen, void *privdata)
 	}
 	fcntl(h->zero_fd, F_SETFD, 1); /* Set close-on-exec */
 
+	h->status_page = map_status_page();
+
 	return (cman_handle_t)h;
 }
 
@@ -342,6 +397,8 @@ int cman_finish(cman_handle_t handle)
 	h->magic = 0;
 	close(h->fd);
 	close(h->zero_fd);
+	if (h->status_page)
+		munmap(h->status_page, sizeof(struct cman_status_page));
 	free(h);
 
 	return 0;
@@ -563,8 +620,13 @@ int cman_dispatch(cman_handle_t handle, int flags)
 int cman_get_node_count(cman_handle_t handle)
 {
 	struct cman_handle *h = (struct cman_handle *)handle;
+	struct cman_status_page status;
 	VALIDATE_HANDLE(h);
 
+	/* If we're not a member then let the daemon say why */
+	if (!read_status_page(h, &status) && status.member)
+		return status.node_count;
+
 	return info_call(h, CMAN_CMD_GETALLMEMBERS, NULL, 0, NULL, 0);
 }
 
@@ -616,6 +678,70 @@ int cman_get_nodes(cman_handle_t handle, int maxnodes, int *retnodes, cman_node_
 	return 0;
 }
 
+int cman_get_nodes_since(cman_handle_t handle, unsigned int *generation, int maxnodes, int *retnodes, cman_node_t *nodes)
+{
+	struct cman_handle *h = (struct cman_handle *)handle;
+	struct cl_members_generation gen;
+	struct cl_members_generation *reply;
+	int status;
+	int buflen;
+	int count = 0;
+	VALIDATE_HANDLE(h);
+
+	if (!generation || !retnodes || !nodes || maxnodes < 1)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	buflen = sizeof(struct cl_members_generation) + sizeof(struct cl_cluster_node) * maxnodes;
+	reply = malloc(buflen);
+	if (!reply)
+		return -1;
+
+	gen.generation = *generation;
+	status = info_call(h, CMAN_CMD_GETMEMBERS_SINCE, &gen, sizeof(gen), reply, buflen);
+	if (status < 0)
+	{
+		int saved_errno = errno;
+		free(reply);
+		errno = saved_errno;
+		return -1;
+	}
+
+	/* Nothing has changed */
+	if (status == 0)
+	{
+		free(reply);
+		return 1;
+	}
+
+	/* The reply didn't fit so we didn't get any of it */
+	if (status > maxnodes)
+	{
+		free(reply);
+		*retnodes = status;
+		errno = E2BIG;
+		return -1;
+	}
+
+	if (reply->nodes[0].size != sizeof(struct cl_cluster_node))
+	{
+		free(reply);
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (count = 0; count < status; count++)
+	{
+		copy_node(&nodes[count], &reply->nodes[count]);
+	}
+	*generation = reply->generation;
+	free(reply);
+	*retnodes = status;
+	return 0;
+}
+
 int cman_get_disallowed_nodes(cman_handle_t handle, int maxnodes, int *retnodes, cman_node_t *nodes)
 {
 	struct cman_handle *h = (struct cman_handle *)handle;
@@ -732,8 +858,12 @@ int cman_is_listening(cman_handle_t handle, int nodeid, uint8_t port)
 int cman_is_quorate(cman_handle_t handle)
 {
 	struct cman_handle *h = (struct cman_handle *)handle;
+	struct cman_status_page status;
 	VALIDATE_HANDLE(h);
 
+	if (!read_status_page(h, &status))
+		return status.quorate;
+
 	return info_call(h, CMAN_CMD_ISQUORATE, NULL, 0, NULL, 0);
 }
 
@@ -817,6 +947,7 @@ int cman_leave_cluster(cman_handle_t handle, int reason)
 int cman_get_cluster(cman_handle_t handle, cman_cluster_t *clinfo)
 {
 	struct cman_handle *h = (struct cman_handle *)handle;
+	struct cman_status_page status;
 	VALIDATE_HANDLE(h);
 
 	if (!clinfo)
@@ -824,6 +955,12 @@ int cman_get_cluster(cman_handle_t handle, cman_cluster_t *clinfo)
 		errno = EINVAL;
 		return -1;
 	}
+
+	if (!read_status_page(h, &status))
+	{
+		memcpy(clinfo, &status.cluster, sizeof(cman_cluster_t));
+		return 0;
+	}
 	return info_call(h, CMAN_CMD_GETCLUSTER, NULL, 0, clinfo, sizeof(cman_cluster_t));
 }
 
@@ -993,6 +1130,20 @@ int cman_set_debuglog(cman_handle_t handle, int subsystems)
 	return info_call(h, CMAN_CMD_SET_DEBUGLOG, &subsystems, sizeof(int), NULL, 0);
 }
 
+int cman_get_reply_stats(cman_handle_t handle, cman_reply_stats_t *stats)
+{
+	struct cman_handle *h = (struct cman_handle *)handle;
+	VALIDATE_HANDLE(h);
+
+	if (!stats)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	return info_call(h, CMAN_CMD_GET_REPLY_STATS, NULL, 0, stats, sizeof(cman_reply_stats_t));
+}
+
 int cman_replyto_shutdown(cman_handle_t handle, int yesno)
 {
 	struct cman_handle *h = (struct cman_handle *)handle;
@@ -294,6 +294,14 @@ int cman_get_subsys_count(cman_handle_t handle);
  */
 int cman_get_nodes(cman_handle_t handle, int maxnodes, int *retnodes, cman_node_t *nodes);
 
+/* As cman_get_nodes(), but only if the membership has changed since
+ * *generation, which should be 0 the first time. Returns 1 and leaves
+ * everything alone if nothing has changed, or 0 with the nodes filled in
+ * and *generation updated if it has. If there are more than maxnodes nodes
+ * then it fails with E2BIG, and *retnodes is set to how many there are.
+ */
+int cman_get_nodes_since(cman_handle_t handle, unsigned int *generation, int maxnodes, int *retnodes, cman_node_t *nodes);
+
 /* Returns a list of nodes that are known to AIS but blocked from joining the
  * CMAN cluster because they rejoined with cluster without a cman_tool join
  */
@@ -450,4 +458,23 @@ int cman_set_dirty(cman_handle_t handle);
 
 int cman_set_debuglog(cman_handle_t handle, int subsystems);
 
+/*
+ * How cman is keeping up with sending replies and events to its clients.
+ * The counts are since cman started. This needs an admin socket.
+ */
+typedef struct cman_reply_stats
+{
+	uint32_t rs_connections;
+	uint32_t rs_queue_depth;	/* replies waiting to go, all clients */
+	uint32_t rs_max_queue_depth;	/* most ever waiting for one client */
+	uint32_t rs_overflows;		/* clients dropped for too many waiting */
+	uint64_t rs_replies_queued;
+	uint64_t rs_buffers_shared;	/* extra clients given a queued event */
+	uint64_t rs_bytes_sent;		/* sent as soon as they were ready */
+	uint64_t rs_bytes_flushed;	/* sent later from the queue */
+	uint64_t rs_flushes;
+} cman_reply_stats_t;
+
+int cman_get_reply_stats(cman_handle_t handle, cman_reply_stats_t *stats);
+
 #endif
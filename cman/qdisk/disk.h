@@ -215,6 +215,9 @@ int qdisk_init(char *name, char *clustername);
 int qdisk_validate(char *name);
 int qdisk_read(target_info_t *disk, __off64_t ofs, void *buf, int len);
 int qdisk_write(target_info_t *disk, __off64_t ofs, const void *buf, int len);
+int qdisk_read_blocks(target_info_t *disk, __off64_t ofs, size_t stride,
+		      int nblocks, void *scratch, void *buf, int len,
+		      int *status);
 
 #define qdisk_nodeid_offset(nodeid, ssz) \
 	(OFFSET_FIRST_STATUS_BLOCK(ssz) + (SPACE_PER_STATUS_BLOCK(ssz) * (nodeid - 1)))
@@ -259,6 +262,7 @@ typedef struct {
 	char *qc_status_file;
 	char *qc_cman_label;
 	char *qc_status_sockname;
+	void *qc_scan_buf;	/* All the status blocks, read at once */
 } qd_ctx;
 
 typedef struct {
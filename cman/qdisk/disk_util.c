@@ -260,5 +260,9 @@ qd_destroy(qd_ctx *ctx)
 		free(ctx->qc_device);
 		ctx->qc_device = NULL;
 	}
+	if (ctx->qc_scan_buf) {
+		free(ctx->qc_scan_buf);
+		ctx->qc_scan_buf = NULL;
+	}
 	qdisk_close(&ctx->qc_disk);
 }
@@ -153,6 +153,53 @@ check_self(qd_ctx *ctx, status_block_t *sb)
 }
 
 
+/**
+  Read all of the node blocks into ni[].ni_status with one I/O.  If that
+  can't be done, fall back to reading them one at a time so that a bad
+  block doesn't hide the rest.  Returns the number of blocks that could
+  not be read, and sets status[x] to -1 for each of those.
+ */
+static int
+read_status_blocks(qd_ctx *ctx, node_info_t *ni, int max, int *status)
+{
+	status_block_t sbs[MAX_NODES_DISK];
+	size_t stride = SPACE_PER_STATUS_BLOCK(ctx->qc_disk.d_blksz);
+	int x, errors;
+
+	if (!ctx->qc_scan_buf &&
+	    posix_memalign(&ctx->qc_scan_buf, ctx->qc_disk.d_pagesz,
+			   stride * MAX_NODES_DISK) != 0)
+		ctx->qc_scan_buf = NULL;
+
+	if (ctx->qc_scan_buf) {
+		errors = qdisk_read_blocks(&ctx->qc_disk,
+				qdisk_nodeid_offset(1, ctx->qc_disk.d_blksz),
+				stride, max, ctx->qc_scan_buf,
+				sbs, sizeof(sbs[0]), status);
+		if (errors >= 0) {
+			for (x = 0; x < max; x++) {
+				if (status[x] == 0)
+					memcpy(&ni[x].ni_status, &sbs[x],
+					       sizeof(sbs[x]));
+			}
+			return errors;
+		}
+	}
+
+	errors = 0;
+	for (x = 0; x < max; x++) {
+		status[x] = qdisk_read(&ctx->qc_disk,
+			       qdisk_nodeid_offset(x+1, ctx->qc_disk.d_blksz),
+			       &ni[x].ni_status, sizeof(ni[x].ni_status));
+		if (status[x] < 0) {
+			status[x] = -1;
+			++errors;
+		}
+	}
+	return errors;
+}
+
+
 /**
   Read in the node blocks off of the quorum disk and see if anyone has
   or has not updated their timestamp recently.  See check_transitions as
@@ -161,19 +208,19 @@ check_self(qd_ctx *ctx, status_block_t *sb)
 static int
 read_node_blocks(qd_ctx *ctx, node_info_t *ni, int max)
 {
-	int x, errors = 0;
+	int x, errors;
+	int status[MAX_NODES_DISK];
 	status_block_t *sb;
 
+	errors = read_status_blocks(ctx, ni, max, status);
+
 	for (x = 0; x < max; x++) {
 
 		sb = &ni[x].ni_status;
 
-		if (qdisk_read(&ctx->qc_disk,
-			       qdisk_nodeid_offset(x+1, ctx->qc_disk.d_blksz),
-			       sb, sizeof(*sb)) < 0) {
+		if (status[x] < 0) {
 			logt_print(LOG_WARNING,"Error reading node ID block %d\n",
 			       x+1);
-			++errors;
 			continue;
 		}
 		swab_status_block_t(sb);
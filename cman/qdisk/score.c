@@ -10,10 +10,20 @@
 #include <fcntl.h>
 #include <pthread.h>
 #include <string.h>
+#include <strings.h>
 #include <ccs.h>
 #include <liblogthread.h>
 #include <sched.h>
+#include <poll.h>
+#include <netdb.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <linux/dm-ioctl.h>
 #include "disk.h"
 #include "score.h"
 
@@ -22,6 +32,19 @@ static int _score = 0, _maxscore = 0, _score_thread_running = 0;
 static pthread_t score_thread = (pthread_t)0;
 extern void set_priority(int, int);
 
+/*
+  Script heuristics may be run by a helper process, forked once when the
+  score thread starts, so that qdiskd itself does not fork for every check.
+ */
+static int use_helper = 0;
+static int helper_fd = -1;
+static pid_t helper_pid = 0;
+
+struct helper_msg {
+	int index;		/* into the heuristics */
+	int status;		/* from waitpid(), in replies */
+};
+
 struct h_arg {
 	struct h_data *h;
 	int sched_queue;
@@ -72,35 +95,33 @@ restore_signals(void)
 
 
 /**
-  Spin off a user-defined heuristic
+  Close everything above stderr but keep, so that children don't hold
+  the quorum disk, our sockets and the like open.  ONLY do this after
+  a fork().
  */
-static int
-fork_heuristic(struct h_data *h)
+static void
+close_fds(int keep)
 {
-	int pid;
-	char *argv[4];
-	time_t now;
+	long x, max;
 
-	if (h->childpid) {	
-		errno = EINPROGRESS;
-		return -1;
-	}
-
-	now = time(NULL);
-	if (now < h->nextrun)
-		return 0;
+	max = sysconf(_SC_OPEN_MAX);
+	if (max < 0)
+		max = 1024;
 
-	h->nextrun = now + h->interval;
+	for (x = 3; x < max; x++) {
+		if (x != keep)
+			close(x);
+	}
+}
 
-	pid = fork();
-	if (pid < 0)
-		return -1;
 
-	if (pid) {
-		h->childpid = pid;
-		return 0;
-	}
-	
+/**
+  Set up a child forked to run a script.  ONLY do this after a fork().
+  Descriptors above stderr, except keep, are closed.
+ */
+static void
+child_setup(int keep)
+{
 	/*
 	 * always use SCHED_OTHER for the child processes 
 	 * nice -1 is fine; but we don't know what the child process
@@ -115,10 +136,21 @@ fork_heuristic(struct h_data *h)
 	set_priority(SCHED_OTHER, -1);
 	munlockall();
 	restore_signals();
+	close_fds(keep);
+}
+
+
+/**
+  Run a script with sh -c.  Only returns if the exec failed.
+ */
+static void
+exec_heuristic(char *program)
+{
+	char *argv[4];
 
 	argv[0] = strdup("/bin/sh");
 	argv[1] = strdup("-c");
-	argv[2] = h->program;
+	argv[2] = program;
 	argv[3] = NULL;
 
 	nullify();
@@ -129,6 +161,480 @@ fork_heuristic(struct h_data *h)
 	free(argv[1]);
 
 	logt_print(LOG_ERR, "Execv failed\n");
+}
+
+
+/**
+  Main loop of the helper: run the scripts qdiskd asks for, one at a time
+  per heuristic, and tell it how each one exited.  Goes away when qdiskd
+  closes its end of the socket.
+ */
+static void
+helper_main(struct h_data *h, int count, int fd, pid_t *pids)
+{
+	struct helper_msg msg;
+	struct pollfd pfd;
+	pid_t pid;
+	int status, ret, x;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (1) {
+		/* Reap at least every 100ms; qdiskd checks once a second */
+		ret = poll(&pfd, 1, 100);
+		if (ret > 0) {
+			ret = recv(fd, &msg, sizeof(msg), 0);
+			if (ret == 0)
+				break;
+			if (ret < 0 && errno != EINTR)
+				break;
+
+			if (ret == sizeof(msg) && msg.index >= 0 &&
+			    msg.index < count && !pids[msg.index]) {
+				pid = fork();
+				if (pid == 0) {
+					restore_signals();
+					close(fd);
+					exec_heuristic(h[msg.index].program);
+					_exit(1);
+				}
+
+				if (pid > 0) {
+					pids[msg.index] = pid;
+				} else {
+					/* Counts as a failed check */
+					msg.status = 1 << 8;
+					send(fd, &msg, sizeof(msg), 0);
+				}
+			}
+		}
+
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			for (x = 0; x < count; x++) {
+				if (pids[x] != pid)
+					continue;
+				pids[x] = 0;
+				msg.index = x;
+				msg.status = status;
+				send(fd, &msg, sizeof(msg), 0);
+				break;
+			}
+		}
+	}
+
+	_exit(0);
+}
+
+
+/**
+  Fork the helper which runs the scripts for us.  Falls back to forking
+  each script from qdiskd if this fails.
+ */
+static int
+start_helper(struct h_data *h, int count)
+{
+	int sv[2];
+	pid_t pid, *pids;
+
+	/* The helper's copy; it must not malloc after the fork */
+	pids = calloc(count, sizeof(pid_t));
+	if (!pids)
+		return -1;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+		logt_print(LOG_ERR, "Heuristic helper: socketpair: %s\n",
+			   strerror(errno));
+		free(pids);
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		logt_print(LOG_ERR, "Heuristic helper: fork: %s\n",
+			   strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		free(pids);
+		return -1;
+	}
+
+	if (pid == 0) {
+		close(sv[0]);
+		child_setup(sv[1]);
+		nullify();
+		helper_main(h, count, sv[1], pids);
+	}
+
+	free(pids);
+	close(sv[1]);
+	fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+	helper_fd = sv[0];
+	helper_pid = pid;
+
+	logt_print(LOG_DEBUG, "Heuristic helper started, pid %d\n", pid);
+	return 0;
+}
+
+
+/**
+  Stop using the helper; its scripts which haven't reported back fail.
+ */
+static void
+stop_helper(struct h_data *h, int count)
+{
+	int x;
+
+	if (helper_fd < 0)
+		return;
+
+	close(helper_fd);
+	helper_fd = -1;
+	waitpid(helper_pid, NULL, 0);
+	helper_pid = 0;
+
+	for (x = 0; x < count; x++) {
+		if (h[x].type != H_SCRIPT || !h[x].running)
+			continue;
+		h[x].running = 0;
+		h[x].status = -1;
+		h[x].done = 1;
+	}
+}
+
+
+/**
+  Ask the helper to run a script
+ */
+static int
+helper_run(struct h_data *h, int index)
+{
+	struct helper_msg msg;
+
+	msg.index = index;
+	msg.status = 0;
+	if (send(helper_fd, &msg, sizeof(msg),
+		 MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(msg))
+		return -1;
+
+	h->running = 1;
+	return 0;
+}
+
+
+/**
+  Pick up the results of any scripts the helper has finished
+ */
+static void
+helper_results(struct h_data *h, int count)
+{
+	struct helper_msg msg;
+	int ret;
+
+	while (helper_fd >= 0) {
+		ret = recv(helper_fd, &msg, sizeof(msg), MSG_DONTWAIT);
+		if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		if (ret <= 0) {
+			logt_print(LOG_ERR, "Heuristic helper went away; "
+				   "running heuristics directly\n");
+			stop_helper(h, count);
+			return;
+		}
+		if (ret != sizeof(msg) || msg.index < 0 || msg.index >= count)
+			continue;
+
+		h[msg.index].running = 0;
+		h[msg.index].done = 1;
+		if (WIFEXITED(msg.status) && WEXITSTATUS(msg.status) == 0)
+			h[msg.index].status = 0;
+		else
+			h[msg.index].status = -1;
+	}
+}
+
+
+static uint16_t
+icmp_cksum(void *data, int len)
+{
+	uint16_t *p = data;
+	uint32_t sum = 0;
+
+	for (; len > 1; len -= 2)
+		sum += *p++;
+	if (len)
+		sum += *(uint8_t *)p;
+
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+	return ~sum;
+}
+
+
+/*
+  Our echo id on a raw socket, where we see everyone's replies.  On an
+  ICMP socket the kernel sets the id and gives us only our own.
+ */
+#define ping_id(h) ((uint16_t)((getpid() ^ (unsigned long)(h)) & 0xffff))
+
+
+/**
+  Send an echo request to each of the hosts in a ping heuristic.  Any
+  reply to this one before the interval is up will do.
+ */
+static void
+ping_start(struct h_data *h)
+{
+	struct icmphdr icmp;
+	int x, sent = 0;
+
+	if (h->fd < 0) {
+		/* Unprivileged ICMP sockets if we have them, else raw */
+		h->raw = 0;
+		h->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK |
+			       SOCK_CLOEXEC, IPPROTO_ICMP);
+		if (h->fd < 0) {
+			h->raw = 1;
+			h->fd = socket(AF_INET, SOCK_RAW | SOCK_NONBLOCK |
+				       SOCK_CLOEXEC, IPPROTO_ICMP);
+		}
+		if (h->fd < 0) {
+			logt_print(LOG_ERR, "Heuristic: '%s': socket: %s\n",
+				   h->program, strerror(errno));
+			goto fail;
+		}
+	}
+
+	memset(&icmp, 0, sizeof(icmp));
+	icmp.type = ICMP_ECHO;
+	icmp.un.echo.id = htons(ping_id(h));
+	icmp.un.echo.sequence = htons(++h->seq);
+	icmp.checksum = icmp_cksum(&icmp, sizeof(icmp));
+
+	for (x = 0; x < h->naddrs; x++) {
+		if (sendto(h->fd, &icmp, sizeof(icmp), 0,
+			   (struct sockaddr *)&h->addrs[x],
+			   sizeof(struct sockaddr_in)) == sizeof(icmp))
+			sent++;
+	}
+	if (!sent)
+		goto fail;
+
+	h->started = time(NULL);
+	h->running = 1;
+	return;
+
+fail:
+	h->status = -1;
+	h->done = 1;
+}
+
+
+/**
+  Look for a reply to our last echo request, and give up on it once
+  the interval is up.
+ */
+static void
+ping_check(struct h_data *h)
+{
+	char buf[1500];
+	struct icmphdr *icmp;
+	struct iphdr *ip;
+	int len, hlen;
+
+	while ((len = recv(h->fd, buf, sizeof(buf), 0)) > 0) {
+		hlen = 0;
+		if (h->raw) {
+			ip = (struct iphdr *)buf;
+			if (len < (int)sizeof(*ip))
+				continue;
+			hlen = ip->ihl * 4;
+		}
+		if (len < hlen + (int)sizeof(*icmp))
+			continue;
+
+		icmp = (struct icmphdr *)(buf + hlen);
+		if (icmp->type != ICMP_ECHOREPLY ||
+		    ntohs(icmp->un.echo.sequence) != h->seq)
+			continue;
+		if (h->raw && ntohs(icmp->un.echo.id) != ping_id(h))
+			continue;
+
+		h->running = 0;
+		h->status = 0;
+		h->done = 1;
+		return;
+	}
+
+	if (time(NULL) >= h->started + h->interval) {
+		h->running = 0;
+		h->status = -1;
+		h->done = 1;
+	}
+}
+
+
+/**
+  The interface must be up and have a link
+ */
+static int
+check_link(struct h_data *h)
+{
+	struct ifreq ifr;
+
+	if (h->fd < 0)
+		h->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (h->fd < 0)
+		return -1;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, h->target, IFNAMSIZ - 1);
+	if (ioctl(h->fd, SIOCGIFFLAGS, &ifr) < 0)
+		return -1;
+
+	if ((ifr.ifr_flags & (IFF_UP | IFF_RUNNING)) !=
+	    (IFF_UP | IFF_RUNNING))
+		return -1;
+	return 0;
+}
+
+
+#define DM_STATUS_SIZE 16384
+
+/**
+  The multipath map must have at least h->arg active paths.  Asks
+  device-mapper for the status of the map; each path in it shows up
+  as "major:minor A" or "major:minor F".
+ */
+static int
+check_multipath(struct h_data *h)
+{
+	uint64_t buf[DM_STATUS_SIZE / sizeof(uint64_t)];
+	struct dm_ioctl *dmi = (struct dm_ioctl *)buf;
+	struct dm_target_spec *spec;
+	char *params, *tok, *prev, *save;
+	unsigned int offset, x, major, minor;
+	int active = 0;
+
+	if (h->fd < 0)
+		h->fd = open("/dev/mapper/control", O_RDWR | O_CLOEXEC);
+	if (h->fd < 0)
+		return -1;
+
+	memset(dmi, 0, sizeof(*dmi));
+	dmi->version[0] = DM_VERSION_MAJOR;
+	dmi->data_size = sizeof(buf);
+	dmi->data_start = sizeof(*dmi);
+	strncpy(dmi->name, h->target, sizeof(dmi->name) - 1);
+
+	if (ioctl(h->fd, DM_TABLE_STATUS, dmi) < 0)
+		return -1;
+	if (dmi->flags & DM_BUFFER_FULL_FLAG)
+		return -1;
+
+	/* next is from the first target on a status call */
+	offset = dmi->data_start;
+	for (x = 0; x < dmi->target_count; x++) {
+		if (offset + sizeof(*spec) >= dmi->data_size)
+			break;
+		spec = (struct dm_target_spec *)((char *)buf + offset);
+		((char *)buf)[sizeof(buf) - 1] = 0;
+
+		if (!strcmp(spec->target_type, "multipath")) {
+			params = (char *)(spec + 1);
+			prev = NULL;
+			for (tok = strtok_r(params, " ", &save); tok;
+			     tok = strtok_r(NULL, " ", &save)) {
+				if (prev && !strcmp(tok, "A") &&
+				    sscanf(prev, "%u:%u", &major, &minor) == 2)
+					active++;
+				prev = tok;
+			}
+		}
+
+		if (!spec->next)
+			break;
+		offset = dmi->data_start + spec->next;
+	}
+
+	return (active >= h->arg) ? 0 : -1;
+}
+
+
+/**
+  The file must exist, and be no more than h->arg seconds old if set
+ */
+static int
+check_file(struct h_data *h)
+{
+	struct stat st;
+
+	if (stat(h->target, &st) < 0)
+		return -1;
+	if (h->arg > 0 && time(NULL) - st.st_mtime > h->arg)
+		return -1;
+	return 0;
+}
+
+
+/**
+  Spin off a user-defined heuristic
+ */
+static int
+fork_heuristic(struct h_data *h, int index)
+{
+	int pid;
+	time_t now;
+
+	if (h->childpid || h->running) {
+		errno = EINPROGRESS;
+		return -1;
+	}
+
+	now = time(NULL);
+	if (now < h->nextrun)
+		return 0;
+
+	h->nextrun = now + h->interval;
+
+	switch (h->type) {
+	case H_SCRIPT:
+		break;
+	case H_PING:
+		ping_start(h);
+		return 0;
+	case H_LINK:
+		h->status = check_link(h);
+		h->done = 1;
+		return 0;
+	case H_MULTIPATH:
+		h->status = check_multipath(h);
+		h->done = 1;
+		return 0;
+	case H_FILE:
+		h->status = check_file(h);
+		h->done = 1;
+		return 0;
+	default:
+		h->status = -1;
+		h->done = 1;
+		return 0;
+	}
+
+	if (helper_fd >= 0 && helper_run(h, index) == 0)
+		return 0;
+
+	pid = fork();
+	if (pid < 0)
+		return -1;
+
+	if (pid) {
+		h->childpid = pid;
+		return 0;
+	}
+
+	child_setup(-1);
+	exec_heuristic(h->program);
 	return 0;
 }
 
@@ -164,9 +670,20 @@ total_score(struct h_data *h, int max, int *score, int *maxscore)
 static int
 check_heuristic(struct h_data *h, int block)
 {
-	int ret;
+	int ret = 0;
 	int status;
 
+	if (h->type == H_PING && h->running)
+		ping_check(h);
+
+	if (h->done) {
+		/* Built-in check, or a script run by the helper */
+		h->done = 0;
+		if (h->status == 0)
+			goto up;
+		goto miss;
+	}
+
 	if (h->childpid == 0)
 		/* No child to check */
 		return 0;
@@ -189,6 +706,7 @@ check_heuristic(struct h_data *h, int block)
 		goto miss;
 	}
 	
+up:
 	/* Returned 0 and was not killed */
 	if (!h->available) {
 		h->available = 1;
@@ -225,7 +743,7 @@ fork_heuristics(struct h_data *h, int max)
 	int x;
 
 	for (x = 0; x < max; x++)
-		fork_heuristic(&h[x]);
+		fork_heuristic(&h[x], x);
 	return 0;
 }
 
@@ -238,12 +756,112 @@ check_heuristics(struct h_data *h, int max, int block)
 {
 	int x;
 
+	helper_results(h, max);
 	for (x = 0; x < max; x++)
 		check_heuristic(&h[x], block);
 	return 0;
 }
 
 
+/**
+  Resolve the hosts of a ping heuristic.  Addresses are looked up once
+  here, not every time we ping.
+ */
+static void
+configure_ping(struct h_data *h)
+{
+	struct addrinfo hints, *res, *ai;
+	struct sockaddr_in *addrs;
+	char *hosts, *host, *save;
+
+	hosts = strdup(h->program);
+	if (!hosts)
+		return;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_RAW;
+
+	for (host = strtok_r(hosts, " \t,", &save); host;
+	     host = strtok_r(NULL, " \t,", &save)) {
+		if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+			logt_print(LOG_ERR, "Heuristic: '%s': can't resolve "
+				   "%s\n", h->program, host);
+			continue;
+		}
+
+		for (ai = res; ai; ai = ai->ai_next) {
+			addrs = realloc(h->addrs, sizeof(struct sockaddr_in) *
+					(h->naddrs + 1));
+			if (!addrs)
+				break;
+			h->addrs = addrs;
+			memcpy(&h->addrs[h->naddrs++], ai->ai_addr,
+			       sizeof(struct sockaddr_in));
+		}
+		freeaddrinfo(res);
+	}
+
+	free(hosts);
+}
+
+
+/**
+  Work out what sort of heuristic this is, and take its arguments from
+  program.  Unknown ones are still counted in the score, but always fail.
+ */
+static void
+configure_type(struct h_data *h, char *type)
+{
+	char target[256];
+	int arg = -1;
+
+	if (!strcasecmp(type, "script")) {
+		h->type = H_SCRIPT;
+		return;
+	}
+
+	if (!strcasecmp(type, "ping")) {
+		h->type = H_PING;
+		configure_ping(h);
+		if (!h->naddrs)
+			logt_print(LOG_ERR, "Heuristic: '%s': no hosts to "
+				   "ping\n", h->program);
+		return;
+	}
+
+	if (!strcasecmp(type, "link"))
+		h->type = H_LINK;
+	else if (!strcasecmp(type, "multipath"))
+		h->type = H_MULTIPATH;
+	else if (!strcasecmp(type, "file"))
+		h->type = H_FILE;
+	else {
+		logt_print(LOG_ERR, "Heuristic: '%s': unknown type '%s'\n",
+			   h->program, type);
+		h->type = H_UNKNOWN;
+		return;
+	}
+
+	if (sscanf(h->program, "%255s %d", target, &arg) < 1) {
+		logt_print(LOG_ERR, "Heuristic: '%s': nothing to check\n",
+			   h->program);
+		h->type = H_UNKNOWN;
+		return;
+	}
+	h->target = strdup(target);
+	if (!h->target)
+		h->type = H_UNKNOWN;
+
+	if (h->type == H_MULTIPATH)
+		/* At least one path by default */
+		h->arg = (arg > 0) ? arg : 1;
+	else if (h->type == H_FILE)
+		/* Any age by default */
+		h->arg = (arg > 0) ? arg : 0;
+}
+
+
 /**
   Read configuration data from CCS into the array provided
  */
@@ -257,6 +875,11 @@ configure_heuristics(int ccsfd, struct h_data *h, int max)
 	if (!h || !max)
 		return -1;
 
+	if (ccs_get(ccsfd, "/cluster/quorumd/@heuristic_helper", &val) == 0) {
+		use_helper = !!atoi(val);
+		free(val);
+	}
+
 	do {
 		h[x].program = NULL;
 		h[x].available = 0;
@@ -266,6 +889,17 @@ configure_heuristics(int ccsfd, struct h_data *h, int max)
 		h[x].score = 1;
 		h[x].childpid = 0;
 		h[x].nextrun = 0;
+		h[x].type = H_SCRIPT;
+		h[x].running = 0;
+		h[x].done = 0;
+		h[x].status = 0;
+		h[x].target = NULL;
+		h[x].arg = 0;
+		h[x].fd = -1;
+		h[x].raw = 0;
+		h[x].seq = 0;
+		h[x].naddrs = 0;
+		h[x].addrs = NULL;
 
 		/* Get program */
 		snprintf(query, sizeof(query),
@@ -305,9 +939,18 @@ configure_heuristics(int ccsfd, struct h_data *h, int max)
 				h[x].tko = 1;
 		}
 
+		/* Get type; scripts if not set */
+		snprintf(query, sizeof(query),
+			 "/cluster/quorumd/heuristic[%d]/@type", x+1);
+		if (ccs_get(ccsfd, query, &val) == 0) {
+			configure_type(&h[x], val);
+			free(val);
+		}
+
 		logt_print(LOG_DEBUG,
-		       "Heuristic: '%s' score=%d interval=%d tko=%d\n",
-		       h[x].program, h[x].score, h[x].interval, h[x].tko);
+		       "Heuristic: '%s' type=%d score=%d interval=%d tko=%d\n",
+		       h[x].program, h[x].type, h[x].score, h[x].interval,
+		       h[x].tko);
 
 	} while (++x < max);
 
@@ -353,10 +996,19 @@ static void *
 score_thread_main(void *arg)
 {
 	struct h_arg *args = (struct h_arg *)arg;
-	int score, maxscore;
+	int score, maxscore, x;
 	
 	set_priority(args->sched_queue, args->sched_prio);
 
+	if (use_helper) {
+		for (x = 0; x < args->count; x++) {
+			if (args->h[x].type == H_SCRIPT) {
+				start_helper(args->h, args->count);
+				break;
+			}
+		}
+	}
+
 	while (_score_thread_running) {
 		fork_heuristics(args->h, args->count);
 		check_heuristics(args->h, args->count, 0);
@@ -371,6 +1023,15 @@ score_thread_main(void *arg)
 			sleep(1);
 	}
 
+	stop_helper(args->h, args->count);
+	for (x = 0; x < args->count; x++) {
+		if (args->h[x].fd >= 0)
+			close(args->h[x].fd);
+		free(args->h[x].program);
+		free(args->h[x].target);
+		free(args->h[x].addrs);
+	}
+
 	free(args->h);
 	free(args);
 	logt_print(LOG_INFO, "Score thread going away\n");
@@ -381,7 +1042,8 @@ score_thread_main(void *arg)
 /**
   Start the score thread.  h is copied into an argument which is
   passed in as the arg parameter in the score thread, so it is safe
-  to pass in h if it was allocated on the stack.
+  to pass in h if it was allocated on the stack.  The strings and
+  addresses h points to are freed by the score thread when it exits.
  */
 int
 start_score_thread(qd_ctx *ctx, struct h_data *h, int count)
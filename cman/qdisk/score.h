@@ -5,8 +5,23 @@
 #define _SCORE_H
 
 #include <time.h>
+#include <stdint.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <netinet/in.h>
+
+/*
+   What a heuristic is.  Scripts are run with sh -c; the rest are
+   checked from within qdiskd, and take their arguments from program.
+ */
+typedef enum {
+	H_UNKNOWN	= -1,
+	H_SCRIPT	= 0,	/* program is a shell command */
+	H_PING		= 1,	/* program is a list of hosts, any may answer */
+	H_LINK		= 2,	/* program is an interface which must be up */
+	H_MULTIPATH	= 3,	/* program is a multipath map [min paths] */
+	H_FILE		= 4	/* program is a file [max age in seconds] */
+} h_type_t;
 
 struct h_data {
 	char *	program;
@@ -17,6 +32,19 @@ struct h_data {
 	int	misses;
 	pid_t	childpid;
 	time_t	nextrun;
+
+	h_type_t type;
+	int	running;	/* waiting for a check to finish */
+	int	done;		/* check finished, result in status */
+	int	status;		/* 0 if it passed */
+	time_t	started;
+	char *	target;		/* interface, map or file */
+	int	arg;		/* min paths or max age */
+	int	fd;		/* socket or dm control device, -1 if none */
+	int	raw;		/* ping socket is SOCK_RAW, not an ICMP socket */
+	uint16_t seq;		/* of the last echo request sent */
+	int	naddrs;
+	struct sockaddr_in *addrs;
 };
 
 /*
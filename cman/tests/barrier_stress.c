@@ -0,0 +1,304 @@
+/*
+ * Drive barrier.c with thousands of barriers at once, the way a lot of
+ * clients would through the daemon, with the rest of cman stubbed out.
+ * Totem is a queue: our own messages come back to us in order, and the
+ * other nodes' WAITs are made up and delivered in a random order.
+ *
+ * Every client must get exactly one return for each barrier it waits on:
+ * 0 when all the nodes have got there, or ESRCH from
+ * check_barrier_returns() when a node has left first.  Exits non-zero if
+ * any did not, or if any barriers are left over at the end.
+ */
+
+#include <corosync/engine/logsys.h>
+
+/* No logsys in a test program */
+#undef LOGSYS_DECLARE_SUBSYS
+#define LOGSYS_DECLARE_SUBSYS(subsys)
+#undef log_printf
+#define log_printf(level, format, args...) do { } while (0)
+
+#include "../daemon/barrier.c"
+
+#include <time.h>
+
+int we_are_a_cluster_member = 1;
+int cluster_members;
+
+/* Messages we have sent, waiting to be delivered back to us */
+static struct cl_barriermsg *msgq;
+static int msgq_len, msgq_size;
+
+int comms_send_message(void *buf, int len, unsigned char toport,
+		       unsigned char fromport, int nodeid, unsigned int flags)
+{
+	if (msgq_len == msgq_size) {
+		msgq_size = msgq_size ? msgq_size * 2 : 1024;
+		msgq = realloc(msgq, msgq_size * sizeof(struct cl_barriermsg));
+		if (!msgq) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	memcpy(&msgq[msgq_len++], buf, sizeof(struct cl_barriermsg));
+	return 0;
+}
+
+/* What each client has been told */
+static struct connection *cons;
+static int *returns;
+static int *last_status;
+static int num_barriers = 5000;
+
+int send_status_return(struct connection *con, uint32_t cmd, int status)
+{
+	int i = con - cons;
+
+	returns[i]++;
+	last_status[i] = status;
+	return 0;
+}
+
+static int stub_timer_add_duration(unsigned long long nanosec, void *data,
+				   void (*timer_fn)(void *data),
+				   corosync_timer_handle_t *handle)
+{
+	return 0;
+}
+
+static void stub_timer_delete(corosync_timer_handle_t handle)
+{
+}
+
+static struct corosync_api_v1 stub_corosync_api = {
+	.timer_add_duration = stub_timer_add_duration,
+	.timer_delete = stub_timer_delete,
+};
+
+struct corosync_api_v1 *corosync = &stub_corosync_api;
+
+static uint64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void deliver(void)
+{
+	int i;
+
+	/* Delivering can send more */
+	for (i = 0; i < msgq_len; i++)
+		process_barrier_msg(&msgq[i], NULL);
+	msgq_len = 0;
+}
+
+static int barrier_cmd(int i, char cmd, unsigned int flags, unsigned long arg)
+{
+	struct cl_barrier_info info;
+	int retlen = 0;
+
+	memset(&info, 0, sizeof(info));
+	info.cmd = cmd;
+	sprintf(info.name, "stress.%d", i);
+	info.flags = flags;
+	info.arg = arg;
+	return do_cmd_barrier(&cons[i], (char *)&info, &retlen);
+}
+
+static int check_returns(const char *phase, int status)
+{
+	int i, bad = 0;
+
+	for (i = 0; i < num_barriers; i++) {
+		if (returns[i] != 1 || last_status[i] != status) {
+			if (!bad)
+				fprintf(stderr, "%s: barrier %d had %d returns, status %d\n",
+					phase, i, returns[i], last_status[i]);
+			bad++;
+		}
+	}
+	return bad;
+}
+
+static int count_barriers(void)
+{
+	struct list *blist;
+	int i, count = 0;
+
+	for (i = 0; i < BARRIER_HASH_SIZE; i++)
+		list_iterate(blist, &barrier_hash[i])
+			count++;
+	return count;
+}
+
+static void report(const char *what, uint64_t nsecs, int count)
+{
+	printf("%-28s %8d %10.1f\n", what, count, (double)nsecs / count);
+}
+
+static void usage(char *prog, FILE *file)
+{
+	fprintf(file, "Usage:\n");
+	fprintf(file, "%s [bnch]\n", prog);
+	fprintf(file, "\n");
+	fprintf(file, "   -h           show this help information\n");
+	fprintf(file, "   -b <num>     number of barriers (default 5000)\n");
+	fprintf(file, "   -n <num>     number of nodes (default 4)\n");
+	fprintf(file, "   -c <num>     calls of check_barrier_returns (default 10000)\n");
+	fprintf(file, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int *order;
+	int num_nodes = 4;
+	int checks = 10000;
+	int bad = 0;
+	int optchar;
+	int i, j, node, tmp;
+	uint64_t begin;
+
+	while ((optchar = getopt(argc, argv, "b:n:c:h")) != EOF) {
+		switch (optchar) {
+		case 'b':
+			num_barriers = atoi(optarg);
+			break;
+		case 'n':
+			num_nodes = atoi(optarg);
+			break;
+		case 'c':
+			checks = atoi(optarg);
+			break;
+		case 'h':
+			usage(argv[0], stdout);
+			exit(0);
+		default:
+			usage(argv[0], stderr);
+			exit(1);
+		}
+	}
+
+	if (num_barriers < 1 || num_nodes < 1 || checks < 1) {
+		usage(argv[0], stderr);
+		exit(1);
+	}
+
+	cons = calloc(num_barriers, sizeof(struct connection));
+	returns = calloc(num_barriers, sizeof(int));
+	last_status = calloc(num_barriers, sizeof(int));
+	order = malloc(num_barriers * sizeof(int));
+	if (!cons || !returns || !last_status || !order) {
+		perror("calloc");
+		return 1;
+	}
+
+	for (i = 0; i < num_barriers; i++)
+		list_init(&cons[i].barriers);
+
+	barrier_init();
+	cluster_members = num_nodes;
+	srandom(getpid());
+	printf("%d barriers, %d nodes\n", num_barriers, num_nodes);
+	printf("operation                       calls    ns/call\n");
+
+	/* Every node gets to every barrier; half of them delete themselves */
+	begin = now_nsec();
+	for (i = 0; i < num_barriers; i++) {
+		if (barrier_cmd(i, BARRIER_CMD_REGISTER,
+				(i & 1) ? BARRIER_ATTR_AUTODELETE : 0, num_nodes)) {
+			fprintf(stderr, "register %d failed\n", i);
+			return 1;
+		}
+	}
+	report("register", now_nsec() - begin, num_barriers);
+
+	/* Nodes leaving now and then; nobody is waiting yet */
+	begin = now_nsec();
+	for (i = 0; i < checks; i++)
+		check_barrier_returns();
+	report("check (nothing waiting)", now_nsec() - begin, checks);
+
+	begin = now_nsec();
+	for (i = 0; i < num_barriers; i++) {
+		if (barrier_cmd(i, BARRIER_CMD_WAIT, 0, 0) != -EWOULDBLOCK) {
+			fprintf(stderr, "wait %d failed\n", i);
+			return 1;
+		}
+	}
+	report("wait", now_nsec() - begin, num_barriers);
+
+	begin = now_nsec();
+	deliver();
+	for (node = 2; node <= num_nodes; node++) {
+		for (i = 0; i < num_barriers; i++)
+			order[i] = i;
+		for (i = num_barriers - 1; i > 0; i--) {
+			j = random() % (i + 1);
+			tmp = order[i];
+			order[i] = order[j];
+			order[j] = tmp;
+		}
+		for (i = 0; i < num_barriers; i++) {
+			struct cl_barriermsg bmsg;
+
+			bmsg.cmd = CLUSTER_MSG_BARRIER;
+			bmsg.subcmd = BARRIER_WAIT;
+			sprintf(bmsg.name, "stress.%d", order[i]);
+			process_barrier_msg(&bmsg, NULL);
+		}
+		deliver();
+	}
+	report("message", now_nsec() - begin, num_barriers * (num_nodes + 1));
+
+	bad += check_returns("complete", 0);
+
+	for (i = 0; i < num_barriers; i++) {
+		if (barrier_cmd(i, BARRIER_CMD_DELETE, 0, 0) != ((i & 1) ? -ENOENT : 0)) {
+			fprintf(stderr, "delete %d: autodelete was not honoured\n", i);
+			bad++;
+		}
+	}
+
+	/* Now a node leaves while everyone is waiting */
+	memset(returns, 0, num_barriers * sizeof(int));
+	memset(last_status, 0, num_barriers * sizeof(int));
+	for (i = 0; i < num_barriers; i++) {
+		barrier_cmd(i, BARRIER_CMD_REGISTER, 0, num_nodes);
+		barrier_cmd(i, BARRIER_CMD_WAIT, 0, 0);
+	}
+	deliver();
+
+	begin = now_nsec();
+	check_barrier_returns();
+	report("check (all waiting)", now_nsec() - begin, 1);
+
+	begin = now_nsec();
+	for (i = 0; i < checks; i++)
+		check_barrier_returns();
+	report("check (all woken)", now_nsec() - begin, checks);
+
+	bad += check_returns("node left", ESRCH);
+
+	/* Clients going away take their barriers with them */
+	begin = now_nsec();
+	for (i = 0; i < num_barriers; i++)
+		remove_barriers(&cons[i]);
+	report("remove", now_nsec() - begin, num_barriers);
+
+	if (count_barriers() || !list_empty(&pending_list)) {
+		fprintf(stderr, "%d barriers left over\n", count_barriers());
+		bad++;
+	}
+
+	free(order);
+	free(last_status);
+	free(returns);
+	free(cons);
+	free(msgq);
+
+	printf("%d errors\n", bad);
+	return bad ? 1 : 0;
+}
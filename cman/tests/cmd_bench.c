@@ -0,0 +1,234 @@
+/*
+ * Time process_command() against a made-up cluster, calling it the way
+ * the daemon does for each client request, with the rest of cman stubbed
+ * out (see cmd_stubs.h).  The node lookups are cycled over every node so
+ * that the cost of finding one shows up as the cluster gets bigger.
+ */
+
+#include "cmd_stubs.h"
+
+#include <getopt.h>
+
+struct bench_cmd {
+	const char *name;
+	int cmd;
+	void (*setup)(char *cmdbuf, int i);
+};
+
+static int num_nodes = 256;
+static unsigned int *nodeids;
+
+static void setup_none(char *cmdbuf, int i)
+{
+}
+
+static void setup_getnode_id(char *cmdbuf, int i)
+{
+	struct cl_cluster_node *u_node = (struct cl_cluster_node *)cmdbuf;
+
+	u_node->name[0] = '\0';
+	u_node->node_id = nodeids[i % num_nodes];
+}
+
+static void setup_getnode_name(char *cmdbuf, int i)
+{
+	struct cl_cluster_node *u_node = (struct cl_cluster_node *)cmdbuf;
+
+	sprintf(u_node->name, "node%u", nodeids[i % num_nodes]);
+}
+
+static void setup_nodeid(char *cmdbuf, int i)
+{
+	memcpy(cmdbuf, &nodeids[i % num_nodes], sizeof(int));
+}
+
+/* a poller that has already seen the current membership */
+static void setup_generation(char *cmdbuf, int i)
+{
+	struct cl_members_generation *gen = (struct cl_members_generation *)cmdbuf;
+
+	gen->generation = members_generation;
+}
+
+/* and one that hasn't, as after every membership change */
+static void setup_changed(char *cmdbuf, int i)
+{
+	struct cl_members_generation *gen = (struct cl_members_generation *)cmdbuf;
+
+	members_changed();
+	gen->generation = 0;
+}
+
+static struct bench_cmd bench_cmds[] = {
+	{ "isquorate",     CMAN_CMD_ISQUORATE,     setup_none },
+	{ "getnodecount",  CMAN_CMD_GETNODECOUNT,  setup_none },
+	{ "getcluster",    CMAN_CMD_GETCLUSTER,    setup_none },
+	{ "getnode-id",    CMAN_CMD_GETNODE,       setup_getnode_id },
+	{ "getnode-name",  CMAN_CMD_GETNODE,       setup_getnode_name },
+	{ "getnodeaddrs",  CMAN_CMD_GET_NODEADDRS, setup_nodeid },
+	{ "getextrainfo",  CMAN_CMD_GETEXTRAINFO,  setup_none },
+	{ "getallmembers", CMAN_CMD_GETALLMEMBERS, setup_none },
+	{ "since-same",    CMAN_CMD_GETMEMBERS_SINCE, setup_generation },
+	{ "since-changed", CMAN_CMD_GETMEMBERS_SINCE, setup_changed },
+};
+
+#define NUM_BENCH_CMDS (sizeof(bench_cmds) / sizeof(bench_cmds[0]))
+
+static void usage(char *prog, FILE *file)
+{
+	unsigned int i;
+
+	fprintf(file, "Usage:\n");
+	fprintf(file, "%s [nisch]\n", prog);
+	fprintf(file, "\n");
+	fprintf(file, "   -h           show this help information\n");
+	fprintf(file, "   -n <num>     number of nodes in the cluster (default 256)\n");
+	fprintf(file, "   -i <num>     calls of each command (default 100000)\n");
+	fprintf(file, "   -s           spread nodeids out as if made from IP addresses\n");
+	fprintf(file, "   -c <cmd>     only time this command\n");
+	fprintf(file, "\n");
+	fprintf(file, "Commands:");
+	for (i = 0; i < NUM_BENCH_CMDS; i++)
+		fprintf(file, " %s", bench_cmds[i].name);
+	fprintf(file, "\n");
+}
+
+static uint64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int make_cluster(int spread)
+{
+	char name[MAX_CLUSTER_MEMBER_NAME_LEN];
+	int i;
+
+	nodeids = malloc(num_nodes * sizeof(unsigned int));
+	if (!nodeids)
+		return -1;
+
+	for (i = 0; i < num_nodes; i++) {
+		if (spread)
+			nodeids[i] = 0x0a000000 +
+				((uint64_t)(i + 1) * 2654435761U) % 0xffffff;
+		else
+			nodeids[i] = i + 1;
+	}
+
+	sprintf(name, "node%u", nodeids[0]);
+	cman_set_nodename(name);
+	cman_set_nodeid(nodeids[0]);
+	if (cman_join_cluster(&stub_corosync_api, "bench", 1, 0, 1, num_nodes))
+		return -1;
+
+	for (i = 1; i < num_nodes; i++) {
+		sprintf(name, "node%u", nodeids[i]);
+		add_ccs_node(name, nodeids[i], 1, num_nodes);
+	}
+	for (i = 0; i < num_nodes; i++)
+		add_ais_node(nodeids[i], 1, num_nodes);
+
+	we_are_a_cluster_member = 1;
+	return 0;
+}
+
+static int run(struct bench_cmd *bc, int count)
+{
+	struct connection con;
+	char cmdbuf[sizeof(struct cl_cluster_node)];
+	char small_retbuf[1024];
+	char *retbuf;
+	uint64_t begin, total = 0;
+	int i, retlen, ret;
+
+	memset(&con, 0, sizeof(con));
+	memset(cmdbuf, 0, sizeof(cmdbuf));
+
+	for (i = 0; i < count; i++) {
+		bc->setup(cmdbuf, i);
+		retbuf = small_retbuf;
+		retlen = 0;
+
+		begin = now_nsec();
+		ret = process_command(&con, bc->cmd, cmdbuf, &retbuf, &retlen,
+				      sizeof(small_retbuf),
+				      sizeof(struct sock_reply_header));
+		total += now_nsec() - begin;
+
+		/* as the daemon does when a reply didn't fit */
+		if (retbuf != small_retbuf)
+			free(retbuf);
+
+		if (ret < 0) {
+			fprintf(stderr, "%s: call %d failed: %d\n", bc->name, i, ret);
+			return -1;
+		}
+	}
+
+	printf("%-14s %8d %10.1f\n", bc->name, count, (double)total / count);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *only = NULL;
+	int count = 100000;
+	int spread = 0;
+	int optchar;
+	unsigned int i;
+
+	while ((optchar = getopt(argc, argv, "n:i:sc:h")) != EOF) {
+		switch (optchar) {
+		case 'n':
+			num_nodes = atoi(optarg);
+			break;
+		case 'i':
+			count = atoi(optarg);
+			break;
+		case 's':
+			spread = 1;
+			break;
+		case 'c':
+			only = optarg;
+			break;
+		case 'h':
+			usage(argv[0], stdout);
+			exit(0);
+		default:
+			usage(argv[0], stderr);
+			exit(1);
+		}
+	}
+
+	if (num_nodes <= 0 || count <= 0) {
+		usage(argv[0], stderr);
+		exit(1);
+	}
+
+	/* as many as totem will have */
+	if (num_nodes > PROCESSOR_COUNT_MAX) {
+		fprintf(stderr, "At most %d nodes\n", PROCESSOR_COUNT_MAX);
+		exit(1);
+	}
+
+	if (make_cluster(spread)) {
+		fprintf(stderr, "Unable to set up %d nodes\n", num_nodes);
+		return 1;
+	}
+
+	printf("%d nodes, %d cluster members, quorum %d\n", get_node_count(),
+	       cluster_members, quorum);
+	printf("command           calls    ns/call\n");
+
+	for (i = 0; i < NUM_BENCH_CMDS; i++) {
+		if (only && strcmp(only, bench_cmds[i].name))
+			continue;
+		if (run(&bench_cmds[i], count))
+			return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * The parts of cman that commands.c uses, stubbed out so that commands.c
+ * can be built into a test program on its own.  Nothing goes on the wire:
+ * messages are dropped, and totem reports a single IPv4 address for each
+ * node, made up from its nodeid.
+ */
+
+#include <corosync/engine/logsys.h>
+
+/* No logsys in a test program */
+#undef LOGSYS_DECLARE_SUBSYS
+#define LOGSYS_DECLARE_SUBSYS(subsys)
+#undef log_printf
+#define log_printf(level, format, args...) do { } while (0)
+#define logsys_config_debug_set(subsys, value) do { } while (0)
+
+#include "../daemon/commands.c"
+
+/* ais.c */
+
+uint64_t incarnation;
+int num_ais_nodes;
+struct memb_ring_id cman_ring_id;
+
+static void stub_set_quorum(const unsigned int *view_list,
+			    size_t view_list_entries, int quorate,
+			    struct memb_ring_id *ring_id)
+{
+}
+
+quorum_set_quorate_fn_t corosync_set_quorum = stub_set_quorum;
+
+int comms_send_message(void *buf, int len, unsigned char toport,
+		       unsigned char fromport, int nodeid, unsigned int flags)
+{
+	return len;
+}
+
+void corosync_shutdown(void)
+{
+}
+
+/* daemon.c */
+
+volatile sig_atomic_t quit_threads;
+int num_connections;
+uint32_t max_outstanding_messages = DEFAULT_MAX_QUEUED;
+
+int send_status_return(struct connection *con, uint32_t cmd, int status)
+{
+	return 0;
+}
+
+int send_data_reply(struct connection *con, int nodeid, int port,
+		    const char *data, int len)
+{
+	return 0;
+}
+
+void notify_listeners(struct connection *con, int reason, int arg)
+{
+}
+
+int num_listeners(void)
+{
+	return 0;
+}
+
+int cman_finish(void)
+{
+	return 0;
+}
+
+void notify_confchg(struct sock_header *message)
+{
+}
+
+void get_reply_stats(struct cl_reply_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+/* barrier.c */
+
+void process_barrier_msg(struct cl_barriermsg *msg, struct cluster_node *node)
+{
+}
+
+int do_cmd_barrier(struct connection *con, char *cmdbuf, int *retlen)
+{
+	return -EINVAL;
+}
+
+/* cmanconfig.c */
+
+int two_node;
+
+int read_cman_nodes(struct corosync_api_v1 *api, unsigned int *config_version,
+		    int check_nodeids)
+{
+	return -1;
+}
+
+/* corosync */
+
+static char *stub_iface_status[INTERFACE_MAX];
+
+static int stub_totem_ifaces_get(unsigned int nodeid,
+				 struct totem_ip_address *interfaces,
+				 char ***status, unsigned int *iface_count)
+{
+	uint32_t addr = htonl(0x0a000000 | (nodeid & 0xffffff));
+
+	memset(interfaces, 0, sizeof(struct totem_ip_address) * INTERFACE_MAX);
+	interfaces[0].nodeid = nodeid;
+	interfaces[0].family = AF_INET;
+	memcpy(interfaces[0].addr, &addr, sizeof(addr));
+
+	*status = stub_iface_status;
+	*iface_count = 1;
+	return 0;
+}
+
+static int stub_object_find_create(hdb_handle_t parent, const void *name,
+				   size_t name_len, hdb_handle_t *find_handle)
+{
+	*find_handle = 0;
+	return 0;
+}
+
+static int stub_object_find_next(hdb_handle_t find_handle,
+				 hdb_handle_t *object_handle)
+{
+	return -1;
+}
+
+static int stub_object_find_destroy(hdb_handle_t find_handle)
+{
+	return 0;
+}
+
+static int stub_object_reload_config(int flush, const char **error_string)
+{
+	*error_string = "not supported";
+	return -1;
+}
+
+static int stub_timer_add_duration(unsigned long long nanosec, void *data,
+				   void (*timer_fn)(void *data),
+				   corosync_timer_handle_t *handle)
+{
+	return 0;
+}
+
+static void stub_timer_delete(corosync_timer_handle_t handle)
+{
+}
+
+static struct corosync_api_v1 stub_corosync_api = {
+	.object_find_create = stub_object_find_create,
+	.object_find_next = stub_object_find_next,
+	.object_find_destroy = stub_object_find_destroy,
+	.object_reload_config = stub_object_reload_config,
+	.timer_add_duration = stub_timer_add_duration,
+	.timer_delete = stub_timer_delete,
+	.totem_ifaces_get = stub_totem_ifaces_get,
+};
@@ -45,6 +45,7 @@ int main()
 	cman_node_t *nodes;
 	cman_version_t ver;
 	cman_cluster_t clinfo;
+	unsigned int generation = 0;
 
 	h = cman_init(0);
 	if (!h)
@@ -95,6 +96,13 @@ int main()
 		perror("get_nodes failed");
 	}
 
+	/* The second call should find nothing has changed */
+	if (!cman_get_nodes_since(h, &generation, num, &retnodes, nodes) &&
+	    cman_get_nodes_since(h, &generation, num, &retnodes, nodes) == 1)
+		printf("membership generation %u\n", generation);
+	else
+		perror("get_nodes_since failed");
+
 	// Need to clear this.
 	// Who wrote this rubbish? oh, I did.
 	nodes[0].cn_name[0] = '\0';
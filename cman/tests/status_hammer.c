@@ -0,0 +1,224 @@
+/*
+ * Hammer the status page.  Reader threads map it and copy it the way
+ * libcman does, while the main thread takes commands.c through nodes
+ * leaving and joining, as the daemon would.  Every copy a reader gets must
+ * be one that the daemon wrote in one go: every node has one vote, so the
+ * votes have to match the members, quorate has to agree with the quorum
+ * and votes in it, and the generation never goes backwards.  Exits non-zero if any copy was torn.
+ */
+
+#include "cmd_stubs.h"
+
+#include <sys/mman.h>
+#include <pthread.h>
+#include <limits.h>
+#include <getopt.h>
+
+#include "statuspage.h"
+
+struct reader {
+	pthread_t thread;
+	unsigned long reads;
+	unsigned long busy;
+	unsigned long torn;
+	unsigned long changes;
+};
+
+static char status_file[PATH_MAX];
+static volatile int stop;
+static int num_nodes = 16;
+
+static struct cman_status_page *map_page(void)
+{
+	struct cman_status_page *page;
+	int fd;
+
+	fd = open(status_file, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	page = mmap(NULL, sizeof(struct cman_status_page), PROT_READ,
+		    MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED)
+		return NULL;
+	return page;
+}
+
+static int check_copy(struct cman_status_page *st, uint32_t last_generation)
+{
+	if (st->total_votes != st->members)
+		return -1;
+	if (st->quorate != (st->total_votes >= st->quorum))
+		return -1;
+	if (st->members > st->node_count || st->node_count != num_nodes)
+		return -1;
+	if (st->members_generation < last_generation)
+		return -1;
+	if (strcmp(st->cluster.name, "hammer") || st->cluster.number != 1)
+		return -1;
+	return 0;
+}
+
+static void *reader_thread(void *arg)
+{
+	struct reader *r = arg;
+	struct cman_status_page *page;
+	struct cman_status_page st;
+	uint32_t last_generation = 0;
+
+	page = map_page();
+	if (!page) {
+		perror("map status page");
+		r->torn++;
+		return NULL;
+	}
+
+	while (!stop) {
+		if (status_page_read(page, &st)) {
+			r->busy++;
+			continue;
+		}
+		r->reads++;
+
+		if (check_copy(&st, last_generation)) {
+			if (!r->torn)
+				fprintf(stderr, "torn copy: quorate %d votes %u quorum %u "
+					"members %u nodes %d generation %u (last %u)\n",
+					st.quorate, st.total_votes, st.quorum,
+					st.members, st.node_count,
+					st.members_generation, last_generation);
+			r->torn++;
+		}
+		if (st.members_generation != last_generation)
+			r->changes++;
+		last_generation = st.members_generation;
+	}
+
+	munmap(page, sizeof(struct cman_status_page));
+	return NULL;
+}
+
+static void make_cluster(void)
+{
+	char name[MAX_CLUSTER_MEMBER_NAME_LEN];
+	int i;
+
+	cman_set_nodename("node1");
+	cman_set_nodeid(1);
+	cman_join_cluster(&stub_corosync_api, "hammer", 1, 0, 1, num_nodes);
+
+	for (i = 2; i <= num_nodes; i++) {
+		sprintf(name, "node%d", i);
+		add_ccs_node(name, i, 1, num_nodes);
+	}
+	for (i = 1; i <= num_nodes; i++)
+		add_ais_node(i, 1, num_nodes);
+
+	send_transition_msg(0, 1);
+	flush_status_page();
+}
+
+static void usage(char *prog, FILE *file)
+{
+	fprintf(file, "Usage:\n");
+	fprintf(file, "%s [nrih]\n", prog);
+	fprintf(file, "\n");
+	fprintf(file, "   -h           show this help information\n");
+	fprintf(file, "   -n <num>     number of nodes in the cluster (default 16)\n");
+	fprintf(file, "   -r <num>     reader threads (default 4)\n");
+	fprintf(file, "   -i <num>     membership changes (default 2000000)\n");
+	fprintf(file, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct reader *readers;
+	struct cman_status_page *page, st;
+	unsigned long reads = 0, busy = 0, torn = 0, changes = 0;
+	int num_readers = 4;
+	int count = 2000000;
+	int optchar;
+	int i, nodeid;
+
+	while ((optchar = getopt(argc, argv, "n:r:i:h")) != EOF) {
+		switch (optchar) {
+		case 'n':
+			num_nodes = atoi(optarg);
+			break;
+		case 'r':
+			num_readers = atoi(optarg);
+			break;
+		case 'i':
+			count = atoi(optarg);
+			break;
+		case 'h':
+			usage(argv[0], stdout);
+			exit(0);
+		default:
+			usage(argv[0], stderr);
+			exit(1);
+		}
+	}
+
+	if (num_nodes < 2 || num_nodes > PROCESSOR_COUNT_MAX ||
+	    num_readers < 1 || count < 1) {
+		usage(argv[0], stderr);
+		exit(1);
+	}
+
+	/* Not the real one, there may be a cman running */
+	snprintf(status_file, sizeof(status_file), "/dev/shm/cman_status_hammer.%d",
+		 getpid());
+	if (status_page_open(status_file, 0600)) {
+		perror(status_file);
+		return 1;
+	}
+
+	make_cluster();
+
+	readers = calloc(num_readers, sizeof(struct reader));
+	if (!readers) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < num_readers; i++)
+		pthread_create(&readers[i].thread, NULL, reader_thread, &readers[i]);
+
+	/* Nodes come and go at random; quorum never drops on its own, so the
+	   cluster goes in and out of quorum as they do */
+	srandom(getpid());
+	for (i = 0; i < count; i++) {
+		nodeid = 2 + random() % (num_nodes - 1);
+		if (find_node_by_nodeid(nodeid)->state == NODESTATE_MEMBER)
+			del_ais_node(nodeid);
+		else
+			add_ais_node(nodeid, i, num_nodes);
+
+		/* notify_listeners() would do this in the daemon */
+		flush_status_page();
+	}
+
+	stop = 1;
+	for (i = 0; i < num_readers; i++) {
+		pthread_join(readers[i].thread, NULL);
+		reads += readers[i].reads;
+		busy += readers[i].busy;
+		torn += readers[i].torn;
+		changes += readers[i].changes;
+	}
+
+	/* Once the daemon has gone, readers must not believe what is left */
+	page = map_page();
+	status_page_close(status_file);
+	if (!page || !status_page_read(page, &st)) {
+		fprintf(stderr, "status page still readable after close\n");
+		torn++;
+	}
+	if (page)
+		munmap(page, sizeof(struct cman_status_page));
+
+	printf("%d changes, %lu reads, %lu changes seen, %lu busy, %lu torn\n",
+	       count, reads, changes, busy, torn);
+	return torn ? 1 : 0;
+}
@@ -1,5 +1,8 @@
 #ifdef _REENTRANT
 #include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #endif
 #include <sys/types.h>
 #include <sys/ioctl.h>
@@ -23,6 +26,7 @@
 #define BUILDING_LIBDLM
 #include "libdlm.h"
 #include <linux/dlm_device.h>
+#include "mockdev.h"
 
 #define MISC_PREFIX		"/dev/misc/"
 #define DLM_PREFIX		"dlm_"
@@ -75,6 +79,53 @@ struct dlm_lock_result_v5 {
 };
 
 
+/*
+ * Batched dispatch, completion queue and AST workers
+ *
+ * A lockspace only gets a dlm_dispatch_state once one of the
+ * dlm_ls_dispatch_batch(), dlm_ls_completion_queue() or dlm_ls_ast_workers()
+ * calls is used; otherwise results are read and ASTs called as before.
+ */
+
+/* results read by one pass of dlm_ls_dispatch_batch() */
+#define DISPATCH_BATCH		64
+#define RESULT_LEN		(sizeof(struct dlm_lock_result) + DLM_USER_LVB_LEN)
+#define AST_WORKER_QUEUE	256
+#define AST_WORKERS_MAX		64
+
+/* ring of completions, size is a power of two */
+struct ast_queue {
+	struct dlm_completion *ring;
+	unsigned int size;
+	unsigned int head;	/* next to remove */
+	unsigned int tail;	/* next to add */
+};
+
+#ifdef _REENTRANT
+struct ast_worker {
+	pthread_t tid;
+	pthread_mutex_t mutex;
+	pthread_cond_t work;
+	pthread_cond_t space;
+	struct ast_queue queue;
+	int stop;
+};
+#endif
+
+struct dlm_dispatch_state {
+	char *buf;		/* DISPATCH_BATCH results */
+	struct dlm_lock_result *results[DISPATCH_BATCH];
+	int queue_enabled;
+	struct ast_queue cq;
+#ifdef _REENTRANT
+	pthread_mutex_t cq_mutex;
+	pthread_cond_t cq_space;
+	int cq_fd;		/* eventfd, readable while cq is not empty */
+	struct ast_worker *workers;
+	int worker_count;
+#endif
+};
+
 /*
  * One of these per lockspace in use by the application
  */
@@ -86,6 +137,8 @@ struct dlm_ls_info {
 #else
     int tid;
 #endif
+    struct dlm_dispatch_state *ds;
+    int sync_read;
 };
 
 /*
@@ -99,10 +152,36 @@ static struct dlm_ls_info *default_ls = NULL;
 static int control_fd = -1;
 static struct dlm_device_version kernel_version;
 static int kernel_version_detected = 0;
+static int mock_device = 0;
 
 
 static int release_lockspace(uint32_t minor, uint32_t flags);
+static void free_dispatch_state(struct dlm_ls_info *lsinfo);
+
 
+/* lockspace device io, which goes to mockdev.c in place of the kernel
+   when DLM_MOCK_DEVICE is set */
+
+static ssize_t dev_read(int fd, void *buf, size_t len)
+{
+	if (mock_device)
+		return mock_read(fd, buf, len);
+	return read(fd, buf, len);
+}
+
+static ssize_t dev_write(int fd, const void *buf, size_t len)
+{
+	if (mock_device)
+		return mock_write(fd, buf, len);
+	return write(fd, buf, len);
+}
+
+static int dev_close(int fd)
+{
+	if (mock_device)
+		return mock_close(fd);
+	return close(fd);
+}
 
 static void ls_dev_name(const char *lsname, char *devname, int devlen)
 {
@@ -114,21 +193,43 @@ static void dummy_ast_routine(void *arg)
 }
 
 #ifdef _REENTRANT
-/* Used for the synchronous and "simplified, synchronous" API routines */
-struct lock_wait
+/*
+ * Used for the synchronous and "simplified, synchronous" API routines.
+ * A thread has at most one synchronous call in progress, so each thread
+ * waits on its own futex, which is reused from call to call with nothing
+ * to set up or tear down.
+ */
+struct sync_wait
 {
-    pthread_cond_t  cond;
-    pthread_mutex_t mutex;
-    struct dlm_lksb lksb;
+    volatile int done;
 };
 
+static __thread struct sync_wait sync_slot;
+
+static struct sync_wait *sync_wait_start(void)
+{
+    struct sync_wait *sw = &sync_slot;
+
+    sw->done = 0;
+    return sw;
+}
+
+static void sync_wait_finish(struct sync_wait *sw)
+{
+    while (!sw->done)
+	syscall(SYS_futex, &sw->done, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+
+    /* see the lksb as the dispatching thread left it */
+    __sync_synchronize();
+}
+
 static void sync_ast_routine(void *arg)
 {
-    struct lock_wait *lwait = arg;
+    struct sync_wait *sw = arg;
 
-    pthread_mutex_lock(&lwait->mutex);
-    pthread_cond_signal(&lwait->cond);
-    pthread_mutex_unlock(&lwait->mutex);
+    __sync_synchronize();
+    sw->done = 1;
+    syscall(SYS_futex, &sw->done, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
 }
 
 /* lock_resource & unlock_resource
@@ -138,7 +239,8 @@ static void sync_ast_routine(void *arg)
 int lock_resource(const char *resource, int mode, int flags, int *lockid)
 {
     int status;
-    struct lock_wait lwait;
+    struct dlm_lksb lksb;
+    struct sync_wait *sw;
 
     if (default_ls == NULL)
     {
@@ -156,33 +258,30 @@ int lock_resource(const char *resource, int mode, int flags, int *lockid)
 
     /* Conversions need the lockid in the LKSB */
     if (flags & LKF_CONVERT)
-	lwait.lksb.sb_lkid = *lockid;
+	lksb.sb_lkid = *lockid;
 
-    pthread_cond_init(&lwait.cond, NULL);
-    pthread_mutex_init(&lwait.mutex, NULL);
-    pthread_mutex_lock(&lwait.mutex);
+    sw = sync_wait_start();
 
     status = dlm_lock(mode,
-		      &lwait.lksb,
+		      &lksb,
 		      flags,
 		      resource,
 		      strlen(resource),
 		      0,
 		      sync_ast_routine,
-		      &lwait,
+		      sw,
 		      NULL,
 		      NULL);
     if (status)
 	return status;
 
     /* Wait for it to complete */
-    pthread_cond_wait(&lwait.cond, &lwait.mutex);
-    pthread_mutex_unlock(&lwait.mutex);
+    sync_wait_finish(sw);
 
-    *lockid = lwait.lksb.sb_lkid;
+    *lockid = lksb.sb_lkid;
 
-    errno = lwait.lksb.sb_status;
-    if (lwait.lksb.sb_status)
+    errno = lksb.sb_status;
+    if (lksb.sb_status)
 	return -1;
     else
 	return 0;
@@ -192,7 +291,8 @@ int lock_resource(const char *resource, int mode, int flags, int *lockid)
 int unlock_resource(int lockid)
 {
     int status;
-    struct lock_wait lwait;
+    struct dlm_lksb lksb;
+    struct sync_wait *sw;
 
     if (default_ls == NULL)
     {
@@ -200,21 +300,18 @@ int unlock_resource(int lockid)
 	return -1;
     }
 
-    pthread_cond_init(&lwait.cond, NULL);
-    pthread_mutex_init(&lwait.mutex, NULL);
-    pthread_mutex_lock(&lwait.mutex);
+    sw = sync_wait_start();
 
-    status = dlm_unlock(lockid, 0, &lwait.lksb, &lwait);
+    status = dlm_unlock(lockid, 0, &lksb, sw);
 
     if (status)
 	return status;
 
     /* Wait for it to complete */
-    pthread_cond_wait(&lwait.cond, &lwait.mutex);
-    pthread_mutex_unlock(&lwait.mutex);
+    sync_wait_finish(sw);
 
-    errno = lwait.lksb.sb_status;
-    if (lwait.lksb.sb_status != DLM_EUNLOCK)
+    errno = lksb.sb_status;
+    if (lksb.sb_status != DLM_EUNLOCK)
 	return -1;
     else
 	return 0;
@@ -236,8 +333,9 @@ static int ls_pthread_cleanup(struct dlm_ls_info *lsinfo)
     }
     if (!status)
     {
+	free_dispatch_state(lsinfo);
 	free(lsinfo);
-	close(fd);
+	dev_close(fd);
     }
 
     return status;
@@ -261,7 +359,8 @@ int dlm_pthread_cleanup(void)
 /* Non-pthread version of cleanup */
 static int ls_pthread_cleanup(struct dlm_ls_info *lsinfo)
 {
-    close(lsinfo->fd);
+    free_dispatch_state(lsinfo);
+    dev_close(lsinfo->fd);
     free(lsinfo);
     return 0;
 }
@@ -365,6 +464,15 @@ static int open_control_device(void)
 	if (control_fd > -1)
 		goto out;
 
+	if (mock_device_enabled()) {
+		mock_device = 1;
+		kernel_version.version[0] = DLM_DEVICE_VERSION_MAJOR;
+		kernel_version.version[1] = DLM_DEVICE_VERSION_MINOR;
+		kernel_version.version[2] = DLM_DEVICE_VERSION_PATCH;
+		kernel_version_detected = 1;
+		return 0;
+	}
+
 	rv = find_control_minor(&minor);
 	if (rv < 0)
 		return -1;
@@ -519,17 +627,9 @@ static int do_dlm_dispatch_v5(int fd)
 	return 0;
 }
 
-static int do_dlm_dispatch_v6(int fd)
+/* Copy a result into the user's lksb */
+static void copy_result_v6(struct dlm_lock_result *result)
 {
-	char resultbuf[sizeof(struct dlm_lock_result) + DLM_USER_LVB_LEN];
-	struct dlm_lock_result *result = (struct dlm_lock_result *)resultbuf;
-	int status;
-	void (*astaddr)(void *astarg);
-
-	status = read(fd, result, sizeof(resultbuf));
-	if (status <= 0)
-		return -1;
-
 	/* Copy lksb to user's buffer - except the LVB ptr */
 	memcpy(result->user_lksb, &result->lksb,
 	       sizeof(struct dlm_lksb) - sizeof(char*));
@@ -540,6 +640,20 @@ static int do_dlm_dispatch_v6(int fd)
 		       (char *)result + result->lvb_offset, DLM_LVB_LEN);
 
 	result->user_lksb->sb_status = -result->user_lksb->sb_status;
+}
+
+static int do_dlm_dispatch_v6(int fd)
+{
+	char resultbuf[RESULT_LEN];
+	struct dlm_lock_result *result = (struct dlm_lock_result *)resultbuf;
+	int status;
+	void (*astaddr)(void *astarg);
+
+	status = dev_read(fd, result, sizeof(resultbuf));
+	if (status <= 0)
+		return -1;
+
+	copy_result_v6(result);
 
 	if (result->user_astaddr) {
 		astaddr = result->user_astaddr;
@@ -557,6 +671,405 @@ static int do_dlm_dispatch(int fd)
 		return do_dlm_dispatch_v6(fd);
 }
 
+/*
+ * Batched dispatch
+ * Results are read into the preallocated dlm_dispatch_state buffer, then
+ * their lksbs are filled in and the ASTs are either called, added to the
+ * completion queue for the application to collect, or passed to the AST
+ * worker threads.  The ASTs used by the synchronous calls are always called
+ * directly since their callers are waiting on them.
+ */
+
+static unsigned int queue_count(struct ast_queue *q)
+{
+	return q->tail - q->head;
+}
+
+static int queue_init(struct ast_queue *q, unsigned int size)
+{
+	unsigned int n = 1;
+
+	while (n < size)
+		n <<= 1;
+
+	q->ring = malloc(n * sizeof(struct dlm_completion));
+	if (!q->ring)
+		return -1;
+	q->size = n;
+	q->head = 0;
+	q->tail = 0;
+	return 0;
+}
+
+static int queue_grow(struct ast_queue *q)
+{
+	struct dlm_completion *ring;
+	unsigned int i, count = queue_count(q);
+
+	ring = malloc(q->size * 2 * sizeof(struct dlm_completion));
+	if (!ring)
+		return -1;
+
+	for (i = 0; i < count; i++)
+		ring[i] = q->ring[(q->head + i) & (q->size - 1)];
+
+	free(q->ring);
+	q->ring = ring;
+	q->size *= 2;
+	q->head = 0;
+	q->tail = count;
+	return 0;
+}
+
+static void queue_add(struct ast_queue *q, struct dlm_completion *comp)
+{
+	q->ring[q->tail++ & (q->size - 1)] = *comp;
+}
+
+static void queue_remove(struct ast_queue *q, struct dlm_completion *comp)
+{
+	*comp = q->ring[q->head++ & (q->size - 1)];
+}
+
+static int is_sync_ast(void (*astaddr)(void *astarg))
+{
+#ifdef _REENTRANT
+	if (astaddr == sync_ast_routine)
+		return 1;
+#endif
+	return astaddr == dummy_ast_routine;
+}
+
+static void queue_completions(struct dlm_dispatch_state *ds,
+			      struct dlm_completion *comps, int count)
+{
+	int i;
+#ifdef _REENTRANT
+	int was_empty;
+
+	pthread_mutex_lock(&ds->cq_mutex);
+	was_empty = !queue_count(&ds->cq);
+#endif
+
+	for (i = 0; i < count; i++) {
+		/* only when the synchronous calls read results themselves
+		   or the application lets the queue fill */
+		if (queue_count(&ds->cq) == ds->cq.size &&
+		    queue_grow(&ds->cq) < 0) {
+			/* nowhere to keep it, so deliver it now */
+#ifdef _REENTRANT
+			pthread_mutex_unlock(&ds->cq_mutex);
+#endif
+			comps[i].astaddr(comps[i].astarg);
+#ifdef _REENTRANT
+			pthread_mutex_lock(&ds->cq_mutex);
+#endif
+			continue;
+		}
+		queue_add(&ds->cq, &comps[i]);
+	}
+
+#ifdef _REENTRANT
+	if (was_empty && queue_count(&ds->cq))
+		eventfd_write(ds->cq_fd, 1);
+	pthread_mutex_unlock(&ds->cq_mutex);
+#endif
+}
+
+#ifdef _REENTRANT
+static void unlock_mutex(void *arg)
+{
+	pthread_mutex_unlock(arg);
+}
+
+/* All the ASTs for one lksb go to the same worker so they stay in order */
+static void worker_add(struct dlm_dispatch_state *ds,
+		       struct dlm_completion *comp)
+{
+	struct ast_worker *w;
+	unsigned long h = (unsigned long)comp->lksb;
+
+	h ^= h >> 7;
+	h ^= h >> 17;
+	w = &ds->workers[h % ds->worker_count];
+
+	pthread_mutex_lock(&w->mutex);
+	pthread_cleanup_push(unlock_mutex, &w->mutex);
+	while (queue_count(&w->queue) == w->queue.size)
+		pthread_cond_wait(&w->space, &w->mutex);
+	queue_add(&w->queue, comp);
+	pthread_cond_signal(&w->work);
+	pthread_cleanup_pop(1);
+}
+
+static void *ast_worker_thread(void *arg)
+{
+	struct ast_worker *w = arg;
+	struct dlm_completion comp;
+
+	pthread_mutex_lock(&w->mutex);
+	for (;;) {
+		while (!queue_count(&w->queue) && !w->stop)
+			pthread_cond_wait(&w->work, &w->mutex);
+
+		/* the queue is drained before stopping */
+		if (!queue_count(&w->queue))
+			break;
+
+		queue_remove(&w->queue, &comp);
+		pthread_cond_signal(&w->space);
+		pthread_mutex_unlock(&w->mutex);
+
+		comp.astaddr(comp.astarg);
+
+		pthread_mutex_lock(&w->mutex);
+	}
+	pthread_mutex_unlock(&w->mutex);
+	return NULL;
+}
+
+static void stop_ast_workers(struct dlm_dispatch_state *ds)
+{
+	struct ast_worker *w;
+	int i;
+
+	for (i = 0; i < ds->worker_count; i++) {
+		w = &ds->workers[i];
+		pthread_mutex_lock(&w->mutex);
+		w->stop = 1;
+		pthread_cond_signal(&w->work);
+		pthread_mutex_unlock(&w->mutex);
+	}
+
+	for (i = 0; i < ds->worker_count; i++) {
+		w = &ds->workers[i];
+		pthread_join(w->tid, NULL);
+		pthread_mutex_destroy(&w->mutex);
+		pthread_cond_destroy(&w->work);
+		pthread_cond_destroy(&w->space);
+		free(w->queue.ring);
+	}
+
+	free(ds->workers);
+	ds->workers = NULL;
+	ds->worker_count = 0;
+}
+#endif
+
+static void deliver_results(struct dlm_ls_info *lsinfo, int count)
+{
+	struct dlm_dispatch_state *ds = lsinfo->ds;
+	struct dlm_completion comps[DISPATCH_BATCH];
+	struct dlm_lock_result *result;
+	int i, queued = 0;
+
+	for (i = 0; i < count; i++) {
+		result = ds->results[i];
+		copy_result_v6(result);
+
+		if (!result->user_astaddr)
+			continue;
+
+		comps[queued].astaddr = result->user_astaddr;
+		comps[queued].astarg = result->user_astparam;
+		comps[queued].lksb = result->user_lksb;
+		comps[queued].bast_mode = result->bast_mode;
+
+		if (is_sync_ast(comps[queued].astaddr))
+			comps[queued].astaddr(comps[queued].astarg);
+#ifdef _REENTRANT
+		else if (ds->worker_count)
+			worker_add(ds, &comps[queued]);
+#endif
+		else if (ds->queue_enabled)
+			queued++;
+		else
+			comps[queued].astaddr(comps[queued].astarg);
+	}
+
+	if (queued)
+		queue_completions(ds, comps, queued);
+}
+
+/*
+ * Read up to max results into the dispatch buffer, stopping at the first
+ * read that fails (EAGAIN when the fd is non-blocking and nothing is left).
+ * Each read returns one result with current kernels, but any that return
+ * more are split up by the result lengths.  Returns the number of results,
+ * or -1 if the first read failed.
+ */
+
+static int read_results(struct dlm_ls_info *lsinfo, int max)
+{
+	struct dlm_dispatch_state *ds = lsinfo->ds;
+	struct dlm_lock_result *result;
+	unsigned int off = 0, len, pos;
+	int rv, count = 0;
+
+	if (max > DISPATCH_BATCH)
+		max = DISPATCH_BATCH;
+
+	while (count < max && DISPATCH_BATCH * RESULT_LEN - off >= RESULT_LEN) {
+		rv = dev_read(lsinfo->fd, ds->buf + off,
+			  DISPATCH_BATCH * RESULT_LEN - off);
+		if (rv <= 0) {
+			if (!count)
+				return -1;
+			break;
+		}
+
+		for (pos = 0; pos < rv && count < DISPATCH_BATCH; pos += len) {
+			result = (struct dlm_lock_result *)(ds->buf + off + pos);
+			len = result->length;
+			if (len < sizeof(struct dlm_lock_result) ||
+			    len > rv - pos)
+				len = rv - pos;
+			ds->results[count++] = result;
+		}
+
+		/* results contain pointers */
+		off += (rv + 7) & ~7;
+	}
+
+	return count;
+}
+
+static struct dlm_dispatch_state *get_dispatch_state(struct dlm_ls_info *lsinfo)
+{
+	struct dlm_dispatch_state *ds = lsinfo->ds;
+
+	if (ds)
+		return ds;
+
+	if (kernel_version.version[0] == 5) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	ds = malloc(sizeof(struct dlm_dispatch_state));
+	if (!ds)
+		return NULL;
+	memset(ds, 0, sizeof(struct dlm_dispatch_state));
+
+	ds->buf = malloc(DISPATCH_BATCH * RESULT_LEN);
+	if (!ds->buf) {
+		free(ds);
+		return NULL;
+	}
+
+#ifdef _REENTRANT
+	ds->cq_fd = eventfd(0, 0);
+	if (ds->cq_fd < 0) {
+		free(ds->buf);
+		free(ds);
+		return NULL;
+	}
+	fcntl(ds->cq_fd, F_SETFL, fcntl(ds->cq_fd, F_GETFL, 0) | O_NONBLOCK);
+	fcntl(ds->cq_fd, F_SETFD, 1);
+	pthread_mutex_init(&ds->cq_mutex, NULL);
+	pthread_cond_init(&ds->cq_space, NULL);
+#endif
+
+	lsinfo->ds = ds;
+	return ds;
+}
+
+static void free_dispatch_state(struct dlm_ls_info *lsinfo)
+{
+	struct dlm_dispatch_state *ds = lsinfo->ds;
+
+	if (!ds)
+		return;
+
+#ifdef _REENTRANT
+	stop_ast_workers(ds);
+	close(ds->cq_fd);
+	pthread_mutex_destroy(&ds->cq_mutex);
+	pthread_cond_destroy(&ds->cq_space);
+#endif
+	free(ds->cq.ring);
+	free(ds->buf);
+	free(ds);
+	lsinfo->ds = NULL;
+}
+
+/* Read and deliver one result, blocking, for the recv thread and the
+   non-threaded synchronous calls */
+
+static int ls_dispatch_v6(struct dlm_ls_info *lsinfo)
+{
+	struct dlm_dispatch_state *ds = lsinfo->ds;
+	int count;
+
+	if (!ds)
+		return do_dlm_dispatch_v6(lsinfo->fd);
+
+#ifdef _REENTRANT
+	/* don't take results from the kernel that the queue has no room
+	   for; the kernel holds them until the application catches up */
+	if (ds->queue_enabled && pthread_self() == lsinfo->tid) {
+		pthread_mutex_lock(&ds->cq_mutex);
+		pthread_cleanup_push(unlock_mutex, &ds->cq_mutex);
+		while (queue_count(&ds->cq) == ds->cq.size)
+			pthread_cond_wait(&ds->cq_space, &ds->cq_mutex);
+		pthread_cleanup_pop(1);
+	}
+#endif
+
+	count = read_results(lsinfo, 1);
+	if (count <= 0)
+		return -1;
+
+#ifdef _REENTRANT
+	{
+		int oldstate;
+
+		/* the recv thread is cancelled when the lockspace is closed,
+		   but not while it holds a queue lock */
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+		deliver_results(lsinfo, count);
+		pthread_setcancelstate(oldstate, NULL);
+	}
+#else
+	deliver_results(lsinfo, count);
+#endif
+	return 0;
+}
+
+/* Read and deliver up to max results (all that are ready if max is 0)
+   without blocking */
+
+static int ls_dispatch_batch(struct dlm_ls_info *lsinfo, int max)
+{
+	int fdflags, count = 0, want, total = 0;
+
+	fdflags = fcntl(lsinfo->fd, F_GETFL, 0);
+	if (!(fdflags & O_NONBLOCK))
+		fcntl(lsinfo->fd, F_SETFL, fdflags | O_NONBLOCK);
+
+	while (!max || total < max) {
+		want = max ? max - total : DISPATCH_BATCH;
+
+		count = read_results(lsinfo, want);
+		if (count < 0)
+			break;
+
+		deliver_results(lsinfo, count);
+		total += count;
+
+		/* a short batch means the kernel had no more */
+		if (count < want && count < DISPATCH_BATCH)
+			break;
+	}
+
+	if (!(fdflags & O_NONBLOCK))
+		fcntl(lsinfo->fd, F_SETFL, fdflags);
+
+	if (!total && count < 0 && errno != EAGAIN)
+		return -1;
+	return total;
+}
+
 
 /*
  * sync_write()
@@ -571,15 +1084,16 @@ static int do_dlm_dispatch(int fd)
 static int sync_write_v5(struct dlm_ls_info *lsinfo,
 			 struct dlm_write_request_v5 *req, int len)
 {
-	struct lock_wait lwait;
+	struct sync_wait *sw;
 	int status;
 
-	if (pthread_self() == lsinfo->tid) {
-		/* This is the DLM worker thread, don't use lwait to sync */
+	if (pthread_self() == lsinfo->tid || lsinfo->sync_read) {
+		/* This is the DLM worker thread, or the caller reads its
+		   own results, don't wait for another thread to sync */
 		req->i.lock.castaddr  = dummy_ast_routine;
 		req->i.lock.castparam = NULL;
 
-		status = write(lsinfo->fd, req, len);
+		status = dev_write(lsinfo->fd, req, len);
 		if (status < 0)
 			return -1;
 
@@ -587,19 +1101,16 @@ static int sync_write_v5(struct dlm_ls_info *lsinfo,
 			do_dlm_dispatch_v5(lsinfo->fd);
 		}
 	} else {
-		pthread_cond_init(&lwait.cond, NULL);
-		pthread_mutex_init(&lwait.mutex, NULL);
-		pthread_mutex_lock(&lwait.mutex);
+		sw = sync_wait_start();
 
 		req->i.lock.castaddr  = sync_ast_routine;
-		req->i.lock.castparam = &lwait;
+		req->i.lock.castparam = sw;
 
-		status = write(lsinfo->fd, req, len);
+		status = dev_write(lsinfo->fd, req, len);
 		if (status < 0)
 			return -1;
 
-		pthread_cond_wait(&lwait.cond, &lwait.mutex);
-		pthread_mutex_unlock(&lwait.mutex);
+		sync_wait_finish(sw);
 	}
 
 	return status; /* lock status is in the lksb */
@@ -608,35 +1119,33 @@ static int sync_write_v5(struct dlm_ls_info *lsinfo,
 static int sync_write_v6(struct dlm_ls_info *lsinfo,
 			 struct dlm_write_request *req, int len)
 {
-	struct lock_wait lwait;
+	struct sync_wait *sw;
 	int status;
 
-	if (pthread_self() == lsinfo->tid) {
-		/* This is the DLM worker thread, don't use lwait to sync */
+	if (pthread_self() == lsinfo->tid || lsinfo->sync_read) {
+		/* This is the DLM worker thread, or the caller reads its
+		   own results, don't wait for another thread to sync */
 		req->i.lock.castaddr  = dummy_ast_routine;
 		req->i.lock.castparam = NULL;
 
-		status = write(lsinfo->fd, req, len);
+		status = dev_write(lsinfo->fd, req, len);
 		if (status < 0)
 			return -1;
 
 		while (req->i.lock.lksb->sb_status == EINPROG) {
-			do_dlm_dispatch_v6(lsinfo->fd);
+			ls_dispatch_v6(lsinfo);
 		}
 	} else {
-		pthread_cond_init(&lwait.cond, NULL);
-		pthread_mutex_init(&lwait.mutex, NULL);
-		pthread_mutex_lock(&lwait.mutex);
+		sw = sync_wait_start();
 
 		req->i.lock.castaddr  = sync_ast_routine;
-		req->i.lock.castparam = &lwait;
+		req->i.lock.castparam = sw;
 
-		status = write(lsinfo->fd, req, len);
+		status = dev_write(lsinfo->fd, req, len);
 		if (status < 0)
 			return -1;
 
-		pthread_cond_wait(&lwait.cond, &lwait.mutex);
-		pthread_mutex_unlock(&lwait.mutex);
+		sync_wait_finish(sw);
 	}
 
 	return status; /* lock status is in the lksb */
@@ -652,7 +1161,7 @@ static int sync_write_v5(struct dlm_ls_info *lsinfo,
 	req->i.lock.castaddr  = dummy_ast_routine;
 	req->i.lock.castparam = NULL;
 
-	status = write(lsinfo->fd, req, len);
+	status = dev_write(lsinfo->fd, req, len);
 	if (status < 0)
 		return -1;
 
@@ -674,12 +1183,12 @@ static int sync_write_v6(struct dlm_ls_info *lsinfo,
 	req->i.lock.castaddr  = dummy_ast_routine;
 	req->i.lock.castparam = NULL;
 
-	status = write(lsinfo->fd, req, len);
+	status = dev_write(lsinfo->fd, req, len);
 	if (status < 0)
 		return -1;
 
 	while (req->i.lock.lksb->sb_status == EINPROG) {
-		do_dlm_dispatch_v6(lsinfo->fd);
+		ls_dispatch_v6(lsinfo);
 	}
 
 	errno = req->i.lock.lksb->sb_status;
@@ -748,7 +1257,7 @@ static int ls_lock_v5(dlm_lshandle_t ls,
 	if (flags & LKF_WAIT)
 		status = sync_write_v5(lsinfo, req, len);
 	else
-		status = write(lsinfo->fd, req, len);
+		status = dev_write(lsinfo->fd, req, len);
 
 	if (status < 0)
 		return -1;
@@ -762,7 +1271,8 @@ static int ls_lock_v5(dlm_lshandle_t ls,
 	return 0;
 }
 
-static int ls_lock_v6(dlm_lshandle_t ls,
+/* Fill in a lock request, returning the length to write */
+static int fill_lock_v6(struct dlm_write_request *req,
 		uint32_t mode,
 		struct dlm_lksb *lksb,
 		uint32_t flags,
@@ -775,12 +1285,6 @@ static int ls_lock_v6(dlm_lshandle_t ls,
 		uint64_t *xid,
 		uint64_t *timeout)
 {
-	char parambuf[sizeof(struct dlm_write_request) + DLM_RESNAME_MAXLEN];
-	struct dlm_write_request *req = (struct dlm_write_request *)parambuf;
-	struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
-	int status;
-	int len;
-
 	memset(req, 0, sizeof(*req));
 	set_version_v6(req);
 
@@ -815,13 +1319,39 @@ static int ls_lock_v6(dlm_lshandle_t ls,
 		memcpy(req->i.lock.lvb, lksb->sb_lvbptr, DLM_LVB_LEN);
 	}
 
-	len = sizeof(struct dlm_write_request) + namelen;
+	return sizeof(struct dlm_write_request) + namelen;
+}
+
+static int ls_lock_v6(dlm_lshandle_t ls,
+		uint32_t mode,
+		struct dlm_lksb *lksb,
+		uint32_t flags,
+		const void *name,
+		unsigned int namelen,
+		uint32_t parent,
+		void (*astaddr) (void *astarg),
+		void *astarg,
+		void (*bastaddr) (void *astarg),
+		uint64_t *xid,
+		uint64_t *timeout)
+{
+	char parambuf[sizeof(struct dlm_write_request) + DLM_RESNAME_MAXLEN];
+	struct dlm_write_request *req = (struct dlm_write_request *)parambuf;
+	struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
+	int status;
+	int len;
+
+	len = fill_lock_v6(req, mode, lksb, flags, name, namelen, parent,
+			   astaddr, astarg, bastaddr, xid, timeout);
+	if (len < 0)
+		return -1;
+
 	lksb->sb_status = EINPROG;
 
 	if (flags & LKF_WAIT)
 		status = sync_write_v6(lsinfo, req, len);
 	else
-		status = write(lsinfo->fd, req, len);
+		status = dev_write(lsinfo->fd, req, len);
 
 	if (status < 0)
 		return -1;
@@ -993,7 +1523,7 @@ static int ls_unlock_v5(struct dlm_ls_info *lsinfo, uint32_t lkid,
 	if (flags & LKF_WAIT)
 		return sync_write_v5(lsinfo, &req, sizeof(req));
 	else
-		return write(lsinfo->fd, &req, sizeof(req));
+		return dev_write(lsinfo->fd, &req, sizeof(req));
 }
 
 static int ls_unlock_v6(struct dlm_ls_info *lsinfo, uint32_t lkid,
@@ -1015,7 +1545,7 @@ static int ls_unlock_v6(struct dlm_ls_info *lsinfo, uint32_t lkid,
 	if (flags & LKF_WAIT)
 		return sync_write_v6(lsinfo, &req, sizeof(req));
 	else
-		return write(lsinfo->fd, &req, sizeof(req));
+		return dev_write(lsinfo->fd, &req, sizeof(req));
 }
 
 int dlm_ls_unlock(dlm_lshandle_t ls, uint32_t lkid, uint32_t flags,
@@ -1050,6 +1580,121 @@ int dlm_ls_unlock_wait(dlm_lshandle_t ls, uint32_t lkid, uint32_t flags,
 	return dlm_ls_unlock(ls, lkid, flags | LKF_WAIT, lksb, NULL);
 }
 
+/*
+ * Batched async lock and unlock requests in own lockspace
+ *
+ * The dlm device takes one request per write and returns the lock id as
+ * the result of the write, so it can't be given several requests in one
+ * write or writev; the requests are built in one buffer and written back
+ * to back.  A failed request doesn't stop the rest of the batch.
+ */
+
+int dlm_ls_lock_batch(dlm_lshandle_t ls, struct dlm_lock_request *reqs,
+		      int count)
+{
+	char parambuf[sizeof(struct dlm_write_request) + DLM_RESNAME_MAXLEN];
+	struct dlm_write_request *req = (struct dlm_write_request *)parambuf;
+	struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
+	struct dlm_lock_request *r;
+	int i, len, status, done = 0;
+
+	if (ls == NULL) {
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	if (count < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		r = &reqs[i];
+		r->lkid = 0;
+
+		/* ASTs are needed to know when each one completes */
+		if ((r->flags & LKF_WAIT) ||
+		    (r->flags & LKF_VALBLK && !r->lksb->sb_lvbptr)) {
+			r->status = EINVAL;
+			continue;
+		}
+
+		if (kernel_version.version[0] == 5) {
+			status = ls_lock_v5(ls, r->mode, r->lksb, r->flags,
+					    r->name, r->namelen, 0, r->astaddr,
+					    r->astarg, r->bastaddr);
+			goto next;
+		}
+
+		len = fill_lock_v6(req, r->mode, r->lksb, r->flags, r->name,
+				   r->namelen, 0, r->astaddr, r->astarg,
+				   r->bastaddr, NULL, NULL);
+		if (len < 0) {
+			r->status = errno;
+			continue;
+		}
+
+		r->lksb->sb_status = EINPROG;
+
+		status = dev_write(lsinfo->fd, req, len);
+		if (status > 0)
+			r->lksb->sb_lkid = status;
+ next:
+		if (status < 0) {
+			r->status = errno;
+			continue;
+		}
+		r->status = 0;
+		r->lkid = r->lksb->sb_lkid;
+		done++;
+	}
+
+	return done;
+}
+
+int dlm_ls_unlock_batch(dlm_lshandle_t ls, struct dlm_unlock_request *reqs,
+			int count)
+{
+	struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
+	struct dlm_unlock_request *r;
+	int i, status, done = 0;
+
+	if (ls == NULL) {
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	if (count < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		r = &reqs[i];
+
+		if (!r->lkid || (r->flags & LKF_WAIT)) {
+			r->status = EINVAL;
+			continue;
+		}
+
+		if (kernel_version.version[0] == 5)
+			status = ls_unlock_v5(lsinfo, r->lkid, r->flags,
+					      r->lksb, r->astarg);
+		else
+			status = ls_unlock_v6(lsinfo, r->lkid, r->flags,
+					      r->lksb, r->astarg);
+
+		if (status < 0) {
+			r->status = errno;
+			continue;
+		}
+		r->status = 0;
+		done++;
+	}
+
+	return done;
+}
+
 int dlm_unlock_wait(uint32_t lkid, uint32_t flags, struct dlm_lksb *lksb)
 {
 	return dlm_ls_unlock_wait(default_ls, lkid, flags | LKF_WAIT, lksb);
@@ -1086,7 +1731,7 @@ int dlm_ls_deadlock_cancel(dlm_lshandle_t ls, uint32_t lkid, uint32_t flags)
 	req.i.lock.lkid = lkid;
 	req.i.lock.flags = flags;
 
-	return write(lsinfo->fd, &req, sizeof(req));
+	return dev_write(lsinfo->fd, &req, sizeof(req));
 }
 
 
@@ -1116,7 +1761,7 @@ int dlm_ls_purge(dlm_lshandle_t ls, int nodeid, int pid)
 	req.i.purge.nodeid = nodeid;
 	req.i.purge.pid = pid;
 
-	status = write(lsinfo->fd, &req, sizeof(req));
+	status = dev_write(lsinfo->fd, &req, sizeof(req));
 
 	if (status < 0)
 		return -1;
@@ -1176,8 +1821,12 @@ static void *dlm_recv_thread(void *lsinfo)
 {
 	struct dlm_ls_info *lsi = lsinfo;
 
-	for (;;)
-		do_dlm_dispatch(lsi->fd);
+	for (;;) {
+		if (lsi->ds)
+			ls_dispatch_v6(lsi);
+		else
+			do_dlm_dispatch(lsi->fd);
+	}
 
 	return NULL;
 }
@@ -1197,7 +1846,7 @@ int dlm_pthread_init(void)
     if (pthread_create(&default_ls->tid, NULL, dlm_recv_thread, default_ls))
     {
 	int saved_errno = errno;
-	close(default_ls->fd);
+	dev_close(default_ls->fd);
 	free(default_ls);
 	default_ls = NULL;
 	errno = saved_errno;
@@ -1217,10 +1866,229 @@ int dlm_ls_pthread_init(dlm_lshandle_t ls)
 	return -1;
     }
 
+    /* the synchronous calls are reading the results themselves */
+    if (lsinfo->sync_read)
+    {
+	errno = EBUSY;
+	return -1;
+    }
+
     return pthread_create(&lsinfo->tid, NULL, dlm_recv_thread, (void *)ls);
 }
 #endif
 
+/*
+ * Synchronous calls that read their own results, for a thread that has
+ * the lockspace to itself.  Any other results read while waiting are
+ * delivered as dlm_ls_dispatch_batch() would.
+ */
+
+int dlm_ls_sync_read(dlm_lshandle_t ls, int enable)
+{
+	struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
+
+	if (lsinfo->tid) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	lsinfo->sync_read = enable ? 1 : 0;
+	return 0;
+}
+
+/*
+ * Batched dispatch, completion queue and AST workers for a lockspace
+ */
+
+int dlm_ls_dispatch_batch(dlm_lshandle_t ls, int max)
+{
+	struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
+	int fdflags, count = 0;
+
+	if (max < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* the recv thread is reading the results already */
+	if (lsinfo->tid) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (kernel_version.version[0] == 5) {
+		fdflags = fcntl(lsinfo->fd, F_GETFL, 0);
+		fcntl(lsinfo->fd, F_SETFL, fdflags | O_NONBLOCK);
+		while ((!max || count < max) && !do_dlm_dispatch_v5(lsinfo->fd))
+			count++;
+		fcntl(lsinfo->fd, F_SETFL, fdflags);
+		if (!count && errno != EAGAIN)
+			return -1;
+		return count;
+	}
+
+	if (!get_dispatch_state(lsinfo))
+		return -1;
+
+	return ls_dispatch_batch(lsinfo, max);
+}
+
+int dlm_ls_completion_queue(dlm_lshandle_t ls, int size)
+{
+	struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
+	struct dlm_dispatch_state *ds;
+
+	if (size <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (lsinfo->tid) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	ds = get_dispatch_state(lsinfo);
+	if (!ds)
+		return -1;
+
+	if (ds->queue_enabled) {
+		errno = EEXIST;
+		return -1;
+	}
+#ifdef _REENTRANT
+	if (ds->worker_count) {
+		errno = EBUSY;
+		return -1;
+	}
+#endif
+
+	if (queue_init(&ds->cq, size) < 0)
+		return -1;
+
+	ds->queue_enabled = 1;
+	return 0;
+}
+
+int dlm_ls_get_completions(dlm_lshandle_t ls, struct dlm_completion *comps,
+			   int max)
+{
+	struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
+	struct dlm_dispatch_state *ds = lsinfo->ds;
+	unsigned int room;
+	int count = 0;
+
+	if (!ds || !ds->queue_enabled || max < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* without a recv thread, read whatever the queue has room for */
+	if (!lsinfo->tid) {
+#ifdef _REENTRANT
+		pthread_mutex_lock(&ds->cq_mutex);
+#endif
+		room = ds->cq.size - queue_count(&ds->cq);
+#ifdef _REENTRANT
+		pthread_mutex_unlock(&ds->cq_mutex);
+#endif
+		if (room && ls_dispatch_batch(lsinfo, room) < 0)
+			return -1;
+	}
+
+#ifdef _REENTRANT
+	pthread_mutex_lock(&ds->cq_mutex);
+#endif
+	while (count < max && queue_count(&ds->cq))
+		queue_remove(&ds->cq, &comps[count++]);
+#ifdef _REENTRANT
+	if (count)
+		pthread_cond_signal(&ds->cq_space);
+	if (!queue_count(&ds->cq)) {
+		eventfd_t val;
+		eventfd_read(ds->cq_fd, &val);
+	}
+	pthread_mutex_unlock(&ds->cq_mutex);
+#endif
+
+	return count;
+}
+
+#ifdef _REENTRANT
+int dlm_ls_completion_fd(dlm_lshandle_t ls)
+{
+	struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
+
+	if (!lsinfo->ds || !lsinfo->ds->queue_enabled) {
+		errno = EINVAL;
+		return -1;
+	}
+	return lsinfo->ds->cq_fd;
+}
+
+int dlm_ls_ast_workers(dlm_lshandle_t ls, int count)
+{
+	struct dlm_ls_info *lsinfo = (struct dlm_ls_info *)ls;
+	struct dlm_dispatch_state *ds;
+	struct ast_worker *w;
+	int i, saved_errno;
+
+	if (count <= 0 || count > AST_WORKERS_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (lsinfo->tid) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	ds = get_dispatch_state(lsinfo);
+	if (!ds)
+		return -1;
+
+	if (ds->worker_count) {
+		errno = EEXIST;
+		return -1;
+	}
+	if (ds->queue_enabled) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	ds->workers = malloc(count * sizeof(struct ast_worker));
+	if (!ds->workers)
+		return -1;
+	memset(ds->workers, 0, count * sizeof(struct ast_worker));
+
+	for (i = 0; i < count; i++) {
+		w = &ds->workers[i];
+		if (queue_init(&w->queue, AST_WORKER_QUEUE) < 0)
+			goto fail;
+		pthread_mutex_init(&w->mutex, NULL);
+		pthread_cond_init(&w->work, NULL);
+		pthread_cond_init(&w->space, NULL);
+
+		errno = pthread_create(&w->tid, NULL, ast_worker_thread, w);
+		if (errno) {
+			pthread_mutex_destroy(&w->mutex);
+			pthread_cond_destroy(&w->work);
+			pthread_cond_destroy(&w->space);
+			free(w->queue.ring);
+			goto fail;
+		}
+		ds->worker_count++;
+	}
+	return 0;
+
+ fail:
+	saved_errno = errno;
+	stop_ast_workers(ds);
+	errno = saved_errno;
+	return -1;
+}
+#endif
+
 /*
  * Lockspace manipulation functions
  * Privileged users (checked by the kernel) can create/release lockspaces
@@ -1290,6 +2158,16 @@ static dlm_lshandle_t create_lockspace(const char *name, mode_t mode,
 	if (!newls)
 		return NULL;
 
+	if (mock_device) {
+		newls->fd = mock_open_lockspace(name, 1);
+		if (newls->fd == -1)
+			goto fail;
+		newls->tid = 0;
+		newls->ds = NULL;
+		newls->sync_read = 0;
+		return (dlm_lshandle_t)newls;
+	}
+
 	ls_dev_name(name, dev_path, sizeof(dev_path));
 
 	if (kernel_version.version[0] == 5)
@@ -1324,6 +2202,8 @@ static dlm_lshandle_t create_lockspace(const char *name, mode_t mode,
 	if (mode)
 		fchmod(newls->fd, mode);
 	newls->tid = 0;
+	newls->ds = NULL;
+	newls->sync_read = 0;
 	fcntl(newls->fd, F_SETFD, 1);
 	return (dlm_lshandle_t)newls;
 
@@ -1384,6 +2264,11 @@ int dlm_release_lockspace(const char *name, dlm_lshandle_t ls, int force)
 	uint32_t flags = 0;
 	int fd, is_symlink = 0;
 
+	if (mock_device) {
+		ls_pthread_cleanup(lsinfo);
+		return mock_release_lockspace(name, force);
+	}
+
 	ls_dev_name(name, dev_path, sizeof(dev_path));
 	if (!lstat(dev_path, &st) && S_ISLNK(st.st_mode))
 		is_symlink = 1;
@@ -1444,9 +2329,14 @@ dlm_lshandle_t dlm_open_lockspace(const char *name)
 		return NULL;
 
 	newls->tid = 0;
+	newls->ds = NULL;
+	newls->sync_read = 0;
 	ls_dev_name(name, dev_name, sizeof(dev_name));
 
-	newls->fd = open(dev_name, O_RDWR);
+	if (mock_device)
+		newls->fd = mock_open_lockspace(name, 0);
+	else
+		newls->fd = open(dev_name, O_RDWR);
 	saved_errno = errno;
 
 	if (newls->fd == -1) {
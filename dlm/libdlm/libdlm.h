@@ -147,8 +147,36 @@ extern dlm_lshandle_t dlm_new_lockspace(const char *name, mode_t mode,
  * dlm_ls_unlock_wait()
  * dlm_ls_deadlock_cancel()
  * dlm_ls_purge()
+ * dlm_ls_lock_batch() - async requests or converts for an array of locks
+ * dlm_ls_unlock_batch() - async unlocks or cancels for an array of locks
+ *
+ * The batch calls return the number of requests that were submitted and
+ * set status in each request to 0 or an errno value; a failed request
+ * doesn't stop the others.  For submitted lock requests lkid is set as well
+ * as the lksb lock id.  LKF_WAIT is not allowed in a batch.
  */
 
+struct dlm_lock_request {
+	uint32_t mode;
+	uint32_t flags;
+	const void *name;
+	unsigned int namelen;
+	struct dlm_lksb *lksb;
+	void (*astaddr) (void *astarg);
+	void *astarg;
+	void (*bastaddr) (void *astarg);
+	uint32_t lkid;				/* returned */
+	int status;				/* returned */
+};
+
+struct dlm_unlock_request {
+	uint32_t lkid;
+	uint32_t flags;
+	struct dlm_lksb *lksb;
+	void *astarg;
+	int status;				/* returned */
+};
+
 extern int dlm_ls_lock(dlm_lshandle_t lockspace,
 		uint32_t mode,
 		struct dlm_lksb *lksb,
@@ -204,6 +232,14 @@ extern int dlm_ls_purge(dlm_lshandle_t lockspace,
 		int nodeid,
 		int pid);
 
+extern int dlm_ls_lock_batch(dlm_lshandle_t lockspace,
+		struct dlm_lock_request *reqs,
+		int count);
+
+extern int dlm_ls_unlock_batch(dlm_lshandle_t lockspace,
+		struct dlm_unlock_request *reqs,
+		int count);
+
 
 /*
  * For threaded applications
@@ -226,6 +262,69 @@ extern int dlm_pthread_cleanup(void);
 #endif
 
 
+/*
+ * dlm_ls_sync_read() - with enable set, the synchronous calls on the
+ *                      lockspace (dlm_ls_lock_wait etc) write the request
+ *                      and read the result from the lockspace fd themselves
+ *                      instead of waiting to be woken by the lockspace
+ *                      thread.  For an application where one thread uses
+ *                      the lockspace and there is no dlm_ls_pthread_init()
+ *                      thread; other results read meanwhile have their ASTs
+ *                      delivered in the caller.  This is how libdlm_lt
+ *                      always works.
+ */
+
+extern int dlm_ls_sync_read(dlm_lshandle_t lockspace, int enable);
+
+
+/*
+ * Batched dispatch and AST delivery for your own lockspace (not for v5
+ * kernels, apart from dlm_ls_dispatch_batch)
+ *
+ * dlm_ls_dispatch_batch() - reads up to max pending results (all of them if
+ *                           max is 0) without blocking and delivers them;
+ *                           returns the number delivered.  Not for use with
+ *                           a lockspace that has a recv thread.
+ * dlm_ls_completion_queue() - instead of calling ASTs from the library,
+ *                           queue them for the application to collect with
+ *                           dlm_ls_get_completions().  size is the number
+ *                           held before the recv thread stops reading
+ *                           results from the kernel.
+ * dlm_ls_get_completions() - returns up to max queued completions.  Without
+ *                           a recv thread, pending results are read first,
+ *                           so it can be called when dlm_ls_get_fd() polls
+ *                           readable.
+ * dlm_ls_completion_fd() - with a recv thread, an fd that polls readable
+ *                           while there are queued completions.
+ * dlm_ls_ast_workers() - call ASTs from a pool of count threads instead of
+ *                        the thread reading the results.  ASTs for the same
+ *                        lksb are always called by the same thread, in
+ *                        order.
+ *
+ * The completion queue and the AST workers are alternatives, and both must
+ * be set up before dlm_ls_pthread_init().  The ASTs of the synchronous calls
+ * are always delivered directly.
+ */
+
+struct dlm_completion {
+	void (*astaddr) (void *astarg);
+	void *astarg;
+	struct dlm_lksb *lksb;
+	int bast_mode;		/* the mode being blocked, for a bast */
+};
+
+extern int dlm_ls_dispatch_batch(dlm_lshandle_t lockspace, int max);
+extern int dlm_ls_completion_queue(dlm_lshandle_t lockspace, int size);
+extern int dlm_ls_get_completions(dlm_lshandle_t lockspace,
+		struct dlm_completion *comps,
+		int max);
+
+#ifdef _REENTRANT
+extern int dlm_ls_completion_fd(dlm_lshandle_t lockspace);
+extern int dlm_ls_ast_workers(dlm_lshandle_t lockspace, int count);
+#endif
+
+
 /*
  * Lock modes
  */
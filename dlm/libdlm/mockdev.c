@@ -0,0 +1,896 @@
+#ifdef _REENTRANT
+#include <pthread.h>
+#endif
+#include <sys/types.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <linux/types.h>
+#include <linux/dlm.h>
+#define BUILDING_LIBDLM
+#include "libdlm.h"
+#include <linux/dlm_device.h>
+#include "mockdev.h"
+
+/*
+ * A single node lock manager following the rules of the kernel dlm:
+ * each resource has grant, convert and wait queues, requests are
+ * granted in order when their mode is compatible with the granted
+ * modes of the other locks, holders in the way are sent blocking ASTs,
+ * and the LVB is read or written according to the mode transition.
+ * Conversion deadlocks fail the conversion with EDEADLK or, with
+ * CONVDEADLK, demote the converting lock to NL.  Resources, and so
+ * their LVBs, last as long as the lockspace.
+ *
+ * Results go to the handle that owns the lock, whichever handle the
+ * request was written to.
+ */
+
+#define RSB_HASH_SIZE		4096
+#define LKB_HASH_SIZE		4096
+#define RESULT_LEN		(sizeof(struct dlm_lock_result) + DLM_USER_LVB_LEN)
+
+#define MOCK_NONE		-1
+#define MOCK_GRANTED		0
+#define MOCK_CONVERT		1
+#define MOCK_WAITING		2
+#define MOCK_QUEUES		3
+
+/* modes_compat[a][b] for NL..EX */
+static const int modes_compat[6][6] = {
+	/* NL CR CW PR PW EX */
+	{  1, 1, 1, 1, 1, 1 },	/* NL */
+	{  1, 1, 1, 1, 1, 0 },	/* CR */
+	{  1, 1, 1, 0, 0, 0 },	/* CW */
+	{  1, 1, 0, 1, 0, 0 },	/* PR */
+	{  1, 1, 0, 0, 0, 0 },	/* PW */
+	{  1, 0, 0, 0, 0, 0 }	/* EX */
+};
+
+/* lvb_ops[grmode + 1][rqmode + 1]: 1 reads the resource's LVB into the
+   lock, 0 writes the lock's LVB to the resource, -1 does neither */
+static const int lvb_ops[7][7] = {
+	/* UN  NL  CR  CW  PR  PW  EX */
+	{  -1,  1,  1,  1,  1,  1,  1 },	/* UN */
+	{  -1,  1,  1,  1,  1,  1,  1 },	/* NL */
+	{  -1, -1,  1,  1,  1,  1,  1 },	/* CR */
+	{  -1, -1, -1,  1,  1,  1,  1 },	/* CW */
+	{  -1, -1, -1, -1,  1,  1,  1 },	/* PR */
+	{  -1,  0,  0,  0,  0,  0,  1 },	/* PW */
+	{  -1,  0,  0,  0,  0,  0,  0 }		/* EX */
+};
+
+struct mock_result {
+	struct mock_result *next;
+	int len;
+	struct dlm_lock_result result;	/* followed by the lvb */
+	char lvb[DLM_USER_LVB_LEN];
+};
+
+struct mock_lkb;
+
+struct mock_queue {
+	struct mock_lkb *head;
+	struct mock_lkb *tail;
+};
+
+struct mock_rsb {
+	struct mock_rsb *next;
+	int namelen;
+	char name[DLM_RESNAME_MAXLEN];
+	char lvb[DLM_USER_LVB_LEN];
+	struct mock_queue queue[MOCK_QUEUES];
+};
+
+struct mock_lkb {
+	struct mock_lkb *hash_next;
+	struct mock_lkb *next;		/* handle's locks */
+	struct mock_lkb *prev;
+	struct mock_lkb *qnext;		/* resource queue */
+	struct mock_lkb *qprev;
+	struct mock_handle *h;
+	struct mock_rsb *rsb;
+	uint32_t lkid;
+	int status;
+	int grmode;			/* -1 until granted */
+	int rqmode;
+	int highbast;
+	uint32_t flags;
+	int sb_status;
+	int sb_flags;
+	char lvb[DLM_USER_LVB_LEN];
+	struct dlm_lksb *lksb;
+	void *castaddr;
+	void *castparam;
+	void *bastaddr;
+	void *bastparam;
+};
+
+struct mock_ls {
+	struct mock_ls *next;
+	char name[DLM_LOCKSPACE_LEN + 1];
+	int handles;
+	int listed;			/* not yet released */
+	uint32_t next_lkid;
+	struct mock_rsb *rsb_hash[RSB_HASH_SIZE];
+	struct mock_lkb *lkb_hash[LKB_HASH_SIZE];
+};
+
+struct mock_handle {
+	struct mock_handle *next;
+	int fd;
+	struct mock_ls *ls;
+	struct mock_lkb *locks;
+	struct mock_result *results;
+	struct mock_result *results_tail;
+};
+
+static struct mock_ls *lockspaces;
+static struct mock_handle *handles;
+
+#ifdef _REENTRANT
+static pthread_mutex_t mock_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define mock_lock()	pthread_mutex_lock(&mock_mutex)
+#define mock_unlock()	pthread_mutex_unlock(&mock_mutex)
+#else
+#define mock_lock()	do { } while (0)
+#define mock_unlock()	do { } while (0)
+#endif
+
+int mock_device_enabled(void)
+{
+	const char *env = getenv(MOCK_DEVICE_ENV);
+
+	return env && *env && strcmp(env, "0");
+}
+
+static uint32_t name_hash(const char *name, int len)
+{
+	uint32_t h = 2166136261u;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static struct mock_ls *find_ls(const char *name)
+{
+	struct mock_ls *ls;
+
+	for (ls = lockspaces; ls; ls = ls->next) {
+		if (!strcmp(ls->name, name))
+			return ls;
+	}
+	return NULL;
+}
+
+static void unlist_ls(struct mock_ls *ls)
+{
+	struct mock_ls **p;
+
+	for (p = &lockspaces; *p; p = &(*p)->next) {
+		if (*p == ls) {
+			*p = ls->next;
+			break;
+		}
+	}
+	ls->listed = 0;
+}
+
+static void free_ls(struct mock_ls *ls)
+{
+	struct mock_rsb *r, *rnext;
+	int i;
+
+	for (i = 0; i < RSB_HASH_SIZE; i++) {
+		for (r = ls->rsb_hash[i]; r; r = rnext) {
+			rnext = r->next;
+			free(r);
+		}
+	}
+	free(ls);
+}
+
+static struct mock_handle *find_handle(int fd)
+{
+	struct mock_handle *h;
+
+	for (h = handles; h; h = h->next) {
+		if (h->fd == fd)
+			return h;
+	}
+	return NULL;
+}
+
+static struct mock_rsb *get_rsb(struct mock_ls *ls, const char *name,
+				int namelen)
+{
+	struct mock_rsb *r;
+	uint32_t b = name_hash(name, namelen) & (RSB_HASH_SIZE - 1);
+
+	for (r = ls->rsb_hash[b]; r; r = r->next) {
+		if (r->namelen == namelen && !memcmp(r->name, name, namelen))
+			return r;
+	}
+
+	r = malloc(sizeof(struct mock_rsb));
+	if (!r)
+		return NULL;
+	memset(r, 0, sizeof(struct mock_rsb));
+	memcpy(r->name, name, namelen);
+	r->namelen = namelen;
+	r->next = ls->rsb_hash[b];
+	ls->rsb_hash[b] = r;
+	return r;
+}
+
+static struct mock_lkb *find_lkb(struct mock_ls *ls, uint32_t lkid)
+{
+	struct mock_lkb *lkb;
+
+	for (lkb = ls->lkb_hash[lkid & (LKB_HASH_SIZE - 1)]; lkb;
+	     lkb = lkb->hash_next) {
+		if (lkb->lkid == lkid)
+			return lkb;
+	}
+	return NULL;
+}
+
+static void del_queue(struct mock_lkb *lkb)
+{
+	struct mock_queue *q;
+
+	if (lkb->status == MOCK_NONE)
+		return;
+	q = &lkb->rsb->queue[lkb->status];
+
+	if (lkb->qprev)
+		lkb->qprev->qnext = lkb->qnext;
+	else
+		q->head = lkb->qnext;
+	if (lkb->qnext)
+		lkb->qnext->qprev = lkb->qprev;
+	else
+		q->tail = lkb->qprev;
+
+	lkb->qnext = lkb->qprev = NULL;
+	lkb->status = MOCK_NONE;
+}
+
+static void move_queue(struct mock_lkb *lkb, int status)
+{
+	struct mock_queue *q = &lkb->rsb->queue[status];
+
+	del_queue(lkb);
+
+	lkb->status = status;
+	lkb->qprev = q->tail;
+	if (q->tail)
+		q->tail->qnext = lkb;
+	else
+		q->head = lkb;
+	q->tail = lkb;
+}
+
+/* take the lock off its resource and its handle, and free it */
+
+static void del_lkb(struct mock_lkb *lkb)
+{
+	struct mock_ls *ls = lkb->h->ls;
+	struct mock_lkb **p;
+
+	del_queue(lkb);
+
+	for (p = &ls->lkb_hash[lkb->lkid & (LKB_HASH_SIZE - 1)]; *p;
+	     p = &(*p)->hash_next) {
+		if (*p == lkb) {
+			*p = lkb->hash_next;
+			break;
+		}
+	}
+
+	if (lkb->prev)
+		lkb->prev->next = lkb->next;
+	else
+		lkb->h->locks = lkb->next;
+	if (lkb->next)
+		lkb->next->prev = lkb->prev;
+
+	free(lkb);
+}
+
+/* queue a result for the lock's handle and make its fd readable; a
+   blocking AST has bast_mode set, a completion AST has -1 */
+
+static void queue_result(struct mock_lkb *lkb, int bast_mode, int lvb)
+{
+	struct mock_handle *h = lkb->h;
+	struct mock_result *mr;
+	struct dlm_lock_result *result;
+
+	mr = malloc(sizeof(struct mock_result));
+	if (!mr)
+		return;
+	memset(mr, 0, sizeof(struct mock_result));
+
+	result = &mr->result;
+	result->version[0] = DLM_DEVICE_VERSION_MAJOR;
+	result->version[1] = DLM_DEVICE_VERSION_MINOR;
+	result->version[2] = DLM_DEVICE_VERSION_PATCH;
+	if (bast_mode >= 0) {
+		result->user_astaddr = lkb->bastaddr;
+		result->user_astparam = lkb->bastparam;
+		result->bast_mode = bast_mode;
+	} else {
+		result->user_astaddr = lkb->castaddr;
+		result->user_astparam = lkb->castparam;
+	}
+	result->user_lksb = lkb->lksb;
+	result->lksb.sb_status = lkb->sb_status;
+	result->lksb.sb_lkid = lkb->lkid;
+	result->lksb.sb_flags = lkb->sb_flags;
+	mr->len = sizeof(struct dlm_lock_result);
+
+	if (lvb) {
+		result->lvb_offset = mr->len;
+		memcpy(mr->lvb, lkb->lvb, DLM_USER_LVB_LEN);
+		mr->len += DLM_USER_LVB_LEN;
+	}
+	result->length = mr->len;
+
+	if (h->results_tail)
+		h->results_tail->next = mr;
+	else
+		h->results = mr;
+	h->results_tail = mr;
+
+	eventfd_write(h->fd, 1);
+}
+
+/* status is negative, as the kernel passes it */
+
+static void queue_cast(struct mock_lkb *lkb, int status, int lvb)
+{
+	lkb->sb_status = status;
+	queue_result(lkb, -1, lvb);
+	lkb->sb_flags = 0;
+}
+
+static int modes_conflict(int mode1, int mode2)
+{
+	return !modes_compat[mode1][mode2];
+}
+
+/* does lkb's requested mode conflict with another lock's granted mode;
+   converting locks still hold theirs */
+
+static int queue_conflict(struct mock_rsb *r, struct mock_lkb *lkb)
+{
+	struct mock_lkb *other;
+	int q;
+
+	for (q = MOCK_GRANTED; q <= MOCK_CONVERT; q++) {
+		for (other = r->queue[q].head; other; other = other->qnext) {
+			if (other != lkb &&
+			    modes_conflict(other->grmode, lkb->rqmode))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * When a request is made (now), a conversion is granted if it is
+ * compatible, unless QUECVT asks for it to queue behind the others, and
+ * a new lock is granted if it is compatible and nothing is queued.
+ * Later, only the head of the convert queue, and then the head of the
+ * wait queue once no conversions remain, can be granted, so locks are
+ * granted in the order they queued.
+ */
+
+static int can_be_granted(struct mock_rsb *r, struct mock_lkb *lkb, int now)
+{
+	struct mock_lkb *conv_head = r->queue[MOCK_CONVERT].head;
+
+	if (queue_conflict(r, lkb))
+		return 0;
+
+	if (lkb->grmode >= 0) {
+		if (now && !(lkb->flags & DLM_LKF_QUECVT))
+			return 1;
+		return !conv_head || conv_head == lkb;
+	}
+
+	if (conv_head)
+		return 0;
+	if (now)
+		return !r->queue[MOCK_WAITING].head;
+	return r->queue[MOCK_WAITING].head == lkb;
+}
+
+static void grant_lock(struct mock_lkb *lkb)
+{
+	struct mock_rsb *r = lkb->rsb;
+	int lvb = 0;
+
+	if (lkb->flags & DLM_LKF_VALBLK) {
+		switch (lvb_ops[lkb->grmode + 1][lkb->rqmode + 1]) {
+		case 1:
+			memcpy(lkb->lvb, r->lvb, DLM_USER_LVB_LEN);
+			lvb = 1;
+			break;
+		case 0:
+			memcpy(r->lvb, lkb->lvb, DLM_USER_LVB_LEN);
+			break;
+		}
+	}
+
+	lkb->grmode = lkb->rqmode;
+	lkb->highbast = 0;
+	move_queue(lkb, MOCK_GRANTED);
+	queue_cast(lkb, 0, lvb);
+}
+
+/* tell the holders that are in the way of lkb's request, once for each
+   mode they are asked to give way to */
+
+static void send_blocking_asts(struct mock_rsb *r, struct mock_lkb *lkb)
+{
+	struct mock_lkb *gr;
+	int q;
+
+	for (q = MOCK_GRANTED; q <= MOCK_CONVERT; q++) {
+		for (gr = r->queue[q].head; gr; gr = gr->qnext) {
+			if (gr == lkb || !gr->bastaddr)
+				continue;
+			if (gr->highbast >= lkb->rqmode ||
+			    !modes_conflict(gr->grmode, lkb->rqmode))
+				continue;
+			gr->highbast = lkb->rqmode;
+			queue_result(gr, lkb->rqmode, 0);
+		}
+	}
+}
+
+/* is another conversion waiting for lkb's granted mode while lkb would
+   wait for its granted mode */
+
+static int conversion_deadlock(struct mock_rsb *r, struct mock_lkb *lkb)
+{
+	struct mock_lkb *other;
+
+	for (other = r->queue[MOCK_CONVERT].head; other;
+	     other = other->qnext) {
+		if (other != lkb &&
+		    modes_conflict(other->grmode, lkb->rqmode) &&
+		    modes_conflict(lkb->grmode, other->rqmode))
+			return 1;
+	}
+	return 0;
+}
+
+static void grant_pending(struct mock_rsb *r)
+{
+	struct mock_lkb *lkb;
+
+	while ((lkb = r->queue[MOCK_CONVERT].head) &&
+	       can_be_granted(r, lkb, 0))
+		grant_lock(lkb);
+
+	while ((lkb = r->queue[MOCK_WAITING].head) &&
+	       can_be_granted(r, lkb, 0))
+		grant_lock(lkb);
+
+	if ((lkb = r->queue[MOCK_CONVERT].head))
+		send_blocking_asts(r, lkb);
+	if ((lkb = r->queue[MOCK_WAITING].head))
+		send_blocking_asts(r, lkb);
+}
+
+/* the request has been set up in lkb; grant it, queue it or fail it */
+
+static void request_lock(struct mock_rsb *r, struct mock_lkb *lkb)
+{
+	int conv;
+
+	if (can_be_granted(r, lkb, 1)) {
+		conv = lkb->grmode >= 0;
+		grant_lock(lkb);
+
+		/* a conversion down may let others in */
+		if (conv)
+			grant_pending(r);
+		return;
+	}
+
+	if (lkb->flags & DLM_LKF_NOQUEUE) {
+		if (lkb->flags & DLM_LKF_NOQUEUEBAST)
+			send_blocking_asts(r, lkb);
+		lkb->rqmode = lkb->grmode;
+		queue_cast(lkb, -EAGAIN, 0);
+		if (lkb->grmode < 0)
+			del_lkb(lkb);
+		return;
+	}
+
+	if (lkb->grmode >= 0 && conversion_deadlock(r, lkb)) {
+		if (!(lkb->flags & DLM_LKF_CONVDEADLK)) {
+			lkb->rqmode = lkb->grmode;
+			queue_cast(lkb, -EDEADLK, 0);
+			return;
+		}
+
+		/* give up the granted mode so the others can go first */
+		lkb->grmode = DLM_LOCK_NL;
+		lkb->sb_flags |= DLM_SBF_DEMOTED;
+		move_queue(lkb, MOCK_CONVERT);
+		grant_pending(r);
+		return;
+	}
+
+	move_queue(lkb, lkb->grmode >= 0 ? MOCK_CONVERT : MOCK_WAITING);
+	send_blocking_asts(r, lkb);
+}
+
+/* a convert may change everything but the resource */
+
+static void set_params(struct mock_lkb *lkb, struct dlm_lock_params *p)
+{
+	lkb->rqmode = p->mode;
+	lkb->flags = p->flags;
+	lkb->lksb = p->lksb;
+	lkb->castaddr = p->castaddr;
+	lkb->castparam = p->castparam;
+	lkb->bastaddr = p->bastaddr;
+	lkb->bastparam = p->bastparam;
+	if (p->flags & DLM_LKF_VALBLK)
+		memcpy(lkb->lvb, p->lvb, DLM_USER_LVB_LEN);
+}
+
+static int do_lock(struct mock_handle *h, struct dlm_lock_params *p)
+{
+	struct mock_ls *ls = h->ls;
+	struct mock_lkb *lkb;
+	struct mock_rsb *r;
+	uint32_t lkid;
+
+	if (p->mode > DLM_LOCK_EX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (p->flags & DLM_LKF_CONVERT) {
+		lkb = find_lkb(ls, p->lkid);
+		if (!lkb) {
+			errno = ENOENT;
+			return -1;
+		}
+		if (lkb->status != MOCK_GRANTED) {
+			errno = EBUSY;
+			return -1;
+		}
+		set_params(lkb, p);
+		request_lock(lkb->rsb, lkb);
+		return 0;
+	}
+
+	if (!p->namelen || p->namelen > DLM_RESNAME_MAXLEN) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	r = get_rsb(ls, p->name, p->namelen);
+	lkb = malloc(sizeof(struct mock_lkb));
+	if (!r || !lkb) {
+		free(lkb);
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(lkb, 0, sizeof(struct mock_lkb));
+
+	do {
+		lkid = ++ls->next_lkid;
+	} while (!lkid || find_lkb(ls, lkid));
+
+	lkb->lkid = lkid;
+	lkb->h = h;
+	lkb->rsb = r;
+	lkb->status = MOCK_NONE;
+	lkb->grmode = -1;
+	set_params(lkb, p);
+
+	lkb->hash_next = ls->lkb_hash[lkid & (LKB_HASH_SIZE - 1)];
+	ls->lkb_hash[lkid & (LKB_HASH_SIZE - 1)] = lkb;
+	lkb->next = h->locks;
+	if (h->locks)
+		h->locks->prev = lkb;
+	h->locks = lkb;
+
+	/* lkb is gone after this if a NOQUEUE request failed */
+	request_lock(r, lkb);
+
+	/* the device returns the lock id from the write */
+	return lkid;
+}
+
+/*
+ * Cancelling a queued request completes it with ECANCEL, or EDEADLK for
+ * a deadlock cancel; a new lock goes away and a conversion goes back to
+ * its granted mode.  Like the kernel, cancelling a lock that has
+ * already been granted succeeds and does nothing.
+ */
+
+static int do_unlock(struct mock_handle *h, struct dlm_lock_params *p,
+		     int cancel_status)
+{
+	struct mock_lkb *lkb;
+	struct mock_rsb *r;
+
+	lkb = find_lkb(h->ls, p->lkid);
+	if (!lkb) {
+		errno = ENOENT;
+		return -1;
+	}
+	r = lkb->rsb;
+
+	/* unlock uses the lock's completion ast */
+	if (p->castparam)
+		lkb->castparam = p->castparam;
+	if (p->lksb)
+		lkb->lksb = p->lksb;
+
+	if (cancel_status) {
+		switch (lkb->status) {
+		case MOCK_WAITING:
+			queue_cast(lkb, cancel_status, 0);
+			del_lkb(lkb);
+			break;
+		case MOCK_CONVERT:
+			lkb->rqmode = lkb->grmode;
+			move_queue(lkb, MOCK_GRANTED);
+			queue_cast(lkb, cancel_status, 0);
+			break;
+		default:
+			return 0;
+		}
+		grant_pending(r);
+		return 0;
+	}
+
+	if (lkb->status != MOCK_GRANTED &&
+	    !(p->flags & DLM_LKF_FORCEUNLOCK)) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if ((p->flags & DLM_LKF_VALBLK) && lkb->grmode > DLM_LOCK_PR)
+		memcpy(r->lvb, p->lvb, DLM_USER_LVB_LEN);
+
+	queue_cast(lkb, -DLM_EUNLOCK, 0);
+	del_lkb(lkb);
+	grant_pending(r);
+	return 0;
+}
+
+ssize_t mock_write(int fd, const void *buf, size_t len)
+{
+	const struct dlm_write_request *req = buf;
+	struct dlm_lock_params *p;
+	struct mock_handle *h;
+	char kbuf[sizeof(struct dlm_write_request) + DLM_RESNAME_MAXLEN];
+	int rv;
+
+	if (len < sizeof(struct dlm_write_request) || len > sizeof(kbuf)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* copied, as the kernel copies it in */
+	memset(kbuf, 0, sizeof(kbuf));
+	memcpy(kbuf, buf, len);
+	req = (struct dlm_write_request *)kbuf;
+	p = (struct dlm_lock_params *)&req->i.lock;
+
+	mock_lock();
+	h = find_handle(fd);
+	if (!h) {
+		mock_unlock();
+		errno = EBADF;
+		return -1;
+	}
+
+	switch (req->cmd) {
+	case DLM_USER_LOCK:
+		if (!(p->flags & DLM_LKF_CONVERT) &&
+		    len < sizeof(struct dlm_write_request) + p->namelen) {
+			errno = EINVAL;
+			rv = -1;
+			break;
+		}
+		rv = do_lock(h, p);
+		break;
+	case DLM_USER_UNLOCK:
+		rv = do_unlock(h, p, (p->flags & DLM_LKF_CANCEL) ?
+				     -DLM_ECANCEL : 0);
+		break;
+	case DLM_USER_DEADLOCK:
+		rv = do_unlock(h, p, -EDEADLK);
+		break;
+	case DLM_USER_PURGE:
+		/* there are no orphans without PERSISTENT locks from other
+		   processes */
+		rv = 0;
+		break;
+	default:
+		errno = EINVAL;
+		rv = -1;
+	}
+
+	mock_unlock();
+	return rv;
+}
+
+ssize_t mock_read(int fd, void *buf, size_t len)
+{
+	struct mock_handle *h;
+	struct mock_result *mr;
+	eventfd_t count;
+	int rv;
+
+	if (len < RESULT_LEN) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* the fd is a semaphore counting the results, so this blocks, or
+	   fails with EAGAIN, the way the device read does */
+	if (eventfd_read(fd, &count) < 0)
+		return -1;
+
+	mock_lock();
+	h = find_handle(fd);
+	if (!h || !h->results) {
+		mock_unlock();
+		errno = h ? EAGAIN : EBADF;
+		return -1;
+	}
+
+	mr = h->results;
+	h->results = mr->next;
+	if (!h->results)
+		h->results_tail = NULL;
+	mock_unlock();
+
+	memcpy(buf, &mr->result, mr->len);
+	rv = mr->len;
+	free(mr);
+	return rv;
+}
+
+int mock_open_lockspace(const char *name, int create)
+{
+	struct mock_ls *ls;
+	struct mock_handle *h;
+
+	if (strlen(name) > DLM_LOCKSPACE_LEN) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	h = malloc(sizeof(struct mock_handle));
+	if (!h)
+		return -1;
+	memset(h, 0, sizeof(struct mock_handle));
+
+	h->fd = eventfd(0, EFD_SEMAPHORE);
+	if (h->fd < 0) {
+		free(h);
+		return -1;
+	}
+
+	mock_lock();
+	ls = find_ls(name);
+	if (!ls && create) {
+		ls = malloc(sizeof(struct mock_ls));
+		if (ls) {
+			memset(ls, 0, sizeof(struct mock_ls));
+			strcpy(ls->name, name);
+			ls->listed = 1;
+			ls->next = lockspaces;
+			lockspaces = ls;
+		}
+	}
+	if (!ls) {
+		mock_unlock();
+		close(h->fd);
+		free(h);
+		errno = create ? ENOMEM : ENOENT;
+		return -1;
+	}
+
+	ls->handles++;
+	h->ls = ls;
+	h->next = handles;
+	handles = h;
+	mock_unlock();
+
+	return h->fd;
+}
+
+int mock_close(int fd)
+{
+	struct mock_handle *h, **p;
+	struct mock_result *mr;
+	struct mock_rsb *r;
+	struct mock_ls *ls;
+
+	mock_lock();
+	for (p = &handles; *p; p = &(*p)->next) {
+		if ((*p)->fd == fd)
+			break;
+	}
+	h = *p;
+	if (!h) {
+		mock_unlock();
+		return close(fd);
+	}
+	*p = h->next;
+
+	/* the locks of a closed handle are released, as when the device
+	   is closed, and whoever was waiting for them can have them */
+	while (h->locks) {
+		r = h->locks->rsb;
+		del_lkb(h->locks);
+		grant_pending(r);
+	}
+
+	while ((mr = h->results)) {
+		h->results = mr->next;
+		free(mr);
+	}
+
+	ls = h->ls;
+	if (!--ls->handles && !ls->listed)
+		free_ls(ls);
+	mock_unlock();
+
+	free(h);
+	return close(fd);
+}
+
+int mock_release_lockspace(const char *name, int force)
+{
+	struct mock_ls *ls;
+	struct mock_handle *h;
+
+	mock_lock();
+	ls = find_ls(name);
+	if (!ls) {
+		mock_unlock();
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (!force) {
+		for (h = handles; h; h = h->next) {
+			if (h->ls == ls && h->locks) {
+				mock_unlock();
+				errno = EBUSY;
+				return -1;
+			}
+		}
+	}
+
+	unlist_ls(ls);
+	if (!ls->handles)
+		free_ls(ls);
+	mock_unlock();
+	return 0;
+}
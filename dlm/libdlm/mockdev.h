@@ -0,0 +1,32 @@
+#ifndef __MOCKDEV_DOT_H__
+#define __MOCKDEV_DOT_H__
+
+/*
+ * An in-process lock manager standing in for the dlm lockspace devices,
+ * used in place of the kernel when DLM_MOCK_DEVICE is set in the
+ * environment, so libdlm and its users can be run, profiled and debugged
+ * without the dlm module.  Each open
+ * lockspace handle is an eventfd that polls readable while results are
+ * waiting; libdlm passes its reads and writes to mock_read/mock_write
+ * instead of the device.
+ */
+
+#define MOCK_DEVICE_ENV		"DLM_MOCK_DEVICE"
+
+int mock_device_enabled(void);
+
+/* returns the fd for a lockspace handle, creating the lockspace first if
+   create is set */
+int mock_open_lockspace(const char *name, int create);
+
+/* the lockspace goes away when the last handle is closed, or now if force
+   is set */
+int mock_release_lockspace(const char *name, int force);
+
+int mock_close(int fd);
+
+/* as read and write on a lockspace device */
+ssize_t mock_read(int fd, void *buf, size_t len);
+ssize_t mock_write(int fd, const void *buf, size_t len);
+
+#endif
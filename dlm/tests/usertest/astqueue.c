@@ -0,0 +1,246 @@
+/*
+ * Lock and unlock many resources, with the results delivered by
+ * dlm_ls_dispatch_batch(), a completion queue, or AST worker threads.
+ */
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/poll.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "libdlm.h"
+
+#define DELIVER_BATCH	0
+#define DELIVER_QUEUE	1
+#define DELIVER_WORKERS	2
+
+struct lock {
+	struct dlm_lksb lksb;
+	int num;
+};
+
+static dlm_lshandle_t ls;
+static struct lock *locks;
+static int resources = 100;
+static int verbose;
+
+static pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static int done;
+static int errors;
+
+static void usage(char *prog, FILE *file)
+{
+	fprintf(file, "Usage:\n");
+	fprintf(file, "%s [lnrdqwvh]\n", prog);
+	fprintf(file, "\n");
+	fprintf(file, "   -h           show this help information\n");
+	fprintf(file, "   -l <name>    lockspace name (default astqueue)\n");
+	fprintf(file, "   -n <num>     number of locks (default 10000)\n");
+	fprintf(file, "   -r <num>     number of resources (default 100)\n");
+	fprintf(file, "   -d <how>     deliver with batch, queue or workers\n");
+	fprintf(file, "                (default batch)\n");
+	fprintf(file, "   -q <num>     completion queue size (default 256)\n");
+	fprintf(file, "   -w <num>     number of AST workers (default 4)\n");
+	fprintf(file, "   -v           verbose\n");
+	fprintf(file, "\n");
+}
+
+static void ast_routine(void *arg)
+{
+	struct lock *lk = arg;
+	char name[64];
+	int status;
+
+	if (lk->lksb.sb_status == EUNLOCK) {
+		pthread_mutex_lock(&done_mutex);
+		done++;
+		pthread_cond_signal(&done_cond);
+		pthread_mutex_unlock(&done_mutex);
+		return;
+	}
+
+	if (lk->lksb.sb_status) {
+		snprintf(name, sizeof(name), "astqueue%d", lk->num % resources);
+		fprintf(stderr, "lock %d on %s failed: %d\n", lk->num, name,
+			lk->lksb.sb_status);
+		pthread_mutex_lock(&done_mutex);
+		errors++;
+		done++;
+		pthread_cond_signal(&done_cond);
+		pthread_mutex_unlock(&done_mutex);
+		return;
+	}
+
+	if (verbose > 1)
+		printf("granted %d lkid %x\n", lk->num, lk->lksb.sb_lkid);
+
+	status = dlm_ls_unlock(ls, lk->lksb.sb_lkid, 0, &lk->lksb, lk);
+	if (status)
+		perror("unlock");
+}
+
+static int get_done(void)
+{
+	int n;
+
+	pthread_mutex_lock(&done_mutex);
+	n = done;
+	pthread_mutex_unlock(&done_mutex);
+	return n;
+}
+
+static int collect(int deliver, struct dlm_completion *comps, int max)
+{
+	struct pollfd pfd;
+	int i, n;
+
+	pfd.fd = dlm_ls_get_fd(ls);
+	pfd.events = POLLIN;
+
+	if (poll(&pfd, 1, 10000) <= 0) {
+		fprintf(stderr, "no results in 10 seconds\n");
+		return -1;
+	}
+
+	if (deliver == DELIVER_BATCH)
+		return dlm_ls_dispatch_batch(ls, 0);
+
+	n = dlm_ls_get_completions(ls, comps, max);
+	for (i = 0; i < n; i++)
+		comps[i].astaddr(comps[i].astarg);
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *lsname = "astqueue";
+	struct dlm_completion *comps = NULL;
+	struct timeval begin, end;
+	char name[64];
+	double secs;
+	int deliver = DELIVER_BATCH;
+	int count = 10000, qsize = 256, workers = 4;
+	int optchar, status, i;
+
+	while ((optchar = getopt(argc, argv, "l:n:r:d:q:w:vh")) != EOF) {
+		switch (optchar) {
+		case 'l':
+			lsname = optarg;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'r':
+			resources = atoi(optarg);
+			break;
+		case 'd':
+			if (!strcmp(optarg, "batch"))
+				deliver = DELIVER_BATCH;
+			else if (!strcmp(optarg, "queue"))
+				deliver = DELIVER_QUEUE;
+			else if (!strcmp(optarg, "workers"))
+				deliver = DELIVER_WORKERS;
+			else {
+				usage(argv[0], stderr);
+				exit(1);
+			}
+			break;
+		case 'q':
+			qsize = atoi(optarg);
+			break;
+		case 'w':
+			workers = atoi(optarg);
+			break;
+		case 'v':
+			verbose++;
+			break;
+		case 'h':
+			usage(argv[0], stdout);
+			exit(0);
+		default:
+			usage(argv[0], stderr);
+			exit(1);
+		}
+	}
+
+	if (count <= 0 || resources <= 0) {
+		usage(argv[0], stderr);
+		exit(1);
+	}
+
+	locks = calloc(count, sizeof(struct lock));
+	if (!locks) {
+		perror("calloc");
+		return 1;
+	}
+
+	ls = dlm_create_lockspace(lsname, 0777);
+	if (!ls) {
+		perror("dlm_create_lockspace");
+		return 1;
+	}
+
+	switch (deliver) {
+	case DELIVER_QUEUE:
+		comps = malloc(qsize * sizeof(struct dlm_completion));
+		if (!comps || dlm_ls_completion_queue(ls, qsize)) {
+			perror("dlm_ls_completion_queue");
+			goto out;
+		}
+		break;
+	case DELIVER_WORKERS:
+		if (dlm_ls_ast_workers(ls, workers) ||
+		    dlm_ls_pthread_init(ls)) {
+			perror("dlm_ls_ast_workers");
+			goto out;
+		}
+		break;
+	}
+
+	gettimeofday(&begin, NULL);
+
+	for (i = 0; i < count; i++) {
+		locks[i].num = i;
+		snprintf(name, sizeof(name), "astqueue%d", i % resources);
+
+		status = dlm_ls_lock(ls, LKM_NLMODE, &locks[i].lksb, 0,
+				     name, strlen(name), 0, ast_routine,
+				     &locks[i], NULL, NULL);
+		if (status) {
+			perror("lock");
+			goto out;
+		}
+	}
+
+	if (deliver == DELIVER_WORKERS) {
+		pthread_mutex_lock(&done_mutex);
+		while (done < count)
+			pthread_cond_wait(&done_cond, &done_mutex);
+		pthread_mutex_unlock(&done_mutex);
+	} else {
+		while (get_done() < count) {
+			if (collect(deliver, comps, qsize) < 0)
+				goto out;
+		}
+	}
+
+	gettimeofday(&end, NULL);
+
+	secs = (end.tv_sec - begin.tv_sec) +
+	       (end.tv_usec - begin.tv_usec) * 1.e-6;
+	printf("%d locks, %d errors, %.3f seconds, %.0f locks/sec\n",
+	       count, errors, secs, secs > 0 ? count / secs : 0);
+ out:
+	dlm_release_lockspace(lsname, ls, 1);
+	free(comps);
+	free(locks);
+	return errors ? 1 : 0;
+}
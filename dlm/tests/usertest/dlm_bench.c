@@ -0,0 +1,501 @@
+/*
+ * Run a configurable lock workload from a number of threads against one
+ * or more lockspaces, and report throughput and latency percentiles for
+ * each kind of request as CSV or JSON.
+ *
+ * With -f (or DLM_MOCK_DEVICE set) libdlm uses its in-process lock
+ * manager instead of the kernel, so the numbers are the cost of the
+ * library and the contention between the threads, without the kernel
+ * or the network.
+ */
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "libdlm.h"
+
+#define OP_LOCK		0
+#define OP_CONVERT	1
+#define OP_UNLOCK	2
+#define OP_COUNT	3
+
+#define PATTERN_LOCK	0	/* lock then unlock, converting in between */
+#define PATTERN_HOLD	1	/* keep a lock, convert it or move it */
+
+#define MAX_LOCKSPACES	64
+
+static const char *op_names[OP_COUNT] = { "lock", "convert", "unlock" };
+static const char *mode_names[] = { "NL", "CR", "CW", "PR", "PW", "EX" };
+
+struct thread_info {
+	pthread_t thread;
+	dlm_lshandle_t ls;
+	unsigned int seed;
+	uint64_t *lat[OP_COUNT];
+	int count[OP_COUNT];
+	int errors[OP_COUNT];
+	int deadlocks;
+	char lvb[DLM_LVB_LEN];
+};
+
+static int lockspaces = 1;
+static int threads = 4;
+static int resources = 1000;
+static int ops = 100000;
+static int convert_pct = -1;
+static int use_lvb;
+static int pattern = PATTERN_LOCK;
+static int mode_weight[6];
+static int weight_total;
+
+static pthread_barrier_t start_barrier;
+
+static void usage(char *prog, FILE *file)
+{
+	fprintf(file, "Usage:\n");
+	fprintf(file, "%s [lLtrnmcpVofh]\n", prog);
+	fprintf(file, "\n");
+	fprintf(file, "   -h           show this help information\n");
+	fprintf(file, "   -l <name>    lockspace name prefix (default dlm_bench)\n");
+	fprintf(file, "   -L <num>     number of lockspaces (default 1)\n");
+	fprintf(file, "   -t <num>     number of threads (default 4)\n");
+	fprintf(file, "   -r <num>     number of resources (default 1000)\n");
+	fprintf(file, "   -n <num>     operations per thread (default 100000)\n");
+	fprintf(file, "   -m <mix>     mode weights (default PR:3,EX:1)\n");
+	fprintf(file, "   -c <pct>     percent of operations that are converts\n");
+	fprintf(file, "                (default 0 for lock, 50 for hold)\n");
+	fprintf(file, "   -p <how>     lock: lock and unlock each resource used\n");
+	fprintf(file, "                hold: keep a lock between operations\n");
+	fprintf(file, "   -V           use the lock value block\n");
+	fprintf(file, "   -o <fmt>     csv or json (default csv)\n");
+	fprintf(file, "   -f           use the fake lockspace device\n");
+	fprintf(file, "\n");
+}
+
+static int parse_mix(char *mix)
+{
+	char *tok, *save = NULL, *colon;
+	int m;
+
+	memset(mode_weight, 0, sizeof(mode_weight));
+	weight_total = 0;
+
+	for (tok = strtok_r(mix, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		colon = strchr(tok, ':');
+		if (colon)
+			*colon++ = '\0';
+
+		for (m = 0; m < 6; m++) {
+			if (!strcasecmp(tok, mode_names[m]))
+				break;
+		}
+		if (m == 6)
+			return -1;
+
+		mode_weight[m] = colon ? atoi(colon) : 1;
+		if (mode_weight[m] < 0)
+			return -1;
+		weight_total += mode_weight[m];
+	}
+
+	return weight_total ? 0 : -1;
+}
+
+static int pick_mode(struct thread_info *ti)
+{
+	int r = rand_r(&ti->seed) % weight_total;
+	int m;
+
+	for (m = 0; m < 5; m++) {
+		if (r < mode_weight[m])
+			break;
+		r -= mode_weight[m];
+	}
+	return m;
+}
+
+static uint64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void record(struct thread_info *ti, int op, uint64_t begin, int rv,
+		   struct dlm_lksb *lksb)
+{
+	ti->lat[op][ti->count[op]++] = now_nsec() - begin;
+
+	if (!rv && op == OP_UNLOCK && lksb->sb_status == EUNLOCK)
+		return;
+	if (!rv && !lksb->sb_status)
+		return;
+
+	if (op == OP_CONVERT && lksb->sb_status == EDEADLK)
+		ti->deadlocks++;
+	else
+		ti->errors[op]++;
+}
+
+/* bump the value for holders of PW and EX, as they write it back */
+
+static void update_lvb(struct thread_info *ti, int mode)
+{
+	uint32_t val;
+
+	if (!use_lvb || mode < LKM_PWMODE)
+		return;
+
+	memcpy(&val, ti->lvb, sizeof(val));
+	val++;
+	memcpy(ti->lvb, &val, sizeof(val));
+}
+
+static int do_lock(struct thread_info *ti, struct dlm_lksb *lksb, int mode,
+		   int res)
+{
+	char name[64];
+	uint64_t begin;
+	int rv;
+
+	snprintf(name, sizeof(name), "dlm_bench%d", res);
+	memset(lksb, 0, sizeof(*lksb));
+	lksb->sb_lvbptr = use_lvb ? ti->lvb : NULL;
+
+	begin = now_nsec();
+	rv = dlm_ls_lock_wait(ti->ls, mode, lksb,
+			      use_lvb ? LKF_VALBLK : 0,
+			      name, strlen(name), 0, NULL, NULL, NULL);
+	record(ti, OP_LOCK, begin, rv, lksb);
+
+	return (rv || lksb->sb_status) ? -1 : 0;
+}
+
+static void do_convert(struct thread_info *ti, struct dlm_lksb *lksb,
+		       int *held, int mode)
+{
+	uint64_t begin;
+	int rv;
+
+	update_lvb(ti, *held);
+
+	begin = now_nsec();
+	rv = dlm_ls_lock_wait(ti->ls, mode, lksb,
+			      LKF_CONVERT | (use_lvb ? LKF_VALBLK : 0),
+			      NULL, 0, 0, NULL, NULL, NULL);
+	record(ti, OP_CONVERT, begin, rv, lksb);
+
+	if (!rv && !lksb->sb_status)
+		*held = mode;
+}
+
+static void do_unlock(struct thread_info *ti, struct dlm_lksb *lksb, int held)
+{
+	uint64_t begin;
+	int rv;
+
+	update_lvb(ti, held);
+
+	begin = now_nsec();
+	rv = dlm_ls_unlock_wait(ti->ls, lksb->sb_lkid,
+				use_lvb ? LKF_VALBLK : 0, lksb);
+	record(ti, OP_UNLOCK, begin, rv, lksb);
+}
+
+static void *bench_thread(void *arg)
+{
+	struct thread_info *ti = arg;
+	struct dlm_lksb lksb;
+	int i, mode, held = -1;
+
+	pthread_barrier_wait(&start_barrier);
+
+	for (i = 0; i < ops; i++) {
+		int convert = (int)(rand_r(&ti->seed) % 100) < convert_pct;
+
+		if (pattern == PATTERN_HOLD && held >= 0 && convert) {
+			do_convert(ti, &lksb, &held, pick_mode(ti));
+			continue;
+		}
+
+		if (held >= 0) {
+			do_unlock(ti, &lksb, held);
+			held = -1;
+		}
+
+		mode = pick_mode(ti);
+		if (do_lock(ti, &lksb, mode, rand_r(&ti->seed) % resources))
+			continue;
+		held = mode;
+
+		/* in the lock pattern nothing is kept between operations */
+
+		if (pattern == PATTERN_LOCK) {
+			if (convert)
+				do_convert(ti, &lksb, &held, pick_mode(ti));
+			do_unlock(ti, &lksb, held);
+			held = -1;
+		}
+	}
+
+	if (held >= 0)
+		do_unlock(ti, &lksb, held);
+
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+struct op_stats {
+	int count;
+	int errors;
+	double p50, p99, p999, max;
+};
+
+static void op_stats(struct thread_info *ti, int op, struct op_stats *st)
+{
+	uint64_t *all;
+	int i, n = 0;
+
+	memset(st, 0, sizeof(*st));
+	for (i = 0; i < threads; i++) {
+		st->count += ti[i].count[op];
+		st->errors += ti[i].errors[op];
+	}
+	if (!st->count)
+		return;
+
+	all = malloc(st->count * sizeof(uint64_t));
+	if (!all)
+		return;
+	for (i = 0; i < threads; i++) {
+		memcpy(all + n, ti[i].lat[op], ti[i].count[op] * sizeof(uint64_t));
+		n += ti[i].count[op];
+	}
+
+	qsort(all, n, sizeof(uint64_t), cmp_u64);
+	st->p50 = all[n / 2] / 1000.0;
+	st->p99 = all[(uint64_t)n * 99 / 100] / 1000.0;
+	st->p999 = all[(uint64_t)n * 999 / 1000] / 1000.0;
+	st->max = all[n - 1] / 1000.0;
+	free(all);
+}
+
+static void report(struct thread_info *ti, double secs, int json, int fake)
+{
+	struct op_stats st[OP_COUNT];
+	int op, total = 0, errors = 0, deadlocks = 0, i;
+
+	for (op = 0; op < OP_COUNT; op++) {
+		op_stats(ti, op, &st[op]);
+		total += st[op].count;
+		errors += st[op].errors;
+	}
+	for (i = 0; i < threads; i++)
+		deadlocks += ti[i].deadlocks;
+
+	if (!json) {
+		printf("op,count,errors,deadlocks,ops_per_sec,"
+		       "p50_us,p99_us,p999_us,max_us\n");
+		for (op = 0; op < OP_COUNT; op++) {
+			printf("%s,%d,%d,%d,%.0f,%.2f,%.2f,%.2f,%.2f\n",
+			       op_names[op], st[op].count, st[op].errors,
+			       op == OP_CONVERT ? deadlocks : 0,
+			       secs > 0 ? st[op].count / secs : 0,
+			       st[op].p50, st[op].p99, st[op].p999,
+			       st[op].max);
+		}
+		printf("total,%d,%d,%d,%.0f,,,,\n", total, errors, deadlocks,
+		       secs > 0 ? total / secs : 0);
+		return;
+	}
+
+	printf("{\n");
+	printf("  \"config\": { \"lockspaces\": %d, \"threads\": %d, "
+	       "\"resources\": %d, \"ops_per_thread\": %d, "
+	       "\"pattern\": \"%s\", \"convert_pct\": %d, \"lvb\": %s, "
+	       "\"fake_device\": %s },\n",
+	       lockspaces, threads, resources, ops,
+	       pattern == PATTERN_LOCK ? "lock" : "hold", convert_pct,
+	       use_lvb ? "true" : "false", fake ? "true" : "false");
+	printf("  \"seconds\": %.6f,\n", secs);
+	printf("  \"ops_per_sec\": %.0f,\n", secs > 0 ? total / secs : 0);
+	printf("  \"errors\": %d,\n", errors);
+	printf("  \"deadlocks\": %d,\n", deadlocks);
+	printf("  \"ops\": {\n");
+	for (op = 0; op < OP_COUNT; op++) {
+		printf("    \"%s\": { \"count\": %d, \"errors\": %d, "
+		       "\"ops_per_sec\": %.0f, \"p50_us\": %.2f, "
+		       "\"p99_us\": %.2f, \"p999_us\": %.2f, "
+		       "\"max_us\": %.2f }%s\n",
+		       op_names[op], st[op].count, st[op].errors,
+		       secs > 0 ? st[op].count / secs : 0,
+		       st[op].p50, st[op].p99, st[op].p999, st[op].max,
+		       op < OP_COUNT - 1 ? "," : "");
+	}
+	printf("  }\n");
+	printf("}\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *prefix = "dlm_bench";
+	char default_mix[] = "PR:3,EX:1";
+	char *mix = default_mix;
+	char lsname[64];
+	dlm_lshandle_t ls[MAX_LOCKSPACES];
+	struct thread_info *ti;
+	uint64_t begin, end;
+	int json = 0, fake = 0;
+	int optchar, op, i, rv = 0;
+
+	while ((optchar = getopt(argc, argv, "l:L:t:r:n:m:c:p:Vo:fh")) != EOF) {
+		switch (optchar) {
+		case 'l':
+			prefix = optarg;
+			break;
+		case 'L':
+			lockspaces = atoi(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'r':
+			resources = atoi(optarg);
+			break;
+		case 'n':
+			ops = atoi(optarg);
+			break;
+		case 'm':
+			mix = optarg;
+			break;
+		case 'c':
+			convert_pct = atoi(optarg);
+			break;
+		case 'p':
+			if (!strcmp(optarg, "lock"))
+				pattern = PATTERN_LOCK;
+			else if (!strcmp(optarg, "hold"))
+				pattern = PATTERN_HOLD;
+			else {
+				usage(argv[0], stderr);
+				exit(1);
+			}
+			break;
+		case 'V':
+			use_lvb = 1;
+			break;
+		case 'o':
+			if (!strcmp(optarg, "json"))
+				json = 1;
+			else if (strcmp(optarg, "csv")) {
+				usage(argv[0], stderr);
+				exit(1);
+			}
+			break;
+		case 'f':
+			fake = 1;
+			break;
+		case 'h':
+			usage(argv[0], stdout);
+			exit(0);
+		default:
+			usage(argv[0], stderr);
+			exit(1);
+		}
+	}
+
+	if (convert_pct < 0)
+		convert_pct = pattern == PATTERN_LOCK ? 0 : 50;
+
+	if (lockspaces <= 0 || lockspaces > MAX_LOCKSPACES || threads <= 0 ||
+	    resources <= 0 || ops <= 0 || convert_pct > 100 ||
+	    parse_mix(mix)) {
+		usage(argv[0], stderr);
+		exit(1);
+	}
+
+	/* must be set before libdlm first looks for the device */
+	if (fake)
+		setenv("DLM_MOCK_DEVICE", "1", 1);
+	else
+		fake = getenv("DLM_MOCK_DEVICE") != NULL;
+
+	ti = calloc(threads, sizeof(struct thread_info));
+	if (!ti) {
+		perror("calloc");
+		return 1;
+	}
+
+	for (i = 0; i < lockspaces; i++) {
+		snprintf(lsname, sizeof(lsname), "%s%d", prefix, i);
+		ls[i] = dlm_create_lockspace(lsname, 0777);
+		if (!ls[i] || dlm_ls_pthread_init(ls[i])) {
+			perror(lsname);
+			lockspaces = i + (ls[i] != NULL);
+			rv = 1;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < threads; i++) {
+		ti[i].ls = ls[i % lockspaces];
+		ti[i].seed = i + 1;
+		for (op = 0; op < OP_COUNT; op++) {
+			/* a convert or an unlock can follow each lock, and
+			   one unlock can come at the end */
+			ti[i].lat[op] = malloc((ops + 1) * sizeof(uint64_t));
+			if (!ti[i].lat[op]) {
+				perror("malloc");
+				rv = 1;
+				goto out;
+			}
+		}
+	}
+
+	pthread_barrier_init(&start_barrier, NULL, threads + 1);
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&ti[i].thread, NULL, bench_thread, &ti[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	begin = now_nsec();
+
+	for (i = 0; i < threads; i++)
+		pthread_join(ti[i].thread, NULL);
+
+	end = now_nsec();
+
+	report(ti, (end - begin) / 1e9, json, fake);
+ out:
+	for (i = 0; i < lockspaces; i++) {
+		snprintf(lsname, sizeof(lsname), "%s%d", prefix, i);
+		dlm_release_lockspace(lsname, ls[i], 1);
+	}
+	for (i = 0; i < threads; i++) {
+		for (op = 0; op < OP_COUNT; op++)
+			free(ti[i].lat[op]);
+	}
+	free(ti);
+	return rv;
+}
@@ -19,6 +19,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <getopt.h>
+#include <sys/time.h>
 
 #include "libdlm.h"
 
@@ -26,18 +27,23 @@ static pthread_cond_t  cond;
 static pthread_mutex_t mutex;
 
 static int count = 0;
+static dlm_lshandle_t lockspace = NULL;
 
 static void usage(char *prog, FILE *file)
 {
     fprintf(file, "Usage:\n");
-    fprintf(file, "%s [mcnpquhV] <lockname>\n", prog);
+    fprintf(file, "%s [hVminlbcq]\n", prog);
     fprintf(file, "\n");
     fprintf(file, "   -V         Show version of %s\n", prog);
     fprintf(file, "   -h         Show this help information\n");
     fprintf(file, "   -m <num>   Maximum number of locks to hold (default 100000)\n");
     fprintf(file, "   -i <num>   Show progress in <n> increments (default 1000)\n");
     fprintf(file, "   -n <num>   Number of resources (default 10)\n");
-    fprintf(file, "   -q         Quit\n");
+    fprintf(file, "   -l <name>  Use this lockspace instead of the default one\n");
+    fprintf(file, "   -b <num>   Submit locks in batches of <n> with dlm_ls_lock_batch\n");
+    fprintf(file, "              (uses lockspace \"flood\" unless -l is given)\n");
+    fprintf(file, "   -c <num>   Stop after <n> lock operations and show the rate\n");
+    fprintf(file, "   -q         Don't show progress\n");
 
 
     fprintf(file, "\n");
@@ -49,7 +55,10 @@ static void ast_routine(void *arg)
     struct dlm_lksb *lksb = arg;
 
     if (lksb->sb_status == 0) {
-	dlm_unlock(lksb->sb_lkid, 0, lksb, lksb);
+	if (lockspace)
+	    dlm_ls_unlock(lockspace, lksb->sb_lkid, 0, lksb, lksb);
+	else
+	    dlm_unlock(lksb->sb_lkid, 0, lksb, lksb);
 	return;
     }
 
@@ -58,6 +67,49 @@ static void ast_routine(void *arg)
     }
 }
 
+static double elapsed(struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) +
+	   (now.tv_usec - start->tv_usec) * 1.e-6;
+}
+
+/* Submit the next num locks in one dlm_ls_lock_batch call */
+static int lock_batch(struct dlm_lock_request *reqs, int num,
+		      struct dlm_lksb *lksbs, int *lksbnum, int maxlocks,
+		      char **resources, int rescount, int mode, int flags)
+{
+    int i, done;
+
+    for (i = 0; i < num; i++) {
+	char *resource = resources[rand() % rescount];
+
+	reqs[i].mode = mode;
+	reqs[i].flags = flags;
+	reqs[i].name = resource;
+	reqs[i].namelen = strlen(resource);
+	reqs[i].lksb = &lksbs[*lksbnum];
+	reqs[i].astaddr = ast_routine;
+	reqs[i].astarg = &lksbs[*lksbnum];
+	reqs[i].bastaddr = NULL;
+	*lksbnum = (*lksbnum + 1) % maxlocks;
+    }
+
+    done = dlm_ls_lock_batch(lockspace, reqs, num);
+    if (done < 0)
+	return -1;
+
+    for (i = 0; i < num; i++) {
+	if (reqs[i].status) {
+	    errno = reqs[i].status;
+	    return -1;
+	}
+    }
+    return done;
+}
+
 int main(int argc, char *argv[])
 {
     int  flags = 0;
@@ -70,14 +122,20 @@ int main(int argc, char *argv[])
     int  i;
     int  mode = LKM_CRMODE;
     int  lksbnum = 0;
+    int  batch = 0;
+    int  total = 0;
+    char *lsname = NULL;
     signed char opt;
     char **resources;
     struct dlm_lksb *lksbs;
+    struct dlm_lock_request *reqs = NULL;
+    struct timeval start;
+    double secs;
 
     /* Deal with command-line arguments */
     opterr = 0;
     optind = 0;
-    while ((opt=getopt(argc,argv,"?m:i:qn:vV")) != EOF)
+    while ((opt=getopt(argc,argv,"?hm:i:qn:l:b:c:V")) != EOF)
     {
 	switch(opt)
 	{
@@ -101,12 +159,24 @@ int main(int argc, char *argv[])
 	    rescount = atoi(optarg);
 	    break;
 
+	case 'l':
+	    lsname = optarg;
+	    break;
+
+	case 'b':
+	    batch = atoi(optarg);
+	    break;
+
+	case 'c':
+	    total = atoi(optarg);
+	    break;
+
 	case 'q':
 	    quiet = 1;
 	    break;
 
 	case 'V':
-	    printf("\nflood version 0.3\n\n");
+	    printf("\nflood version 0.4\n\n");
 	    exit(1);
 	    break;
 	}
@@ -134,37 +204,98 @@ int main(int argc, char *argv[])
     pthread_mutex_init(&mutex, NULL);
     pthread_mutex_lock(&mutex);
 
-    dlm_pthread_init();
+    if (batch > 0 && !lsname)
+	    lsname = "flood";
 
-    while (1) {
+    if (batch > 0)
+    {
+	    reqs = malloc(sizeof(struct dlm_lock_request) * batch);
+	    if (!reqs)
+	    {
+		    perror("cannot allocate batch");
+		    return 1;
+	    }
+    }
+
+    if (lsname)
+    {
+	    lockspace = dlm_create_lockspace(lsname, 0777);
+	    if (!lockspace)
+	    {
+		    perror("dlm_create_lockspace");
+		    return 1;
+	    }
+	    dlm_ls_pthread_init(lockspace);
+    }
+    else
+	    dlm_pthread_init();
+
+    gettimeofday(&start, NULL);
+
+    while (!total || lockops < total) {
 	    char *resource = resources[rand() % rescount];
+	    int prev = lockops;
 
-	    status = dlm_lock(mode,
-			      &lksbs[lksbnum],
-			      flags,
-			      resource,
-			      strlen(resource),
-			      0, // Parent,
-			      ast_routine,
-			      &lksbs[lksbnum],
-			      NULL, // bast_routine,
-			      NULL); // Range
+	    if (batch > 0)
+		    status = lock_batch(reqs, batch, lksbs, &lksbnum,
+					maxlocks, resources, rescount,
+					mode, flags);
+	    else if (lockspace)
+		    status = dlm_ls_lock(lockspace,
+					 mode,
+					 &lksbs[lksbnum],
+					 flags,
+					 resource,
+					 strlen(resource),
+					 0, // Parent,
+					 ast_routine,
+					 &lksbs[lksbnum],
+					 NULL, // bast_routine,
+					 NULL); // Range
+	    else
+		    status = dlm_lock(mode,
+				      &lksbs[lksbnum],
+				      flags,
+				      resource,
+				      strlen(resource),
+				      0, // Parent,
+				      ast_routine,
+				      &lksbs[lksbnum],
+				      NULL, // bast_routine,
+				      NULL); // Range
 	    if (status == -1)
 	    {
 		    perror("lock failed");
 		    return -1;
 	    }
 
-	    count++;
-	    lockops++;
-	    if ((lockops % increment) == 0 && !quiet)
-		    fprintf(stderr, "%d lockops, %d locks\n", lockops, count);
+	    if (batch > 0) {
+		    count += status;
+		    lockops += status;
+	    } else {
+		    count++;
+		    lockops++;
+		    lksbnum = (lksbnum+1)%maxlocks;
+	    }
+
+	    if (lockops / increment != prev / increment && !quiet)
+		    fprintf(stderr, "%d lockops, %d locks, %.0f lockops/sec\n",
+			    lockops, count, lockops / elapsed(&start));
 
 	    while (count > maxlocks) {
 		    sleep(1);
 	    }
-	    lksbnum = (lksbnum+1)%maxlocks;
     }
 
+    /* wait for the last unlocks */
+    while (count > 0)
+	    usleep(1000);
+
+    secs = elapsed(&start);
+    printf("%d lockops in %.3f seconds, %.0f lockops/sec, batch %d\n",
+	   lockops, secs, secs > 0 ? lockops / secs : 0, batch);
+
+    if (lockspace)
+	    dlm_release_lockspace(lsname, lockspace, 1);
     return 0;
 }
@@ -0,0 +1,207 @@
+/*
+ * Check the lock manager behind DLM_MOCK_DEVICE: blocking ASTs, queued
+ * grants, LVB reads and writes, NOQUEUE, cancel, conversion deadlock,
+ * and the release of a closed handle's locks.  It runs without the
+ * kernel dlm, and exits non-zero if anything is not as expected.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "libdlm.h"
+
+struct lock {
+	const char *tag;
+	struct dlm_lksb lksb;
+	char lvb[DLM_LVB_LEN];
+	int casts;
+	int basts;
+	int bast_mode;
+};
+
+static dlm_lshandle_t ls;
+static int failures;
+
+static void ast_routine(void *arg)
+{
+	struct lock *lk = arg;
+
+	lk->casts++;
+}
+
+static void bast_routine(void *arg)
+{
+	struct lock *lk = arg;
+
+	lk->basts++;
+}
+
+static void check(int ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "pass" : "FAIL", what);
+	if (!ok)
+		failures++;
+}
+
+/* deliver everything that is waiting */
+
+static void dispatch(dlm_lshandle_t h)
+{
+	dlm_ls_dispatch_batch(h, 0);
+}
+
+static int lock(dlm_lshandle_t h, struct lock *lk, int mode, int flags,
+		const char *name)
+{
+	lk->lksb.sb_lvbptr = lk->lvb;
+	lk->casts = 0;
+
+	return dlm_ls_lock(h, mode, &lk->lksb, flags, name,
+			   name ? strlen(name) : 0, 0, ast_routine, lk,
+			   bast_routine, NULL);
+}
+
+static int convert(dlm_lshandle_t h, struct lock *lk, int mode, int flags)
+{
+	return lock(h, lk, mode, flags | LKF_CONVERT, NULL);
+}
+
+static int unlock(dlm_lshandle_t h, struct lock *lk, int flags)
+{
+	lk->casts = 0;
+	return dlm_ls_unlock(h, lk->lksb.sb_lkid, flags, &lk->lksb, lk);
+}
+
+static void test_bast_and_lvb(void)
+{
+	struct lock a = { "a" }, b = { "b" };
+
+	lock(ls, &a, LKM_EXMODE, LKF_VALBLK, "res1");
+	dispatch(ls);
+	check(a.casts == 1 && a.lksb.sb_status == 0, "EX granted");
+
+	lock(ls, &b, LKM_PRMODE, LKF_VALBLK, "res1");
+	dispatch(ls);
+	check(b.casts == 0, "PR waits behind EX");
+	check(a.basts == 1, "EX holder gets a blocking AST");
+
+	/* a second waiter for the same mode sends no more */
+	strcpy(a.lvb, "written by a");
+	convert(ls, &a, LKM_NLMODE, LKF_VALBLK);
+	dispatch(ls);
+	check(a.casts == 1 && a.lksb.sb_status == 0, "EX converted to NL");
+	check(b.casts == 1 && b.lksb.sb_status == 0, "PR granted after EX goes");
+	check(!strcmp(b.lvb, "written by a"), "PR reads LVB written by EX");
+
+	unlock(ls, &a, 0);
+	unlock(ls, &b, 0);
+	dispatch(ls);
+	check(a.lksb.sb_status == EUNLOCK && b.lksb.sb_status == EUNLOCK,
+	      "both unlocked");
+}
+
+static void test_noqueue_and_cancel(void)
+{
+	struct lock a = { "a" }, b = { "b" }, c = { "c" };
+
+	lock(ls, &a, LKM_PWMODE, 0, "res2");
+	dispatch(ls);
+
+	lock(ls, &b, LKM_PRMODE, LKF_NOQUEUE, "res2");
+	dispatch(ls);
+	check(b.casts == 1 && b.lksb.sb_status == EAGAIN,
+	      "NOQUEUE request fails with EAGAIN");
+	check(a.basts == 0, "NOQUEUE request sends no blocking AST");
+
+	lock(ls, &c, LKM_EXMODE, 0, "res2");
+	dispatch(ls);
+	check(c.casts == 0, "EX waits behind PW");
+
+	unlock(ls, &c, LKF_CANCEL);
+	dispatch(ls);
+	check(c.casts == 1 && c.lksb.sb_status == ECANCEL,
+	      "cancelled request completes with ECANCEL");
+
+	unlock(ls, &a, 0);
+	dispatch(ls);
+}
+
+static void test_conversion_deadlock(void)
+{
+	struct lock a = { "a" }, b = { "b" };
+
+	lock(ls, &a, LKM_PRMODE, 0, "res3");
+	lock(ls, &b, LKM_PRMODE, 0, "res3");
+	dispatch(ls);
+
+	convert(ls, &a, LKM_EXMODE, 0);
+	dispatch(ls);
+	check(a.casts == 0, "PR to EX waits for the other PR");
+
+	convert(ls, &b, LKM_EXMODE, 0);
+	dispatch(ls);
+	check(b.casts == 1 && b.lksb.sb_status == EDEADLK,
+	      "second PR to EX gets EDEADLK");
+
+	unlock(ls, &b, 0);
+	dispatch(ls);
+	check(a.casts == 1 && a.lksb.sb_status == 0,
+	      "first conversion granted once the other unlocks");
+
+	unlock(ls, &a, 0);
+	dispatch(ls);
+}
+
+static void test_close_releases(void)
+{
+	struct lock a = { "a" }, b = { "b" };
+	dlm_lshandle_t other;
+
+	other = dlm_open_lockspace("mocklock");
+	if (!other) {
+		check(0, "open a second handle");
+		return;
+	}
+
+	lock(other, &a, LKM_EXMODE, 0, "res4");
+	dispatch(other);
+	check(a.casts == 1, "EX granted on the second handle");
+
+	lock(ls, &b, LKM_EXMODE, 0, "res4");
+	dispatch(ls);
+	check(b.casts == 0, "EX waits for the other handle");
+
+	dlm_close_lockspace(other);
+	dispatch(ls);
+	check(b.casts == 1 && b.lksb.sb_status == 0,
+	      "closing a handle releases its locks");
+
+	unlock(ls, &b, 0);
+	dispatch(ls);
+}
+
+int main(int argc, char *argv[])
+{
+	setenv("DLM_MOCK_DEVICE", "1", 1);
+
+	ls = dlm_create_lockspace("mocklock", 0600);
+	if (!ls) {
+		perror("dlm_create_lockspace");
+		return 1;
+	}
+
+	test_bast_and_lvb();
+	test_noqueue_and_cancel();
+	test_conversion_deadlock();
+	test_close_releases();
+
+	dlm_release_lockspace("mocklock", ls, 1);
+
+	printf("%d failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * Latency of synchronous lock/unlock pairs:
+ *
+ * cond - dlm_ls_lock/dlm_ls_unlock with an AST that signals a condvar set
+ *        up for each call, the way the synchronous calls used to work
+ * wait - dlm_ls_lock_wait/dlm_ls_unlock_wait, woken by the lockspace thread
+ * read - dlm_ls_lock_wait/dlm_ls_unlock_wait with dlm_ls_sync_read, reading
+ *        the results in the calling thread
+ */
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "libdlm.h"
+
+struct lock_wait {
+	pthread_cond_t cond;
+	pthread_mutex_t mutex;
+	struct dlm_lksb lksb;
+};
+
+static dlm_lshandle_t ls;
+
+static void usage(char *prog, FILE *file)
+{
+	fprintf(file, "Usage:\n");
+	fprintf(file, "%s [lnmh]\n", prog);
+	fprintf(file, "\n");
+	fprintf(file, "   -h           show this help information\n");
+	fprintf(file, "   -l <name>    lockspace name (default synclat)\n");
+	fprintf(file, "   -n <num>     number of lock/unlock pairs (default 10000)\n");
+	fprintf(file, "   -m <how>     cond, wait or read (default all three)\n");
+	fprintf(file, "\n");
+}
+
+static void sync_ast_routine(void *arg)
+{
+	struct lock_wait *lwait = arg;
+
+	pthread_mutex_lock(&lwait->mutex);
+	pthread_cond_signal(&lwait->cond);
+	pthread_mutex_unlock(&lwait->mutex);
+}
+
+static int cond_lock(const char *name, struct dlm_lksb *lksb)
+{
+	struct lock_wait lwait;
+	int status;
+
+	pthread_cond_init(&lwait.cond, NULL);
+	pthread_mutex_init(&lwait.mutex, NULL);
+	pthread_mutex_lock(&lwait.mutex);
+
+	status = dlm_ls_lock(ls, LKM_EXMODE, &lwait.lksb, 0, name,
+			     strlen(name), 0, sync_ast_routine, &lwait,
+			     NULL, NULL);
+	if (!status)
+		pthread_cond_wait(&lwait.cond, &lwait.mutex);
+	pthread_mutex_unlock(&lwait.mutex);
+
+	*lksb = lwait.lksb;
+	return status;
+}
+
+static int cond_unlock(struct dlm_lksb *lksb)
+{
+	struct lock_wait lwait;
+	int status;
+
+	pthread_cond_init(&lwait.cond, NULL);
+	pthread_mutex_init(&lwait.mutex, NULL);
+	pthread_mutex_lock(&lwait.mutex);
+
+	status = dlm_ls_unlock(ls, lksb->sb_lkid, 0, &lwait.lksb, &lwait);
+	if (!status)
+		pthread_cond_wait(&lwait.cond, &lwait.mutex);
+	pthread_mutex_unlock(&lwait.mutex);
+
+	*lksb = lwait.lksb;
+	return status;
+}
+
+static uint64_t now_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int run(const char *how, int count, uint64_t *lat)
+{
+	struct dlm_lksb lksb;
+	uint64_t begin;
+	int i, rv;
+
+	for (i = 0; i < count; i++) {
+		memset(&lksb, 0, sizeof(lksb));
+		begin = now_usec();
+
+		if (!strcmp(how, "cond")) {
+			rv = cond_lock("synclat", &lksb);
+			if (!rv && !lksb.sb_status)
+				rv = cond_unlock(&lksb);
+		} else {
+			rv = dlm_ls_lock_wait(ls, LKM_EXMODE, &lksb, 0,
+					      "synclat", 7, 0, NULL, NULL,
+					      NULL);
+			if (!rv && !lksb.sb_status)
+				rv = dlm_ls_unlock_wait(ls, lksb.sb_lkid, 0,
+							&lksb);
+		}
+
+		lat[i] = now_usec() - begin;
+
+		if (rv || (lksb.sb_status && lksb.sb_status != EUNLOCK)) {
+			fprintf(stderr, "%s: lock %d failed: %d %d\n", how, i,
+				rv, lksb.sb_status);
+			return -1;
+		}
+	}
+
+	qsort(lat, count, sizeof(uint64_t), cmp_u64);
+	printf("%-4s %8d %8llu %8llu %8llu %8llu %8llu\n", how, count,
+	       (unsigned long long)lat[0],
+	       (unsigned long long)lat[count / 2],
+	       (unsigned long long)lat[count * 99 / 100],
+	       (unsigned long long)lat[count * 999 / 1000],
+	       (unsigned long long)lat[count - 1]);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *lsname = "synclat";
+	const char *hows[] = { "cond", "wait", "read" };
+	const char *only = NULL;
+	uint64_t *lat;
+	int count = 10000;
+	int optchar, i, rv = 0;
+
+	while ((optchar = getopt(argc, argv, "l:n:m:h")) != EOF) {
+		switch (optchar) {
+		case 'l':
+			lsname = optarg;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'm':
+			only = optarg;
+			break;
+		case 'h':
+			usage(argv[0], stdout);
+			exit(0);
+		default:
+			usage(argv[0], stderr);
+			exit(1);
+		}
+	}
+
+	if (count <= 0) {
+		usage(argv[0], stderr);
+		exit(1);
+	}
+
+	lat = malloc(count * sizeof(uint64_t));
+	if (!lat) {
+		perror("malloc");
+		return 1;
+	}
+
+	printf("how     pairs  min(us)  p50(us)  p99(us) p999(us)  max(us)\n");
+
+	for (i = 0; i < 3; i++) {
+		if (only && strcmp(only, hows[i]))
+			continue;
+
+		/* a lockspace handle per run, since sync_read and the
+		   lockspace thread exclude each other */
+		ls = dlm_create_lockspace(lsname, 0777);
+		if (!ls) {
+			perror("dlm_create_lockspace");
+			return 1;
+		}
+
+		if (!strcmp(hows[i], "read"))
+			rv = dlm_ls_sync_read(ls, 1);
+		else
+			rv = dlm_ls_pthread_init(ls);
+		if (rv) {
+			perror(hows[i]);
+			break;
+		}
+
+		rv = run(hows[i], count, lat);
+
+		dlm_release_lockspace(lsname, ls, 1);
+		if (rv)
+			break;
+	}
+
+	free(lat);
+	return rv ? 1 : 0;
+}
@@ -15,6 +15,7 @@
 #include <linux/dlmconstants.h>
 #include "libdlm.h"
 #include "libdlmcontrol.h"
+#include "lockdump.h"
 #include "copyright.cf"
 
 #define LKM_IVMODE -1
@@ -511,11 +512,6 @@ static void print_rsb(char *line, struct rinfo *ri)
 	ri->nodeid = nodeid;
 
 	ri->namelen = namelen;
-	
-	p = strchr(line, '\n');
-	if (!p)
-		goto fail;
-	*p = '\0';
 
 	p = strstr(line, namefmt);
 	if (!p)
@@ -653,26 +649,33 @@ static void print_lkb(char *line, struct rinfo *ri)
 {
 	struct lkb lkb;
 	char type[4];
-	int rv;
-
-	rv = sscanf(line, "%s %x %d %x %u %"PRIu64" %x %x %d %d %d %d %d %d %u %"PRIu64" %"PRIu64,
-		    type,
-		    &lkb.id,
-		    &lkb.nodeid,
-		    &lkb.remid,
-		    &lkb.ownpid,
-		    &lkb.xid,
-		    &lkb.exflags,
-		    &lkb.flags,
-		    &lkb.status,
-		    &lkb.grmode,
-		    &lkb.rqmode,
-		    &lkb.highbast,
-		    &lkb.rsb_lookup,
-		    &lkb.wait_type,
-		    &lkb.lvbseq,
-		    &lkb.timestamp,
-		    &lkb.time_bast);
+	char *p = line;
+
+	memset(&lkb, 0, sizeof(lkb));
+
+	/* type id nodeid remid ownpid xid exflags flags status grmode rqmode
+	   highbast rsb_lookup wait_type lvbseq timestamp time_bast */
+
+	if (!lockdump_word(&p, type, sizeof(type)) ||
+	    !lockdump_hex(&p, &lkb.id) ||
+	    !lockdump_int(&p, &lkb.nodeid) ||
+	    !lockdump_hex(&p, &lkb.remid) ||
+	    !lockdump_int(&p, &lkb.ownpid) ||
+	    !lockdump_u64(&p, &lkb.xid) ||
+	    !lockdump_hex(&p, &lkb.exflags) ||
+	    !lockdump_hex(&p, &lkb.flags) ||
+	    !lockdump_int(&p, &lkb.status) ||
+	    !lockdump_int(&p, &lkb.grmode) ||
+	    !lockdump_int(&p, &lkb.rqmode) ||
+	    !lockdump_int(&p, &lkb.highbast) ||
+	    !lockdump_int(&p, &lkb.rsb_lookup) ||
+	    !lockdump_int(&p, &lkb.wait_type) ||
+	    !lockdump_uint(&p, &lkb.lvbseq) ||
+	    !lockdump_u64(&p, &lkb.timestamp) ||
+	    !lockdump_u64(&p, &lkb.time_bast)) {
+		fprintf(stderr, "print_lkb error line \"%s\"\n", line);
+		return;
+	}
 
 	ri->lkb_count++;
 
@@ -785,80 +788,62 @@ static void print_summary(struct summary *s)
 	printf("  expect reply  %u\n", s->expect_replies);
 }
 
-#define LOCK_LINE_MAX 1024
-
 static void do_waiters(char *name, struct summary *sum)
 {
-	FILE *file;
+	struct lockdump ld;
 	char path[PATH_MAX];
-	char line[LOCK_LINE_MAX];
-	char rname[65];
+	char *line, *p;
 	int header = 0;
-	int i, j, spaces;
-	int rv, nodeid, wait_type;
+	int nodeid, wait_type;
 	uint32_t id;
 
 	snprintf(path, PATH_MAX, "/sys/kernel/debug/dlm/%s_waiters", name);
 
-	file = fopen(path, "r");
-	if (!file)
+	if (lockdump_open(&ld, path) < 0)
 		return;
 
-	while (fgets(line, LOCK_LINE_MAX, file)) {
+	while ((line = lockdump_line(&ld))) {
 		if (!header) {
 			printf("\n");
 			printf("Expecting reply\n");
 			header = 1;
 		}
 
-		rv = sscanf(line, "%x %d %d",
-			    &id, &wait_type, &nodeid);
+		p = line;
 
-		if (rv != 3) {
-			printf("waiters: %s", line);
+		if (!lockdump_hex(&p, &id) ||
+		    !lockdump_int(&p, &wait_type) ||
+		    !lockdump_int(&p, &nodeid)) {
+			printf("waiters: %s\n", line);
 			continue;
 		}
 
-		/* parse the resource name from the remainder of the line */
-		j = 0;
-		spaces = 0;
-
-		for (i = 0; i < LOCK_LINE_MAX; i++) {
-			if (line[i] == '\n')
-				break;
-			if (spaces == 3) {
-				rname[j++] = line[i];
-				if (j == (sizeof(rname) - 1))
-					break;
-			} else if (line[i] == ' ') {
-				spaces++;
-			}
-		}
+		/* the resource name is the remainder of the line */
+		if (*p == ' ')
+			p++;
 
-		printf("nodeid %2d msg %s lkid %08x resource \"%s\"\n",
-		       nodeid, msg_str(wait_type), id, rname);
+		printf("nodeid %2d msg %s lkid %08x resource \"%.64s\"\n",
+		       nodeid, msg_str(wait_type), id, p);
 
 		sum->expect_replies++;
 	}
-	fclose(file);
+	lockdump_close(&ld);
 }
 
 static void do_lockdebug(char *name)
 {
 	struct summary summary;
 	struct rinfo info;
-	FILE *file;
+	struct lockdump ld;
 	char path[PATH_MAX];
-	char line[LOCK_LINE_MAX];
+	char *line;
 	int old = 0;
 
 	snprintf(path, PATH_MAX, "/sys/kernel/debug/dlm/%s_all", name);
 
-	file = fopen(path, "r");
-	if (!file) {
+	if (lockdump_open(&ld, path) < 0) {
 		snprintf(path, PATH_MAX, "/sys/kernel/debug/dlm/%s", name);
-		file = fopen(path, "r");
-		if (!file) {
+		if (lockdump_open(&ld, path) < 0) {
 			fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
 			return;
 		}
@@ -868,7 +853,7 @@ static void do_lockdebug(char *name)
 	memset(&summary, 0, sizeof(struct summary));
 	memset(&info, 0, sizeof(struct rinfo));
 
-	while (fgets(line, LOCK_LINE_MAX, file)) {
+	while ((line = lockdump_line(&ld))) {
 
 		if (old)
 			goto raw;
@@ -895,9 +880,9 @@ static void do_lockdebug(char *name)
 			continue;
 		}
  raw:
-		printf("%s", line);
+		printf("%s\n", line);
 	}
-	fclose(file);
+	lockdump_close(&ld);
 
 	do_waiters(name, &summary);
 
@@ -907,89 +892,44 @@ static void do_lockdebug(char *name)
 	}
 }
 
-static void parse_r_name(char *line, char *name)
-{
-	char *p;
-	int i = 0;
-	int begin = 0;
-
-	for (p = line; ; p++) {
-		if (*p == '"') {
-			if (begin)
-				break;
-			begin = 1;
-			continue;
-		}
-		if (begin)
-			name[i++] = *p;
-	}
-}
-
 static void do_lockdump(char *name)
 {
-	FILE *file;
+	struct lockdump ld;
+	struct lockdump_lock lk;
 	char path[PATH_MAX];
-	char line[LOCK_LINE_MAX];
+	char *line;
 	char r_name[65];
-	int r_nodeid;
-	int r_len;
 	int rv;
-	unsigned int time;
-	unsigned long long xid;
-	uint32_t	id;
-	int		nodeid;
-	uint32_t	remid;
-	int		ownpid;
-	uint32_t	exflags;
-	uint32_t	flags;
-	int8_t		status;
-	int8_t		grmode;
-	int8_t		rqmode;
 
 	snprintf(path, PATH_MAX, "/sys/kernel/debug/dlm/%s_locks", name);
 
-	file = fopen(path, "r");
-	if (!file) {
+	if (lockdump_open(&ld, path) < 0) {
 		fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
 		return;
 	}
 
 	/* skip the header on the first line */
-	if (!fgets(line, LOCK_LINE_MAX, file))
-		return;
+	if (!lockdump_line(&ld))
+		goto out;
+
+	while ((line = lockdump_line(&ld))) {
+		rv = lockdump_parse_lock(line, &lk);
 
-	while (fgets(line, LOCK_LINE_MAX, file)) {
-		rv = sscanf(line, "%x %d %x %u %llu %x %x %hhd %hhd %hhd %u %d %d",
-		       &id,
-		       &nodeid,
-		       &remid,
-		       &ownpid,
-		       &xid,
-		       &exflags,
-		       &flags,
-		       &status,
-		       &grmode,
-		       &rqmode,
-		       &time,
-		       &r_nodeid,
-		       &r_len);
-
-		if (rv != 13) {
+		if (rv != LOCKDUMP_LOCK_FIELDS) {
 			fprintf(stderr, "invalid debugfs line %d: %s\n",
 				rv, line);
-			return;
+			goto out;
 		}
 
-		memset(r_name, 0, sizeof(r_name));
-		parse_r_name(line, r_name);
+		lockdump_name(&lk, r_name, sizeof(r_name));
 
 		/* don't print MSTCPY locks without -M */
-		if (!r_nodeid && nodeid) {
+		if (!lk.r_nodeid && lk.nodeid) {
 			if (!dump_mstcpy)
 				continue;
 			printf("id %08x gr %s rq %s pid %u MSTCPY %d \"%s\"\n",
-				id, mode_str(grmode), mode_str(rqmode),
-				ownpid, nodeid, r_name);
+				lk.id, mode_str(lk.grmode), mode_str(lk.rqmode),
+				lk.ownpid, lk.nodeid, r_name);
 			continue;
 		}
 
@@ -999,15 +939,15 @@ static void do_lockdump(char *name)
 		   IV.  (does it make sense to include status in the output,
 		   e.g. G,C,W?) */
 
-		if (status == DLM_LKSTS_GRANTED)
-			rqmode = LKM_IVMODE;
+		if (lk.status == DLM_LKSTS_GRANTED)
+			lk.rqmode = LKM_IVMODE;
 
 		printf("id %08x gr %s rq %s pid %u master %d \"%s\"\n",
-			id, mode_str(grmode), mode_str(rqmode),
-			ownpid, nodeid, r_name);
+			lk.id, mode_str(lk.grmode), mode_str(lk.rqmode),
+			lk.ownpid, lk.nodeid, r_name);
 	}
-
-	fclose(file);
+ out:
+	lockdump_close(&ld);
 }
 
 static char *dlmc_lf_str(uint32_t flags)
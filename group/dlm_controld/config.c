@@ -215,9 +215,12 @@ static void read_ccs_protocol(const char *path, int *config_val)
 #define ENABLE_FENCING_PATH "/cluster/dlm/@enable_fencing"
 #define ENABLE_QUORUM_PATH "/cluster/dlm/@enable_quorum"
 #define ENABLE_DEADLK_PATH "/cluster/dlm/@enable_deadlk"
+#define DEADLK_CKPT_CHUNK_PATH "/cluster/dlm/@deadlk_ckpt_chunk"
 #define ENABLE_PLOCK_PATH "/cluster/dlm/@enable_plock"
 #define PLOCK_DEBUG_PATH "/cluster/dlm/@plock_debug"
 #define PLOCK_RATE_LIMIT_PATH "/cluster/dlm/@plock_rate_limit"
+#define PLOCK_BATCH_PATH "/cluster/dlm/@plock_batch"
+#define PLOCK_THREADS_PATH "/cluster/dlm/@plock_threads"
 #define PLOCK_OWNERSHIP_PATH "/cluster/dlm/@plock_ownership"
 #define DROP_RESOURCES_TIME_PATH "/cluster/dlm/@drop_resources_time"
 #define DROP_RESOURCES_COUNT_PATH "/cluster/dlm/@drop_resources_count"
@@ -264,6 +267,8 @@ int setup_ccs(void)
 		read_ccs_int(ENABLE_DEADLK_PATH, &cfgd_enable_deadlk);
 	if (!optd_enable_plock)
 		read_ccs_int(ENABLE_PLOCK_PATH, &cfgd_enable_plock);
+	if (!optd_plock_threads)
+		read_ccs_int(PLOCK_THREADS_PATH, &cfgd_plock_threads);
 	if (!optd_plock_ownership) {
 		rv = read_ccs_int(PLOCK_OWNERSHIP_PATH, &cfgd_plock_ownership);
 		if (rv < 0)
@@ -280,6 +285,12 @@ int setup_ccs(void)
 		if (rv < 0)
 			read_ccs_int(GFS_PLOCK_RATE_LIMIT_PATH, &cfgd_plock_rate_limit);
 	}
+	if (!optd_plock_batch) {
+		read_ccs_int(PLOCK_BATCH_PATH, &cfgd_plock_batch);
+	}
+	if (!optd_deadlk_ckpt_chunk) {
+		read_ccs_int(DEADLK_CKPT_CHUNK_PATH, &cfgd_deadlk_ckpt_chunk);
+	}
 	if (!optd_drop_resources_time) {
 		rv = read_ccs_int(DROP_RESOURCES_TIME_PATH, &cfgd_drop_resources_time);
 		if (rv < 0)
@@ -9,9 +9,12 @@
 #define DEFAULT_ENABLE_FENCING 1
 #define DEFAULT_ENABLE_QUORUM 0
 #define DEFAULT_ENABLE_DEADLK 0
+#define DEFAULT_DEADLK_CKPT_CHUNK (64 * 1024)
 #define DEFAULT_ENABLE_PLOCK 1
 #define DEFAULT_PLOCK_DEBUG 0
 #define DEFAULT_PLOCK_RATE_LIMIT 0
+#define DEFAULT_PLOCK_BATCH 64
+#define DEFAULT_PLOCK_THREADS 1
 #define DEFAULT_PLOCK_OWNERSHIP 1
 #define DEFAULT_DROP_RESOURCES_TIME 10000 /* 10 sec */
 #define DEFAULT_DROP_RESOURCES_COUNT 10
@@ -25,9 +28,12 @@ extern int optd_debug_logfile;
 extern int optd_enable_fencing;
 extern int optd_enable_quorum;
 extern int optd_enable_deadlk;
+extern int optd_deadlk_ckpt_chunk;
 extern int optd_enable_plock;
 extern int optd_plock_debug;
 extern int optd_plock_rate_limit;
+extern int optd_plock_batch;
+extern int optd_plock_threads;
 extern int optd_plock_ownership;
 extern int optd_drop_resources_time;
 extern int optd_drop_resources_count;
@@ -41,9 +47,12 @@ extern int cfgd_debug_logfile;
 extern int cfgd_enable_fencing;
 extern int cfgd_enable_quorum;
 extern int cfgd_enable_deadlk;
+extern int cfgd_deadlk_ckpt_chunk;
 extern int cfgd_enable_plock;
 extern int cfgd_plock_debug;
 extern int cfgd_plock_rate_limit;
+extern int cfgd_plock_batch;
+extern int cfgd_plock_threads;
 extern int cfgd_plock_ownership;
 extern int cfgd_drop_resources_time;
 extern int cfgd_drop_resources_count;
@@ -210,11 +210,49 @@ const char *msg_name(int type)
 		return "deadlk_checkpoint_ready";
 	case DLM_MSG_DEADLK_CANCEL_LOCK:
 		return "deadlk_cancel_lock";
+	case DLM_MSG_PLOCK_BATCH:
+		return "plock_batch";
 	default:
 		return "unknown";
 	}
 }
 
+/* nodes running daemon protocol 1.2 or later accept multiple plock ops in
+   one DLM_MSG_PLOCK_BATCH message */
+
+int plock_batch_supported(void)
+{
+	if (our_protocol.daemon_run[0] > 1)
+		return 1;
+	if (our_protocol.daemon_run[0] == 1 && our_protocol.daemon_run[1] >= 2)
+		return 1;
+	return 0;
+}
+
+/* nodes running daemon protocol 1.3 or later can read the bulk plock
+   checkpoint format */
+
+int plock_ckpt_bulk_supported(void)
+{
+	if (our_protocol.daemon_run[0] > 1)
+		return 1;
+	if (our_protocol.daemon_run[0] == 1 && our_protocol.daemon_run[1] >= 3)
+		return 1;
+	return 0;
+}
+
+/* nodes running daemon protocol 1.4 or later can read the deadlock
+   checkpoint stream format */
+
+int deadlk_ckpt_stream_supported(void)
+{
+	if (our_protocol.daemon_run[0] > 1)
+		return 1;
+	if (our_protocol.daemon_run[0] == 1 && our_protocol.daemon_run[1] >= 4)
+		return 1;
+	return 0;
+}
+
 static int _send_message(cpg_handle_t h, void *buf, int len, int type)
 {
 	struct iovec iov;
@@ -334,6 +372,7 @@ static void free_ls(struct lockspace *ls)
 		free(node);
 	}
 
+	free_plock_resources(ls);
 	free(ls);
 }
 
@@ -1091,6 +1130,12 @@ static void receive_plocks_stored(struct lockspace *ls, struct dlm_header *hd,
 	if (!ls->need_plocks)
 		return;
 
+	if (ls->plock_retrieve) {
+		log_group(ls, "receive_plocks_stored %d:%u ignore retrieving",
+			  hd->nodeid, hd->msgdata);
+		return;
+	}
+
 	/* a confchg arrived between the last start and the plocks_stored msg,
 	   so we ignore this plocks_stored msg and wait to read the ckpt until
 	   the next plocks_stored msg following the current start */
@@ -1112,12 +1157,26 @@ static void receive_plocks_stored(struct lockspace *ls, struct dlm_header *hd,
 		return;
 	}
 
-	retrieve_plocks(ls, &sig);
+	ls->plocks_stored_nodeid = hd->nodeid;
+	ls->plocks_stored_flags = hd->flags;
+	ls->plocks_stored_sig = hd->msgdata2;
+
+	/* a bulk ckpt is read a chunk at a time from the main loop, which
+	   calls plocks_retrieved() when it's done */
+
+	if (retrieve_plocks(ls, &sig))
+		return;
+
+	plocks_retrieved(ls, sig);
+}
 
-	if ((hd->flags & DLM_MFLG_PLOCK_SIG) && (sig != hd->msgdata2)) {
+void plocks_retrieved(struct lockspace *ls, uint32_t sig)
+{
+	if ((ls->plocks_stored_flags & DLM_MFLG_PLOCK_SIG) &&
+	    (sig != ls->plocks_stored_sig)) {
 		log_error("lockspace %s plock disabled our sig %x "
-			  "nodeid %d sig %x", ls->name, sig, hd->nodeid,
-			  hd->msgdata2);
+			  "nodeid %d sig %x", ls->name, sig,
+			  ls->plocks_stored_nodeid, ls->plocks_stored_sig);
 		ls->disable_plock = 1;
 		ls->need_plocks = 1; /* don't set HAVEPLOCK */
 		ls->save_plocks = 0;
@@ -1519,6 +1578,9 @@ static void confchg_cb(cpg_handle_t handle,
 		return;
 	}
 
+	/* the rest of a ckpt being read is from before this confchg */
+	retrieve_plocks_finish(ls);
+
 	rv = add_change(ls, member_list, member_list_entries,
 			left_list, left_list_entries,
 			joined_list, joined_list_entries, &cg);
@@ -1604,6 +1666,16 @@ static void deliver_cb(cpg_handle_t handle,
 				  hd->type, nodeid, cfgd_enable_plock);
 		break;
 
+	case DLM_MSG_PLOCK_BATCH:
+		if (ls->disable_plock)
+			break;
+		if (cfgd_enable_plock)
+			receive_plock_batch(ls, hd, len);
+		else
+			log_error("msg %d nodeid %d enable_plock %d",
+				  hd->type, nodeid, cfgd_enable_plock);
+		break;
+
 	case DLM_MSG_PLOCK_OWN:
 		if (ls->disable_plock)
 			break;
@@ -2275,8 +2347,10 @@ int setup_cpg_daemon(void)
 	INIT_LIST_HEAD(&daemon_nodes);
 
 	memset(&our_protocol, 0, sizeof(our_protocol));
+	/* 1.2.1 adds DLM_MSG_PLOCK_BATCH, 1.3.1 the bulk plock ckpt format,
+	   1.4.1 the deadlock ckpt stream format */
 	our_protocol.daemon_max[0] = 1;
-	our_protocol.daemon_max[1] = 1;
+	our_protocol.daemon_max[1] = 4;
 	our_protocol.daemon_max[2] = 1;
 	our_protocol.kernel_max[0] = 1;
 	our_protocol.kernel_max[1] = 1;
@@ -1,13 +1,14 @@
 #include "dlm_daemon.h"
 #include "config.h"
 #include "libdlm.h"
+#include "lockdump.h"
 
 static SaCkptHandleT global_ckpt_h;
 static SaCkptCallbacksT callbacks = { 0, 0 };
 static SaVersionT version = { 'B', 1, 1 };
-static char section_buf[10 * 1024 * 1024];  /* 10MB of pack_lock's enough? */
+static char *section_buf;
+static uint32_t section_buf_size;
 static uint32_t section_len;
-static uint32_t section_max;
 
 struct node {
 	struct list_head	list;
@@ -40,9 +41,57 @@ struct pack_lock {
 	int8_t			copy;
 };
 
+/* Checkpoint stream format, written when all nodes run daemon protocol 1.4.
+   Each resource with locks is written as a pack_rsb, its name padded to 8
+   bytes, then a pack_lock for each lock.  These records are packed into
+   sections of at most cfgd_deadlk_ckpt_chunk bytes named "c<n>"; when a
+   section fills, the resource continues with a new pack_rsb at the start of
+   the next one, so the writer and reader only hold one chunk at a time.
+   Section "i" holds a pack_stream giving the chunk size and count.  The old
+   format has one section per resource, named by the resource name, holding
+   only its pack_locks. */
+
+#define DEADLK_CKPT_VERSION	1
+#define DEADLK_CKPT_CHUNK_MIN	4096
+#define DEADLK_CKPT_CHUNK_MAX	(64 * 1024 * 1024)
+#define STREAM_SECTION		"i"
+#define SECTION_NAME_LEN	16
+
+#define PACK_NAME_LEN(len)	(((len) + 7) & ~7)
+
+struct pack_stream {
+	uint32_t version;
+	uint32_t chunk_size;
+	uint32_t chunk_count;
+	uint32_t r_count;
+	uint32_t lock_count;
+	uint32_t pad;
+};
+
+struct pack_rsb {
+	uint32_t count;		/* pack_locks that follow in this chunk */
+	uint16_t len;		/* name length */
+	uint16_t pad;
+};
+
+/* Resources and transactions are hashed (by name and xid) as the locks from
+   debugfs and the checkpoints are added; the tables double in size when the
+   average chain length reaches DEADLK_HASH_LOAD. */
+
+#define DEADLK_HASH_MIN		256
+#define DEADLK_HASH_MAX		(1 << 22)
+#define DEADLK_HASH_LOAD	2
+
+/* lock modes -1 (IV) to 6 (PD) index the compat matrix as mode + 1 */
+#define DLM_MODE_COUNT		8
+
 struct dlm_rsb {
 	struct list_head	list;
 	struct list_head	locks;
+	struct list_head	hash_list;  /* ls->resources_hash */
+	uint32_t		hash;
+	struct dlm_lkb		**granted;  /* granted locks grouped by grmode */
+	int			mode_first[DLM_MODE_COUNT + 1]; /* in granted */
 	char			name[DLM_RESNAME_MAXLEN];
 	int			len;
 };
@@ -61,13 +110,24 @@ struct dlm_lkb {
 						   lock that's blocking us */
 };
 
-/* waitfor pointers alloc'ed 4 at at time */
+/* waitfor pointers alloc'ed 4 at first, doubling after that */
 #define TR_NALLOC		4
 
+#define TR_ON_STACK		0x00000001 /* find_blocked */
+#define TR_BLOCKED		0x00000002 /* waits on a cycle, or is in one */
+#define TR_IN_CYCLE		0x00000004
+
 struct trans {
 	struct list_head	list;
 	struct list_head	locks;
+	struct list_head	hash_list;	      /* ls->transactions_hash */
 	uint64_t		xid;
+	struct trans		*waitfor_mark;	      /* last trans to add us
+							 to its waitfor */
+	int			index;		      /* find_blocked */
+	int			lowlink;
+	int			next_waitfor;
+	uint32_t		flags;
 	int			others_waiting_on_us; /* count of trans's
 							 pointing to us in
 							 waitfor */
@@ -110,6 +170,16 @@ static const char *status_str(int lksts)
 	return "?";
 }
 
+static uint64_t dt_usec(struct timeval *start, struct timeval *stop)
+{
+	uint64_t dt;
+
+	dt = stop->tv_sec - start->tv_sec;
+	dt *= 1000000;
+	dt += stop->tv_usec - start->tv_usec;
+	return dt;
+}
+
 static void free_resources(struct lockspace *ls)
 {
 	struct dlm_rsb *r, *r_safe;
@@ -123,8 +193,16 @@ static void free_resources(struct lockspace *ls)
 			free(lkb);
 		}
 		list_del(&r->list);
+		if (r->granted)
+			free(r->granted);
 		free(r);
 	}
+
+	if (ls->resources_hash)
+		free(ls->resources_hash);
+	ls->resources_hash = NULL;
+	ls->resources_hash_size = 0;
+	ls->resources_count = 0;
 }
 
 static void free_transactions(struct lockspace *ls)
@@ -137,6 +215,12 @@ static void free_transactions(struct lockspace *ls)
 			free(tr->waitfor);
 		free(tr);
 	}
+
+	if (ls->transactions_hash)
+		free(ls->transactions_hash);
+	ls->transactions_hash = NULL;
+	ls->transactions_hash_size = 0;
+	ls->transactions_count = 0;
 }
 
 static void disable_deadlock(void)
@@ -156,13 +240,94 @@ void setup_deadlock(void)
 		log_error("ckpt init error %d", rv);
 }
 
+static uint32_t name_hash(char *name, int len)
+{
+	uint32_t hash = 2166136261U;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static unsigned int xid_hash(uint64_t xid, unsigned int size)
+{
+	return (unsigned int)((xid * 0x9E3779B97F4A7C15ULL) >> 32) &
+	       (size - 1);
+}
+
+static int resize_resources_hash(struct lockspace *ls, unsigned int size)
+{
+	struct list_head *hash;
+	struct dlm_rsb *r;
+	unsigned int i;
+
+	hash = malloc(size * sizeof(struct list_head));
+	if (!hash)
+		return -ENOMEM;
+
+	for (i = 0; i < size; i++)
+		INIT_LIST_HEAD(&hash[i]);
+
+	list_for_each_entry(r, &ls->resources, list)
+		list_add_tail(&r->hash_list, &hash[r->hash & (size - 1)]);
+
+	if (ls->resources_hash)
+		free(ls->resources_hash);
+	ls->resources_hash = hash;
+	ls->resources_hash_size = size;
+	return 0;
+}
+
+static int resize_transactions_hash(struct lockspace *ls, unsigned int size)
+{
+	struct list_head *hash;
+	struct trans *tr;
+	unsigned int i;
+
+	hash = malloc(size * sizeof(struct list_head));
+	if (!hash)
+		return -ENOMEM;
+
+	for (i = 0; i < size; i++)
+		INIT_LIST_HEAD(&hash[i]);
+
+	list_for_each_entry(tr, &ls->transactions, list)
+		list_add_tail(&tr->hash_list, &hash[xid_hash(tr->xid, size)]);
+
+	if (ls->transactions_hash)
+		free(ls->transactions_hash);
+	ls->transactions_hash = hash;
+	ls->transactions_hash_size = size;
+	return 0;
+}
+
+/* if a hash table can't be allocated or grown we carry on with what we
+   have; lookups fall back to the list when there's no table */
+
 static struct dlm_rsb *get_resource(struct lockspace *ls, char *name, int len)
 {
+	struct list_head *head = &ls->resources;
+	unsigned int size = ls->resources_hash_size;
 	struct dlm_rsb *r;
+	uint32_t hash;
 
-	list_for_each_entry(r, &ls->resources, list) {
-		if (r->len == len && !strncmp(r->name, name, len))
-			return r;
+	hash = name_hash(name, len);
+
+	if (ls->resources_hash) {
+		head = &ls->resources_hash[hash & (size - 1)];
+		list_for_each_entry(r, head, hash_list) {
+			if (r->hash == hash && r->len == len &&
+			    !strncmp(r->name, name, len))
+				return r;
+		}
+	} else {
+		list_for_each_entry(r, head, list) {
+			if (r->len == len && !strncmp(r->name, name, len))
+				return r;
+		}
 	}
 
 	r = malloc(sizeof(struct dlm_rsb));
@@ -174,8 +339,21 @@ static struct dlm_rsb *get_resource(struct lockspace *ls, char *name, int len)
 	memset(r, 0, sizeof(struct dlm_rsb));
 	memcpy(r->name, name, len);
 	r->len = len;
+	r->hash = hash;
 	INIT_LIST_HEAD(&r->locks);
 	list_add(&r->list, &ls->resources);
+	ls->resources_count++;
+
+	if (ls->resources_hash)
+		list_add(&r->hash_list, head);
+	else
+		INIT_LIST_HEAD(&r->hash_list);
+
+	if (!size)
+		resize_resources_hash(ls, DEADLK_HASH_MIN);
+	else if (ls->resources_count > size * DEADLK_HASH_LOAD &&
+		 size < DEADLK_HASH_MAX)
+		resize_resources_hash(ls, size * 2);
 	return r;
 }
 
@@ -314,81 +492,50 @@ static struct dlm_lkb *add_lock(struct lockspace *ls, struct dlm_rsb *r,
 	return lkb;
 }
 
-static void parse_r_name(char *line, char *name)
-{
-	char *p;
-	int i = 0;
-	int begin = 0;
-
-	for (p = line; ; p++) {
-		if (*p == '"') {
-			if (begin)
-				break;
-			begin = 1;
-			continue;
-		}
-		if (begin)
-			name[i++] = *p;
-	}
-}
-
-#define LOCK_LINE_MAX 1024
-
 static int read_debugfs_locks(struct lockspace *ls)
 {
-	FILE *file;
+	struct lockdump ld;
+	struct lockdump_lock lk;
 	char path[PATH_MAX];
-	char line[LOCK_LINE_MAX];
+	char *line;
 	struct dlm_rsb *r;
 	struct pack_lock lock;
 	char r_name[65];
-	unsigned long long xid;
-	unsigned int waiting;
-	int r_nodeid;
-	int r_len;
 	int rv;
 
 	snprintf(path, PATH_MAX, "/sys/kernel/debug/dlm/%s_locks", ls->name);
 
-	file = fopen(path, "r");
-	if (!file)
+	if (lockdump_open(&ld, path) < 0)
 		return -1;
 
 	/* skip the header on the first line */
-	if (!fgets(line, LOCK_LINE_MAX, file)) {
+	if (!lockdump_line(&ld)) {
 		log_error("Unable to read %s: %d", path, errno);
 		goto out;
 	}
 
-	while (fgets(line, LOCK_LINE_MAX, file)) {
-		memset(&lock, 0, sizeof(struct pack_lock));
-
-		rv = sscanf(line, "%x %d %x %u %llu %x %x %hhd %hhd %hhd %u %d %d",
-			    &lock.id,
-			    &lock.nodeid,
-			    &lock.remid,
-			    &lock.ownpid,
-			    &xid,
-			    &lock.exflags,
-			    &lock.flags,
-			    &lock.status,
-			    &lock.grmode,
-			    &lock.rqmode,
-			    &waiting,
-			    &r_nodeid,
-			    &r_len);
-
-		lock.xid = xid; /* hack to avoid warning */
-
-		if (rv != 13) {
+	while ((line = lockdump_line(&ld))) {
+		rv = lockdump_parse_lock(line, &lk);
+		if (rv != LOCKDUMP_LOCK_FIELDS) {
 			log_error("invalid debugfs line %d: %s", rv, line);
 			goto out;
 		}
 
-		memset(r_name, 0, sizeof(r_name));
-		parse_r_name(line, r_name);
-
-		r = get_resource(ls, r_name, r_len);
+		memset(&lock, 0, sizeof(struct pack_lock));
+		lock.id = lk.id;
+		lock.nodeid = lk.nodeid;
+		lock.remid = lk.remid;
+		lock.ownpid = lk.ownpid;
+		lock.xid = lk.xid;
+		lock.exflags = lk.exflags;
+		lock.flags = lk.flags;
+		lock.status = lk.status;
+		lock.grmode = lk.grmode;
+		lock.rqmode = lk.rqmode;
+
+		lockdump_name(&lk, r_name, sizeof(r_name));
+
+		r = get_resource(ls, r_name, lk.r_len);
 		if (!r)
 			break;
 
@@ -396,10 +543,60 @@ static int read_debugfs_locks(struct lockspace *ls)
 		add_lock(ls, r, our_nodeid, &lock);
 	}
  out:
-	fclose(file);
+	lockdump_close(&ld);
+	return 0;
+}
+
+static int grow_section_buf(uint32_t len)
+{
+	char *buf;
+
+	if (len <= section_buf_size)
+		return 0;
+
+	buf = realloc(section_buf, len);
+	if (!buf)
+		return -ENOMEM;
+	section_buf = buf;
+	section_buf_size = len;
 	return 0;
 }
 
+/* the buffer is only needed while a checkpoint is read or written */
+
+static void free_section_buf(void)
+{
+	free(section_buf);
+	section_buf = NULL;
+	section_buf_size = 0;
+}
+
+static void unpack_lock(struct pack_lock *lock)
+{
+	lock->xid     = le64_to_cpu(lock->xid);
+	lock->id      = le32_to_cpu(lock->id);
+	lock->nodeid  = le32_to_cpu(lock->nodeid);
+	lock->remid   = le32_to_cpu(lock->remid);
+	lock->ownpid  = le32_to_cpu(lock->ownpid);
+	lock->exflags = le32_to_cpu(lock->exflags);
+	lock->flags   = le32_to_cpu(lock->flags);
+}
+
+static void pack_lock(struct pack_lock *lock, struct dlm_lkb *lkb)
+{
+	lock->xid     = cpu_to_le64(lkb->lock.xid);
+	lock->id      = cpu_to_le32(lkb->lock.id);
+	lock->nodeid  = cpu_to_le32(lkb->lock.nodeid);
+	lock->remid   = cpu_to_le32(lkb->lock.remid);
+	lock->ownpid  = cpu_to_le32(lkb->lock.ownpid);
+	lock->exflags = cpu_to_le32(lkb->lock.exflags);
+	lock->flags   = cpu_to_le32(lkb->lock.flags);
+	lock->status  = lkb->lock.status;
+	lock->grmode  = lkb->lock.grmode;
+	lock->rqmode  = lkb->lock.rqmode;
+	lock->copy    = lkb->lock.copy;
+}
+
 static int read_checkpoint_locks(struct lockspace *ls, int from_nodeid,
 			         char *numbuf, int buflen)
 {
@@ -412,66 +609,303 @@ static int read_checkpoint_locks(struct lockspace *ls, int from_nodeid,
 	if (!r)
 		return -1;
 
-	lock = (struct pack_lock *) &section_buf;
+	lock = (struct pack_lock *) section_buf;
 
 	for (i = 0; i < count; i++) {
-		lock->xid     = le64_to_cpu(lock->xid);
-		lock->id      = le32_to_cpu(lock->id);
-		lock->nodeid  = le32_to_cpu(lock->nodeid);
-		lock->remid   = le32_to_cpu(lock->remid);
-		lock->ownpid  = le32_to_cpu(lock->ownpid);
-		lock->exflags = le32_to_cpu(lock->exflags);
-		lock->flags   = le32_to_cpu(lock->flags);
-
+		unpack_lock(lock);
 		add_lock(ls, r, from_nodeid, lock);
 		lock++;
 	}
 	return 0;
 }
 
-static int pack_lkb_list(struct list_head *q, struct pack_lock **lockp)
+static void pack_section_buf(struct lockspace *ls, struct dlm_rsb *r)
 {
+	struct pack_lock *lock;
 	struct dlm_lkb *lkb;
-	struct pack_lock *lock = *lockp;
 	int count = 0;
 
-	list_for_each_entry(lkb, q, list) {
-		if (count + 1 > section_max) {
-			log_error("too many locks %d for ckpt buf", count);
-			break;
-		}
-
-		lock->xid     = cpu_to_le64(lkb->lock.xid);
-		lock->id      = cpu_to_le32(lkb->lock.id);
-		lock->nodeid  = cpu_to_le32(lkb->lock.nodeid);
-		lock->remid   = cpu_to_le32(lkb->lock.remid);
-		lock->ownpid  = cpu_to_le32(lkb->lock.ownpid);
-		lock->exflags = cpu_to_le32(lkb->lock.exflags);
-		lock->flags   = cpu_to_le32(lkb->lock.flags);
-		lock->status  = lkb->lock.status;
-		lock->grmode  = lkb->lock.grmode;
-		lock->rqmode  = lkb->lock.rqmode;
-		lock->copy    = lkb->lock.copy;
+	lock = (struct pack_lock *) section_buf;
 
+	list_for_each_entry(lkb, &r->locks, list) {
+		memset(lock, 0, sizeof(struct pack_lock));
+		pack_lock(lock, lkb);
 		lock++;
 		count++;
 	}
-	return count;
+
+	section_len = count * sizeof(struct pack_lock);
 }
 
-static void pack_section_buf(struct lockspace *ls, struct dlm_rsb *r)
+/* Writing the stream format: the resources are run through twice, first
+   with no checkpoint handle to count the chunks and bytes for the
+   checkpoint attributes, then to pack and write each chunk as it fills. */
+
+struct ckpt_stream {
+	struct lockspace	*ls;
+	SaCkptCheckpointHandleT	h;	   /* 0 when only sizing */
+	uint32_t		size;	   /* chunk size */
+	uint32_t		len;	   /* bytes in the current chunk */
+	uint32_t		chunk_count;
+	uint64_t		bytes;	   /* in the chunks completed */
+	struct pack_rsb		*pr;	   /* record being filled */
+	uint32_t		pr_count;
+	uint32_t		r_count;
+	uint32_t		lock_count;
+};
+
+static SaAisErrorT create_section(struct lockspace *ls,
+				  SaCkptCheckpointHandleT h, char *id,
+				  int id_len, void *buf, uint32_t len)
+{
+	SaCkptSectionIdT section_id;
+	SaCkptSectionCreationAttributesT section_attr;
+	SaAisErrorT rv;
+
+	section_id.id = (void *)id;
+	section_id.idLen = id_len;
+	section_attr.sectionId = &section_id;
+	section_attr.expirationTime = SA_TIME_END;
+
+ create_retry:
+	rv = saCkptSectionCreate(h, &section_attr, buf, len);
+	if (rv == SA_AIS_ERR_TRY_AGAIN) {
+		log_group(ls, "write_checkpoint: ckpt create retry");
+		sleep(1);
+		goto create_retry;
+	}
+	return rv;
+}
+
+static void end_record(struct ckpt_stream *st)
+{
+	if (st->pr)
+		st->pr->count = cpu_to_le32(st->pr_count);
+	st->pr = NULL;
+	st->pr_count = 0;
+}
+
+static int flush_chunk(struct ckpt_stream *st)
+{
+	char id[SECTION_NAME_LEN];
+	SaAisErrorT rv;
+	int len;
+
+	end_record(st);
+
+	if (!st->len)
+		return 0;
+
+	if (st->h) {
+		len = snprintf(id, SECTION_NAME_LEN, "c%u", st->chunk_count);
+		rv = create_section(st->ls, st->h, id, len + 1, section_buf,
+				    st->len);
+		if (rv != SA_AIS_OK) {
+			log_error("write_checkpoint: section %s create %d",
+				  id, rv);
+			return -1;
+		}
+	}
+
+	st->chunk_count++;
+	st->bytes += st->len;
+	st->len = 0;
+	return 0;
+}
+
+/* start a record for r in the current chunk, or the next one if there's no
+   room for it with at least one lock */
+
+static int begin_record(struct ckpt_stream *st, struct dlm_rsb *r)
+{
+	uint32_t name_len = PACK_NAME_LEN(r->len);
+	struct pack_rsb *pr;
+
+	end_record(st);
+
+	if (st->len + sizeof(struct pack_rsb) + name_len +
+	    sizeof(struct pack_lock) > st->size) {
+		if (flush_chunk(st) < 0)
+			return -1;
+	}
+
+	if (st->h) {
+		pr = (struct pack_rsb *)(section_buf + st->len);
+		memset(pr, 0, sizeof(struct pack_rsb) + name_len);
+		pr->len = cpu_to_le16(r->len);
+		memcpy(pr + 1, r->name, r->len);
+		st->pr = pr;
+	}
+	st->len += sizeof(struct pack_rsb) + name_len;
+	return 0;
+}
+
+static int stream_resource(struct ckpt_stream *st, struct dlm_rsb *r)
 {
 	struct pack_lock *lock;
-	int count;
+	struct dlm_lkb *lkb;
 
-	memset(&section_buf, 0, sizeof(section_buf));
-	section_max = sizeof(section_buf) / sizeof(struct pack_lock);
+	if (list_empty(&r->locks))
+		return 0;
 
-	lock = (struct pack_lock *) &section_buf;
+	if (begin_record(st, r) < 0)
+		return -1;
+	st->r_count++;
 
-	count = pack_lkb_list(&r->locks, &lock);
+	list_for_each_entry(lkb, &r->locks, list) {
+		if (st->len + sizeof(struct pack_lock) > st->size) {
+			if (flush_chunk(st) < 0 || begin_record(st, r) < 0)
+				return -1;
+		}
 
-	section_len = count * sizeof(struct pack_lock);
+		if (st->h) {
+			lock = (struct pack_lock *)(section_buf + st->len);
+			memset(lock, 0, sizeof(struct pack_lock));
+			pack_lock(lock, lkb);
+		}
+		st->len += sizeof(struct pack_lock);
+		st->pr_count++;
+		st->lock_count++;
+	}
+	return 0;
+}
+
+static int stream_resources(struct lockspace *ls, struct ckpt_stream *st)
+{
+	struct dlm_rsb *r;
+
+	list_for_each_entry(r, &ls->resources, list) {
+		if (stream_resource(st, r) < 0)
+			return -1;
+	}
+	return flush_chunk(st);
+}
+
+static uint32_t stream_chunk_size(void)
+{
+	uint32_t size = cfgd_deadlk_ckpt_chunk;
+
+	if (size < DEADLK_CKPT_CHUNK_MIN)
+		size = DEADLK_CKPT_CHUNK_MIN;
+	if (size > DEADLK_CKPT_CHUNK_MAX)
+		size = DEADLK_CKPT_CHUNK_MAX;
+	return size;
+}
+
+/* Reading the stream format, one chunk at a time into section_buf. */
+
+static int read_stream_chunk(struct lockspace *ls, int nodeid, uint32_t len)
+{
+	struct pack_rsb *pr;
+	struct pack_lock *lock;
+	struct dlm_rsb *r;
+	uint32_t off = 0, count, name_len, i;
+
+	while (off + sizeof(struct pack_rsb) <= len) {
+		pr = (struct pack_rsb *)(section_buf + off);
+		count = le32_to_cpu(pr->count);
+		name_len = le16_to_cpu(pr->len);
+
+		if (!name_len || name_len > DLM_RESNAME_MAXLEN ||
+		    off + sizeof(struct pack_rsb) + PACK_NAME_LEN(name_len) +
+		    (uint64_t)count * sizeof(struct pack_lock) > len) {
+			log_error("read_checkpoint: %d bad record at %u len %u "
+				  "count %u", nodeid, off, name_len, count);
+			return -1;
+		}
+
+		r = get_resource(ls, (char *)(pr + 1), name_len);
+		if (!r)
+			return -1;
+
+		off += sizeof(struct pack_rsb) + PACK_NAME_LEN(name_len);
+		lock = (struct pack_lock *)(section_buf + off);
+
+		for (i = 0; i < count; i++) {
+			unpack_lock(lock);
+			add_lock(ls, r, nodeid, lock);
+			lock++;
+		}
+		off += count * sizeof(struct pack_lock);
+	}
+	return 0;
+}
+
+static SaAisErrorT read_section(struct lockspace *ls,
+				SaCkptCheckpointHandleT h, char *id,
+				int id_len, void *buf, uint32_t len,
+				uint32_t *read_len)
+{
+	SaCkptIOVectorElementT iov;
+	SaAisErrorT rv;
+	int retries = 0;
+
+	iov.sectionId.id = (void *)id;
+	iov.sectionId.idLen = id_len;
+	iov.dataBuffer = buf;
+	iov.dataSize = len;
+	iov.dataOffset = 0;
+
+ read_retry:
+	rv = saCkptCheckpointRead(h, &iov, 1, NULL);
+	if (rv == SA_AIS_ERR_TRY_AGAIN) {
+		log_group(ls, "read_checkpoint: ckpt read retry");
+		sleep(1);
+		if (retries++ < 10)
+			goto read_retry;
+	}
+	if (rv == SA_AIS_OK)
+		*read_len = iov.readSize;
+	return rv;
+}
+
+static void read_checkpoint_stream(struct lockspace *ls, int nodeid,
+				   SaCkptCheckpointHandleT h)
+{
+	struct pack_stream ps;
+	char id[SECTION_NAME_LEN];
+	uint32_t chunk_size, chunk_count, read_len, i;
+	SaAisErrorT rv;
+	int len;
+
+	strcpy(id, STREAM_SECTION);
+	rv = read_section(ls, h, id, sizeof(STREAM_SECTION), &ps, sizeof(ps),
+			  &read_len);
+	if (rv != SA_AIS_OK || read_len != sizeof(ps) ||
+	    le32_to_cpu(ps.version) != DEADLK_CKPT_VERSION) {
+		log_error("read_checkpoint: %d bad stream section %d len %u",
+			  nodeid, rv, read_len);
+		return;
+	}
+
+	chunk_size = le32_to_cpu(ps.chunk_size);
+	chunk_count = le32_to_cpu(ps.chunk_count);
+
+	log_group(ls, "read_checkpoint: %d stream r_count %u lock_count %u "
+		  "chunks %u size %u", nodeid, le32_to_cpu(ps.r_count),
+		  le32_to_cpu(ps.lock_count), chunk_count, chunk_size);
+
+	if (chunk_size > DEADLK_CKPT_CHUNK_MAX ||
+	    grow_section_buf(chunk_size)) {
+		log_error("read_checkpoint: %d no mem for chunk size %u",
+			  nodeid, chunk_size);
+		return;
+	}
+
+	for (i = 0; i < chunk_count; i++) {
+		len = snprintf(id, SECTION_NAME_LEN, "c%u", i);
+
+		rv = read_section(ls, h, id, len + 1, section_buf, chunk_size,
+				  &read_len);
+		if (rv != SA_AIS_OK) {
+			log_error("read_checkpoint: %d ckpt read %s error %d",
+				  nodeid, id, rv);
+			return;
+		}
+
+		if (read_stream_chunk(ls, nodeid, read_len) < 0)
+			return;
+	}
 }
 
 static int _unlink_checkpoint(struct lockspace *ls, SaNameT *name)
@@ -590,6 +1024,12 @@ static void read_checkpoint(struct lockspace *ls, int nodeid)
 		return;
 	}
 
+	if (deadlk_ckpt_stream_supported()) {
+		read_checkpoint_stream(ls, nodeid, h);
+		retries = 0;
+		goto out;
+	}
+
 	retries = 0;
  init_retry:
 	rv = saCkptSectionIterationInitialize(h, SA_CKPT_SECTIONS_ANY, 0, &itr);
@@ -625,8 +1065,14 @@ static void read_checkpoint(struct lockspace *ls, int nodeid)
 		if (!desc.sectionSize)
 			continue;
 
+		if (grow_section_buf(desc.sectionSize)) {
+			log_error("read_checkpoint: %d no mem for section %llu",
+				  nodeid, (unsigned long long)desc.sectionSize);
+			goto out_it;
+		}
+
 		iov.sectionId = desc.sectionId;
-		iov.dataBuffer = &section_buf;
+		iov.dataBuffer = section_buf;
 		iov.dataSize = desc.sectionSize;
 		iov.dataOffset = 0;
 
@@ -680,21 +1126,68 @@ static void read_checkpoint(struct lockspace *ls, int nodeid)
 	}
 	if (rv != SA_AIS_OK)
 		log_error("read_checkpoint: %d close error %d", nodeid, rv);
+	free_section_buf();
+}
+
+static int write_checkpoint_stream(struct lockspace *ls,
+				  SaCkptCheckpointHandleT h,
+				  struct ckpt_stream *st)
+{
+	struct pack_stream ps;
+	char id[] = STREAM_SECTION;
+	SaAisErrorT rv;
+
+	if (grow_section_buf(st->size)) {
+		log_error("write_checkpoint: no mem for chunk size %u",
+			  st->size);
+		return -1;
+	}
+
+	/* the same chunks as the sizing pass, now written */
+	st->h = h;
+	st->len = 0;
+	st->chunk_count = 0;
+	st->bytes = 0;
+	st->pr = NULL;
+	st->pr_count = 0;
+	st->r_count = 0;
+	st->lock_count = 0;
+
+	if (stream_resources(ls, st) < 0)
+		return -1;
+
+	memset(&ps, 0, sizeof(ps));
+	ps.version = cpu_to_le32(DEADLK_CKPT_VERSION);
+	ps.chunk_size = cpu_to_le32(st->size);
+	ps.chunk_count = cpu_to_le32(st->chunk_count);
+	ps.r_count = cpu_to_le32(st->r_count);
+	ps.lock_count = cpu_to_le32(st->lock_count);
+
+	rv = create_section(ls, h, id, sizeof(id), &ps, sizeof(ps));
+	if (rv != SA_AIS_OK) {
+		log_error("write_checkpoint: stream section create %d", rv);
+		return -1;
+	}
+
+	st->bytes += sizeof(ps);
+	return 0;
 }
 
 static void write_checkpoint(struct lockspace *ls)
 {
 	SaCkptCheckpointCreationAttributesT attr;
 	SaCkptCheckpointHandleT h;
-	SaCkptSectionIdT section_id;
-	SaCkptSectionCreationAttributesT section_attr;
 	SaCkptCheckpointOpenFlagsT flags;
 	SaNameT name;
 	SaAisErrorT rv;
-	char buf[DLM_RESNAME_MAXLEN];
+	char buf[DLM_RESNAME_MAXLEN + 1];
+	struct ckpt_stream st;
 	struct dlm_rsb *r;
 	struct dlm_lkb *lkb;
-	int r_count, lock_count, total_size, section_size, max_section_size;
+	uint64_t total_size, bytes = 0;
+	uint32_t sections = 0;
+	int r_count, lock_count, section_size, max_section_size;
+	int stream = deadlk_ckpt_stream_supported();
 	int len;
 
 	len = snprintf((char *)name.value, SA_MAX_NAME_LENGTH, "dlmdeadlk.%s.%d",
@@ -731,13 +1224,31 @@ static void write_checkpoint(struct lockspace *ls)
 	log_group(ls, "write_checkpoint: r_count %d, lock_count %d",
 		  r_count, lock_count);
 
-	log_group(ls, "write_checkpoint: total %d bytes, max_section %d bytes",
-		  total_size, max_section_size);
+	if (stream) {
+		memset(&st, 0, sizeof(st));
+		st.ls = ls;
+		st.size = stream_chunk_size();
+		stream_resources(ls, &st);
+
+		total_size = st.bytes + sizeof(struct pack_stream);
+		max_section_size = st.size;
+
+		log_group(ls, "write_checkpoint: stream total %llu bytes, "
+			  "%u chunks of %u bytes", (unsigned long long)total_size,
+			  st.chunk_count, st.size);
+	} else {
+		log_group(ls, "write_checkpoint: total %llu bytes, "
+			  "max_section %d bytes", (unsigned long long)total_size,
+			  max_section_size);
+	}
 
 	attr.creationFlags = SA_CKPT_WR_ALL_REPLICAS;
 	attr.checkpointSize = total_size;
 	attr.retentionDuration = SA_TIME_MAX;
-	attr.maxSections = r_count + 1;      /* don't know why we need +1 */
+	if (stream)
+		attr.maxSections = st.chunk_count + 2;
+	else
+		attr.maxSections = r_count + 1; /* don't know why we need +1 */
 	attr.maxSectionSize = max_section_size;
 	attr.maxSectionIdSize = DLM_RESNAME_MAXLEN;
 
@@ -765,40 +1276,61 @@ static void write_checkpoint(struct lockspace *ls)
 		  (unsigned long long)h);
 	ls->deadlk_ckpt_handle = (uint64_t) h;
 
+	if (stream) {
+		if (!write_checkpoint_stream(ls, h, &st)) {
+			sections = st.chunk_count + 1;
+			bytes = st.bytes;
+		}
+		goto out;
+	}
+
+	if (grow_section_buf(max_section_size)) {
+		log_error("write_checkpoint: no mem for section %d",
+			  max_section_size);
+		goto out;
+	}
+
 	list_for_each_entry(r, &ls->resources, list) {
+		/* r->name isn't terminated when it's the max length */
 		memset(buf, 0, sizeof(buf));
-		len = snprintf(buf, sizeof(buf), "%s", r->name);
-
-		section_id.id = (void *)buf;
-		section_id.idLen = len + 1;
-		section_attr.sectionId = &section_id;
-		section_attr.expirationTime = SA_TIME_END;
+		len = strnlen(r->name, r->len);
+		memcpy(buf, r->name, len);
 
 		pack_section_buf(ls, r);
 
 		log_group(ls, "write_checkpoint: section size %u id %u \"%s\"",
-			  section_len, section_id.idLen, buf);
+			  section_len, len + 1, buf);
 
-	 create_retry:
-		rv = saCkptSectionCreate(h, &section_attr, &section_buf,
-					 section_len);
-		if (rv == SA_AIS_ERR_TRY_AGAIN) {
-			log_group(ls, "write_checkpoint: ckpt create retry");
-			sleep(1);
-			goto create_retry;
-		}
+		rv = create_section(ls, h, buf, len + 1, section_buf,
+				    section_len);
 		if (rv == SA_AIS_ERR_EXIST) {
 			/* this shouldn't happen in general */
 			log_error("write_checkpoint: clearing old ckpt");
 			saCkptCheckpointClose(h);
 			_unlink_checkpoint(ls, &name);
+			sections = 0;
+			bytes = 0;
 			goto open_retry;
 		}
 		if (rv != SA_AIS_OK) {
 			log_error("write_checkpoint: section create %d", rv);
 			break;
 		}
+		sections++;
+		bytes += section_len;
 	}
+ out:
+	free_section_buf();
+
+	ls->deadlk_ckpt_writes++;
+	ls->deadlk_ckpt_sections += sections;
+	ls->deadlk_ckpt_bytes += bytes;
+
+	log_group(ls, "write_checkpoint: wrote %u sections %llu bytes, "
+		  "total writes %u sections %llu bytes %llu",
+		  sections, (unsigned long long)bytes, ls->deadlk_ckpt_writes,
+		  (unsigned long long)ls->deadlk_ckpt_sections,
+		  (unsigned long long)ls->deadlk_ckpt_bytes);
 }
 
 static void send_message(struct lockspace *ls, int type,
@@ -974,16 +1506,6 @@ void receive_cycle_start(struct lockspace *ls, struct dlm_header *hd, int len)
 	send_checkpoint_ready(ls);
 }
 
-static uint64_t dt_usec(struct timeval *start, struct timeval *stop)
-{
-	uint64_t dt;
-
-	dt = stop->tv_sec - start->tv_sec;
-	dt *= 1000000;
-	dt += stop->tv_usec - start->tv_usec;
-	return dt;
-}
-
 /* TODO: nodes added during a cycle - what will they do with messages
    they recv from other nodes running the cycle? */
 
@@ -1158,11 +1680,21 @@ static void add_lkb_trans(struct trans *tr, struct dlm_lkb *lkb)
 
 static struct trans *get_trans(struct lockspace *ls, uint64_t xid)
 {
+	struct list_head *head = NULL;
+	unsigned int size = ls->transactions_hash_size;
 	struct trans *tr;
 
-	list_for_each_entry(tr, &ls->transactions, list) {
-		if (tr->xid == xid)
-			return tr;
+	if (ls->transactions_hash) {
+		head = &ls->transactions_hash[xid_hash(xid, size)];
+		list_for_each_entry(tr, head, hash_list) {
+			if (tr->xid == xid)
+				return tr;
+		}
+	} else {
+		list_for_each_entry(tr, &ls->transactions, list) {
+			if (tr->xid == xid)
+				return tr;
+		}
 	}
 
 	tr = malloc(sizeof(struct trans));
@@ -1178,18 +1710,48 @@ static struct trans *get_trans(struct lockspace *ls, uint64_t xid)
 	tr->waitfor_count = 0;
 	INIT_LIST_HEAD(&tr->locks);
 	list_add(&tr->list, &ls->transactions);
+	ls->transactions_count++;
+
+	if (head)
+		list_add(&tr->hash_list, head);
+	else
+		INIT_LIST_HEAD(&tr->hash_list);
+
+	if (!size)
+		resize_transactions_hash(ls, DEADLK_HASH_MIN);
+	else if (ls->transactions_count > size * DEADLK_HASH_LOAD &&
+		 size < DEADLK_HASH_MAX)
+		resize_transactions_hash(ls, size * 2);
 	return tr;
 }
 
+static void del_trans(struct lockspace *ls, struct trans *tr)
+{
+	struct dlm_lkb *lkb, *safe;
+
+	list_for_each_entry_safe(lkb, safe, &tr->locks, trans_list)
+		list_del_init(&lkb->trans_list);
+
+	list_del(&tr->list);
+	list_del(&tr->hash_list);
+	ls->transactions_count--;
+	if (tr->waitfor)
+		free(tr->waitfor);
+	free(tr);
+}
+
 /* for each rsb, for each lock, find/create trans, add lkb to the trans list */
 
 static void create_trans_list(struct lockspace *ls)
 {
+	struct timeval start, end;
 	struct dlm_rsb *r;
 	struct dlm_lkb *lkb;
 	struct trans *tr;
 	int r_count = 0, lkb_count = 0;
 
+	gettimeofday(&start, NULL);
+
 	list_for_each_entry(r, &ls->resources, list) {
 		r_count++;
 		list_for_each_entry(lkb, &r->locks, list) {
@@ -1201,8 +1763,10 @@ static void create_trans_list(struct lockspace *ls)
 		}
 	}
  out:
-	log_group(ls, "create_trans_list: r_count %d lkb_count %d",
-		  r_count, lkb_count);
+	gettimeofday(&end, NULL);
+	log_group(ls, "create_trans_list: r_count %d lkb_count %d "
+		  "tr_count %u time %.3f s", r_count, lkb_count,
+		  ls->transactions_count, dt_usec(&start, &end) * 1.e-6);
 }
 
 static int locks_compat(struct dlm_lkb *waiting_lkb,
@@ -1223,19 +1787,6 @@ static int locks_compat(struct dlm_lkb *waiting_lkb,
 				waiting_lkb->lock.rqmode);
 }
 
-static int in_waitfor(struct trans *tr, struct trans *add_tr)
-{
-	int i;
-
-	for (i = 0; i < tr->waitfor_alloc; i++) {
-		if (!tr->waitfor[i])
-			continue;
-		if (tr->waitfor[i] == add_tr)
-			return 1;
-	}
-	return 0;
-}
-
 static void add_waitfor(struct lockspace *ls, struct dlm_lkb *waiting_lkb,
 			struct dlm_lkb *granted_lkb)
 {
@@ -1252,8 +1803,11 @@ static void add_waitfor(struct lockspace *ls, struct dlm_lkb *waiting_lkb,
 		return;
 	}
 
-	/* don't add the same trans to the waitfor list multiple times */
-	if (tr->waitfor_count && in_waitfor(tr, granted_lkb->trans)) {
+	/* don't add the same trans to the waitfor list multiple times;
+	   create_waitfor_graph() adds all of tr's waitfors before moving on
+	   to the next trans, so the granted trans has already been added if
+	   tr was the last to add it */
+	if (granted_lkb->trans->waitfor_mark == tr) {
 		log_group(ls, "trans %llx already waiting for trans %llx, "
 			  "waiting %x %s, granted %x %s",
 			  (unsigned long long)waiting_lkb->trans->xid,
@@ -1265,13 +1819,17 @@ static void add_waitfor(struct lockspace *ls, struct dlm_lkb *waiting_lkb,
 
 	if (tr->waitfor_count == tr->waitfor_alloc) {
 		struct trans **old_waitfor = tr->waitfor;
-		tr->waitfor_alloc += TR_NALLOC;
-		tr->waitfor = malloc(tr->waitfor_alloc * sizeof(tr));
+		int alloc = tr->waitfor_alloc ? tr->waitfor_alloc * 2 :
+						TR_NALLOC;
+
+		tr->waitfor = malloc(alloc * sizeof(tr));
 		if (!tr->waitfor) {
-			log_error("add_waitfor no mem %u", tr->waitfor_alloc);
+			log_error("add_waitfor no mem %u", alloc);
+			tr->waitfor = old_waitfor;
 			return;
 		}
-		memset(tr->waitfor, 0, tr->waitfor_alloc * sizeof(tr));
+		memset(tr->waitfor, 0, alloc * sizeof(tr));
+		tr->waitfor_alloc = alloc;
 
 		/* copy then free old set of pointers */
 		for (i = 0; i < tr->waitfor_count; i++)
@@ -1282,9 +1840,61 @@ static void add_waitfor(struct lockspace *ls, struct dlm_lkb *waiting_lkb,
 
 	tr->waitfor[tr->waitfor_count++] = granted_lkb->trans;
 	granted_lkb->trans->others_waiting_on_us++;
+	granted_lkb->trans->waitfor_mark = tr;
 	waiting_lkb->waitfor_trans = granted_lkb->trans;
 }
 
+static int valid_mode(int mode)
+{
+	return (mode >= -1 && mode < DLM_MODE_COUNT - 1);
+}
+
+/* Group the granted locks on r by grmode (in r->granted, with the locks
+   granted in mode m from r->mode_first[m + 1] up to r->mode_first[m + 2]),
+   so that a waiting lock only has to look at the locks in the modes it's
+   incompatible with.  Done the first time a lock waits on r. */
+
+static int sort_granted(struct dlm_rsb *r)
+{
+	struct dlm_lkb *lkb;
+	int count[DLM_MODE_COUNT];
+	int total = 0, m;
+
+	if (r->granted)
+		return 0;
+
+	memset(count, 0, sizeof(count));
+
+	list_for_each_entry(lkb, &r->locks, list) {
+		if (lkb->lock.status == DLM_LKSTS_WAITING)
+			continue;
+		/* lkb status is GRANTED or CONVERT */
+		if (!valid_mode(lkb->lock.grmode))
+			continue;
+		count[lkb->lock.grmode + 1]++;
+		total++;
+	}
+
+	r->granted = malloc((total ? total : 1) * sizeof(struct dlm_lkb *));
+	if (!r->granted)
+		return -ENOMEM;
+
+	r->mode_first[0] = 0;
+	for (m = 0; m < DLM_MODE_COUNT; m++) {
+		r->mode_first[m + 1] = r->mode_first[m] + count[m];
+		count[m] = r->mode_first[m];
+	}
+
+	list_for_each_entry(lkb, &r->locks, list) {
+		if (lkb->lock.status == DLM_LKSTS_WAITING)
+			continue;
+		if (!valid_mode(lkb->lock.grmode))
+			continue;
+		r->granted[count[lkb->lock.grmode + 1]++] = lkb;
+	}
+	return 0;
+}
+
 /* for each trans, for each waiting lock, go to rsb of the lock,
    find granted locks on that rsb, then find the trans the
    granted lock belongs to, add that trans to our waitfor list */
@@ -1292,9 +1902,13 @@ static void add_waitfor(struct lockspace *ls, struct dlm_lkb *waiting_lkb,
 static void create_waitfor_graph(struct lockspace *ls)
 {
 	struct dlm_lkb *waiting_lkb, *granted_lkb;
+	struct timeval start, end;
 	struct dlm_rsb *r;
 	struct trans *tr;
 	int depend_count = 0;
+	int rq, m, i;
+
+	gettimeofday(&start, NULL);
 
 	list_for_each_entry(tr, &ls->transactions, list) {
 		list_for_each_entry(waiting_lkb, &tr->locks, trans_list) {
@@ -1303,18 +1917,44 @@ static void create_waitfor_graph(struct lockspace *ls)
 			/* waiting_lkb status is CONVERT or WAITING */
 
 			r = waiting_lkb->rsb;
+			rq = waiting_lkb->lock.rqmode;
+
+			if (!valid_mode(rq)) {
+				log_group(ls, "waiting %x %s rqmode %d",
+					  waiting_lkb->lock.id, r->name, rq);
+				continue;
+			}
+
+			/* no memory to group them, check each granted lock */
+			if (sort_granted(r) < 0) {
+				list_for_each_entry(granted_lkb, &r->locks, list) {
+					if (granted_lkb->lock.status==DLM_LKSTS_WAITING)
+						continue;
+					if (!valid_mode(granted_lkb->lock.grmode))
+						continue;
+					add_waitfor(ls, waiting_lkb, granted_lkb);
+					depend_count++;
+				}
+				continue;
+			}
 
-			list_for_each_entry(granted_lkb, &r->locks, list) {
-				if (granted_lkb->lock.status==DLM_LKSTS_WAITING)
+			for (m = 0; m < DLM_MODE_COUNT; m++) {
+				if (__dlm_compat_matrix[m][rq + 1])
 					continue;
-				/* granted_lkb status is GRANTED or CONVERT */
-				add_waitfor(ls, waiting_lkb, granted_lkb);
-				depend_count++;
+
+				for (i = r->mode_first[m];
+				     i < r->mode_first[m + 1]; i++) {
+					add_waitfor(ls, waiting_lkb,
+						    r->granted[i]);
+					depend_count++;
+				}
 			}
 		}
 	}
 
-	log_group(ls, "create_waitfor_graph: depend_count %d", depend_count);
+	gettimeofday(&end, NULL);
+	log_group(ls, "create_waitfor_graph: depend_count %d time %.3f s",
+		  depend_count, dt_usec(&start, &end) * 1.e-6);
 }
 
 /* Assume a transaction that's not waiting on any locks will complete, release
@@ -1322,7 +1962,16 @@ static void create_waitfor_graph(struct lockspace *ls)
    blocked waiting on the removed transaction's now-released locks may now be
    unblocked, complete, release all held locks and exit.  Repeat this until
    no more transactions can be removed.  If there are transactions remaining,
-   then they are deadlocked. */
+   then they are deadlocked.
+
+   The transactions that remain are those in a cycle of the waitfor graph,
+   and those waiting (directly or through others) on one in a cycle, so
+   rather than repeatedly removing the ones that aren't waiting, these are
+   found in one pass.  Tarjan's algorithm finds the strongly connected
+   components of the graph, a component of more than one trans being a
+   cycle.  Each component is completed after all the components it waits
+   on, so whether a single trans is waiting on a blocked one is known when
+   its component is completed. */
 
 static void remove_waitfor(struct trans *tr, struct trans *remove_tr)
 {
@@ -1343,66 +1992,173 @@ static void remove_waitfor(struct trans *tr, struct trans *remove_tr)
 	}
 }
 
-/* remove_tr is not waiting for anything, assume it completes and goes away
-   and remove it from any other transaction's waitfor list */
+/* sets TR_BLOCKED on the trans that would remain, TR_IN_CYCLE on those of
+   them in a cycle; iterative since the graph can be deep */
 
-static void remove_trans(struct lockspace *ls, struct trans *remove_tr)
+static int find_blocked(struct lockspace *ls)
 {
-	struct trans *tr;
+	struct trans **stack, **call;
+	struct trans *root, *tr, *wf, *parent;
+	uint32_t flags;
+	int count = 0, index = 0, sp = 0, top, first, i;
 
 	list_for_each_entry(tr, &ls->transactions, list) {
-		if (tr == remove_tr)
+		tr->index = -1;
+		tr->next_waitfor = 0;
+		tr->flags = 0;
+		count++;
+	}
+
+	if (!count)
+		return 0;
+
+	stack = malloc(count * sizeof(struct trans *));
+	call = malloc(count * sizeof(struct trans *));
+	if (!stack || !call) {
+		free(stack);
+		free(call);
+		return -ENOMEM;
+	}
+
+	list_for_each_entry(root, &ls->transactions, list) {
+		if (root->index >= 0)
 			continue;
-		if (!remove_tr->others_waiting_on_us)
-			break;
-		remove_waitfor(tr, remove_tr);
+
+		root->index = root->lowlink = index++;
+		root->flags |= TR_ON_STACK;
+		stack[sp++] = root;
+		call[0] = root;
+		top = 1;
+
+		while (top) {
+			tr = call[top - 1];
+
+			if (tr->next_waitfor < tr->waitfor_alloc) {
+				wf = tr->waitfor[tr->next_waitfor++];
+				if (!wf)
+					continue;
+
+				if (wf->index < 0) {
+					wf->index = wf->lowlink = index++;
+					wf->flags |= TR_ON_STACK;
+					stack[sp++] = wf;
+					call[top++] = wf;
+				} else if ((wf->flags & TR_ON_STACK) &&
+					   wf->index < tr->lowlink) {
+					tr->lowlink = wf->index;
+				}
+				continue;
+			}
+
+			/* done with tr's waitfors */
+
+			top--;
+			if (top) {
+				parent = call[top - 1];
+				if (tr->lowlink < parent->lowlink)
+					parent->lowlink = tr->lowlink;
+			}
+
+			if (tr->lowlink != tr->index)
+				continue;
+
+			/* tr and the trans above it on the stack are a
+			   component, everything they wait on outside of it
+			   has been completed */
+
+			for (first = sp - 1; stack[first] != tr; first--)
+				;
+
+			if (sp - first > 1) {
+				flags = TR_BLOCKED | TR_IN_CYCLE;
+			} else {
+				flags = 0;
+				for (i = 0; i < tr->waitfor_alloc; i++) {
+					wf = tr->waitfor[i];
+					if (wf && (wf->flags & TR_BLOCKED)) {
+						flags = TR_BLOCKED;
+						break;
+					}
+				}
+			}
+
+			for (i = first; i < sp; i++) {
+				stack[i]->flags &= ~TR_ON_STACK;
+				stack[i]->flags |= flags;
+			}
+			sp = first;
+		}
 	}
 
-	if (remove_tr->others_waiting_on_us)
-		log_group(ls, "trans %llx removed others waiting %d",
-			  (unsigned long long)remove_tr->xid,
-			  remove_tr->others_waiting_on_us);
+	free(stack);
+	free(call);
+	return 0;
 }
 
+/* Returns the number of trans removed, or -1 if the graph couldn't be
+   reduced */
+
 static int reduce_waitfor_graph(struct lockspace *ls)
 {
-	struct trans *tr, *safe;
-	int blocked = 0;
-	int removed = 0;
+	struct timeval start, end;
+	struct trans *tr, *wf, *safe;
+	int blocked = 0, cycle = 0, removed = 0;
+	int i;
 
-	list_for_each_entry_safe(tr, safe, &ls->transactions, list) {
-		if (tr->waitfor_count) {
-			blocked++;
+	gettimeofday(&start, NULL);
+
+	if (find_blocked(ls) < 0) {
+		log_error("reduce_waitfor_graph no mem %u",
+			  ls->transactions_count);
+		return -1;
+	}
+
+	/* the unblocked trans complete, so the remaining ones stop waiting
+	   for them */
+
+	list_for_each_entry(tr, &ls->transactions, list) {
+		if (!(tr->flags & TR_BLOCKED))
 			continue;
+		blocked++;
+		if (tr->flags & TR_IN_CYCLE)
+			cycle++;
+
+		for (i = 0; i < tr->waitfor_alloc; i++) {
+			wf = tr->waitfor[i];
+			if (wf && !(wf->flags & TR_BLOCKED)) {
+				tr->waitfor[i] = NULL;
+				tr->waitfor_count--;
+				wf->others_waiting_on_us--;
+			}
 		}
-		remove_trans(ls, tr);
-		list_del(&tr->list);
-		if (tr->waitfor)
-			free(tr->waitfor);
-		free(tr);
+	}
+
+	list_for_each_entry_safe(tr, safe, &ls->transactions, list) {
+		if (tr->flags & TR_BLOCKED)
+			continue;
+		del_trans(ls, tr);
 		removed++;
 	}
 
-	log_group(ls, "reduce_waitfor_graph: %d blocked, %d removed",
-		  blocked, removed);
+	gettimeofday(&end, NULL);
+	log_group(ls, "reduce_waitfor_graph: %d blocked, %d in cycles, "
+		  "%d removed, time %.3f s", blocked, cycle, removed,
+		  dt_usec(&start, &end) * 1.e-6);
 	return removed;
 }
 
-static void reduce_waitfor_graph_loop(struct lockspace *ls)
-{
-	int removed;
-
-	while (1) {
-		removed = reduce_waitfor_graph(ls);
-		if (!removed)
-			break;
-	}
-}
+/* canceling a trans in a cycle breaks the cycle */
 
 static struct trans *find_trans_to_cancel(struct lockspace *ls)
 {
 	struct trans *tr;
 
+	list_for_each_entry(tr, &ls->transactions, list) {
+		if (!(tr->flags & TR_IN_CYCLE) || !tr->others_waiting_on_us)
+			continue;
+		return tr;
+	}
+
 	list_for_each_entry(tr, &ls->transactions, list) {
 		if (!tr->others_waiting_on_us)
 			continue;
@@ -1455,11 +2211,11 @@ static void cancel_trans(struct lockspace *ls)
 	   waitfor_count */
 	removed = reduce_waitfor_graph(ls);
 
-	if (!removed)
+	if (removed <= 0)
 		log_group(ls, "canceled trans not removed from graph");
 
-	/* now call reduce_waitfor_graph() in another loop and it
-	   should completely reduce */
+	/* now call reduce_waitfor_graph() again and it should completely
+	   reduce */
 }
 
 static void dump_trans(struct lockspace *ls, struct trans *tr)
@@ -1510,6 +2266,10 @@ static void dump_all_trans(struct lockspace *ls)
 
 static void find_deadlock(struct lockspace *ls)
 {
+	struct timeval start, end;
+
+	gettimeofday(&start, NULL);
+
 	if (list_empty(&ls->resources)) {
 		log_group(ls, "no deadlock: no resources");
 		goto out;
@@ -1524,7 +2284,9 @@ static void find_deadlock(struct lockspace *ls)
 	create_trans_list(ls);
 	create_waitfor_graph(ls);
 	dump_all_trans(ls);
-	reduce_waitfor_graph_loop(ls);
+
+	if (reduce_waitfor_graph(ls) < 0)
+		goto out;
 
 	if (list_empty(&ls->transactions)) {
 		log_group(ls, "no deadlock: all transactions reduced");
@@ -1535,7 +2297,7 @@ static void find_deadlock(struct lockspace *ls)
 	dump_all_trans(ls);
 
 	cancel_trans(ls);
-	reduce_waitfor_graph_loop(ls);
+	reduce_waitfor_graph(ls);
 
 	if (list_empty(&ls->transactions)) {
 		log_group(ls, "resolved deadlock with cancel");
@@ -1545,6 +2307,9 @@ static void find_deadlock(struct lockspace *ls)
 	log_error("deadlock resolution failed");
 	dump_all_trans(ls);
  out:
+	gettimeofday(&end, NULL);
+	log_group(ls, "find_deadlock: %u resources, time %.3f s",
+		  ls->resources_count, dt_usec(&start, &end) * 1.e-6);
 	send_cycle_end(ls);
 }
 
@@ -80,6 +80,7 @@ extern int poll_quorum;
 extern int poll_fs;
 extern int poll_ignore_plock;
 extern int poll_drop_plock;
+extern int poll_retrieve_plock;
 extern int plock_fd;
 extern int plock_ci;
 extern struct list_head lockspaces;
@@ -94,13 +95,13 @@ extern uint32_t plock_minor;
 extern uint32_t old_plock_minor;
 
 /* circular buffer of log_debug and log_error messages */
-extern char daemon_debug_buf[256];
+extern __thread char daemon_debug_buf[256];
 extern char dump_buf[DLMC_DUMP_SIZE];
 extern int dump_point;
 extern int dump_wrap;
 
 /* circular buffer of log_plock messages */
-extern char log_plock_line[256];
+extern __thread char log_plock_line[256];
 extern char log_plock_buf[DLMC_DUMP_SIZE];
 extern int log_plock_point;
 extern int log_plock_wrap;
@@ -160,7 +161,8 @@ enum {
 	DLM_MSG_DEADLK_CYCLE_START,
 	DLM_MSG_DEADLK_CYCLE_END,
 	DLM_MSG_DEADLK_CHECKPOINT_READY,
-	DLM_MSG_DEADLK_CANCEL_LOCK
+	DLM_MSG_DEADLK_CANCEL_LOCK,
+	DLM_MSG_PLOCK_BATCH
 };
 
 /* dlm_header flags */
@@ -178,7 +180,8 @@ struct dlm_header {
 	uint32_t global_id;     /* global unique id for this lockspace */
 	uint32_t flags;		/* DLM_MFLG_ */
 	uint32_t msgdata;       /* in-header payload depends on MSG type; lkid
-				   for deadlock, seq for lockspace membership */
+				   for deadlock, seq for lockspace membership,
+				   record count for plock batch */
 	uint32_t msgdata2;	/* second MSG-specific data */
 	uint64_t pad;
 };
@@ -212,6 +215,9 @@ struct lockspace {
 	uint32_t		associated_mg_id;
 	struct list_head	saved_messages;
 	struct list_head	plock_resources;
+	struct list_head	*plock_resources_hash;
+	unsigned int		plock_resources_hash_size;
+	unsigned int		plock_resources_count;
 	time_t			last_checkpoint_time;
 	time_t			last_plock_time;
 	struct timeval		drop_resources_last;
@@ -220,6 +226,11 @@ struct lockspace {
 	uint64_t		checkpoint_r_num_last;
 	uint32_t		checkpoint_r_count;
 	uint32_t		checkpoint_p_count;
+	struct plock_retrieve	*plock_retrieve;
+	int			plocks_stored_nodeid;
+	uint32_t		plocks_stored_flags;
+	uint32_t		plocks_stored_sig;
+	struct plock_worker	*plock_worker;
 
 	/* save copy of groupd member callback data for queries */
 
@@ -231,9 +242,18 @@ struct lockspace {
 	int			deadlk_low_nodeid;
 	struct list_head	deadlk_nodes;
 	uint64_t		deadlk_ckpt_handle;
+	uint32_t		deadlk_ckpt_writes;
+	uint64_t		deadlk_ckpt_sections;
+	uint64_t		deadlk_ckpt_bytes;
 	int			deadlk_confchg_init;
 	struct list_head	transactions;
 	struct list_head	resources;
+	struct list_head	*transactions_hash;
+	unsigned int		transactions_hash_size;
+	unsigned int		transactions_count;
+	struct list_head	*resources_hash;
+	unsigned int		resources_hash_size;
+	unsigned int		resources_count;
 	struct timeval		cycle_start_time;
 	struct timeval		cycle_end_time;
 	struct timeval		last_send_cycle_start;
@@ -273,6 +293,10 @@ void dlm_send_message(struct lockspace *ls, char *buf, int len);
 int dlm_join_lockspace(struct lockspace *ls);
 int dlm_leave_lockspace(struct lockspace *ls);
 const char *msg_name(int type);
+int plock_batch_supported(void);
+int plock_ckpt_bulk_supported(void);
+int deadlk_ckpt_stream_supported(void);
+void plocks_retrieved(struct lockspace *ls, uint32_t sig);
 void update_flow_control_status(void);
 void node_history_cluster_add(int nodeid);
 void node_history_cluster_remove(int nodeid);
@@ -334,15 +358,19 @@ void process_plocks(int ci);
 void drop_resources_all(void);
 int limit_plocks(void);
 void receive_plock(struct lockspace *ls, struct dlm_header *hd, int len);
+void receive_plock_batch(struct lockspace *ls, struct dlm_header *hd, int len);
 void receive_own(struct lockspace *ls, struct dlm_header *hd, int len);
 void receive_sync(struct lockspace *ls, struct dlm_header *hd, int len);
 void receive_drop(struct lockspace *ls, struct dlm_header *hd, int len);
 void process_saved_plocks(struct lockspace *ls);
 void close_plock_checkpoint(struct lockspace *ls);
 void store_plocks(struct lockspace *ls, uint32_t *sig);
-void retrieve_plocks(struct lockspace *ls, uint32_t *sig);
+int retrieve_plocks(struct lockspace *ls, uint32_t *sig);
+void retrieve_plocks_all(void);
+void retrieve_plocks_finish(struct lockspace *ls);
 void purge_plocks(struct lockspace *ls, int nodeid, int unmount);
 int fill_plock_dump_buf(struct lockspace *ls);
+void free_plock_resources(struct lockspace *ls);
 
 /* group.c */
 #define BUILD_GROUPD_COMPAT
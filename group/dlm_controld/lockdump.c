@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "lockdump.h"
+
+int lockdump_open(struct lockdump *ld, const char *path)
+{
+	ld->fd = open(path, O_RDONLY);
+	if (ld->fd < 0)
+		return -1;
+	ld->eof = 0;
+	ld->skip = 0;
+	ld->start = 0;
+	ld->end = 0;
+	return 0;
+}
+
+void lockdump_close(struct lockdump *ld)
+{
+	if (ld->fd >= 0)
+		close(ld->fd);
+	ld->fd = -1;
+}
+
+/* move the partial line to the front of buf and read more after it */
+
+static int fill_buf(struct lockdump *ld)
+{
+	int rv;
+
+	if (ld->start) {
+		memmove(ld->buf, ld->buf + ld->start, ld->end - ld->start);
+		ld->end -= ld->start;
+		ld->start = 0;
+	}
+
+	while (1) {
+		rv = read(ld->fd, ld->buf + ld->end,
+			  LOCKDUMP_BUF_SIZE - ld->end);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		break;
+	}
+
+	if (rv < 0)
+		return -1;
+	if (!rv)
+		ld->eof = 1;
+	ld->end += rv;
+	return 0;
+}
+
+char *lockdump_line(struct lockdump *ld)
+{
+	char *line, *nl;
+
+	while (1) {
+		line = ld->buf + ld->start;
+		nl = memchr(line, '\n', ld->end - ld->start);
+
+		if (nl) {
+			*nl = '\0';
+			ld->start = nl - ld->buf + 1;
+			if (ld->skip) {
+				ld->skip = 0;
+				continue;
+			}
+			return line;
+		}
+
+		if (ld->eof) {
+			if (ld->start == ld->end)
+				return NULL;
+			/* last line without a newline */
+			ld->buf[ld->end] = '\0';
+			ld->start = ld->end;
+			if (ld->skip) {
+				ld->skip = 0;
+				return NULL;
+			}
+			return line;
+		}
+
+		/* a line longer than the buffer is returned truncated, and
+		   the remainder is skipped */
+		if (!ld->start && ld->end == LOCKDUMP_BUF_SIZE) {
+			ld->buf[ld->end] = '\0';
+			ld->start = ld->end;
+			if (ld->skip)
+				continue;
+			ld->skip = 1;
+			return line;
+		}
+
+		if (fill_buf(ld) < 0)
+			return NULL;
+	}
+}
+
+static inline char *skip_spaces(char *p)
+{
+	while (*p == ' ' || *p == '\t')
+		p++;
+	return p;
+}
+
+int lockdump_hex(char **p, uint32_t *val)
+{
+	char *s = skip_spaces(*p);
+	uint32_t v = 0;
+	int n = 0;
+
+	while (1) {
+		if (*s >= '0' && *s <= '9')
+			v = (v << 4) | (*s - '0');
+		else if (*s >= 'a' && *s <= 'f')
+			v = (v << 4) | (*s - 'a' + 10);
+		else if (*s >= 'A' && *s <= 'F')
+			v = (v << 4) | (*s - 'A' + 10);
+		else
+			break;
+		s++;
+		n++;
+	}
+
+	if (!n)
+		return 0;
+	*val = v;
+	*p = s;
+	return 1;
+}
+
+int lockdump_u64(char **p, uint64_t *val)
+{
+	char *s = skip_spaces(*p);
+	uint64_t v = 0;
+	int n = 0;
+
+	while (*s >= '0' && *s <= '9') {
+		v = v * 10 + (*s - '0');
+		s++;
+		n++;
+	}
+
+	if (!n)
+		return 0;
+	*val = v;
+	*p = s;
+	return 1;
+}
+
+int lockdump_uint(char **p, unsigned int *val)
+{
+	uint64_t v;
+
+	if (!lockdump_u64(p, &v))
+		return 0;
+	*val = (unsigned int)v;
+	return 1;
+}
+
+int lockdump_int(char **p, int *val)
+{
+	char *s = skip_spaces(*p);
+	uint64_t v;
+	int neg = 0;
+
+	if (*s == '-') {
+		neg = 1;
+		s++;
+	}
+
+	if (!lockdump_u64(&s, &v))
+		return 0;
+	*val = neg ? -(int)v : (int)v;
+	*p = s;
+	return 1;
+}
+
+int lockdump_word(char **p, char *word, int size)
+{
+	char *s = skip_spaces(*p);
+	int n = 0;
+
+	while (*s && *s != ' ' && *s != '\t') {
+		if (n < size - 1)
+			word[n] = *s;
+		s++;
+		n++;
+	}
+
+	if (!n)
+		return 0;
+	word[n < size ? n : size - 1] = '\0';
+	*p = s;
+	return 1;
+}
+
+int lockdump_parse_lock(char *line, struct lockdump_lock *lock)
+{
+	char *p = line;
+	char *begin, *end;
+	unsigned int ownpid;
+	int val, n = 0;
+
+	if (!lockdump_hex(&p, &lock->id))
+		return n;
+	n++;
+	if (!lockdump_int(&p, &lock->nodeid))
+		return n;
+	n++;
+	if (!lockdump_hex(&p, &lock->remid))
+		return n;
+	n++;
+	if (!lockdump_uint(&p, &ownpid))
+		return n;
+	lock->ownpid = ownpid;
+	n++;
+	if (!lockdump_u64(&p, &lock->xid))
+		return n;
+	n++;
+	if (!lockdump_hex(&p, &lock->exflags))
+		return n;
+	n++;
+	if (!lockdump_hex(&p, &lock->flags))
+		return n;
+	n++;
+	if (!lockdump_int(&p, &val))
+		return n;
+	lock->status = val;
+	n++;
+	if (!lockdump_int(&p, &val))
+		return n;
+	lock->grmode = val;
+	n++;
+	if (!lockdump_int(&p, &val))
+		return n;
+	lock->rqmode = val;
+	n++;
+	if (!lockdump_u64(&p, &lock->time))
+		return n;
+	n++;
+	if (!lockdump_int(&p, &lock->r_nodeid))
+		return n;
+	n++;
+	if (!lockdump_int(&p, &lock->r_len))
+		return n;
+	n++;
+
+	/* the name is everything between the first and last quotes, since
+	   it may contain quotes itself */
+
+	lock->r_name = p;
+	lock->r_name_len = 0;
+
+	begin = strchr(p, '"');
+	if (!begin)
+		return n;
+	end = strrchr(begin + 1, '"');
+	if (!end)
+		end = begin + 1 + strlen(begin + 1);
+
+	lock->r_name = begin + 1;
+	lock->r_name_len = end - (begin + 1);
+	return n;
+}
+
+void lockdump_name(struct lockdump_lock *lock, char *name, int size)
+{
+	int len = lock->r_name_len;
+
+	if (len > size - 1)
+		len = size - 1;
+	memcpy(name, lock->r_name, len);
+	name[len] = '\0';
+}
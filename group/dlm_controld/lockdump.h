@@ -0,0 +1,69 @@
+#ifndef __LOCKDUMP_DOT_H__
+#define __LOCKDUMP_DOT_H__
+
+#include <stdint.h>
+
+/* Reading the dlm debugfs lock dumps, /sys/kernel/debug/dlm/<ls>_locks and
+   <ls>_all, used by both dlm_controld (deadlock detection) and dlm_tool.
+   The file is read in large chunks into the lockdump buffer and lines are
+   returned and parsed in place, so nothing is allocated per line. */
+
+#define LOCKDUMP_BUF_SIZE	65536
+
+/* the numeric fields of a _locks line before the resource name */
+#define LOCKDUMP_LOCK_FIELDS	13
+
+struct lockdump {
+	int fd;
+	int eof;
+	int skip;		/* discarding the rest of an overlong line */
+	unsigned int start;
+	unsigned int end;
+	char buf[LOCKDUMP_BUF_SIZE + 1];
+};
+
+/* a line from <ls>_locks:
+   id nodeid remid pid xid exflags flags sts grmode rqmode time_ms r_nodeid
+   r_len "r_name" */
+
+struct lockdump_lock {
+	uint32_t	id;
+	int		nodeid;
+	uint32_t	remid;
+	int		ownpid;
+	uint64_t	xid;
+	uint32_t	exflags;
+	uint32_t	flags;
+	int8_t		status;
+	int8_t		grmode;
+	int8_t		rqmode;
+	uint64_t	time;
+	int		r_nodeid;
+	int		r_len;
+	char		*r_name;	/* points into the line, not terminated */
+	int		r_name_len;
+};
+
+int lockdump_open(struct lockdump *ld, const char *path);
+void lockdump_close(struct lockdump *ld);
+
+/* Returns the next line without its newline, valid until the next call, or
+   NULL at the end of the file or on a read error (errno set). */
+char *lockdump_line(struct lockdump *ld);
+
+/* Returns the number of numeric fields parsed, LOCKDUMP_LOCK_FIELDS if the
+   line is valid. */
+int lockdump_parse_lock(char *line, struct lockdump_lock *lock);
+
+/* copies the resource name into name[size], terminated */
+void lockdump_name(struct lockdump_lock *lock, char *name, int size);
+
+/* Parse one space separated field at *p and move *p past it; return 1 if
+   a field was parsed, 0 if not. */
+int lockdump_hex(char **p, uint32_t *val);
+int lockdump_int(char **p, int *val);
+int lockdump_uint(char **p, unsigned int *val);
+int lockdump_u64(char **p, uint64_t *val);
+int lockdump_word(char **p, char *word, int size);
+
+#endif
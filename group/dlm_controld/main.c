@@ -17,6 +17,7 @@ static struct client *client = NULL;
 static struct pollfd *pollfd = NULL;
 static pthread_t query_thread;
 static pthread_mutex_t query_mutex;
+static pthread_mutex_t dump_mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct list_head fs_register_list;
 static int kernel_monitor_fd;
 
@@ -420,6 +421,8 @@ static void query_dump_debug(int fd)
 	int extra_len;
 	int len;
 
+	pthread_mutex_lock(&dump_mutex);
+
 	/* in the case of dump_wrap, extra_len will go in two writes,
 	   first the log tail, then the log head */
 	if (dump_wrap)
@@ -441,6 +444,8 @@ static void query_dump_debug(int fd)
 	dump_buf[dump_point] = '\0';
 
 	do_write(fd, dump_buf, len);
+
+	pthread_mutex_unlock(&dump_mutex);
 }
 
 static void query_dump_log_plock(int fd)
@@ -449,6 +454,8 @@ static void query_dump_log_plock(int fd)
 	int extra_len;
 	int len;
 
+	pthread_mutex_lock(&dump_mutex);
+
 	/* in the case of dump_wrap, extra_len will go in two writes,
 	   first the log tail, then the log head */
 	if (log_plock_wrap)
@@ -470,6 +477,8 @@ static void query_dump_log_plock(int fd)
 	log_plock_buf[log_plock_point] = '\0';
 
 	do_write(fd, log_plock_buf, len);
+
+	pthread_mutex_unlock(&dump_mutex);
 }
 
 static void query_dump_plocks(int fd, char *name)
@@ -1050,6 +1059,12 @@ static void loop(void)
 				poll_timeout = 1000;
 		}
 
+		if (poll_retrieve_plock) {
+			retrieve_plocks_all();
+			if (poll_retrieve_plock)
+				poll_timeout = 0;
+		}
+
 		query_unlock();
 	}
  out:
@@ -1136,11 +1151,17 @@ static void print_usage(void)
 	printf("		Default is %d\n", DEFAULT_ENABLE_QUORUM);
 	printf("  -d <num>	Enable (1) or disable (0) deadlock detection code\n");
 	printf("		Default is %d\n", DEFAULT_ENABLE_DEADLK);
+	printf("  -k <bytes>	Deadlock detection checkpoint section size\n");
+	printf("		Default is %d\n", DEFAULT_DEADLK_CKPT_CHUNK);
 	printf("  -p <num>	Enable (1) or disable (0) plock code for cluster fs\n");
 	printf("		Default is %d\n", DEFAULT_ENABLE_PLOCK);
 	printf("  -P		Enable plock debugging\n");
 	printf("  -l <limit>	Limit the rate of plock operations\n");
 	printf("		Default is %d, set to 0 for no limit\n", DEFAULT_PLOCK_RATE_LIMIT);
+	printf("  -b <num>	Max plock operations read from the kernel per wakeup\n");
+	printf("		Default is %d, set to 1 to read one at a time\n", DEFAULT_PLOCK_BATCH);
+	printf("  -T <num>	Enable (1) or disable (0) a plock thread per lockspace\n");
+	printf("		Default is %d\n", DEFAULT_PLOCK_THREADS);
 	printf("  -o <n>	Enable (1) or disable (0) plock ownership\n");
 	printf("		Default is %d\n", DEFAULT_PLOCK_OWNERSHIP);
 	printf("  -t <ms>	plock ownership drop resources time (milliseconds)\n");
@@ -1153,7 +1174,7 @@ static void print_usage(void)
 	printf("  -V		Print program version information, then exit\n");
 }
 
-#define OPTION_STRING "LDKg:f:q:d:p:Pl:o:t:c:a:hVr:"
+#define OPTION_STRING "LDKg:f:q:d:k:p:Pl:b:T:o:t:c:a:hVr:"
 
 static void read_arguments(int argc, char **argv)
 {
@@ -1204,6 +1225,11 @@ static void read_arguments(int argc, char **argv)
 			cfgd_enable_deadlk = atoi(optarg);
 			break;
 
+		case 'k':
+			optd_deadlk_ckpt_chunk = 1;
+			cfgd_deadlk_ckpt_chunk = atoi(optarg);
+			break;
+
 		case 'p':
 			optd_enable_plock = 1;
 			cfgd_enable_plock = atoi(optarg);
@@ -1219,6 +1245,16 @@ static void read_arguments(int argc, char **argv)
 			cfgd_plock_rate_limit = atoi(optarg);
 			break;
 
+		case 'b':
+			optd_plock_batch = 1;
+			cfgd_plock_batch = atoi(optarg);
+			break;
+
+		case 'T':
+			optd_plock_threads = 1;
+			cfgd_plock_threads = atoi(optarg);
+			break;
+
 		case 'o':
 			optd_plock_ownership = 1;
 			cfgd_plock_ownership = atoi(optarg);
@@ -1330,10 +1366,15 @@ int main(int argc, char **argv)
 	return 0;
 }
 
+/* The line buffers are per thread and the circular buffers are shared, since
+   plock worker threads log as well as the main thread. */
+
 void daemon_dump_save(void)
 {
 	int len, i;
 
+	pthread_mutex_lock(&dump_mutex);
+
 	len = strlen(daemon_debug_buf);
 
 	for (i = 0; i < len; i++) {
@@ -1344,12 +1385,16 @@ void daemon_dump_save(void)
 			dump_wrap = 1;
 		}
 	}
+
+	pthread_mutex_unlock(&dump_mutex);
 }
 
 void log_plock_save(void)
 {
 	int len, i;
 
+	pthread_mutex_lock(&dump_mutex);
+
 	len = strlen(log_plock_line);
 
 	for (i = 0; i < len; i++) {
@@ -1360,6 +1405,8 @@ void log_plock_save(void)
 			log_plock_wrap = 1;
 		}
 	}
+
+	pthread_mutex_unlock(&dump_mutex);
 }
 
 int daemon_debug_opt;
@@ -1370,6 +1417,7 @@ int poll_quorum;
 int poll_fs;
 int poll_ignore_plock;
 int poll_drop_plock;
+int poll_retrieve_plock;
 int plock_fd;
 int plock_ci;
 struct list_head lockspaces;
@@ -1382,11 +1430,11 @@ uint32_t control_minor;
 uint32_t monitor_minor;
 uint32_t plock_minor;
 uint32_t old_plock_minor;
-char daemon_debug_buf[256];
+__thread char daemon_debug_buf[256];
 char dump_buf[DLMC_DUMP_SIZE];
 int dump_point;
 int dump_wrap;
-char log_plock_line[256];
+__thread char log_plock_line[256];
 char log_plock_buf[DLMC_DUMP_SIZE];
 int log_plock_point;
 int log_plock_wrap;
@@ -1402,9 +1450,12 @@ int optd_debug_logfile;
 int optd_enable_fencing;
 int optd_enable_quorum;
 int optd_enable_deadlk;
+int optd_deadlk_ckpt_chunk;
 int optd_enable_plock;
 int optd_plock_debug;
 int optd_plock_rate_limit;
+int optd_plock_batch;
+int optd_plock_threads;
 int optd_plock_ownership;
 int optd_drop_resources_time;
 int optd_drop_resources_count;
@@ -1421,9 +1472,12 @@ int cfgd_debug_logfile		= DEFAULT_DEBUG_LOGFILE;
 int cfgd_enable_fencing         = DEFAULT_ENABLE_FENCING;
 int cfgd_enable_quorum          = DEFAULT_ENABLE_QUORUM;
 int cfgd_enable_deadlk          = DEFAULT_ENABLE_DEADLK;
+int cfgd_deadlk_ckpt_chunk      = DEFAULT_DEADLK_CKPT_CHUNK;
 int cfgd_enable_plock           = DEFAULT_ENABLE_PLOCK;
 int cfgd_plock_debug            = DEFAULT_PLOCK_DEBUG;
 int cfgd_plock_rate_limit       = DEFAULT_PLOCK_RATE_LIMIT;
+int cfgd_plock_batch            = DEFAULT_PLOCK_BATCH;
+int cfgd_plock_threads          = DEFAULT_PLOCK_THREADS;
 int cfgd_plock_ownership        = DEFAULT_PLOCK_OWNERSHIP;
 int cfgd_drop_resources_time    = DEFAULT_DROP_RESOURCES_TIME;
 int cfgd_drop_resources_count   = DEFAULT_DROP_RESOURCES_COUNT;
@@ -2,24 +2,70 @@
 #include "config.h"
 
 #include <linux/dlm_plock.h>
+#include <pthread.h>
 
 static uint32_t plock_read_count;
-static uint32_t plock_recv_count;
+static __thread uint32_t plock_recv_count;
 static uint32_t plock_rate_delays;
 static struct timeval plock_read_time;
-static struct timeval plock_recv_time;
+static __thread struct timeval plock_recv_time;
 static struct timeval plock_rate_last;
 
 static int plock_device_fd = -1;
 static SaCkptHandleT system_ckpt_handle;
 static SaCkptCallbacksT callbacks = { 0, 0 };
 static SaVersionT version = { 'B', 1, 1 };
-static char section_buf[1024 * 1024];
+static char *section_buf;
+static uint32_t section_buf_size;
 static uint32_t section_len;
 static int need_fsid_translation = 0;
 
 extern int message_flow_control_on;
 
+/* process_plocks() reads up to cfgd_plock_batch ops from the kernel each time
+   the plock device is readable.  While the batch is processed, results for
+   local ops are queued and written back with one writev, and plock messages
+   for unowned resources are combined into DLM_MSG_PLOCK_BATCH messages.
+   The batch state is per thread; plock worker threads batch the results and
+   messages for the ops they process in the same way. */
+
+#define PLOCK_BATCH_MAX 1024
+
+static __thread int batch_size;
+static __thread int in_batch;
+static __thread int result_count;
+static __thread int send_count;
+static __thread struct lockspace *send_ls;
+static __thread struct dlm_plock_info *read_batch;
+static __thread struct dlm_plock_info *result_batch;
+static __thread struct iovec *batch_iov;
+static __thread char *send_batch_buf;
+
+/* With plock_threads enabled, the plock state of each lockspace is looked
+   after by a worker thread of its own, so that plock traffic in one lockspace
+   doesn't hold up recovery or plocks in the others.  The main thread still
+   reads ops from the kernel and receives cpg messages, but it only queues the
+   plock ones on ls->plock_worker, in the order they were read or delivered,
+   and the worker does the rest.  Before the main thread looks at or changes
+   plock state itself (confchg, checkpoints, dropping resources) it calls
+   plock_worker_sync() to wait for the worker to finish all it was given.
+   The main thread is the only one that queues work, so the worker then stays
+   idle until the main thread gives it more, and the plock state sees the same
+   order of events as it would with a single thread.  The query thread takes
+   state_mutex to read plock state while the worker may be running. */
+
+struct plock_worker {
+	struct lockspace	*ls;
+	pthread_t		thread;
+	pthread_mutex_t		mutex;	     /* queue, busy, stop */
+	pthread_cond_t		cond;	     /* work queued or stop */
+	pthread_cond_t		idle_cond;   /* queue empty and not busy */
+	pthread_mutex_t		state_mutex; /* held while doing work */
+	struct list_head	queue;	     /* struct save_msg */
+	int			busy;
+	int			stop;
+};
+
 struct pack_plock {
 	uint64_t start;
 	uint64_t end;
@@ -32,10 +78,88 @@ struct pack_plock {
 	uint32_t pad;
 };
 
+/* Bulk checkpoint format, written when all nodes run daemon protocol 1.3.
+   Resources are sorted by inode number and packed, each as a pack_resource
+   followed by its pack_plocks, into sections of at most PLOCK_CKPT_CHUNK
+   bytes named "c<n>".  A resource with too many plocks for the rest of a
+   chunk continues at the start of the next one.  Section "i" holds a
+   pack_index followed by a pack_chunk for each chunk giving the range of
+   inode numbers in it, so a new node reading the chunks in order knows
+   which inodes it has complete state for.  The old format has one section
+   per resource named "r<inodenum>.<owner>" containing only pack_plocks. */
+
+#define PLOCK_CKPT_VERSION	1
+#define PLOCK_CKPT_CHUNK	(64 * 1024)
+#define INDEX_SECTION		"i"
+
+struct pack_index {
+	uint32_t version;
+	uint32_t chunk_count;
+	uint32_t r_count;
+	uint32_t p_count;
+};
+
+struct pack_chunk {
+	uint64_t first;		/* first inode number in chunk */
+	uint64_t last;		/* last inode number in chunk */
+	uint32_t len;
+	uint32_t pad;
+};
+
+struct pack_resource {
+	uint64_t number;
+	int32_t owner;
+	uint32_t count;		/* pack_plocks that follow in this chunk */
+};
+
+/* a new node reading a bulk checkpoint reads one chunk each time through the
+   main loop; in between, saved plock messages for inodes it already has the
+   ckpt state for are processed (see process_ready_plocks), and a local op
+   for an inode it doesn't have yet first reads up to that inode's chunk
+   (see retrieve_plocks_upto) */
+
+struct plock_retrieve {
+	SaCkptCheckpointHandleT	h;
+	struct pack_chunk	*chunks;
+	uint32_t		chunk_count;
+	uint32_t		next;	   /* next chunk to read */
+	struct resource		*last_r;   /* may continue in next chunk */
+	uint32_t		r_count;
+	uint32_t		p_count;
+	uint64_t		r_num_first;
+	uint64_t		r_num_last;
+};
+
+/* Resources are kept on ls->plock_resources in creation order (which
+   drop_resources() relies on to find the oldest) and also hashed by inode
+   number so that finding the resource for each plock op doesn't require
+   walking every resource in the lockspace.  The hash table doubles in size
+   when the average chain length reaches RESOURCE_HASH_LOAD. */
+
+#define RESOURCE_HASH_MIN	256
+#define RESOURCE_HASH_MAX	(1 << 22)
+#define RESOURCE_HASH_LOAD	2
+
 #define R_GOT_UNOWN 0x00000001 /* have received owner=0 message */
 
+/* Granted locks and waiters on a resource are each indexed by range in a
+   treap keyed on the range start and augmented with the largest range end in
+   each subtree, so the locks or waiters overlapping a range can be found
+   without looking at the others.  The locks and waiters lists are kept as
+   well, for ordered iteration. */
+
+struct range_node {
+	struct range_node	*left;
+	struct range_node	*right;
+	uint64_t		start;
+	uint64_t		end;
+	uint64_t		max_end;   /* largest end in this subtree */
+	uint32_t		prio;
+};
+
 struct resource {
 	struct list_head	list;	   /* list of resources */
+	struct list_head	hash_list; /* ls->plock_resources_hash bucket */
 	uint64_t		number;
 	int                     owner;     /* nodeid or 0 for unowned */
 	uint32_t		flags;
@@ -43,13 +167,21 @@ struct resource {
 	struct list_head	locks;	   /* one lock for each range */
 	struct list_head	waiters;
 	struct list_head        pending;   /* discovering r owner */
+	struct list_head	recheck;   /* waiters do_waiters must check */
+	struct range_node	*lock_tree;
+	struct range_node	*waiter_tree;
+	uint64_t		waiter_seq;
+	uint32_t		waiter_count;
 };
 
 #define P_SYNCING 0x00000001 /* plock has been sent as part of sync but not
 				yet received */
+#define P_CANDIDATE 0x00000002 /* waiter is on the do_waiters candidate list */
 
 struct posix_lock {
 	struct list_head	list;	   /* resource locks or waiters list */
+	struct list_head	scan;	   /* lock_internal/unlock_internal */
+	struct range_node	range;	   /* r->lock_tree */
 	uint32_t		pid;
 	uint64_t		owner;
 	uint64_t		start;
@@ -61,10 +193,16 @@ struct posix_lock {
 
 struct lock_waiter {
 	struct list_head	list;
+	struct list_head	recheck;   /* r->recheck */
+	struct range_node	range;	   /* r->waiter_tree */
+	uint64_t		seq;	   /* order added to r->waiters */
 	uint32_t		flags;
 	struct dlm_plock_info	info;
 };
 
+/* also used for work queued to a plock worker, where type 0 is an op read
+   from the kernel and buf the dlm_plock_info */
+
 struct save_msg {
 	struct list_head list;
 	int nodeid;
@@ -77,6 +215,10 @@ struct save_msg {
 static void send_own(struct lockspace *ls, struct resource *r, int owner);
 static void save_pending_plock(struct lockspace *ls, struct resource *r,
 			       struct dlm_plock_info *in);
+static int plock_worker_queue(struct lockspace *ls, int type, void *buf,
+			      int len);
+static void plock_worker_sync(struct lockspace *ls);
+static void retrieve_plocks_upto(struct lockspace *ls, uint64_t number);
 
 
 static int got_unown(struct resource *r)
@@ -234,11 +376,86 @@ static uint64_t dt_usec(struct timeval *start, struct timeval *stop)
 	return dt;
 }
 
+static unsigned int resource_hash(uint64_t number, unsigned int size)
+{
+	/* size is a power of two; multiplicative hash spreads the mostly
+	   sequential inode numbers across the buckets */
+	return (unsigned int)((number * 0x9E3779B97F4A7C15ULL) >> 32) &
+	       (size - 1);
+}
+
+static int resize_resource_hash(struct lockspace *ls, unsigned int size)
+{
+	struct list_head *hash;
+	struct resource *r;
+	unsigned int i;
+
+	hash = malloc(size * sizeof(struct list_head));
+	if (!hash)
+		return -ENOMEM;
+
+	for (i = 0; i < size; i++)
+		INIT_LIST_HEAD(&hash[i]);
+
+	list_for_each_entry(r, &ls->plock_resources, list)
+		list_add_tail(&r->hash_list,
+			      &hash[resource_hash(r->number, size)]);
+
+	if (ls->plock_resources_hash)
+		free(ls->plock_resources_hash);
+	ls->plock_resources_hash = hash;
+	ls->plock_resources_hash_size = size;
+	return 0;
+}
+
+/* if the hash table can't be allocated or grown we carry on with what we
+   have; search_resource() falls back to the list when there's no table */
+
+static void add_resource(struct lockspace *ls, struct resource *r)
+{
+	unsigned int size = ls->plock_resources_hash_size;
+
+	list_add_tail(&r->list, &ls->plock_resources);
+	ls->plock_resources_count++;
+
+	if (ls->plock_resources_hash)
+		list_add_tail(&r->hash_list,
+			      &ls->plock_resources_hash[resource_hash(r->number,
+									size)]);
+	else
+		INIT_LIST_HEAD(&r->hash_list);
+
+	if (!size)
+		resize_resource_hash(ls, RESOURCE_HASH_MIN);
+	else if (ls->plock_resources_count > size * RESOURCE_HASH_LOAD &&
+		 size < RESOURCE_HASH_MAX)
+		resize_resource_hash(ls, size * 2);
+}
+
+static void del_resource(struct lockspace *ls, struct resource *r)
+{
+	list_del(&r->list);
+	list_del(&r->hash_list);
+	ls->plock_resources_count--;
+}
+
 static struct resource *search_resource(struct lockspace *ls, uint64_t number)
 {
+	struct list_head *head;
 	struct resource *r;
 
-	list_for_each_entry(r, &ls->plock_resources, list) {
+	if (!ls->plock_resources_hash) {
+		list_for_each_entry(r, &ls->plock_resources, list) {
+			if (r->number == number)
+				return r;
+		}
+		return NULL;
+	}
+
+	head = &ls->plock_resources_hash[resource_hash(number,
+					 ls->plock_resources_hash_size)];
+
+	list_for_each_entry(r, head, hash_list) {
 		if (r->number == number)
 			return r;
 	}
@@ -272,13 +489,14 @@ static int find_resource(struct lockspace *ls, uint64_t number, int create,
 	INIT_LIST_HEAD(&r->locks);
 	INIT_LIST_HEAD(&r->waiters);
 	INIT_LIST_HEAD(&r->pending);
+	INIT_LIST_HEAD(&r->recheck);
 
 	if (cfgd_plock_ownership)
 		r->owner = -1;
 	else
 		r->owner = 0;
 
-	list_add_tail(&r->list, &ls->plock_resources);
+	add_resource(ls, r);
  out:
 	if (r)
 		gettimeofday(&r->last_access, NULL);
@@ -286,18 +504,210 @@ static int find_resource(struct lockspace *ls, uint64_t number, int create,
 	return rv;
 }
 
-static void put_resource(struct resource *r)
+static void put_resource(struct lockspace *ls, struct resource *r)
 {
 	/* with ownership, resources are only freed via drop messages */
 	if (cfgd_plock_ownership)
 		return;
 
 	if (list_empty(&r->locks) && list_empty(&r->waiters)) {
-		list_del(&r->list);
+		del_resource(ls, r);
 		free(r);
 	}
 }
 
+static uint32_t range_prio(void)
+{
+	static __thread uint32_t seed = 2463534242U;
+
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static void range_update(struct range_node *n)
+{
+	n->max_end = n->end;
+	if (n->left && n->left->max_end > n->max_end)
+		n->max_end = n->left->max_end;
+	if (n->right && n->right->max_end > n->max_end)
+		n->max_end = n->right->max_end;
+}
+
+static void range_rotate_left(struct range_node **root)
+{
+	struct range_node *n = *root, *c = n->right;
+
+	n->right = c->left;
+	c->left = n;
+	range_update(n);
+	range_update(c);
+	*root = c;
+}
+
+static void range_rotate_right(struct range_node **root)
+{
+	struct range_node *n = *root, *c = n->left;
+
+	n->left = c->right;
+	c->right = n;
+	range_update(n);
+	range_update(c);
+	*root = c;
+}
+
+/* nodes are ordered by start, and by address for equal starts */
+
+static int range_less(struct range_node *a, struct range_node *b)
+{
+	if (a->start != b->start)
+		return a->start < b->start;
+	return a < b;
+}
+
+static void range_insert(struct range_node **root, struct range_node *n)
+{
+	struct range_node *t = *root;
+
+	if (!t) {
+		n->left = NULL;
+		n->right = NULL;
+		n->max_end = n->end;
+		n->prio = range_prio();
+		*root = n;
+		return;
+	}
+
+	if (range_less(n, t)) {
+		range_insert(&t->left, n);
+		if (t->left->prio > t->prio)
+			range_rotate_right(root);
+		else
+			range_update(t);
+	} else {
+		range_insert(&t->right, n);
+		if (t->right->prio > t->prio)
+			range_rotate_left(root);
+		else
+			range_update(t);
+	}
+}
+
+static void range_remove(struct range_node **root, struct range_node *n)
+{
+	struct range_node *t = *root;
+
+	if (!t)
+		return;
+
+	if (t == n) {
+		if (!t->left) {
+			*root = t->right;
+			return;
+		}
+		if (!t->right) {
+			*root = t->left;
+			return;
+		}
+		if (t->left->prio > t->right->prio) {
+			range_rotate_right(root);
+			range_remove(&(*root)->right, n);
+		} else {
+			range_rotate_left(root);
+			range_remove(&(*root)->left, n);
+		}
+		range_update(*root);
+		return;
+	}
+
+	if (range_less(n, t))
+		range_remove(&t->left, n);
+	else
+		range_remove(&t->right, n);
+	range_update(t);
+}
+
+/* call fn for each node overlapping start-end, in start order, until fn
+   returns non-zero; fn must not change the tree */
+
+static int range_search(struct range_node *t, uint64_t start, uint64_t end,
+			int (*fn)(struct range_node *n, void *arg), void *arg)
+{
+	int rv;
+
+	if (!t || t->max_end < start)
+		return 0;
+
+	rv = range_search(t->left, start, end, fn, arg);
+	if (rv)
+		return rv;
+
+	if (t->start > end)
+		return 0;
+
+	if (t->end >= start) {
+		rv = fn(t, arg);
+		if (rv)
+			return rv;
+	}
+
+	return range_search(t->right, start, end, fn, arg);
+}
+
+static void link_lock(struct resource *r, struct posix_lock *po)
+{
+	po->range.start = po->start;
+	po->range.end = po->end;
+	list_add_tail(&po->list, &r->locks);
+	range_insert(&r->lock_tree, &po->range);
+}
+
+static void del_lock(struct resource *r, struct posix_lock *po)
+{
+	range_remove(&r->lock_tree, &po->range);
+	list_del(&po->list);
+	free(po);
+}
+
+static void set_lock_range(struct resource *r, struct posix_lock *po,
+			   uint64_t start, uint64_t end)
+{
+	range_remove(&r->lock_tree, &po->range);
+	po->start = start;
+	po->end = end;
+	po->range.start = start;
+	po->range.end = end;
+	range_insert(&r->lock_tree, &po->range);
+}
+
+/* recheck: the waiter may not be blocked by the current locks (it came from
+   another node or a checkpoint), so do_waiters needs to look at it the next
+   time it runs, whatever range that is for */
+
+static void link_waiter(struct resource *r, struct lock_waiter *w, int recheck)
+{
+	w->seq = ++r->waiter_seq;
+	w->range.start = w->info.start;
+	w->range.end = w->info.end;
+	list_add_tail(&w->list, &r->waiters);
+	range_insert(&r->waiter_tree, &w->range);
+	r->waiter_count++;
+
+	if (recheck)
+		list_add_tail(&w->recheck, &r->recheck);
+	else
+		INIT_LIST_HEAD(&w->recheck);
+}
+
+static void unlink_waiter(struct resource *r, struct lock_waiter *w)
+{
+	range_remove(&r->waiter_tree, &w->range);
+	list_del(&w->list);
+	list_del(&w->recheck);
+	r->waiter_count--;
+}
+
 static inline int ranges_overlap(uint64_t start1, uint64_t end1,
 				 uint64_t start2, uint64_t end2)
 {
@@ -397,34 +807,77 @@ static int shrink_range2(uint64_t *start2, uint64_t *end2,
 	return error;
 }
 
-static int shrink_range(struct posix_lock *po, uint64_t start, uint64_t end)
+static int shrink_range(struct resource *r, struct posix_lock *po,
+			uint64_t start, uint64_t end)
+{
+	uint64_t start2 = po->start, end2 = po->end;
+	int rv;
+
+	rv = shrink_range2(&start2, &end2, start, end);
+	if (!rv)
+		set_lock_range(r, po, start2, end2);
+	return rv;
+}
+
+struct range_arg {
+	struct dlm_plock_info	*in;
+	struct posix_lock	*po;	   /* conflict_fn result */
+	struct list_head	*list;	   /* owner_fn result */
+};
+
+static int conflict_fn(struct range_node *n, void *arg)
 {
-	return shrink_range2(&po->start, &po->end, start, end);
+	struct posix_lock *po = container_of(n, struct posix_lock, range);
+	struct range_arg *ra = arg;
+
+	if (po->nodeid == ra->in->nodeid && po->owner == ra->in->owner)
+		return 0;
+
+	if (ra->in->ex || po->ex) {
+		ra->po = po;
+		return 1;
+	}
+	return 0;
 }
 
 static int is_conflict(struct resource *r, struct dlm_plock_info *in, int get)
 {
-	struct posix_lock *po;
+	struct range_arg ra = { .in = in };
 
-	list_for_each_entry(po, &r->locks, list) {
-		if (po->nodeid == in->nodeid && po->owner == in->owner)
-			continue;
-		if (!ranges_overlap(po->start, po->end, in->start, in->end))
-			continue;
+	if (!range_search(r->lock_tree, in->start, in->end, conflict_fn, &ra))
+		return 0;
 
-		if (in->ex || po->ex) {
-			if (get) {
-				in->ex = po->ex;
-				in->pid = po->pid;
-				in->start = po->start;
-				in->end = po->end;
-			}
-			return 1;
-		}
+	if (get) {
+		in->ex = ra.po->ex;
+		in->pid = ra.po->pid;
+		in->start = ra.po->start;
+		in->end = ra.po->end;
 	}
+	return 1;
+}
+
+/* add the locks held by the owner of in that overlap in's range to the list,
+   so they can be changed after the tree search is done */
+
+static int owner_fn(struct range_node *n, void *arg)
+{
+	struct posix_lock *po = container_of(n, struct posix_lock, range);
+	struct range_arg *ra = arg;
+
+	if (po->nodeid == ra->in->nodeid && po->owner == ra->in->owner)
+		list_add_tail(&po->scan, ra->list);
 	return 0;
 }
 
+static void owner_locks(struct resource *r, struct dlm_plock_info *in,
+			struct list_head *list)
+{
+	struct range_arg ra = { .in = in, .list = list };
+
+	INIT_LIST_HEAD(list);
+	range_search(r->lock_tree, in->start, in->end, owner_fn, &ra);
+}
+
 static int add_lock(struct resource *r, uint32_t nodeid, uint64_t owner,
 		    uint32_t pid, int ex, uint64_t start, uint64_t end)
 {
@@ -441,7 +894,7 @@ static int add_lock(struct resource *r, uint32_t nodeid, uint64_t owner,
 	po->owner = owner;
 	po->pid = pid;
 	po->ex = ex;
-	list_add_tail(&po->list, &r->locks);
+	link_lock(r, po);
 
 	return 0;
 }
@@ -463,8 +916,7 @@ static int lock_case1(struct posix_lock *po, struct resource *r,
 	if (rv)
 		goto out;
 
-	po->start = in->start;
-	po->end = in->end;
+	set_lock_range(r, po, in->start, in->end);
 	po->ex = in->ex;
 
 	rv = add_lock(r, in->nodeid, in->owner, in->pid, !in->ex, start2, end2);
@@ -493,8 +945,7 @@ static int lock_case2(struct posix_lock *po, struct resource *r,
 	if (rv)
 		goto out;
 
-	po->start = in->start;
-	po->end = in->end;
+	set_lock_range(r, po, in->start, in->end);
 	po->ex = in->ex;
  out:
 	return rv;
@@ -504,13 +955,15 @@ static int lock_internal(struct lockspace *ls, struct resource *r,
 			 struct dlm_plock_info *in)
 {
 	struct posix_lock *po, *safe;
+	struct list_head scan;
 	int rv = 0;
 
-	list_for_each_entry_safe(po, safe, &r->locks, list) {
-		if (po->nodeid != in->nodeid || po->owner != in->owner)
-			continue;
-		if (!ranges_overlap(po->start, po->end, in->start, in->end))
-			continue;
+	/* an owner's locks don't overlap each other, so the order they are
+	   looked at in doesn't matter */
+
+	owner_locks(r, in, &scan);
+
+	list_for_each_entry_safe(po, safe, &scan, scan) {
 
 		/* existing range (RE) overlaps new range (RN) */
 
@@ -539,15 +992,14 @@ static int lock_internal(struct lockspace *ls, struct resource *r,
 			goto out;
 
 		case 3:
-			list_del(&po->list);
-			free(po);
+			del_lock(r, po);
 			break;
 
 		case 4:
 			if (po->start < in->start)
-				po->end = in->start - 1;
+				set_lock_range(r, po, po->start, in->start - 1);
 			else
-				po->start = in->end + 1;
+				set_lock_range(r, po, in->end + 1, po->end);
 			break;
 
 		default:
@@ -567,13 +1019,12 @@ static int unlock_internal(struct lockspace *ls, struct resource *r,
 			   struct dlm_plock_info *in)
 {
 	struct posix_lock *po, *safe;
+	struct list_head scan;
 	int rv = 0;
 
-	list_for_each_entry_safe(po, safe, &r->locks, list) {
-		if (po->nodeid != in->nodeid || po->owner != in->owner)
-			continue;
-		if (!ranges_overlap(po->start, po->end, in->start, in->end))
-			continue;
+	owner_locks(r, in, &scan);
+
+	list_for_each_entry_safe(po, safe, &scan, scan) {
 
 		/* existing range (RE) overlaps new range (RN) */
 
@@ -582,15 +1033,14 @@ static int unlock_internal(struct lockspace *ls, struct resource *r,
 		case 0:
 			/* ranges the same - just remove the existing lock */
 
-			list_del(&po->list);
-			free(po);
+			del_lock(r, po);
 			goto out;
 
 		case 1:
 			/* RN within RE and starts or ends on RE boundary -
 			 * shrink and update RE */
 
-			rv = shrink_range(po, in->start, in->end);
+			rv = shrink_range(r, po, in->start, in->end);
 			goto out;
 
 		case 2:
@@ -599,15 +1049,14 @@ static int unlock_internal(struct lockspace *ls, struct resource *r,
 
 			rv = add_lock(r, in->nodeid, in->owner, in->pid,
 				      po->ex, in->end + 1, po->end);
-			po->end = in->start - 1;
+			set_lock_range(r, po, po->start, in->start - 1);
 			goto out;
 
 		case 3:
 			/* RE within RN - remove RE, then continue checking
 			 * because RN could cover other locks */
 
-			list_del(&po->list);
-			free(po);
+			del_lock(r, po);
 			continue;
 
 		case 4:
@@ -615,7 +1064,7 @@ static int unlock_internal(struct lockspace *ls, struct resource *r,
 			 * update RE, then continue because RN could cover
 			 * other locks */
 
-			rv = shrink_range(po, in->start, in->end);
+			rv = shrink_range(r, po, in->start, in->end);
 			continue;
 
 		default:
@@ -628,7 +1077,7 @@ static int unlock_internal(struct lockspace *ls, struct resource *r,
 }
 
 static int add_waiter(struct lockspace *ls, struct resource *r,
-		      struct dlm_plock_info *in)
+		      struct dlm_plock_info *in, int recheck)
 
 {
 	struct lock_waiter *w;
@@ -636,11 +1085,55 @@ static int add_waiter(struct lockspace *ls, struct resource *r,
 	w = malloc(sizeof(struct lock_waiter));
 	if (!w)
 		return -ENOMEM;
+	memset(w, 0, sizeof(struct lock_waiter));
 	memcpy(&w->info, in, sizeof(struct dlm_plock_info));
-	list_add_tail(&w->list, &r->waiters);
+	link_waiter(r, w, recheck);
 	return 0;
 }
 
+/* The device takes one result per write, so a writev of queued results is
+   handled as a series of writes by the kernel.  If one fails the ones after
+   it are not written, so we write those individually. */
+
+static void flush_results(void)
+{
+	int i, rv, done;
+
+	if (!result_count)
+		return;
+
+	for (i = 0; i < result_count; i++) {
+		batch_iov[i].iov_base = &result_batch[i];
+		batch_iov[i].iov_len = sizeof(struct dlm_plock_info);
+	}
+
+	rv = writev(plock_device_fd, batch_iov, result_count);
+
+	if (rv != result_count * sizeof(struct dlm_plock_info)) {
+		done = rv > 0 ? rv / sizeof(struct dlm_plock_info) : 0;
+		log_debug("flush_results wrote %d of %d errno %d",
+			  done, result_count, errno);
+		for (i = done + 1; i < result_count; i++)
+			write(plock_device_fd, &result_batch[i],
+			      sizeof(struct dlm_plock_info));
+	}
+
+	result_count = 0;
+}
+
+static void write_info(struct dlm_plock_info *in)
+{
+	if (!in_batch) {
+		write(plock_device_fd, in, sizeof(struct dlm_plock_info));
+		return;
+	}
+
+	memcpy(&result_batch[result_count++], in,
+	       sizeof(struct dlm_plock_info));
+	if (result_count == batch_size)
+		flush_results();
+}
+
 static void write_result(struct lockspace *ls, struct dlm_plock_info *in,
 			 int rv)
 {
@@ -648,35 +1141,151 @@ static void write_result(struct lockspace *ls, struct dlm_plock_info *in,
 		in->fsid = ls->associated_mg_id;
 
 	in->rv = rv;
-	write(plock_device_fd, in, sizeof(struct dlm_plock_info));
+	write_info(in);
 }
 
-static void do_waiters(struct lockspace *ls, struct resource *r)
+/* Waiters are granted in the order they were added.  A waiter that doesn't
+   overlap the range that changed, and isn't on r->recheck, was in conflict
+   the last time it was looked at and still is, so only the waiters
+   overlapping start-end and those on r->recheck are looked at (candidates).
+   Granting a waiter only changes locks within its range, which can unblock
+   other waiters overlapping that range: the ones after it become candidates
+   in this pass, the ones before it are left on r->recheck for the next call,
+   just as a single pass over the waiters list would do. */
+
+static __thread struct lock_waiter **candidates;
+static __thread unsigned int candidates_size;
+
+struct candidate_arg {
+	struct resource		*r;
+	uint64_t		seq;	   /* waiters after this are candidates */
+	unsigned int		count;
+};
+
+static int candidate_cmp(const void *a, const void *b)
 {
-	struct lock_waiter *w, *safe;
-	struct dlm_plock_info *in;
+	const struct lock_waiter *wa = *(struct lock_waiter * const *)a;
+	const struct lock_waiter *wb = *(struct lock_waiter * const *)b;
+
+	if (wa->seq < wb->seq)
+		return -1;
+	return wa->seq > wb->seq;
+}
+
+static int candidate_fn(struct range_node *n, void *arg)
+{
+	struct lock_waiter *w = container_of(n, struct lock_waiter, range);
+	struct candidate_arg *ca = arg;
+
+	if (w->flags & P_CANDIDATE)
+		return 0;
+
+	list_del_init(&w->recheck);
+
+	if (w->seq > ca->seq) {
+		w->flags |= P_CANDIDATE;
+		candidates[ca->count++] = w;
+	} else
+		list_add_tail(&w->recheck, &ca->r->recheck);
+	return 0;
+}
+
+static void grant_waiter(struct lockspace *ls, struct resource *r,
+			 struct lock_waiter *w)
+{
+	struct dlm_plock_info *in = &w->info;
 	int rv;
 
-	list_for_each_entry_safe(w, safe, &r->waiters, list) {
-		in = &w->info;
+	unlink_waiter(r, w);
+
+	/*
+	log_group(ls, "take waiter %llx %llx-%llx %d/%u/%llx",
+		  in->number, in->start, in->end,
+		  in->nodeid, in->pid, in->owner);
+	*/
+
+	rv = lock_internal(ls, r, in);
+
+	if (in->nodeid == our_nodeid)
+		write_result(ls, in, rv);
+
+	free(w);
+}
+
+/* used if the candidates array can't be allocated */
+
+static void do_all_waiters(struct lockspace *ls, struct resource *r)
+{
+	struct lock_waiter *w, *safe;
 
-		if (is_conflict(r, in, 0))
+	list_for_each_entry_safe(w, safe, &r->recheck, recheck)
+		list_del_init(&w->recheck);
+
+	list_for_each_entry_safe(w, safe, &r->waiters, list) {
+		if (is_conflict(r, &w->info, 0))
 			continue;
+		grant_waiter(ls, r, w);
+	}
+}
 
-		list_del(&w->list);
+static void do_waiters(struct lockspace *ls, struct resource *r,
+		       uint64_t start, uint64_t end)
+{
+	struct lock_waiter *w, *safe, **new;
+	struct candidate_arg ca;
+	uint64_t wstart, wend;
+	unsigned int i, count;
 
-		/*
-		log_group(ls, "take waiter %llx %llx-%llx %d/%u/%llx",
-			  in->number, in->start, in->end,
-			  in->nodeid, in->pid, in->owner);
-		*/
+	if (!r->waiter_count)
+		return;
 
-		rv = lock_internal(ls, r, in);
+	if (r->waiter_count > candidates_size) {
+		count = candidates_size ? candidates_size : 64;
+		while (count < r->waiter_count)
+			count *= 2;
+		new = realloc(candidates, count * sizeof(struct lock_waiter *));
+		if (!new) {
+			do_all_waiters(ls, r);
+			return;
+		}
+		candidates = new;
+		candidates_size = count;
+	}
 
-		if (in->nodeid == our_nodeid)
-			write_result(ls, in, rv);
+	memset(&ca, 0, sizeof(ca));
+	ca.r = r;
 
-		free(w);
+	list_for_each_entry_safe(w, safe, &r->recheck, recheck) {
+		list_del_init(&w->recheck);
+		w->flags |= P_CANDIDATE;
+		candidates[ca.count++] = w;
+	}
+
+	/* waiter seq starts at 1, so every waiter found here is a candidate */
+	ca.seq = 0;
+	range_search(r->waiter_tree, start, end, candidate_fn, &ca);
+
+	qsort(candidates, ca.count, sizeof(struct lock_waiter *),
+	      candidate_cmp);
+
+	for (i = 0; i < ca.count; i++) {
+		w = candidates[i];
+		w->flags &= ~P_CANDIDATE;
+
+		if (is_conflict(r, &w->info, 0))
+			continue;
+
+		wstart = w->info.start;
+		wend = w->info.end;
+		ca.seq = w->seq;
+		count = ca.count;
+
+		grant_waiter(ls, r, w);
+
+		range_search(r->waiter_tree, wstart, wend, candidate_fn, &ca);
+		if (ca.count > count)
+			qsort(candidates + i + 1, ca.count - i - 1,
+			      sizeof(struct lock_waiter *), candidate_cmp);
 	}
 }
 
@@ -689,7 +1298,7 @@ static void do_lock(struct lockspace *ls, struct dlm_plock_info *in,
 		if (!in->wait)
 			rv = -EAGAIN;
 		else {
-			rv = add_waiter(ls, r, in);
+			rv = add_waiter(ls, r, in, 0);
 			if (rv)
 				goto out;
 			rv = -EINPROGRESS;
@@ -701,8 +1310,8 @@ static void do_lock(struct lockspace *ls, struct dlm_plock_info *in,
 	if (in->nodeid == our_nodeid && rv != -EINPROGRESS)
 		write_result(ls, in, rv);
 
-	do_waiters(ls, r);
-	put_resource(r);
+	do_waiters(ls, r, in->start, in->end);
+	put_resource(ls, r);
 }
 
 static void do_unlock(struct lockspace *ls, struct dlm_plock_info *in,
@@ -715,8 +1324,8 @@ static void do_unlock(struct lockspace *ls, struct dlm_plock_info *in,
 	if (in->nodeid == our_nodeid)
 		write_result(ls, in, rv);
 
-	do_waiters(ls, r);
-	put_resource(r);
+	do_waiters(ls, r, in->start, in->end);
+	put_resource(ls, r);
 }
 
 /* we don't even get to this function if the getlk isn't from us */
@@ -732,7 +1341,7 @@ static void do_get(struct lockspace *ls, struct dlm_plock_info *in,
 		rv = 0;
 
 	write_result(ls, in, rv);
-	put_resource(r);
+	put_resource(ls, r);
 }
 
 static void save_message(struct lockspace *ls, struct dlm_header *hd, int len,
@@ -788,7 +1397,8 @@ static void __receive_plock(struct lockspace *ls, struct dlm_plock_info *in,
    set save_plocks (when we see our options message) can be ignored because it
    should be reflected in the checkpointed state. */
 
-static void _receive_plock(struct lockspace *ls, struct dlm_header *hd, int len)
+static void receive_plock_info(struct lockspace *ls, struct dlm_header *hd,
+			       char *data)
 {
 	struct dlm_plock_info info;
 	struct resource *r = NULL;
@@ -797,7 +1407,7 @@ static void _receive_plock(struct lockspace *ls, struct dlm_header *hd, int len)
 	int from = hd->nodeid;
 	int rv, create;
 
-	memcpy(&info, (char *)hd + sizeof(struct dlm_header), sizeof(info));
+	memcpy(&info, data, sizeof(info));
 	info_bswap_in(&info);
 
 	log_plock(ls, "receive plock %llx %s %s %llx-%llx %d/%u/%llx w %d",
@@ -906,6 +1516,11 @@ static void _receive_plock(struct lockspace *ls, struct dlm_header *hd, int len)
 	}
 }
 
+static void _receive_plock(struct lockspace *ls, struct dlm_header *hd, int len)
+{
+	receive_plock_info(ls, hd, (char *)hd + sizeof(struct dlm_header));
+}
+
 void receive_plock(struct lockspace *ls, struct dlm_header *hd, int len)
 {
 	if (ls->save_plocks) {
@@ -913,9 +1528,70 @@ void receive_plock(struct lockspace *ls, struct dlm_header *hd, int len)
 		return;
 	}
 
+	if (plock_worker_queue(ls, hd->type, hd, len))
+		return;
+
 	_receive_plock(ls, hd, len);
 }
 
+/* a batch message carries hd->msgdata plock_info structs that were read from
+   the kernel together by the sender; each is handled as if it had arrived in
+   its own plock message */
+
+static void _receive_plock_batch(struct lockspace *ls, struct dlm_header *hd,
+				 int len)
+{
+	char *data = (char *)hd + sizeof(struct dlm_header);
+	uint32_t i, count = hd->msgdata;
+
+	if (len < sizeof(struct dlm_header) +
+		  count * sizeof(struct dlm_plock_info)) {
+		log_plock_error(ls, "receive_plock_batch error from %d "
+				"count %u len %d", hd->nodeid, count, len);
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		receive_plock_info(ls, hd, data);
+		data += sizeof(struct dlm_plock_info);
+	}
+}
+
+void receive_plock_batch(struct lockspace *ls, struct dlm_header *hd, int len)
+{
+	if (ls->save_plocks) {
+		save_message(ls, hd, len, hd->nodeid, DLM_MSG_PLOCK_BATCH);
+		return;
+	}
+
+	if (plock_worker_queue(ls, hd->type, hd, len))
+		return;
+
+	_receive_plock_batch(ls, hd, len);
+}
+
+static void flush_send_batch(void)
+{
+	struct dlm_header *hd;
+	int len;
+
+	if (!send_count)
+		return;
+
+	hd = (struct dlm_header *)send_batch_buf;
+	memset(hd, 0, sizeof(struct dlm_header));
+	hd->type = DLM_MSG_PLOCK_BATCH;
+	hd->msgdata = send_count;
+
+	len = sizeof(struct dlm_header) +
+	      send_count * sizeof(struct dlm_plock_info);
+
+	dlm_send_message(send_ls, send_batch_buf, len);
+
+	send_count = 0;
+	send_ls = NULL;
+}
+
 static int send_struct_info(struct lockspace *ls, struct dlm_plock_info *in,
 			    int msg_type)
 {
@@ -923,6 +1599,9 @@ static int send_struct_info(struct lockspace *ls, struct dlm_plock_info *in,
 	int rv = 0, len;
 	char *buf;
 
+	/* keep all our messages in the order they were generated */
+	flush_send_batch();
+
 	len = sizeof(struct dlm_header) + sizeof(struct dlm_plock_info);
 	buf = malloc(len);
 	if (!buf) {
@@ -950,7 +1629,24 @@ static int send_struct_info(struct lockspace *ls, struct dlm_plock_info *in,
 static void send_plock(struct lockspace *ls, struct resource *r,
 		       struct dlm_plock_info *in)
 {
-	send_struct_info(ls, in, DLM_MSG_PLOCK);
+	char *data;
+
+	if (!in_batch || !plock_batch_supported()) {
+		send_struct_info(ls, in, DLM_MSG_PLOCK);
+		return;
+	}
+
+	if (send_ls != ls)
+		flush_send_batch();
+
+	data = send_batch_buf + sizeof(struct dlm_header) +
+	       send_count * sizeof(struct dlm_plock_info);
+	memcpy(data, in, sizeof(struct dlm_plock_info));
+	info_bswap_out((struct dlm_plock_info *)data);
+
+	send_ls = ls;
+	if (++send_count == batch_size)
+		flush_send_batch();
 }
 
 static void send_own(struct lockspace *ls, struct resource *r, int owner)
@@ -1195,6 +1891,9 @@ void receive_own(struct lockspace *ls, struct dlm_header *hd, int len)
 		return;
 	}
 
+	if (plock_worker_queue(ls, hd->type, hd, len))
+		return;
+
 	_receive_own(ls, hd, len);
 }
 
@@ -1274,7 +1973,7 @@ static void _receive_sync(struct lockspace *ls, struct dlm_header *hd, int len)
 		add_lock(r, info.nodeid, info.owner, info.pid, info.ex, 
 			 info.start, info.end);
 	else if (hd->type == DLM_MSG_PLOCK_SYNC_WAITER)
-		add_waiter(ls, r, &info);
+		add_waiter(ls, r, &info, 1);
 }
 
 void receive_sync(struct lockspace *ls, struct dlm_header *hd, int len)
@@ -1284,6 +1983,9 @@ void receive_sync(struct lockspace *ls, struct dlm_header *hd, int len)
 		return;
 	}
 
+	if (plock_worker_queue(ls, hd->type, hd, len))
+		return;
+
 	_receive_sync(ls, hd, len);
 }
 
@@ -1332,7 +2034,7 @@ static void _receive_drop(struct lockspace *ls, struct dlm_header *hd, int len)
 	   guaranteed to be the same on all nodes */
 
 	if (list_empty(&r->locks) && list_empty(&r->waiters)) {
-		list_del(&r->list);
+		del_resource(ls, r);
 		free(r);
 	} else {
 		/* A sent drop, B sent a plock, receive plock, receive drop */
@@ -1348,6 +2050,9 @@ void receive_drop(struct lockspace *ls, struct dlm_header *hd, int len)
 		return;
 	}
 
+	if (plock_worker_queue(ls, hd->type, hd, len))
+		return;
+
 	_receive_drop(ls, hd, len);
 }
 
@@ -1366,15 +2071,17 @@ static int drop_resources(struct lockspace *ls)
 	if (!cfgd_plock_ownership)
 		return 0;
 
-	if (list_empty(&ls->plock_resources))
-		return 0;
-
 	gettimeofday(&now, NULL);
 
 	if (time_diff_ms(&ls->drop_resources_last, &now) <
 			 cfgd_drop_resources_time)
 		return 1;
 
+	plock_worker_sync(ls);
+
+	if (list_empty(&ls->plock_resources))
+		return 0;
+
 	ls->drop_resources_last = now;
 
 	/* try to drop the oldest, unused resources */
@@ -1451,34 +2158,46 @@ int limit_plocks(void)
 	return 0;
 }
 
-void process_plocks(int ci)
+static void do_plock_info(struct lockspace *ls, struct dlm_plock_info *info)
 {
-	struct lockspace *ls;
 	struct resource *r;
-	struct dlm_plock_info info;
-	struct timeval now;
-	uint64_t usec;
 	int create, rv;
 
-	if (limit_plocks()) {
-		poll_ignore_plock = 1;
-		client_ignore(plock_ci, plock_fd);
+	create = (info->optype == DLM_PLOCK_OP_UNLOCK) ? 0 : 1;
+
+	rv = find_resource(ls, info->number, create, &r);
+	if (rv) {
+		info->rv = rv;
+		write_info(info);
 		return;
 	}
 
-	gettimeofday(&now, NULL);
+	if (r->owner == 0) {
+		/* plock state replicated on all nodes */
+		send_plock(ls, r, info);
 
-	memset(&info, 0, sizeof(info));
+	} else if (r->owner == our_nodeid) {
+		/* we are the owner of r, so our plocks are local */
+		__receive_plock(ls, info, our_nodeid, r);
 
-	rv = do_read(plock_device_fd, &info, sizeof(info));
-	if (rv < 0) {
-		log_debug("process_plocks: read error %d fd %d\n",
-			  errno, plock_device_fd);
-		return;
+	} else {
+		/* r owner is -1: r is new, try to become the owner;
+		   r owner > 0: tell other owner to give up ownership;
+		   both done with a message trying to set owner to ourself */
+		send_own(ls, r, our_nodeid);
+		save_pending_plock(ls, r, info);
 	}
+}
+
+static void process_plock_info(struct dlm_plock_info *info,
+			       struct timeval *now)
+{
+	struct lockspace *ls;
+	uint64_t usec;
+	int rv;
 
 	/* kernel doesn't set the nodeid field */
-	info.nodeid = our_nodeid;
+	info->nodeid = our_nodeid;
 
 	if (!cfgd_enable_plock) {
 		rv = -ENOSYS;
@@ -1486,11 +2205,11 @@ void process_plocks(int ci)
 	}
 
 	if (need_fsid_translation)
-		info.fsid = mg_to_ls_id(info.fsid);
+		info->fsid = mg_to_ls_id(info->fsid);
 
-	ls = find_ls_id(info.fsid);
+	ls = find_ls_id(info->fsid);
 	if (!ls) {
-		log_plock(ls, "process_plocks: no ls id %x", info.fsid);
+		log_plock(ls, "process_plocks: no ls id %x", info->fsid);
 		rv = -EEXIST;
 		goto fail;
 	}
@@ -1501,171 +2220,536 @@ void process_plocks(int ci)
 	}
 
 	log_plock(ls, "read plock %llx %s %s %llx-%llx %d/%u/%llx w %d",
-		  (unsigned long long)info.number,
-		  op_str(info.optype),
-		  ex_str(info.optype, info.ex),
-		  (unsigned long long)info.start, (unsigned long long)info.end,
-		  info.nodeid, info.pid, (unsigned long long)info.owner,
-		  info.wait);
+		  (unsigned long long)info->number,
+		  op_str(info->optype),
+		  ex_str(info->optype, info->ex),
+		  (unsigned long long)info->start,
+		  (unsigned long long)info->end,
+		  info->nodeid, info->pid, (unsigned long long)info->owner,
+		  info->wait);
 
 	/* report plock rate and any delays since the last report */
 	plock_read_count++;
 	if (!(plock_read_count % 1000)) {
-		usec = dt_usec(&plock_read_time, &now) ;
+		usec = dt_usec(&plock_read_time, now) ;
 		log_plock(ls, "plock_read_count %u time %.3f s delays %u",
 			  plock_read_count, usec * 1.e-6, plock_rate_delays);
-		plock_read_time = now;
+		plock_read_time = *now;
 		plock_rate_delays = 0;
 	}
 
-	create = (info.optype == DLM_PLOCK_OP_UNLOCK) ? 0 : 1;
+	retrieve_plocks_upto(ls, info->number);
 
-	rv = find_resource(ls, info.number, create, &r);
-	if (rv)
-		goto fail;
+	if (!plock_worker_queue(ls, 0, info, sizeof(struct dlm_plock_info)))
+		do_plock_info(ls, info);
 
-	if (r->owner == 0) {
-		/* plock state replicated on all nodes */
-		send_plock(ls, r, &info);
+	/* the op has created a resource (unless it failed), which
+	   drop_resources_all() will look at */
+	if (cfgd_plock_ownership)
+		poll_drop_plock = 1;
+	return;
 
-	} else if (r->owner == our_nodeid) {
-		/* we are the owner of r, so our plocks are local */
-		__receive_plock(ls, &info, our_nodeid, r);
+ fail:
+	info->rv = rv;
+	write_info(info);
+}
 
-	} else {
-		/* r owner is -1: r is new, try to become the owner;
-		   r owner > 0: tell other owner to give up ownership;
-		   both done with a message trying to set owner to ourself */
-		send_own(ls, r, our_nodeid);
-		save_pending_plock(ls, r, &info);
+static int setup_batch(void)
+{
+	int size = cfgd_plock_batch;
+
+	if (size > PLOCK_BATCH_MAX)
+		size = PLOCK_BATCH_MAX;
+	if (size <= batch_size)
+		return size;
+
+	free(read_batch);
+	free(result_batch);
+	free(batch_iov);
+	free(send_batch_buf);
+
+	read_batch = malloc(size * sizeof(struct dlm_plock_info));
+	result_batch = malloc(size * sizeof(struct dlm_plock_info));
+	batch_iov = malloc(size * sizeof(struct iovec));
+	send_batch_buf = malloc(sizeof(struct dlm_header) +
+				size * sizeof(struct dlm_plock_info));
+
+	if (!read_batch || !result_batch || !batch_iov || !send_batch_buf) {
+		log_error("setup_batch no mem %d", size);
+		free(read_batch);
+		free(result_batch);
+		free(batch_iov);
+		free(send_batch_buf);
+		read_batch = NULL;
+		result_batch = NULL;
+		batch_iov = NULL;
+		send_batch_buf = NULL;
+		batch_size = 0;
+		return 0;
 	}
 
-	if (cfgd_plock_ownership && !list_empty(&ls->plock_resources))
-		poll_drop_plock = 1;
-	return;
+	batch_size = size;
+	return size;
+}
 
- fail:
-	info.rv = rv;
-	rv = write(plock_device_fd, &info, sizeof(info));
+static void free_batch(void)
+{
+	free(read_batch);
+	free(result_batch);
+	free(batch_iov);
+	free(send_batch_buf);
+	read_batch = NULL;
+	result_batch = NULL;
+	batch_iov = NULL;
+	send_batch_buf = NULL;
+	batch_size = 0;
 }
 
-void process_saved_plocks(struct lockspace *ls)
+static void process_plock_one(void)
 {
-	struct save_msg *sm, *sm2;
-	struct dlm_header *hd;
+	struct dlm_plock_info info;
+	struct timeval now;
+	int rv;
 
-	if (list_empty(&ls->saved_messages))
+	gettimeofday(&now, NULL);
+
+	memset(&info, 0, sizeof(info));
+
+	rv = do_read(plock_device_fd, &info, sizeof(info));
+	if (rv < 0) {
+		log_debug("process_plocks: read error %d fd %d\n",
+			  errno, plock_device_fd);
 		return;
+	}
 
-	log_plock(ls, "process_saved_plocks");
+	process_plock_info(&info, &now);
+}
 
-	list_for_each_entry_safe(sm, sm2, &ls->saved_messages, list) {
-		hd = (struct dlm_header *)sm->buf;
+/* The device returns one op per read and -EAGAIN when it has none left, so
+   a readv of N ops is handled by the kernel as a series of reads that stops
+   at the first empty one; a short readv means we've drained the device.
+   Each readv is kept within the current plock_rate_limit interval so that
+   limit_plocks() gets to check the rate (and cpg flow control) as often as
+   it did when ops were read one at a time. */
 
-		switch (sm->type) {
-		case DLM_MSG_PLOCK:
-			_receive_plock(ls, hd, sm->len);
-			break;
-		case DLM_MSG_PLOCK_OWN:
-			_receive_own(ls, hd, sm->len);
-			break;
-		case DLM_MSG_PLOCK_DROP:
-			_receive_drop(ls, hd, sm->len);
-			break;
-		case DLM_MSG_PLOCK_SYNC_LOCK:
-		case DLM_MSG_PLOCK_SYNC_WAITER:
-			_receive_sync(ls, hd, sm->len);
+void process_plocks(int ci)
+{
+	struct timeval now;
+	int size, want, count, total, left, rv, i;
+
+	if (limit_plocks()) {
+		poll_ignore_plock = 1;
+		client_ignore(plock_ci, plock_fd);
+		return;
+	}
+
+	size = setup_batch();
+	if (size <= 1) {
+		process_plock_one();
+		return;
+	}
+
+	gettimeofday(&now, NULL);
+	in_batch = 1;
+	total = 0;
+
+	while (total < size) {
+		if (total && limit_plocks()) {
+			poll_ignore_plock = 1;
+			client_ignore(plock_ci, plock_fd);
 			break;
-		default:
+		}
+
+		want = size - total;
+		if (cfgd_plock_rate_limit) {
+			left = cfgd_plock_rate_limit -
+			       (plock_read_count % cfgd_plock_rate_limit);
+			if (want > left)
+				want = left;
+		}
+
+		for (i = 0; i < want; i++) {
+			batch_iov[i].iov_base = &read_batch[i];
+			batch_iov[i].iov_len = sizeof(struct dlm_plock_info);
+		}
+
+		rv = readv(plock_device_fd, batch_iov, want);
+		if (rv < 0 && errno == EINTR)
 			continue;
+		if (rv <= 0) {
+			if (!total)
+				log_debug("process_plocks: read error %d fd %d",
+					  errno, plock_device_fd);
+			break;
 		}
 
-		list_del(&sm->list);
-		free(sm);
+		count = rv / sizeof(struct dlm_plock_info);
+
+		for (i = 0; i < count; i++)
+			process_plock_info(&read_batch[i], &now);
+
+		total += count;
+
+		if (count < want)
+			break;
 	}
+
+	flush_send_batch();
+	flush_results();
+	in_batch = 0;
 }
 
-/* locks still marked SYNCING should not go into the ckpt; the new node
-   will get those locks by receiving PLOCK_SYNC messages */
+static int process_saved_message(struct lockspace *ls, struct save_msg *sm)
+{
+	struct dlm_header *hd = (struct dlm_header *)sm->buf;
+
+	switch (sm->type) {
+	case DLM_MSG_PLOCK:
+		_receive_plock(ls, hd, sm->len);
+		break;
+	case DLM_MSG_PLOCK_BATCH:
+		_receive_plock_batch(ls, hd, sm->len);
+		break;
+	case DLM_MSG_PLOCK_OWN:
+		_receive_own(ls, hd, sm->len);
+		break;
+	case DLM_MSG_PLOCK_DROP:
+		_receive_drop(ls, hd, sm->len);
+		break;
+	case DLM_MSG_PLOCK_SYNC_LOCK:
+	case DLM_MSG_PLOCK_SYNC_WAITER:
+		_receive_sync(ls, hd, sm->len);
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
 
-static void pack_section_buf(struct lockspace *ls, struct resource *r)
+static void do_plock_work(struct lockspace *ls, struct save_msg *sm)
 {
-	struct pack_plock *pp;
-	struct posix_lock *po;
-	struct lock_waiter *w;
-	int count = 0;
+	if (!sm->type)
+		do_plock_info(ls, (struct dlm_plock_info *)sm->buf);
+	else
+		process_saved_message(ls, sm);
+}
 
-	/* plocks on owned resources are not replicated on other nodes */
-	if (r->owner == our_nodeid)
-		return;
+static void *plock_worker_thread(void *arg)
+{
+	struct plock_worker *pw = arg;
+	struct lockspace *ls = pw->ls;
+	struct save_msg *sm, *safe;
+	struct list_head work;
+	sigset_t mask;
+
+	/* leave signals to the main thread, whose poll they interrupt */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	INIT_LIST_HEAD(&work);
+
+	pthread_mutex_lock(&pw->mutex);
+	for (;;) {
+		while (list_empty(&pw->queue) && !pw->stop)
+			pthread_cond_wait(&pw->cond, &pw->mutex);
+		if (list_empty(&pw->queue))
+			break;
 
-	pp = (struct pack_plock *) &section_buf;
+		list_splice_init(&pw->queue, &work);
+		pw->busy = 1;
+		pthread_mutex_unlock(&pw->mutex);
 
-	list_for_each_entry(po, &r->locks, list) {
-		if (po->flags & P_SYNCING)
-			continue;
-		pp->start	= cpu_to_le64(po->start);
-		pp->end		= cpu_to_le64(po->end);
-		pp->owner	= cpu_to_le64(po->owner);
-		pp->pid		= cpu_to_le32(po->pid);
-		pp->nodeid	= cpu_to_le32(po->nodeid);
-		pp->ex		= po->ex;
-		pp->waiter	= 0;
-		pp++;
-		count++;
+		pthread_mutex_lock(&pw->state_mutex);
+		in_batch = (setup_batch() > 1);
+
+		list_for_each_entry_safe(sm, safe, &work, list) {
+			do_plock_work(ls, sm);
+			list_del(&sm->list);
+			free(sm);
+		}
+
+		flush_send_batch();
+		flush_results();
+		in_batch = 0;
+		pthread_mutex_unlock(&pw->state_mutex);
+
+		pthread_mutex_lock(&pw->mutex);
+		pw->busy = 0;
+		if (list_empty(&pw->queue))
+			pthread_cond_broadcast(&pw->idle_cond);
 	}
+	pthread_mutex_unlock(&pw->mutex);
 
-	list_for_each_entry(w, &r->waiters, list) {
-		if (w->flags & P_SYNCING)
-			continue;
-		pp->start	= cpu_to_le64(w->info.start);
-		pp->end		= cpu_to_le64(w->info.end);
-		pp->owner	= cpu_to_le64(w->info.owner);
-		pp->pid		= cpu_to_le32(w->info.pid);
-		pp->nodeid	= cpu_to_le32(w->info.nodeid);
-		pp->ex		= w->info.ex;
-		pp->waiter	= 1;
-		pp++;
-		count++;
+	free_batch();
+	free(candidates);
+	candidates = NULL;
+	candidates_size = 0;
+	return NULL;
+}
+
+static int start_plock_worker(struct lockspace *ls)
+{
+	struct plock_worker *pw;
+	int rv;
+
+	pw = malloc(sizeof(struct plock_worker));
+	if (!pw)
+		return -ENOMEM;
+	memset(pw, 0, sizeof(struct plock_worker));
+
+	pw->ls = ls;
+	INIT_LIST_HEAD(&pw->queue);
+	pthread_mutex_init(&pw->mutex, NULL);
+	pthread_mutex_init(&pw->state_mutex, NULL);
+	pthread_cond_init(&pw->cond, NULL);
+	pthread_cond_init(&pw->idle_cond, NULL);
+
+	rv = pthread_create(&pw->thread, NULL, plock_worker_thread, pw);
+	if (rv) {
+		log_error("%s plock worker thread error %d", ls->name, rv);
+		free(pw);
+		return -rv;
 	}
 
-	section_len = count * sizeof(struct pack_plock);
+	ls->plock_worker = pw;
+	log_group(ls, "plock worker started");
+	return 0;
 }
 
-static int unpack_section_buf(struct lockspace *ls, char *numbuf, int buflen,
-			      uint64_t *r_num, int *lock_count)
+/* finishes the work already queued before the thread exits */
+
+static void stop_plock_worker(struct lockspace *ls)
 {
-	struct pack_plock *pp;
-	struct posix_lock *po;
-	struct lock_waiter *w;
-	struct resource *r;
-	int count = section_len / sizeof(struct pack_plock);
-	int i, owner = 0;
-	unsigned long long num;
-	struct timeval now;
+	struct plock_worker *pw = ls->plock_worker;
 
-	gettimeofday(&now, NULL);
+	if (!pw)
+		return;
 
-	r = malloc(sizeof(struct resource));
-	if (!r)
-		return -ENOMEM;
-	memset(r, 0, sizeof(struct resource));
-	INIT_LIST_HEAD(&r->locks);
-	INIT_LIST_HEAD(&r->waiters);
-	INIT_LIST_HEAD(&r->pending);
+	pthread_mutex_lock(&pw->mutex);
+	pw->stop = 1;
+	pthread_cond_signal(&pw->cond);
+	pthread_mutex_unlock(&pw->mutex);
 
-	sscanf(numbuf, "r%llu.%d", &num, &owner);
+	pthread_join(pw->thread, NULL);
 
-	r->number = num;
-	r->owner = owner;
-	r->last_access = now;
+	pthread_mutex_destroy(&pw->mutex);
+	pthread_mutex_destroy(&pw->state_mutex);
+	pthread_cond_destroy(&pw->cond);
+	pthread_cond_destroy(&pw->idle_cond);
+	free(pw);
+	ls->plock_worker = NULL;
+}
 
-	*r_num = num;
+/* Returns 1 if the op or message has been queued for the lockspace's plock
+   worker, or 0 if the caller should handle it as usual (plock_threads is
+   off, or the worker couldn't be started or the work copied, in which case
+   the worker has first been left idle). */
 
-	pp = (struct pack_plock *) &section_buf;
+static int plock_worker_queue(struct lockspace *ls, int type, void *buf,
+			      int len)
+{
+	struct plock_worker *pw;
+	struct save_msg *sm;
 
-	for (i = 0; i < count; i++) {
-		if (!pp->waiter) {
+	if (!cfgd_plock_threads)
+		return 0;
+
+	if (!ls->plock_worker && start_plock_worker(ls))
+		return 0;
+
+	pw = ls->plock_worker;
+
+	sm = malloc(sizeof(struct save_msg) + len);
+	if (!sm) {
+		log_plock_error(ls, "plock_worker_queue no mem %d", len);
+		plock_worker_sync(ls);
+		return 0;
+	}
+	memset(sm, 0, sizeof(struct save_msg));
+	memcpy(&sm->buf, buf, len);
+	sm->type = type;
+	sm->len = len;
+
+	pthread_mutex_lock(&pw->mutex);
+	list_add_tail(&sm->list, &pw->queue);
+	pthread_cond_signal(&pw->cond);
+	pthread_mutex_unlock(&pw->mutex);
+	return 1;
+}
+
+/* wait for the worker to do everything that's been queued for it */
+
+static void plock_worker_sync(struct lockspace *ls)
+{
+	struct plock_worker *pw = ls->plock_worker;
+
+	if (!pw)
+		return;
+
+	pthread_mutex_lock(&pw->mutex);
+	while (pw->busy || !list_empty(&pw->queue))
+		pthread_cond_wait(&pw->idle_cond, &pw->mutex);
+	pthread_mutex_unlock(&pw->mutex);
+}
+
+void process_saved_plocks(struct lockspace *ls)
+{
+	struct save_msg *sm, *sm2;
+
+	plock_worker_sync(ls);
+
+	if (list_empty(&ls->saved_messages))
+		return;
+
+	log_plock(ls, "process_saved_plocks");
+
+	list_for_each_entry_safe(sm, sm2, &ls->saved_messages, list) {
+		if (process_saved_message(ls, sm))
+			continue;
+		list_del(&sm->list);
+		free(sm);
+	}
+}
+
+static int grow_section_buf(uint32_t len)
+{
+	char *buf;
+
+	if (len <= section_buf_size)
+		return 0;
+
+	buf = realloc(section_buf, len);
+	if (!buf)
+		return -ENOMEM;
+	section_buf = buf;
+	section_buf_size = len;
+	return 0;
+}
+
+/* locks still marked SYNCING should not go into the ckpt; the new node
+   will get those locks by receiving PLOCK_SYNC messages */
+
+static int count_pack_plocks(struct resource *r)
+{
+	struct posix_lock *po;
+	struct lock_waiter *w;
+	int count = 0;
+
+	/* plocks on owned resources are not replicated on other nodes */
+	if (r->owner == our_nodeid)
+		return 0;
+
+	list_for_each_entry(po, &r->locks, list) {
+		if (!(po->flags & P_SYNCING))
+			count++;
+	}
+	list_for_each_entry(w, &r->waiters, list) {
+		if (!(w->flags & P_SYNCING))
+			count++;
+	}
+	return count;
+}
+
+/* pack up to max plocks from r into pp, skipping the first skip of them */
+
+static int pack_plocks(struct resource *r, struct pack_plock *pp, int skip,
+		       int max)
+{
+	struct posix_lock *po;
+	struct lock_waiter *w;
+	int count = 0;
+
+	if (r->owner == our_nodeid)
+		return 0;
+
+	list_for_each_entry(po, &r->locks, list) {
+		if (po->flags & P_SYNCING)
+			continue;
+		if (skip) {
+			skip--;
+			continue;
+		}
+		if (count == max)
+			return count;
+		pp->start	= cpu_to_le64(po->start);
+		pp->end		= cpu_to_le64(po->end);
+		pp->owner	= cpu_to_le64(po->owner);
+		pp->pid		= cpu_to_le32(po->pid);
+		pp->nodeid	= cpu_to_le32(po->nodeid);
+		pp->ex		= po->ex;
+		pp->waiter	= 0;
+		pp++;
+		count++;
+	}
+
+	list_for_each_entry(w, &r->waiters, list) {
+		if (w->flags & P_SYNCING)
+			continue;
+		if (skip) {
+			skip--;
+			continue;
+		}
+		if (count == max)
+			return count;
+		pp->start	= cpu_to_le64(w->info.start);
+		pp->end		= cpu_to_le64(w->info.end);
+		pp->owner	= cpu_to_le64(w->info.owner);
+		pp->pid		= cpu_to_le32(w->info.pid);
+		pp->nodeid	= cpu_to_le32(w->info.nodeid);
+		pp->ex		= w->info.ex;
+		pp->waiter	= 1;
+		pp++;
+		count++;
+	}
+
+	return count;
+}
+
+static int pack_section_buf(struct lockspace *ls, struct resource *r)
+{
+	int count = count_pack_plocks(r);
+
+	if (grow_section_buf(count * sizeof(struct pack_plock)))
+		return -ENOMEM;
+
+	count = pack_plocks(r, (struct pack_plock *)section_buf, 0, count);
+	section_len = count * sizeof(struct pack_plock);
+	return 0;
+}
+
+static struct resource *new_ckpt_resource(struct lockspace *ls,
+					  uint64_t number, int owner)
+{
+	struct resource *r;
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	r = malloc(sizeof(struct resource));
+	if (!r)
+		return NULL;
+	memset(r, 0, sizeof(struct resource));
+	INIT_LIST_HEAD(&r->locks);
+	INIT_LIST_HEAD(&r->waiters);
+	INIT_LIST_HEAD(&r->pending);
+	INIT_LIST_HEAD(&r->recheck);
+
+	r->number = number;
+	r->owner = owner;
+	r->last_access = now;
+
+	add_resource(ls, r);
+	return r;
+}
+
+static void unpack_plocks(struct resource *r, struct pack_plock *pp, int count)
+{
+	struct posix_lock *po;
+	struct lock_waiter *w;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (!pp->waiter) {
 			po = malloc(sizeof(struct posix_lock));
 			// FIXME: handle failed malloc
 			po->start	= le64_to_cpu(pp->start);
@@ -1674,22 +2758,42 @@ static int unpack_section_buf(struct lockspace *ls, char *numbuf, int buflen,
 			po->pid		= le32_to_cpu(pp->pid);
 			po->nodeid	= le32_to_cpu(pp->nodeid);
 			po->ex		= pp->ex;
-			list_add_tail(&po->list, &r->locks);
+			po->flags	= 0;
+			link_lock(r, po);
 		} else {
 			w = malloc(sizeof(struct lock_waiter));
 			// FIXME: handle failed malloc
+			memset(w, 0, sizeof(struct lock_waiter));
 			w->info.start	= le64_to_cpu(pp->start);
 			w->info.end	= le64_to_cpu(pp->end);
 			w->info.owner	= le64_to_cpu(pp->owner);
 			w->info.pid	= le32_to_cpu(pp->pid);
 			w->info.nodeid	= le32_to_cpu(pp->nodeid);
 			w->info.ex	= pp->ex;
-			list_add_tail(&w->list, &r->waiters);
+			link_waiter(r, w, 1);
 		}
 		pp++;
 	}
+}
+
+static int unpack_section_buf(struct lockspace *ls, char *numbuf, int buflen,
+			      uint64_t *r_num, int *lock_count)
+{
+	struct resource *r;
+	int count = section_len / sizeof(struct pack_plock);
+	int owner = 0;
+	unsigned long long num;
+
+	sscanf(numbuf, "r%llu.%d", &num, &owner);
+
+	r = new_ckpt_resource(ls, num, owner);
+	if (!r)
+		return -ENOMEM;
+
+	*r_num = num;
+
+	unpack_plocks(r, (struct pack_plock *)section_buf, count);
 
-	list_add_tail(&r->list, &ls->plock_resources);
 	*lock_count = count;
 	return 0;
 }
@@ -1799,6 +2903,296 @@ void close_plock_checkpoint(struct lockspace *ls)
 
 #define SECTION_NAME_LEN 34
 
+/* - If r owner is -1, ckpt nothing.
+   - If r owner is us, ckpt owner of us and no plocks.
+   - If r owner is other, ckpt that owner and any plocks we have on r
+     (they've just been synced but owner=0 msg not recved yet).
+   - If r owner is 0 and !got_unown, then we've just unowned r;
+     ckpt owner of us and any plocks that don't have SYNCING set
+     (plocks with SYNCING will be handled by our sync messages).
+   - If r owner is 0 and got_unown, then ckpt owner 0 and all plocks;
+     (there should be no SYNCING plocks) */
+
+static int store_owner(struct lockspace *ls, struct resource *r, int *owner)
+{
+	if (r->owner == -1)
+		return -1;
+	else if (r->owner == our_nodeid)
+		*owner = our_nodeid;
+	else if (r->owner)
+		*owner = r->owner;
+	else if (!r->owner && !got_unown(r))
+		*owner = our_nodeid;
+	else if (!r->owner)
+		*owner = 0;
+	else {
+		log_plock_error(ls, "store_plocks error owner %d r %llx",
+				r->owner, (unsigned long long)r->number);
+		return -1;
+	}
+	return 0;
+}
+
+static SaAisErrorT create_section(struct lockspace *ls,
+				  SaCkptCheckpointHandleT h, char *id,
+				  int id_len, void *data, uint32_t len)
+{
+	SaCkptSectionIdT section_id;
+	SaCkptSectionCreationAttributesT section_attr;
+	SaAisErrorT rv;
+
+	section_id.id = (void *)id;
+	section_id.idLen = id_len;
+	section_attr.sectionId = &section_id;
+	section_attr.expirationTime = SA_TIME_END;
+
+	log_plock(ls, "store_plocks section size %u id %u \"%s\"",
+		  len, section_id.idLen, id);
+
+ create_retry:
+	rv = saCkptSectionCreate(h, &section_attr, data, len);
+	if (rv == SA_AIS_ERR_TRY_AGAIN) {
+		log_group(ls, "store_plocks ckpt create retry");
+		sleep(1);
+		goto create_retry;
+	}
+	return rv;
+}
+
+struct store_r {
+	struct resource		*r;
+	int			owner;
+	int			count;	   /* plocks to pack */
+};
+
+static int store_r_cmp(const void *a, const void *b)
+{
+	const struct store_r *sa = a, *sb = b;
+
+	if (sa->r->number < sb->r->number)
+		return -1;
+	return sa->r->number > sb->r->number;
+}
+
+/* Fill one bulk chunk from resource *ri, plock *pi onward, and advance them.
+   With a NULL buf this only works out the chunk size and range. */
+
+static uint32_t pack_chunk(struct store_r *rs, int rs_count, int *ri, int *pi,
+			   char *buf, struct pack_chunk *pc)
+{
+	struct pack_resource *pr;
+	struct store_r *s;
+	uint32_t len = 0;
+	int count, room;
+
+	memset(pc, 0, sizeof(struct pack_chunk));
+
+	while (*ri < rs_count) {
+		s = &rs[*ri];
+
+		if (len + sizeof(struct pack_resource) > PLOCK_CKPT_CHUNK)
+			break;
+
+		room = (PLOCK_CKPT_CHUNK - len - sizeof(struct pack_resource)) /
+		       sizeof(struct pack_plock);
+		count = s->count - *pi;
+
+		/* don't split a resource header from its first plock */
+		if (count && !room)
+			break;
+		if (count > room)
+			count = room;
+
+		if (buf) {
+			pr = (struct pack_resource *)(buf + len);
+			pr->number = cpu_to_le64(s->r->number);
+			pr->owner = cpu_to_le32(s->owner);
+			pr->count = cpu_to_le32(count);
+			pack_plocks(s->r, (struct pack_plock *)(pr + 1), *pi,
+				    count);
+		}
+
+		if (!len)
+			pc->first = s->r->number;
+		pc->last = s->r->number;
+		len += sizeof(struct pack_resource) +
+		       count * sizeof(struct pack_plock);
+
+		*pi += count;
+		if (*pi < s->count)
+			break;
+		(*ri)++;
+		*pi = 0;
+	}
+
+	pc->len = len;
+	return len;
+}
+
+/* Write a bulk format checkpoint, see PLOCK_CKPT_VERSION.  The chunks are
+   laid out once without data to size the checkpoint, then packed one at a
+   time into section_buf and written. */
+
+static void store_plocks_bulk(struct lockspace *ls, SaNameT *name,
+			      uint32_t *r_count_out, uint32_t *p_count_out,
+			      uint64_t *r_num_first, uint64_t *r_num_last)
+{
+	SaCkptCheckpointCreationAttributesT attr;
+	SaCkptCheckpointHandleT h;
+	SaCkptCheckpointOpenFlagsT flags;
+	SaAisErrorT rv;
+	char buf[SECTION_NAME_LEN];
+	struct store_r *rs = NULL;
+	struct pack_chunk *chunks = NULL, *new;
+	struct pack_index *pi;
+	struct resource *r;
+	uint64_t total_size = 0;
+	uint32_t p_count = 0, index_len, max_section_size;
+	int rs_count = 0, chunk_count = 0, chunks_size = 0;
+	int i, len, ri, pli;
+
+	rs = malloc((ls->plock_resources_count + 1) * sizeof(struct store_r));
+	if (!rs) {
+		log_error("store_plocks no mem for %u resources %s",
+			  ls->plock_resources_count, ls->name);
+		return;
+	}
+
+	list_for_each_entry(r, &ls->plock_resources, list) {
+		if (store_owner(ls, r, &rs[rs_count].owner))
+			continue;
+		rs[rs_count].r = r;
+		rs[rs_count].count = count_pack_plocks(r);
+		p_count += rs[rs_count].count;
+		rs_count++;
+	}
+
+	qsort(rs, rs_count, sizeof(struct store_r), store_r_cmp);
+
+	ri = 0;
+	pli = 0;
+	while (ri < rs_count) {
+		if (chunk_count == chunks_size) {
+			chunks_size = chunks_size ? chunks_size * 2 : 64;
+			new = realloc(chunks,
+				      chunks_size * sizeof(struct pack_chunk));
+			if (!new) {
+				log_error("store_plocks no mem for %d chunks %s",
+					  chunks_size, ls->name);
+				goto out;
+			}
+			chunks = new;
+		}
+		total_size += pack_chunk(rs, rs_count, &ri, &pli, NULL,
+					 &chunks[chunk_count++]);
+	}
+
+	index_len = sizeof(struct pack_index) +
+		    chunk_count * sizeof(struct pack_chunk);
+	total_size += index_len;
+	max_section_size = PLOCK_CKPT_CHUNK;
+	if (index_len > max_section_size)
+		max_section_size = index_len;
+
+	if (grow_section_buf(max_section_size)) {
+		log_error("store_plocks no mem for section %u %s",
+			  max_section_size, ls->name);
+		goto out;
+	}
+
+	log_group(ls, "store_plocks bulk r_count %d p_count %u chunks %d "
+		  "total_size %llu", rs_count, p_count, chunk_count,
+		  (unsigned long long)total_size);
+	log_plock(ls, "store_plocks bulk r_count %d p_count %u chunks %d "
+		  "total_size %llu", rs_count, p_count, chunk_count,
+		  (unsigned long long)total_size);
+
+	attr.creationFlags = SA_CKPT_WR_ALL_REPLICAS;
+	attr.checkpointSize = total_size;
+	attr.retentionDuration = SA_TIME_MAX;
+	attr.maxSections = chunk_count + 2;
+	attr.maxSectionSize = max_section_size;
+	attr.maxSectionIdSize = SECTION_NAME_LEN;
+
+	flags = SA_CKPT_CHECKPOINT_READ |
+		SA_CKPT_CHECKPOINT_WRITE |
+		SA_CKPT_CHECKPOINT_CREATE;
+
+ open_retry:
+	rv = saCkptCheckpointOpen(system_ckpt_handle, name, &attr, flags, 0, &h);
+	if (rv == SA_AIS_ERR_TRY_AGAIN) {
+		log_group(ls, "store_plocks ckpt open retry");
+		sleep(1);
+		goto open_retry;
+	}
+	if (rv == SA_AIS_ERR_EXIST) {
+		log_group(ls, "store_plocks ckpt already exists");
+		goto out;
+	}
+	if (rv != SA_AIS_OK) {
+		log_error("store_plocks ckpt open error %d %s", rv, ls->name);
+		goto out;
+	}
+
+	log_group(ls, "store_plocks open ckpt handle %llx",
+		  (unsigned long long)h);
+	ls->plock_ckpt_handle = (uint64_t) h;
+
+	pi = (struct pack_index *)section_buf;
+	pi->version = cpu_to_le32(PLOCK_CKPT_VERSION);
+	pi->chunk_count = cpu_to_le32(chunk_count);
+	pi->r_count = cpu_to_le32(rs_count);
+	pi->p_count = cpu_to_le32(p_count);
+	for (i = 0; i < chunk_count; i++) {
+		new = (struct pack_chunk *)(pi + 1) + i;
+		new->first = cpu_to_le64(chunks[i].first);
+		new->last = cpu_to_le64(chunks[i].last);
+		new->len = cpu_to_le32(chunks[i].len);
+		new->pad = 0;
+	}
+
+	strcpy(buf, INDEX_SECTION);
+	rv = create_section(ls, h, buf, strlen(buf) + 1, section_buf,
+			    index_len);
+	if (rv == SA_AIS_ERR_EXIST) {
+		/* this shouldn't happen in general */
+		log_group(ls, "store_plocks clearing old ckpt");
+		saCkptCheckpointClose(h);
+		_unlink_checkpoint(ls, name);
+		goto open_retry;
+	}
+	if (rv != SA_AIS_OK) {
+		log_error("store_plocks ckpt section create err %d %s",
+			  rv, ls->name);
+		goto out;
+	}
+
+	ri = 0;
+	pli = 0;
+	for (i = 0; i < chunk_count; i++) {
+		pack_chunk(rs, rs_count, &ri, &pli, section_buf, &chunks[i]);
+
+		len = snprintf(buf, SECTION_NAME_LEN, "c%d", i);
+		rv = create_section(ls, h, buf, len + 1, section_buf,
+				    chunks[i].len);
+		if (rv != SA_AIS_OK) {
+			log_error("store_plocks ckpt section create err %d %s",
+				  rv, ls->name);
+			break;
+		}
+	}
+
+	*r_count_out = rs_count;
+	*p_count_out = p_count;
+	if (rs_count) {
+		*r_num_first = rs[0].r->number;
+		*r_num_last = rs[rs_count - 1].r->number;
+	}
+ out:
+	free(chunks);
+	free(rs);
+}
+
 /* Copy all plock state into a checkpoint so new node can retrieve it.  The
    node creating the ckpt for the mounter needs to be the same node that's
    sending the mounter its journals message (i.e. the low nodeid).  The new
@@ -1814,8 +3208,6 @@ void store_plocks(struct lockspace *ls, uint32_t *sig)
 {
 	SaCkptCheckpointCreationAttributesT attr;
 	SaCkptCheckpointHandleT h;
-	SaCkptSectionIdT section_id;
-	SaCkptSectionCreationAttributesT section_attr;
 	SaCkptCheckpointOpenFlagsT flags;
 	SaNameT name;
 	SaAisErrorT rv;
@@ -1831,6 +3223,8 @@ void store_plocks(struct lockspace *ls, uint32_t *sig)
 	if (!cfgd_enable_plock || ls->disable_plock)
 		return;
 
+	plock_worker_sync(ls);
+
 	/* no change to plock state since we created the last checkpoint */
 	if (ls->last_checkpoint_time > ls->last_plock_time) {
 		log_group(ls, "store_plocks saved ckpt uptodate");
@@ -1848,6 +3242,12 @@ void store_plocks(struct lockspace *ls, uint32_t *sig)
 
 	_unlink_checkpoint(ls, &name);
 
+	if (plock_ckpt_bulk_supported()) {
+		store_plocks_bulk(ls, &name, &r_count, &p_count,
+				  &r_num_first, &r_num_last);
+		goto out;
+	}
+
 	/* loop through all plocks to figure out sizes to set in
 	   the attr fields */
 
@@ -1913,62 +3313,28 @@ void store_plocks(struct lockspace *ls, uint32_t *sig)
 		  (unsigned long long)h);
 	ls->plock_ckpt_handle = (uint64_t) h;
 
-	/* - If r owner is -1, ckpt nothing.
-	   - If r owner is us, ckpt owner of us and no plocks.
-	   - If r owner is other, ckpt that owner and any plocks we have on r
-	     (they've just been synced but owner=0 msg not recved yet).
-	   - If r owner is 0 and !got_unown, then we've just unowned r;
-	     ckpt owner of us and any plocks that don't have SYNCING set
-	     (plocks with SYNCING will be handled by our sync messages).
-	   - If r owner is 0 and got_unown, then ckpt owner 0 and all plocks;
-	     (there should be no SYNCING plocks) */
-
 	list_for_each_entry(r, &ls->plock_resources, list) {
-		if (r->owner == -1)
-			continue;
-		else if (r->owner == our_nodeid)
-			owner = our_nodeid;
-		else if (r->owner)
-			owner = r->owner;
-		else if (!r->owner && !got_unown(r))
-			owner = our_nodeid;
-		else if (!r->owner)
-			owner = 0;
-		else {
-			log_plock_error(ls, "store_plocks error owner %d r %llx",
-					r->owner, (unsigned long long)r->number);
+		if (store_owner(ls, r, &owner))
 			continue;
-		}
 
 		memset(&buf, 0, sizeof(buf));
 		len = snprintf(buf, SECTION_NAME_LEN, "r%llu.%d",
 			       (unsigned long long)r->number, owner);
 
-		section_id.id = (void *)buf;
-		section_id.idLen = len + 1;
-		section_attr.sectionId = &section_id;
-		section_attr.expirationTime = SA_TIME_END;
-
-		memset(&section_buf, 0, sizeof(section_buf));
 		section_len = 0;
 
-		pack_section_buf(ls, r);
+		if (pack_section_buf(ls, r)) {
+			log_error("store_plocks no mem for section %s",
+				  ls->name);
+			break;
+		}
 
 		if (!r_num_first)
 			r_num_first = r->number;
 		r_num_last = r->number;
 
-		log_plock(ls, "store_plocks section size %u id %u \"%s\"",
-			  section_len, section_id.idLen, buf);
-
-	 create_retry:
-		rv = saCkptSectionCreate(h, &section_attr, &section_buf,
-					 section_len);
-		if (rv == SA_AIS_ERR_TRY_AGAIN) {
-			log_group(ls, "store_plocks ckpt create retry");
-			sleep(1);
-			goto create_retry;
-		}
+		rv = create_section(ls, h, buf, len + 1, section_buf,
+				    section_len);
 		if (rv == SA_AIS_ERR_EXIST) {
 			/* this shouldn't happen in general */
 			log_group(ls, "store_plocks clearing old ckpt");
@@ -2005,10 +3371,396 @@ void store_plocks(struct lockspace *ls, uint32_t *sig)
 	ls->checkpoint_p_count = p_count;
 }
 
+static SaAisErrorT read_section(struct lockspace *ls,
+				SaCkptCheckpointHandleT h, char *id,
+				int id_len, void *buf, uint32_t len,
+				uint32_t offset, uint32_t *read_len)
+{
+	SaCkptIOVectorElementT iov;
+	SaAisErrorT rv;
+
+	iov.sectionId.id = (void *)id;
+	iov.sectionId.idLen = id_len;
+	iov.dataBuffer = buf;
+	iov.dataSize = len;
+	iov.dataOffset = offset;
+
+ read_retry:
+	rv = saCkptCheckpointRead(h, &iov, 1, NULL);
+	if (rv == SA_AIS_ERR_TRY_AGAIN) {
+		log_group(ls, "retrieve_plocks ckpt read retry");
+		sleep(1);
+		goto read_retry;
+	}
+	if (rv == SA_AIS_OK)
+		*read_len = iov.readSize;
+	return rv;
+}
+
+/* returns -ENOENT if the ckpt has no index, i.e. it's in the old format */
+
+static int read_index(struct lockspace *ls, SaCkptCheckpointHandleT h,
+		      struct plock_retrieve **rt_out)
+{
+	struct plock_retrieve *rt;
+	struct pack_index pi;
+	struct pack_chunk *pc;
+	char id[] = INDEX_SECTION;
+	uint32_t i, len, read_len;
+	SaAisErrorT rv;
+
+	rv = read_section(ls, h, id, sizeof(id), &pi, sizeof(pi), 0,
+			  &read_len);
+	if (rv == SA_AIS_ERR_NOT_EXIST)
+		return -ENOENT;
+	if (rv != SA_AIS_OK) {
+		log_error("retrieve_plocks ckpt read index error %d %s",
+			  rv, ls->name);
+		return -EIO;
+	}
+
+	if (read_len != sizeof(pi) ||
+	    le32_to_cpu(pi.version) != PLOCK_CKPT_VERSION) {
+		log_error("retrieve_plocks bad index len %u version %u %s",
+			  read_len, le32_to_cpu(pi.version), ls->name);
+		return -EINVAL;
+	}
+
+	rt = malloc(sizeof(struct plock_retrieve));
+	if (!rt)
+		return -ENOMEM;
+	memset(rt, 0, sizeof(struct plock_retrieve));
+	rt->h = h;
+	rt->chunk_count = le32_to_cpu(pi.chunk_count);
+
+	len = rt->chunk_count * sizeof(struct pack_chunk);
+	if (!len)
+		goto out;
+
+	rt->chunks = malloc(len);
+	if (!rt->chunks) {
+		free(rt);
+		return -ENOMEM;
+	}
+
+	rv = read_section(ls, h, id, sizeof(id), rt->chunks, len, sizeof(pi),
+			  &read_len);
+	if (rv != SA_AIS_OK || read_len != len) {
+		log_error("retrieve_plocks ckpt read index error %d len %u %s",
+			  rv, read_len, ls->name);
+		free(rt->chunks);
+		free(rt);
+		return -EIO;
+	}
+
+	for (i = 0; i < rt->chunk_count; i++) {
+		pc = &rt->chunks[i];
+		pc->first = le64_to_cpu(pc->first);
+		pc->last = le64_to_cpu(pc->last);
+		pc->len = le32_to_cpu(pc->len);
+	}
+ out:
+	log_group(ls, "retrieve_plocks bulk r_count %u p_count %u chunks %u",
+		  le32_to_cpu(pi.r_count), le32_to_cpu(pi.p_count),
+		  rt->chunk_count);
+	*rt_out = rt;
+	return 0;
+}
+
+static int retrieve_chunk(struct lockspace *ls, struct plock_retrieve *rt)
+{
+	struct pack_chunk *pc = &rt->chunks[rt->next];
+	struct pack_resource *pr;
+	struct resource *r;
+	char id[SECTION_NAME_LEN];
+	uint64_t number;
+	uint32_t count, read_len, off = 0;
+	SaAisErrorT rv;
+	int len, first = 1;
+
+	len = snprintf(id, SECTION_NAME_LEN, "c%u", rt->next);
+	rt->next++;
+
+	if (grow_section_buf(pc->len)) {
+		log_error("retrieve_plocks no mem for section %u %s",
+			  pc->len, ls->name);
+		return -ENOMEM;
+	}
+
+	rv = read_section(ls, rt->h, id, len + 1, section_buf, pc->len, 0,
+			  &read_len);
+	if (rv != SA_AIS_OK || read_len != pc->len) {
+		log_error("retrieve_plocks ckpt read %s error %d len %u %s",
+			  id, rv, read_len, ls->name);
+		return -EIO;
+	}
+
+	log_plock(ls, "retrieve_plocks chunk %s %llu-%llu len %u", id,
+		  (unsigned long long)pc->first, (unsigned long long)pc->last,
+		  pc->len);
+
+	while (off + sizeof(struct pack_resource) <= pc->len) {
+		pr = (struct pack_resource *)(section_buf + off);
+		number = le64_to_cpu(pr->number);
+		count = le32_to_cpu(pr->count);
+		off += sizeof(struct pack_resource);
+
+		if (count > (pc->len - off) / sizeof(struct pack_plock)) {
+			log_error("retrieve_plocks bad count %u in %s %s",
+				  count, id, ls->name);
+			return -EINVAL;
+		}
+
+		/* the last resource of the previous chunk continued here */
+		if (first && rt->last_r && rt->last_r->number == number)
+			r = rt->last_r;
+		else {
+			r = new_ckpt_resource(ls, number,
+					      (int)le32_to_cpu(pr->owner));
+			if (!r)
+				return -ENOMEM;
+			if (!rt->r_count)
+				rt->r_num_first = number;
+			rt->r_num_last = number;
+			rt->r_count++;
+		}
+
+		unpack_plocks(r, (struct pack_plock *)(section_buf + off),
+			      count);
+		off += count * sizeof(struct pack_plock);
+		rt->p_count += count;
+		rt->last_r = r;
+		first = 0;
+	}
+
+	return 0;
+}
+
+/* While a bulk ckpt is being read, a saved message can be processed if none
+   of the inodes it refers to are in the range of chunks not yet read, and no
+   earlier saved message for any of those inodes is still waiting. */
+
+static uint64_t *waiting_numbers;
+static uint32_t waiting_numbers_size;
+
+static int retrieve_pending(struct plock_retrieve *rt, uint64_t number)
+{
+	if (rt->next >= rt->chunk_count)
+		return 0;
+	return number >= rt->chunks[rt->next].first &&
+	       number <= rt->chunks[rt->chunk_count - 1].last;
+}
+
+static uint32_t saved_info_count(struct save_msg *sm)
+{
+	struct dlm_header *hd = (struct dlm_header *)sm->buf;
+	uint32_t max;
+
+	if (sm->len < sizeof(struct dlm_header))
+		return 0;
+	max = (sm->len - sizeof(struct dlm_header)) /
+	      sizeof(struct dlm_plock_info);
+
+	switch (sm->type) {
+	case DLM_MSG_PLOCK_BATCH:
+		return hd->msgdata < max ? hd->msgdata : max;
+	case DLM_MSG_PLOCK:
+	case DLM_MSG_PLOCK_OWN:
+	case DLM_MSG_PLOCK_DROP:
+	case DLM_MSG_PLOCK_SYNC_LOCK:
+	case DLM_MSG_PLOCK_SYNC_WAITER:
+		return max ? 1 : 0;
+	}
+	return 0;
+}
+
+static uint64_t saved_info_number(struct save_msg *sm, uint32_t i)
+{
+	struct dlm_plock_info info;
+
+	memcpy(&info, sm->buf + sizeof(struct dlm_header) +
+	       i * sizeof(struct dlm_plock_info), sizeof(info));
+	return le64_to_cpu(info.number);
+}
+
+static void process_ready_plocks(struct lockspace *ls,
+				 struct plock_retrieve *rt)
+{
+	struct save_msg *sm, *sm2;
+	uint64_t *new, number;
+	uint32_t i, j, count, waiting = 0;
+	int ready, done = 0;
+
+	list_for_each_entry_safe(sm, sm2, &ls->saved_messages, list) {
+		count = saved_info_count(sm);
+		if (!count)
+			continue;
+
+		ready = 1;
+		for (i = 0; i < count && ready; i++) {
+			number = saved_info_number(sm, i);
+			if (retrieve_pending(rt, number)) {
+				ready = 0;
+				break;
+			}
+			for (j = 0; j < waiting; j++) {
+				if (waiting_numbers[j] == number) {
+					ready = 0;
+					break;
+				}
+			}
+		}
+
+		if (ready) {
+			process_saved_message(ls, sm);
+			list_del(&sm->list);
+			free(sm);
+			done++;
+			continue;
+		}
+
+		if (waiting + count > waiting_numbers_size) {
+			new = realloc(waiting_numbers, (waiting + count) * 2 *
+				      sizeof(uint64_t));
+			if (!new)
+				break;
+			waiting_numbers = new;
+			waiting_numbers_size = (waiting + count) * 2;
+		}
+		for (i = 0; i < count; i++)
+			waiting_numbers[waiting++] = saved_info_number(sm, i);
+	}
+
+	if (done)
+		log_plock(ls, "retrieve_plocks processed %d saved", done);
+}
+
+static void finish_retrieve(struct lockspace *ls, uint32_t *sig)
+{
+	struct plock_retrieve *rt = ls->plock_retrieve;
+
+	saCkptCheckpointClose(rt->h);
+
+	*sig = (0xFFFFFFFF & rt->r_num_first) ^ (0xFFFFFFFF & rt->r_num_last)
+	       ^ rt->r_count ^ rt->p_count;
+
+	log_group(ls, "retrieve_plocks first %llu last %llu r_count %u "
+		  "p_count %u sig %x",
+		  (unsigned long long)rt->r_num_first,
+		  (unsigned long long)rt->r_num_last,
+		  rt->r_count, rt->p_count, *sig);
+	log_plock(ls, "retrieve_plocks first %llu last %llu r_count %u "
+		  "p_count %u sig %x",
+		  (unsigned long long)rt->r_num_first,
+		  (unsigned long long)rt->r_num_last,
+		  rt->r_count, rt->p_count, *sig);
+
+	free(rt->chunks);
+	free(rt);
+	ls->plock_retrieve = NULL;
+}
+
+/* Read the next chunk of a bulk ckpt.  Returns 1 when the ckpt has been
+   read; a read error ends the retrieve early, and the sig check in
+   plocks_retrieved() then disables plocks. */
+
+static int retrieve_next(struct lockspace *ls)
+{
+	struct plock_retrieve *rt = ls->plock_retrieve;
+
+	if (rt->next < rt->chunk_count && retrieve_chunk(ls, rt))
+		rt->next = rt->chunk_count;
+
+	if (rt->next < rt->chunk_count) {
+		process_ready_plocks(ls, rt);
+		return 0;
+	}
+	return 1;
+}
+
+/* called from the main loop to read one chunk from each bulk ckpt still
+   being retrieved */
+
+void retrieve_plocks_all(void)
+{
+	struct lockspace *ls;
+	uint32_t sig;
+
+	poll_retrieve_plock = 0;
+
+	list_for_each_entry(ls, &lockspaces, list) {
+		if (!ls->plock_retrieve)
+			continue;
+
+		plock_worker_sync(ls);
+
+		if (!retrieve_next(ls)) {
+			poll_retrieve_plock = 1;
+			continue;
+		}
+
+		finish_retrieve(ls, &sig);
+		plocks_retrieved(ls, sig);
+	}
+}
+
+/* Read the rest of a bulk ckpt now.  Called before a confchg is applied so
+   that the ckpt state, which predates the confchg, is complete first, as if
+   the whole ckpt had been read when the stored message arrived. */
+
+void retrieve_plocks_finish(struct lockspace *ls)
+{
+	uint32_t sig;
+
+	if (!ls->plock_retrieve)
+		return;
+
+	plock_worker_sync(ls);
+
+	log_group(ls, "retrieve_plocks finish at chunk %u of %u",
+		  ls->plock_retrieve->next, ls->plock_retrieve->chunk_count);
+
+	while (!retrieve_next(ls))
+		;
+
+	finish_retrieve(ls, &sig);
+	plocks_retrieved(ls, sig);
+}
+
+/* Read the ckpt up to and including the chunk holding the given inode.  A
+   local op can't wait for it like a saved message does: find_resource()
+   would create a new resource for the inode, and the ckpt would then add
+   a second one holding the existing locks (and, with plock_ownership, the
+   new one would try to take ownership from the real owner). */
+
+static void retrieve_plocks_upto(struct lockspace *ls, uint64_t number)
+{
+	uint32_t sig;
+
+	if (!ls->plock_retrieve ||
+	    !retrieve_pending(ls->plock_retrieve, number))
+		return;
+
+	plock_worker_sync(ls);
+
+	log_plock(ls, "retrieve_plocks upto %llu at chunk %u of %u",
+		  (unsigned long long)number, ls->plock_retrieve->next,
+		  ls->plock_retrieve->chunk_count);
+
+	while (retrieve_pending(ls->plock_retrieve, number)) {
+		if (retrieve_next(ls)) {
+			finish_retrieve(ls, &sig);
+			plocks_retrieved(ls, sig);
+			return;
+		}
+	}
+}
+
 /* called by a node that's just been added to the group to get existing plock
-   state */
+   state.  Returns 1 if a bulk ckpt is still being read, in which case
+   plocks_retrieved() is called when it's done; otherwise sig is set. */
 
-void retrieve_plocks(struct lockspace *ls, uint32_t *sig)
+int retrieve_plocks(struct lockspace *ls, uint32_t *sig)
 {
 	SaCkptCheckpointHandleT h;
 	SaCkptSectionIterationHandleT itr;
@@ -2017,12 +3769,14 @@ void retrieve_plocks(struct lockspace *ls, uint32_t *sig)
 	SaNameT name;
 	SaAisErrorT rv;
 	char buf[SECTION_NAME_LEN];
-	int len, lock_count;
+	int len, lock_count, error;
 	uint32_t r_count = 0, p_count = 0;
 	uint64_t r_num, r_num_first = 0, r_num_last = 0;
 
 	if (!cfgd_enable_plock || ls->disable_plock)
-		return;
+		return 0;
+
+	plock_worker_sync(ls);
 
 	log_group(ls, "retrieve_plocks");
 
@@ -2041,9 +3795,21 @@ void retrieve_plocks(struct lockspace *ls, uint32_t *sig)
 	if (rv != SA_AIS_OK) {
 		log_error("retrieve_plocks ckpt open error %d %s",
 			  rv, ls->name);
-		return;
+		return 0;
 	}
 
+	error = read_index(ls, h, &ls->plock_retrieve);
+	if (!error) {
+		if (!retrieve_next(ls)) {
+			poll_retrieve_plock = 1;
+			return 1;
+		}
+		finish_retrieve(ls, sig);
+		return 0;
+	}
+	if (error != -ENOENT)
+		goto out;
+
  init_retry:
 	rv = saCkptSectionIterationInitialize(h, SA_CKPT_SECTIONS_ANY, 0, &itr);
 	if (rv == SA_AIS_ERR_TRY_AGAIN) {
@@ -2076,8 +3842,15 @@ void retrieve_plocks(struct lockspace *ls, uint32_t *sig)
 		if (!desc.sectionId.idLen)
 			continue;
 
+		if (grow_section_buf(desc.sectionSize)) {
+			log_error("retrieve_plocks no mem for section %llu %s",
+				  (unsigned long long)desc.sectionSize,
+				  ls->name);
+			goto out_it;
+		}
+
 		iov.sectionId = desc.sectionId;
-		iov.dataBuffer = &section_buf;
+		iov.dataBuffer = section_buf;
 		iov.dataSize = desc.sectionSize;
 		iov.dataOffset = 0;
 
@@ -2147,6 +3920,7 @@ void retrieve_plocks(struct lockspace *ls, uint32_t *sig)
 		  (unsigned long long)r_num_first,
 		  (unsigned long long)r_num_last,
 		  r_count, p_count, *sig);
+	return 0;
 }
 
 /* Called when a node has failed, or we're unmounting.  For a node failure, we
@@ -2163,18 +3937,19 @@ void purge_plocks(struct lockspace *ls, int nodeid, int unmount)
 	if (!cfgd_enable_plock || ls->disable_plock)
 		return;
 
+	plock_worker_sync(ls);
+
 	list_for_each_entry_safe(r, r2, &ls->plock_resources, list) {
 		list_for_each_entry_safe(po, po2, &r->locks, list) {
 			if (po->nodeid == nodeid || unmount) {
-				list_del(&po->list);
-				free(po);
+				del_lock(r, po);
 				purged++;
 			}
 		}
 
 		list_for_each_entry_safe(w, w2, &r->waiters, list) {
 			if (w->info.nodeid == nodeid || unmount) {
-				list_del(&w->list);
+				unlink_waiter(r, w);
 				free(w);
 				purged++;
 			}
@@ -2190,11 +3965,11 @@ void purge_plocks(struct lockspace *ls, int nodeid, int unmount)
 		}
 		
 		if (!list_empty(&r->waiters))
-			do_waiters(ls, r);
+			do_waiters(ls, r, 0, ~0ULL);
 
 		if (!cfgd_plock_ownership &&
 		    list_empty(&r->locks) && list_empty(&r->waiters)) {
-			list_del(&r->list);
+			del_resource(ls, r);
 			free(r);
 		}
 	}
@@ -2217,6 +3992,10 @@ int fill_plock_dump_buf(struct lockspace *ls)
 	memset(plock_dump_buf, 0, sizeof(plock_dump_buf));
 	plock_dump_len = 0;
 
+	/* called by the query thread */
+	if (ls->plock_worker)
+		pthread_mutex_lock(&ls->plock_worker->state_mutex);
+
 	gettimeofday(&now, NULL);
 
 	list_for_each_entry(r, &ls->plock_resources, list) {
@@ -2289,7 +4068,51 @@ int fill_plock_dump_buf(struct lockspace *ls)
 		}
 	}
  out:
+	if (ls->plock_worker)
+		pthread_mutex_unlock(&ls->plock_worker->state_mutex);
 	plock_dump_len = pos;
 	return rv;
 }
 
+
+/* called when the lockspace is freed; the plocks themselves have already
+   been purged, but with ownership enabled the resources remain.  Any plock
+   worker is stopped first. */
+
+void free_plock_resources(struct lockspace *ls)
+{
+	struct posix_lock *po, *po2;
+	struct lock_waiter *w, *w2;
+	struct resource *r, *r2;
+
+	stop_plock_worker(ls);
+
+	if (ls->plock_retrieve) {
+		saCkptCheckpointClose(ls->plock_retrieve->h);
+		free(ls->plock_retrieve->chunks);
+		free(ls->plock_retrieve);
+		ls->plock_retrieve = NULL;
+	}
+
+	list_for_each_entry_safe(r, r2, &ls->plock_resources, list) {
+		list_for_each_entry_safe(po, po2, &r->locks, list) {
+			list_del(&po->list);
+			free(po);
+		}
+		list_for_each_entry_safe(w, w2, &r->waiters, list) {
+			list_del(&w->list);
+			free(w);
+		}
+		list_for_each_entry_safe(w, w2, &r->pending, list) {
+			list_del(&w->list);
+			free(w);
+		}
+		del_resource(ls, r);
+		free(r);
+	}
+
+	if (ls->plock_resources_hash)
+		free(ls->plock_resources_hash);
+	ls->plock_resources_hash = NULL;
+	ls->plock_resources_hash_size = 0;
+}
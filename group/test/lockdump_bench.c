@@ -0,0 +1,272 @@
+/*
+ * Measure parsing a debugfs lock dump (<ls>_locks) with fgets and sscanf,
+ * as dlm_controld and dlm_tool used to, and with the lockdump parser they
+ * share now.
+ *
+ * A dump file with the requested number of lock lines is generated first
+ * (or an existing one given with -f is used), then read with each parser,
+ * and the fields of every line are summed so that both can be checked to
+ * have parsed the same values.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "lockdump.h"
+
+#define LOCK_LINE_MAX 1024
+
+struct result {
+	unsigned int lines;
+	uint64_t sum;
+};
+
+static uint64_t dt_usec(struct timeval *start, struct timeval *stop)
+{
+	uint64_t dt;
+
+	dt = stop->tv_sec - start->tv_sec;
+	dt *= 1000000;
+	dt += stop->tv_usec - start->tv_usec;
+	return dt;
+}
+
+static void generate(const char *path, unsigned int count)
+{
+	FILE *file;
+	unsigned int i;
+	int status, grmode, rqmode;
+
+	file = fopen(path, "w");
+	if (!file) {
+		fprintf(stderr, "can't create %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(file, "id nodeid remid pid xid exflags flags sts grmode "
+		"rqmode time_ms r_nodeid r_len r_name\n");
+
+	srandom(count);
+
+	for (i = 0; i < count; i++) {
+		status = 1 + random() % 3;
+		grmode = status == 1 ? -1 : random() % 6;
+		rqmode = status == 2 ? -1 : random() % 6;
+
+		fprintf(file, "%x %d %x %u %llu %x %x %d %d %d %llu %d %d "
+			"\"       5          %8x\"\n",
+			i + 1, (int)(random() % 16), (unsigned int)random(),
+			(unsigned int)(random() % 32768),
+			(unsigned long long)(random() % 1000),
+			(unsigned int)(random() % 0x10000), (unsigned int)0x10000,
+			status, grmode, rqmode,
+			(unsigned long long)random(), (int)(random() % 16) - 1,
+			24, (unsigned int)(i / 4));
+	}
+
+	fclose(file);
+}
+
+static uint64_t sum_lock(uint32_t id, int nodeid, uint32_t remid, int ownpid,
+			 uint64_t xid, uint32_t exflags, uint32_t flags,
+			 int status, int grmode, int rqmode, int r_nodeid,
+			 int r_len, const char *name, int name_len)
+{
+	uint64_t sum;
+	int i;
+
+	sum = id + nodeid + remid + ownpid + xid + exflags + flags + status +
+	      grmode + rqmode + r_nodeid + r_len;
+	for (i = 0; i < name_len; i++)
+		sum += name[i] * (i + 1);
+	return sum;
+}
+
+/* the way read_debugfs_locks() and do_lockdump() used to parse */
+
+static void parse_r_name(char *line, char *name)
+{
+	char *p;
+	int i = 0;
+	int begin = 0;
+
+	for (p = line; ; p++) {
+		if (*p == '"') {
+			if (begin)
+				break;
+			begin = 1;
+			continue;
+		}
+		if (begin)
+			name[i++] = *p;
+	}
+}
+
+static int run_sscanf(const char *path, struct result *res)
+{
+	FILE *file;
+	char line[LOCK_LINE_MAX];
+	char r_name[65];
+	unsigned long long xid;
+	unsigned int time, ownpid;
+	uint32_t id, remid, exflags, flags;
+	int8_t status, grmode, rqmode;
+	int nodeid, r_nodeid, r_len;
+	int rv;
+
+	file = fopen(path, "r");
+	if (!file)
+		return -1;
+
+	if (!fgets(line, LOCK_LINE_MAX, file))
+		goto out;
+
+	while (fgets(line, LOCK_LINE_MAX, file)) {
+		rv = sscanf(line, "%x %d %x %u %llu %x %x %hhd %hhd %hhd %u %d %d",
+			    &id, &nodeid, &remid, &ownpid, &xid, &exflags,
+			    &flags, &status, &grmode, &rqmode, &time,
+			    &r_nodeid, &r_len);
+		if (rv != 13) {
+			fprintf(stderr, "invalid line %d: %s", rv, line);
+			break;
+		}
+
+		memset(r_name, 0, sizeof(r_name));
+		parse_r_name(line, r_name);
+
+		res->lines++;
+		res->sum += sum_lock(id, nodeid, remid, ownpid, xid, exflags,
+				     flags, status, grmode, rqmode, r_nodeid,
+				     r_len, r_name, strlen(r_name));
+	}
+ out:
+	fclose(file);
+	return 0;
+}
+
+static int run_lockdump(const char *path, struct result *res)
+{
+	static struct lockdump ld;
+	struct lockdump_lock lk;
+	char *line;
+	int rv;
+
+	if (lockdump_open(&ld, path) < 0)
+		return -1;
+
+	if (!lockdump_line(&ld))
+		goto out;
+
+	while ((line = lockdump_line(&ld))) {
+		rv = lockdump_parse_lock(line, &lk);
+		if (rv != LOCKDUMP_LOCK_FIELDS) {
+			fprintf(stderr, "invalid line %d: %s\n", rv, line);
+			break;
+		}
+
+		res->lines++;
+		res->sum += sum_lock(lk.id, lk.nodeid, lk.remid, lk.ownpid,
+				     lk.xid, lk.exflags, lk.flags, lk.status,
+				     lk.grmode, lk.rqmode, lk.r_nodeid,
+				     lk.r_len, lk.r_name, lk.r_name_len);
+	}
+ out:
+	lockdump_close(&ld);
+	return 0;
+}
+
+static void print_usage(void)
+{
+	printf("Usage:\n");
+	printf("\n");
+	printf("lockdump_bench [options]\n");
+	printf("\n");
+	printf("Options:\n");
+	printf("\n");
+	printf("  -n <num>	Number of lock lines to generate\n");
+	printf("		Default is 2000000\n");
+	printf("  -f <path>	Parse this dump file instead of generating one\n");
+	printf("  -k		Keep the generated file\n");
+	printf("  -h		Print this help, then exit\n");
+}
+
+int main(int argc, char **argv)
+{
+	char gen_path[] = "/tmp/lockdump_bench.XXXXXX";
+	struct timeval begin, end;
+	struct result res[2];
+	const char *path = NULL;
+	unsigned int count = 2000000;
+	int optchar, fd, keep = 0;
+	double secs;
+	int i, rv;
+
+	while ((optchar = getopt(argc, argv, "n:f:kh")) != EOF) {
+		switch (optchar) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'f':
+			path = optarg;
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		case 'h':
+			print_usage();
+			exit(EXIT_SUCCESS);
+		default:
+			print_usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (!path) {
+		fd = mkstemp(gen_path);
+		if (fd < 0) {
+			fprintf(stderr, "mkstemp error %d\n", errno);
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+		path = gen_path;
+		generate(path, count);
+	}
+
+	printf("parser,lines,seconds,lines_per_sec,sum\n");
+
+	for (i = 0; i < 2; i++) {
+		memset(&res[i], 0, sizeof(struct result));
+
+		gettimeofday(&begin, NULL);
+		if (i)
+			rv = run_lockdump(path, &res[i]);
+		else
+			rv = run_sscanf(path, &res[i]);
+		gettimeofday(&end, NULL);
+
+		if (rv < 0) {
+			fprintf(stderr, "can't open %s: %s\n", path,
+				strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		secs = dt_usec(&begin, &end) * 1.e-6;
+		printf("%s,%u,%.3f,%.0f,%llx\n", i ? "lockdump" : "sscanf",
+		       res[i].lines, secs, secs > 0 ? res[i].lines / secs : 0,
+		       (unsigned long long)res[i].sum);
+	}
+
+	if (path == gen_path && !keep)
+		unlink(path);
+
+	if (res[0].lines != res[1].lines || res[0].sum != res[1].sum) {
+		printf("MISMATCH\n");
+		return 1;
+	}
+	return 0;
+}
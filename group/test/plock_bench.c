@@ -0,0 +1,328 @@
+/*
+ * Measure the cost of plock ops in dlm_controld as the number of plock
+ * resources in a lockspace grows.
+ *
+ * plock.c is built directly into this program with the rest of the daemon
+ * stubbed out (plock_stubs.h).  Synthetic dlm_plock_info records are written
+ * into one end of a socketpair standing in for the plock misc device, up to
+ * the queue depth (-q) at a time, and pushed through process_plocks(); cpg
+ * messages sent by plock.c are looped back and delivered through
+ * receive_plock()/receive_own() as cpg would deliver our own messages, so the
+ * full local path (device read, resource lookup, message receive, lock,
+ * result write) is exercised.  With -T 1 the ops are spread over -s
+ * lockspaces, each handled by its own plock worker thread.
+ */
+
+#include "plock_stubs.h"
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+
+#define BENCH_ID	0x12345678
+
+static int dev_fd;		/* our end of the fake plock device */
+static unsigned int results_read;
+static unsigned int depth = 1;
+static unsigned int queued;
+static unsigned int nls = 1;
+
+/* benchmark */
+
+static void drain_results(void)
+{
+	struct dlm_plock_info info;
+
+	while (read(dev_fd, &info, sizeof(info)) == sizeof(info)) {
+		if (info.rv && info.rv != -EAGAIN) {
+			fprintf(stderr, "op %llx result %d\n",
+				(unsigned long long)info.number, info.rv);
+			exit(EXIT_FAILURE);
+		}
+		results_read++;
+	}
+}
+
+static void process_queued(void)
+{
+	int bytes;
+
+	while (queued) {
+		process_plocks(0);
+		sync_workers();
+		deliver_messages();
+		sync_workers();
+		drain_results();
+
+		if (ioctl(plock_device_fd, FIONREAD, &bytes) < 0 || !bytes)
+			queued = 0;
+	}
+}
+
+static void do_ls_op(uint32_t fsid, uint64_t number, int optype,
+		     uint64_t start, uint64_t end)
+{
+	struct dlm_plock_info info;
+
+	memset(&info, 0, sizeof(info));
+	info.version[0] = DLM_PLOCK_VERSION_MAJOR;
+	info.version[1] = DLM_PLOCK_VERSION_MINOR;
+	info.version[2] = DLM_PLOCK_VERSION_PATCH;
+	info.optype = optype;
+	info.ex = 1;
+	info.wait = 0;
+	info.fsid = fsid;
+	info.pid = getpid();
+	info.owner = getpid();
+	info.number = number;
+	info.start = start;
+	info.end = end;
+
+	if (write(dev_fd, &info, sizeof(info)) != sizeof(info)) {
+		fprintf(stderr, "device write error %d\n", errno);
+		exit(EXIT_FAILURE);
+	}
+
+	if (++queued >= depth)
+		process_queued();
+}
+
+static void do_op(uint64_t number, int optype, uint64_t start, uint64_t end)
+{
+	do_ls_op(BENCH_ID + number % nls, number, optype, start, end);
+}
+
+static struct lockspace *new_ls(const char *name, uint32_t global_id)
+{
+	struct lockspace *ls;
+
+	ls = malloc(sizeof(struct lockspace));
+	if (!ls) {
+		fprintf(stderr, "no mem\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(ls, 0, sizeof(struct lockspace));
+	strcpy(ls->name, name);
+	ls->global_id = global_id;
+	INIT_LIST_HEAD(&ls->saved_messages);
+	INIT_LIST_HEAD(&ls->plock_resources);
+	list_add(&ls->list, &lockspaces);
+	return ls;
+}
+
+static void free_ls(struct lockspace *ls)
+{
+	list_del(&ls->list);
+	purge_plocks(ls, 0, 1);
+	free_plock_resources(ls);
+	free(ls);
+}
+
+/* populate: one lock held on each of the base resources */
+
+static void populate(unsigned int resources)
+{
+	unsigned int i;
+
+	for (i = 0; i < resources; i++)
+		do_op(i + 1, DLM_PLOCK_OP_LOCK, 0, 0);
+	process_queued();
+}
+
+static void run(unsigned int resources, unsigned int ops)
+{
+	struct timeval begin, end;
+	unsigned int i;
+	uint64_t number;
+	struct lockspace *ls, *safe;
+	char name[DLM_LOCKSPACE_LEN];
+	double secs;
+
+	for (i = 0; i < nls; i++) {
+		snprintf(name, sizeof(name), "plock_bench%u", i);
+		new_ls(name, BENCH_ID + i);
+	}
+	populate(resources);
+
+	/* measure: lock/unlock on random existing inodes, so every op has to
+	   find its resource among all the others */
+
+	srandom(resources);
+	results_read = 0;
+	gettimeofday(&begin, NULL);
+
+	for (i = 0; i < ops; i += 2) {
+		number = (random() % resources) + 1;
+		do_op(number, DLM_PLOCK_OP_LOCK, 100, 199);
+		do_op(number, DLM_PLOCK_OP_UNLOCK, 100, 199);
+	}
+	process_queued();
+
+	gettimeofday(&end, NULL);
+
+	secs = dt_usec(&begin, &end) * 1.e-6;
+	printf("%u,%u,%u,%u,%.3f,%.0f\n", resources, nls, i, results_read,
+	       secs, secs > 0 ? i / secs : 0);
+
+	list_for_each_entry_safe(ls, safe, &lockspaces, list)
+		free_ls(ls);
+}
+
+/* Time storing the plock state in a checkpoint and reading it into a second
+   lockspace, as a node joining the lockspace would, in the old one section
+   per resource format and the bulk format.  While the bulk ckpt is being
+   read, a local op is done on the last inode, whose chunk is read last; it
+   must not leave the joining lockspace with two resources for the inode, so
+   "retrieved" should always equal "resources". */
+
+static void run_ckpt(unsigned int resources)
+{
+	struct timeval begin, mid, end;
+	struct lockspace *ls;
+	uint32_t sig, retrieved_sig;
+	int bulk;
+
+	stub_ls = new_ls("plock_bench", BENCH_ID);
+	populate(resources);
+
+	for (bulk = 0; bulk < 2; bulk++) {
+		stub_ckpt_bulk = bulk;
+		stub_ls->last_checkpoint_time = 0;
+
+		ls = new_ls("plock_bench_join", BENCH_ID + 1);
+		ls->need_plocks = 1;
+		ls->save_plocks = 1;
+		stub_retrieved = 0;
+
+		gettimeofday(&begin, NULL);
+		store_plocks(stub_ls, &sig);
+		gettimeofday(&mid, NULL);
+
+		if (!retrieve_plocks(ls, &retrieved_sig)) {
+			plocks_retrieved(ls, retrieved_sig);
+		} else {
+			do_ls_op(ls->global_id, resources, DLM_PLOCK_OP_LOCK,
+				 0, 0);
+			process_queued();
+			while (poll_retrieve_plock)
+				retrieve_plocks_all();
+		}
+		gettimeofday(&end, NULL);
+
+		printf("%s,%u,%.3f,%.3f,%u,%s\n", bulk ? "bulk" : "old",
+		       resources, dt_usec(&begin, &mid) * 1.e-6,
+		       dt_usec(&mid, &end) * 1.e-6, ls->plock_resources_count,
+		       stub_retrieved && stub_retrieved_sig == sig &&
+		       ls->plock_resources_count == resources ?
+		       "match" : "MISMATCH");
+
+		free_ls(ls);
+		close_plock_checkpoint(stub_ls);
+	}
+
+	free_ls(stub_ls);
+}
+
+static void print_usage(void)
+{
+	printf("Usage:\n");
+	printf("\n");
+	printf("plock_bench [options] [resources ...]\n");
+	printf("\n");
+	printf("Options:\n");
+	printf("\n");
+	printf("  -n <num>	Number of ops to time at each resource count\n");
+	printf("		Default is 200000\n");
+	printf("  -o <n>	Enable (1) or disable (0) plock ownership\n");
+	printf("		Default is 0\n");
+	printf("  -b <num>	Max plock ops processed per wakeup (plock_batch)\n");
+	printf("		Default is %d\n", DEFAULT_PLOCK_BATCH);
+	printf("  -q <num>	Ops queued on the device before each wakeup\n");
+	printf("		Default is 1\n");
+	printf("  -T <num>	Enable (1) or disable (0) plock worker threads\n");
+	printf("		Default is 0\n");
+	printf("  -s <num>	Number of lockspaces the ops are spread over\n");
+	printf("		Default is 1\n");
+	printf("  -c		Time checkpoint store and retrieve instead of ops\n");
+	printf("  -h		Print this help, then exit\n");
+	printf("\n");
+	printf("Default resource counts are 100 1000 10000 100000\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int def_counts[] = { 100, 1000, 10000, 100000 };
+	unsigned int ops = 200000;
+	int sv[2];
+	int i, optchar, ckpt = 0;
+
+	while ((optchar = getopt(argc, argv, "n:o:b:q:T:s:ch")) != EOF) {
+		switch (optchar) {
+		case 'n':
+			ops = atoi(optarg);
+			break;
+		case 'o':
+			cfgd_plock_ownership = atoi(optarg);
+			break;
+		case 'b':
+			cfgd_plock_batch = atoi(optarg);
+			break;
+		case 'q':
+			depth = atoi(optarg);
+			break;
+		case 'T':
+			cfgd_plock_threads = atoi(optarg);
+			break;
+		case 's':
+			nls = atoi(optarg);
+			break;
+		case 'c':
+			ckpt = 1;
+			break;
+		case 'h':
+			print_usage();
+			exit(EXIT_SUCCESS);
+		default:
+			print_usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* the ckpt runs use a single lockspace and a joining one */
+	if (ckpt || !nls)
+		nls = 1;
+
+	INIT_LIST_HEAD(&lockspaces);
+	INIT_LIST_HEAD(&sent_messages);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		fprintf(stderr, "socketpair error %d\n", errno);
+		exit(EXIT_FAILURE);
+	}
+	plock_device_fd = sv[0];
+	dev_fd = sv[1];
+	fcntl(dev_fd, F_SETFL, fcntl(dev_fd, F_GETFL) | O_NONBLOCK);
+
+	if (ckpt)
+		printf("format,resources,store_seconds,retrieve_seconds,"
+		       "retrieved,sig\n");
+	else
+		printf("resources,lockspaces,ops,results,seconds,ops_per_sec\n");
+
+	if (optind < argc) {
+		for (i = optind; i < argc; i++) {
+			if (ckpt)
+				run_ckpt(atoi(argv[i]));
+			else
+				run(atoi(argv[i]), ops);
+		}
+	} else {
+		for (i = 0; i < sizeof(def_counts) / sizeof(def_counts[0]); i++) {
+			if (ckpt)
+				run_ckpt(def_counts[i]);
+			else
+				run(def_counts[i], ops);
+		}
+	}
+
+	return 0;
+}
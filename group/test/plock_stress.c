@@ -0,0 +1,754 @@
+/*
+ * Check the range-indexed plock conflict and waiter code in dlm_controld
+ * against the original list-based code.
+ *
+ * plock.c is built directly into this program with the rest of the daemon
+ * stubbed out (plock_stubs.h).  Random lock, unlock and get ops from several
+ * nodes and owners on a few inodes, with small overlapping ranges, are run
+ * through plock.c and through a copy of the original list-walking functions
+ * kept here as a reference.  Synced waiters that may not be blocked and node
+ * purges are mixed in.  After each op the results written to the (fake) plock
+ * device, the granted locks, and the order of the waiters must all match.
+ *
+ * A getlk may report any one of the conflicting locks, so for get ops only
+ * the result is compared, and the lock returned is checked to be one that
+ * conflicts.
+ */
+
+#include "plock_stubs.h"
+
+#include <sys/socket.h>
+
+static int dev_fd;		/* our end of the fake plock device */
+static int verbose;
+
+#define MAX_RESULTS 4096
+
+static struct dlm_plock_info got[MAX_RESULTS];
+static struct dlm_plock_info want[MAX_RESULTS];
+static int got_count;
+static int want_count;
+
+/* reference: the original list implementation */
+
+struct ref_lock {
+	struct list_head list;
+	uint32_t nodeid;
+	uint64_t owner;
+	uint32_t pid;
+	int ex;
+	uint64_t start;
+	uint64_t end;
+};
+
+struct ref_waiter {
+	struct list_head list;
+	struct dlm_plock_info info;
+};
+
+struct ref_resource {
+	struct list_head list;
+	uint64_t number;
+	struct list_head locks;
+	struct list_head waiters;
+	int waiter_count;
+};
+
+static struct list_head ref_resources;
+
+static struct ref_resource *ref_find(uint64_t number)
+{
+	struct ref_resource *rr;
+
+	list_for_each_entry(rr, &ref_resources, list) {
+		if (rr->number == number)
+			return rr;
+	}
+
+	rr = malloc(sizeof(struct ref_resource));
+	if (!rr) {
+		fprintf(stderr, "no mem\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(rr, 0, sizeof(struct ref_resource));
+	rr->number = number;
+	INIT_LIST_HEAD(&rr->locks);
+	INIT_LIST_HEAD(&rr->waiters);
+	list_add_tail(&rr->list, &ref_resources);
+	return rr;
+}
+
+static void ref_result(struct dlm_plock_info *in, int rv)
+{
+	if (in->nodeid != our_nodeid)
+		return;
+	if (want_count == MAX_RESULTS) {
+		fprintf(stderr, "too many results\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(&want[want_count], in, sizeof(struct dlm_plock_info));
+	want[want_count++].rv = rv;
+}
+
+static int ref_is_conflict(struct ref_resource *rr, struct dlm_plock_info *in,
+			   int get)
+{
+	struct ref_lock *po;
+
+	list_for_each_entry(po, &rr->locks, list) {
+		if (po->nodeid == in->nodeid && po->owner == in->owner)
+			continue;
+		if (!ranges_overlap(po->start, po->end, in->start, in->end))
+			continue;
+
+		if (in->ex || po->ex) {
+			if (get) {
+				in->ex = po->ex;
+				in->pid = po->pid;
+				in->start = po->start;
+				in->end = po->end;
+			}
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int ref_add_lock(struct ref_resource *rr, uint32_t nodeid,
+			uint64_t owner, uint32_t pid, int ex, uint64_t start,
+			uint64_t end)
+{
+	struct ref_lock *po;
+
+	po = malloc(sizeof(struct ref_lock));
+	if (!po)
+		return -ENOMEM;
+	memset(po, 0, sizeof(struct ref_lock));
+
+	po->start = start;
+	po->end = end;
+	po->nodeid = nodeid;
+	po->owner = owner;
+	po->pid = pid;
+	po->ex = ex;
+	list_add_tail(&po->list, &rr->locks);
+	return 0;
+}
+
+static int ref_lock_case1(struct ref_lock *po, struct ref_resource *rr,
+			  struct dlm_plock_info *in)
+{
+	uint64_t start2, end2;
+	int rv;
+
+	start2 = po->start;
+	end2 = po->end;
+	rv = shrink_range2(&start2, &end2, in->start, in->end);
+	if (rv)
+		return rv;
+
+	po->start = in->start;
+	po->end = in->end;
+	po->ex = in->ex;
+
+	return ref_add_lock(rr, in->nodeid, in->owner, in->pid, !in->ex,
+			    start2, end2);
+}
+
+static int ref_lock_case2(struct ref_lock *po, struct ref_resource *rr,
+			  struct dlm_plock_info *in)
+{
+	int rv;
+
+	rv = ref_add_lock(rr, in->nodeid, in->owner, in->pid,
+			  !in->ex, po->start, in->start - 1);
+	if (rv)
+		return rv;
+
+	rv = ref_add_lock(rr, in->nodeid, in->owner, in->pid,
+			  !in->ex, in->end + 1, po->end);
+	if (rv)
+		return rv;
+
+	po->start = in->start;
+	po->end = in->end;
+	po->ex = in->ex;
+	return 0;
+}
+
+static int ref_lock_internal(struct ref_resource *rr,
+			     struct dlm_plock_info *in)
+{
+	struct ref_lock *po, *safe;
+
+	list_for_each_entry_safe(po, safe, &rr->locks, list) {
+		if (po->nodeid != in->nodeid || po->owner != in->owner)
+			continue;
+		if (!ranges_overlap(po->start, po->end, in->start, in->end))
+			continue;
+
+		switch (overlap_type(in->start, in->end, po->start, po->end)) {
+		case 0:
+			po->ex = in->ex;
+			return 0;
+		case 1:
+			if (po->ex == in->ex)
+				return 0;
+			return ref_lock_case1(po, rr, in);
+		case 2:
+			if (po->ex == in->ex)
+				return 0;
+			return ref_lock_case2(po, rr, in);
+		case 3:
+			list_del(&po->list);
+			free(po);
+			break;
+		case 4:
+			if (po->start < in->start)
+				po->end = in->start - 1;
+			else
+				po->start = in->end + 1;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	return ref_add_lock(rr, in->nodeid, in->owner, in->pid,
+			    in->ex, in->start, in->end);
+}
+
+static int ref_unlock_internal(struct ref_resource *rr,
+			       struct dlm_plock_info *in)
+{
+	struct ref_lock *po, *safe;
+	int rv = 0;
+
+	list_for_each_entry_safe(po, safe, &rr->locks, list) {
+		if (po->nodeid != in->nodeid || po->owner != in->owner)
+			continue;
+		if (!ranges_overlap(po->start, po->end, in->start, in->end))
+			continue;
+
+		switch (overlap_type(in->start, in->end, po->start, po->end)) {
+		case 0:
+			list_del(&po->list);
+			free(po);
+			return 0;
+		case 1:
+			return shrink_range2(&po->start, &po->end,
+					     in->start, in->end);
+		case 2:
+			rv = ref_add_lock(rr, in->nodeid, in->owner, in->pid,
+					  po->ex, in->end + 1, po->end);
+			po->end = in->start - 1;
+			return rv;
+		case 3:
+			list_del(&po->list);
+			free(po);
+			continue;
+		case 4:
+			rv = shrink_range2(&po->start, &po->end,
+					   in->start, in->end);
+			continue;
+		default:
+			return -1;
+		}
+	}
+	return rv;
+}
+
+static void ref_add_waiter(struct ref_resource *rr, struct dlm_plock_info *in)
+{
+	struct ref_waiter *w;
+
+	w = malloc(sizeof(struct ref_waiter));
+	if (!w) {
+		fprintf(stderr, "no mem\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(&w->info, in, sizeof(struct dlm_plock_info));
+	list_add_tail(&w->list, &rr->waiters);
+	rr->waiter_count++;
+}
+
+static void ref_do_waiters(struct ref_resource *rr)
+{
+	struct ref_waiter *w, *safe;
+	int rv;
+
+	list_for_each_entry_safe(w, safe, &rr->waiters, list) {
+		if (ref_is_conflict(rr, &w->info, 0))
+			continue;
+
+		list_del(&w->list);
+		rr->waiter_count--;
+		rv = ref_lock_internal(rr, &w->info);
+		ref_result(&w->info, rv);
+		free(w);
+	}
+}
+
+static void ref_op(struct dlm_plock_info *in)
+{
+	struct ref_resource *rr = ref_find(in->number);
+	int rv;
+
+	switch (in->optype) {
+	case DLM_PLOCK_OP_LOCK:
+		if (ref_is_conflict(rr, in, 0)) {
+			if (!in->wait)
+				rv = -EAGAIN;
+			else {
+				ref_add_waiter(rr, in);
+				rv = -EINPROGRESS;
+			}
+		} else
+			rv = ref_lock_internal(rr, in);
+		if (rv != -EINPROGRESS)
+			ref_result(in, rv);
+		ref_do_waiters(rr);
+		break;
+
+	case DLM_PLOCK_OP_UNLOCK:
+		rv = ref_unlock_internal(rr, in);
+		ref_result(in, rv);
+		ref_do_waiters(rr);
+		break;
+
+	case DLM_PLOCK_OP_GET:
+		rv = ref_is_conflict(rr, in, 1);
+		ref_result(in, rv);
+		break;
+	}
+}
+
+static void ref_purge(int nodeid)
+{
+	struct ref_resource *rr;
+	struct ref_lock *po, *po2;
+	struct ref_waiter *w, *w2;
+
+	list_for_each_entry(rr, &ref_resources, list) {
+		list_for_each_entry_safe(po, po2, &rr->locks, list) {
+			if (po->nodeid == nodeid) {
+				list_del(&po->list);
+				free(po);
+			}
+		}
+		list_for_each_entry_safe(w, w2, &rr->waiters, list) {
+			if (w->info.nodeid == nodeid) {
+				list_del(&w->list);
+				rr->waiter_count--;
+				free(w);
+			}
+		}
+		if (!list_empty(&rr->waiters))
+			ref_do_waiters(rr);
+	}
+}
+
+/* comparing plock.c with the reference */
+
+static void read_results(void)
+{
+	struct dlm_plock_info info;
+
+	got_count = 0;
+
+	while (read(dev_fd, &info, sizeof(info)) == sizeof(info)) {
+		if (got_count == MAX_RESULTS) {
+			fprintf(stderr, "too many results\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(&got[got_count++], &info, sizeof(info));
+	}
+}
+
+static int info_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, sizeof(struct dlm_plock_info));
+}
+
+static void print_info(const char *prefix, struct dlm_plock_info *in)
+{
+	printf("%s %llx op %d %s %llx-%llx %d/%u/%llx rv %d\n", prefix,
+	       (unsigned long long)in->number, in->optype,
+	       in->ex ? "WR" : "RD",
+	       (unsigned long long)in->start, (unsigned long long)in->end,
+	       in->nodeid, in->pid, (unsigned long long)in->owner, in->rv);
+}
+
+static int lock_cmp(const void *a, const void *b)
+{
+	const struct ref_lock *la = a, *lb = b;
+
+	if (la->start != lb->start)
+		return la->start < lb->start ? -1 : 1;
+	if (la->nodeid != lb->nodeid)
+		return la->nodeid < lb->nodeid ? -1 : 1;
+	if (la->owner != lb->owner)
+		return la->owner < lb->owner ? -1 : 1;
+	return 0;
+}
+
+/* check the treap order, heap and max_end properties, and count nodes */
+
+static int check_tree(struct range_node *n, struct range_node *parent,
+		      int *count)
+{
+	uint64_t max_end;
+
+	if (!n)
+		return 0;
+
+	(*count)++;
+
+	if (parent && n->prio > parent->prio)
+		return -1;
+	if (n->left && !range_less(n->left, n))
+		return -1;
+	if (n->right && !range_less(n, n->right))
+		return -1;
+
+	max_end = n->end;
+	if (n->left && n->left->max_end > max_end)
+		max_end = n->left->max_end;
+	if (n->right && n->right->max_end > max_end)
+		max_end = n->right->max_end;
+	if (n->max_end != max_end)
+		return -1;
+
+	if (check_tree(n->left, n, count) || check_tree(n->right, n, count))
+		return -1;
+	return 0;
+}
+
+static int compare_resource(struct ref_resource *rr)
+{
+	struct ref_lock got_locks[256], want_locks[256];
+	struct posix_lock *po;
+	struct ref_lock *rl;
+	struct lock_waiter *w;
+	struct ref_waiter *rw;
+	struct resource *r;
+	int got_n = 0, want_n = 0, count, i;
+
+	r = search_resource(stub_ls, rr->number);
+
+	if (!r) {
+		if (list_empty(&rr->locks) && list_empty(&rr->waiters))
+			return 0;
+		printf("%llx: no resource\n", (unsigned long long)rr->number);
+		return -1;
+	}
+
+	list_for_each_entry(po, &r->locks, list) {
+		if (got_n == 256)
+			return -1;
+		rl = &got_locks[got_n++];
+		rl->nodeid = po->nodeid;
+		rl->owner = po->owner;
+		rl->pid = po->pid;
+		rl->ex = po->ex;
+		rl->start = po->start;
+		rl->end = po->end;
+	}
+
+	list_for_each_entry(rl, &rr->locks, list) {
+		if (want_n == 256)
+			return -1;
+		memcpy(&want_locks[want_n++], rl, sizeof(struct ref_lock));
+	}
+
+	if (got_n != want_n) {
+		printf("%llx: %d locks, want %d\n",
+		       (unsigned long long)rr->number, got_n, want_n);
+		return -1;
+	}
+
+	qsort(got_locks, got_n, sizeof(struct ref_lock), lock_cmp);
+	qsort(want_locks, want_n, sizeof(struct ref_lock), lock_cmp);
+
+	for (i = 0; i < got_n; i++) {
+		if (lock_cmp(&got_locks[i], &want_locks[i]) ||
+		    got_locks[i].end != want_locks[i].end ||
+		    got_locks[i].ex != want_locks[i].ex ||
+		    got_locks[i].pid != want_locks[i].pid) {
+			printf("%llx: lock %d differs\n",
+			       (unsigned long long)rr->number, i);
+			return -1;
+		}
+	}
+
+	/* waiters must be in the same order */
+
+	if (r->waiter_count != rr->waiter_count) {
+		printf("%llx: %u waiters, want %d\n",
+		       (unsigned long long)rr->number, r->waiter_count,
+		       rr->waiter_count);
+		return -1;
+	}
+
+	rw = list_entry(rr->waiters.next, struct ref_waiter, list);
+	list_for_each_entry(w, &r->waiters, list) {
+		if (memcmp(&w->info, &rw->info, sizeof(w->info))) {
+			print_info("waiter", &w->info);
+			print_info("want  ", &rw->info);
+			return -1;
+		}
+		rw = list_entry(rw->list.next, struct ref_waiter, list);
+	}
+
+	count = 0;
+	if (check_tree(r->lock_tree, NULL, &count) || count != got_n) {
+		printf("%llx: bad lock tree\n", (unsigned long long)rr->number);
+		return -1;
+	}
+
+	count = 0;
+	if (check_tree(r->waiter_tree, NULL, &count) ||
+	    count != rr->waiter_count) {
+		printf("%llx: bad waiter tree\n",
+		       (unsigned long long)rr->number);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int compare_get(struct dlm_plock_info *in)
+{
+	struct ref_resource *rr = ref_find(in->number);
+	struct ref_lock *po;
+
+	if (got_count != 1 || want_count != 1 || got[0].rv != want[0].rv)
+		return -1;
+
+	if (!got[0].rv)
+		return memcmp(&got[0], &want[0], sizeof(struct dlm_plock_info));
+
+	/* any conflicting lock may be returned */
+
+	list_for_each_entry(po, &rr->locks, list) {
+		if (po->nodeid == in->nodeid && po->owner == in->owner)
+			continue;
+		if (!ranges_overlap(po->start, po->end, in->start, in->end))
+			continue;
+		if (!in->ex && !po->ex)
+			continue;
+		if (po->ex == got[0].ex && po->pid == got[0].pid &&
+		    po->start == got[0].start && po->end == got[0].end)
+			return 0;
+	}
+	return -1;
+}
+
+static int compare(struct dlm_plock_info *in, int sorted)
+{
+	struct ref_resource *rr;
+	int i;
+
+	read_results();
+
+	if (in && in->optype == DLM_PLOCK_OP_GET) {
+		if (compare_get(in))
+			goto fail;
+		goto state;
+	}
+
+	if (sorted) {
+		qsort(got, got_count, sizeof(struct dlm_plock_info), info_cmp);
+		qsort(want, want_count, sizeof(struct dlm_plock_info),
+		      info_cmp);
+	}
+
+	if (got_count != want_count ||
+	    memcmp(got, want, got_count * sizeof(struct dlm_plock_info)))
+		goto fail;
+
+ state:
+	list_for_each_entry(rr, &ref_resources, list) {
+		if (compare_resource(rr))
+			return -1;
+	}
+	return 0;
+
+ fail:
+	for (i = 0; i < got_count; i++)
+		print_info("result", &got[i]);
+	for (i = 0; i < want_count; i++)
+		print_info("want  ", &want[i]);
+	return -1;
+}
+
+/* random ops */
+
+static void random_info(struct dlm_plock_info *in, unsigned int resources)
+{
+	memset(in, 0, sizeof(struct dlm_plock_info));
+	in->version[0] = DLM_PLOCK_VERSION_MAJOR;
+	in->version[1] = DLM_PLOCK_VERSION_MINOR;
+	in->version[2] = DLM_PLOCK_VERSION_PATCH;
+	in->fsid = stub_ls->global_id;
+	in->number = (random() % resources) + 1;
+	in->nodeid = (random() % 3) + 1;
+	in->owner = in->nodeid * 16 + (random() % 3);
+	in->pid = in->owner;
+	in->ex = random() % 2;
+	in->wait = (random() % 4) != 0;
+
+	if (!(random() % 32)) {
+		in->start = 0;
+		in->end = ~0ULL;
+	} else {
+		in->start = random() % 64;
+		in->end = in->start + (random() % 16);
+	}
+}
+
+static int do_op(unsigned int resources, unsigned int n)
+{
+	struct dlm_plock_info in, ref_in, orig;
+	struct ref_resource *rr;
+	struct resource *r;
+	int x = random() % 100;
+	int nodeid;
+
+	want_count = 0;
+
+	if (x == 0) {
+		nodeid = (random() % 3) + 1;
+		if (verbose)
+			printf("%u purge %d\n", n, nodeid);
+		purge_plocks(stub_ls, nodeid, 0);
+		ref_purge(nodeid);
+		return compare(NULL, 1);
+	}
+
+	random_info(&in, resources);
+
+	if (x < 5) {
+		/* a waiter synced from another node, which may not be
+		   blocked by the locks we have */
+
+		in.optype = DLM_PLOCK_OP_LOCK;
+		rr = ref_find(in.number);
+		if (rr->waiter_count > 64)
+			return 0;
+		if (verbose)
+			print_info("sync waiter", &in);
+		find_resource(stub_ls, in.number, 1, &r);
+		add_waiter(stub_ls, r, &in, 1);
+		ref_add_waiter(rr, &in);
+		return compare(NULL, 0);
+	}
+
+	if (x < 60)
+		in.optype = DLM_PLOCK_OP_LOCK;
+	else if (x < 95)
+		in.optype = DLM_PLOCK_OP_UNLOCK;
+	else {
+		in.optype = DLM_PLOCK_OP_GET;
+		in.nodeid = our_nodeid;
+		in.owner = in.nodeid * 16 + (random() % 3);
+		in.pid = in.owner;
+	}
+
+	if (in.optype == DLM_PLOCK_OP_LOCK && in.wait &&
+	    ref_find(in.number)->waiter_count > 64)
+		in.wait = 0;
+
+	if (verbose)
+		print_info("op", &in);
+
+	memcpy(&orig, &in, sizeof(in));
+	memcpy(&ref_in, &in, sizeof(in));
+	find_resource(stub_ls, in.number, 1, &r);
+	__receive_plock(stub_ls, &in, in.nodeid, r);
+	deliver_messages();
+	ref_op(&ref_in);
+
+	return compare(&orig, 0);
+}
+
+static void print_usage(void)
+{
+	printf("Usage:\n");
+	printf("\n");
+	printf("plock_stress [options]\n");
+	printf("\n");
+	printf("Options:\n");
+	printf("\n");
+	printf("  -n <num>	Number of random ops\n");
+	printf("		Default is 1000000\n");
+	printf("  -r <num>	Number of inodes\n");
+	printf("		Default is 4\n");
+	printf("  -s <num>	Random seed\n");
+	printf("		Default is the time\n");
+	printf("  -v		Print each op\n");
+	printf("  -h		Print this help, then exit\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int ops = 1000000, resources = 4, seed = time(NULL), i;
+	int sv[2];
+	int optchar;
+
+	while ((optchar = getopt(argc, argv, "n:r:s:vh")) != EOF) {
+		switch (optchar) {
+		case 'n':
+			ops = atoi(optarg);
+			break;
+		case 'r':
+			resources = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'h':
+			print_usage();
+			exit(EXIT_SUCCESS);
+		default:
+			print_usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	INIT_LIST_HEAD(&lockspaces);
+	INIT_LIST_HEAD(&sent_messages);
+	INIT_LIST_HEAD(&ref_resources);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		fprintf(stderr, "socketpair error %d\n", errno);
+		exit(EXIT_FAILURE);
+	}
+	plock_device_fd = sv[0];
+	dev_fd = sv[1];
+	fcntl(dev_fd, F_SETFL, fcntl(dev_fd, F_GETFL) | O_NONBLOCK);
+
+	stub_ls = malloc(sizeof(struct lockspace));
+	memset(stub_ls, 0, sizeof(struct lockspace));
+	strcpy(stub_ls->name, "plock_stress");
+	stub_ls->global_id = 0x12345678;
+	INIT_LIST_HEAD(&stub_ls->saved_messages);
+	INIT_LIST_HEAD(&stub_ls->plock_resources);
+	list_add(&stub_ls->list, &lockspaces);
+
+	printf("seed %u ops %u inodes %u\n", seed, ops, resources);
+	srandom(seed);
+
+	for (i = 0; i < ops; i++) {
+		if (do_op(resources, i)) {
+			printf("FAIL at op %u seed %u\n", i, seed);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	printf("PASS\n");
+	return 0;
+}
@@ -0,0 +1,361 @@
+/*
+ * The parts of dlm_controld that plock.c uses, stubbed out so that plock.c
+ * can be built into a test program on its own.  Messages sent by plock.c are
+ * queued on sent_messages for the program to deliver with
+ * deliver_messages(), as cpg would deliver our own messages.
+ */
+
+#include "../dlm_controld/plock.c"
+
+static struct lockspace *stub_ls;
+static struct list_head sent_messages;
+static pthread_mutex_t sent_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+struct sent_msg {
+	struct list_head list;
+	int len;
+	char buf[0];
+};
+
+/* cpg.c */
+
+int message_flow_control_on;
+
+void dlm_send_message(struct lockspace *ls, char *buf, int len)
+{
+	struct dlm_header *hd = (struct dlm_header *)buf;
+	struct sent_msg *sm;
+
+	hd->nodeid = our_nodeid;
+	hd->global_id = ls->global_id;
+
+	sm = malloc(sizeof(struct sent_msg) + len);
+	if (!sm) {
+		fprintf(stderr, "no mem\n");
+		exit(EXIT_FAILURE);
+	}
+	sm->len = len;
+	memcpy(sm->buf, buf, len);
+
+	/* plock workers send too */
+	pthread_mutex_lock(&sent_mutex);
+	list_add_tail(&sm->list, &sent_messages);
+	pthread_mutex_unlock(&sent_mutex);
+}
+
+void update_flow_control_status(void)
+{
+}
+
+const char *msg_name(int type)
+{
+	return "plock";
+}
+
+int plock_batch_supported(void)
+{
+	return 1;
+}
+
+static int stub_ckpt_bulk = 1;
+static uint32_t stub_retrieved_sig;
+static int stub_retrieved;
+
+int plock_ckpt_bulk_supported(void)
+{
+	return stub_ckpt_bulk;
+}
+
+void plocks_retrieved(struct lockspace *ls, uint32_t sig)
+{
+	stub_retrieved_sig = sig;
+	stub_retrieved = 1;
+	process_saved_plocks(ls);
+	ls->need_plocks = 0;
+	ls->save_plocks = 0;
+}
+
+/* main.c */
+
+int daemon_debug_opt;
+int poll_ignore_plock;
+int poll_drop_plock;
+int poll_retrieve_plock;
+int plock_fd;
+int plock_ci;
+struct list_head lockspaces;
+int our_nodeid = 1;
+char plock_dump_buf[DLMC_DUMP_SIZE];
+int plock_dump_len;
+uint32_t plock_minor;
+uint32_t old_plock_minor;
+__thread char daemon_debug_buf[256];
+__thread char log_plock_line[256];
+
+int cfgd_enable_plock		= DEFAULT_ENABLE_PLOCK;
+int cfgd_plock_debug		= DEFAULT_PLOCK_DEBUG;
+int cfgd_plock_rate_limit	= 0;
+int cfgd_plock_batch		= DEFAULT_PLOCK_BATCH;
+int cfgd_plock_threads		= 0;
+int cfgd_plock_ownership	= 0;
+int cfgd_drop_resources_time	= DEFAULT_DROP_RESOURCES_TIME;
+int cfgd_drop_resources_count	= DEFAULT_DROP_RESOURCES_COUNT;
+int cfgd_drop_resources_age	= DEFAULT_DROP_RESOURCES_AGE;
+
+void daemon_dump_save(void)
+{
+}
+
+void log_plock_save(void)
+{
+}
+
+void logt_print(int level, const char *fmt, ...)
+{
+}
+
+int do_read(int fd, void *buf, size_t count)
+{
+	int rv, off = 0;
+
+	while (off < count) {
+		rv = read(fd, (char *)buf + off, count - off);
+		if (rv == 0)
+			return -1;
+		if (rv == -1 && errno == EINTR)
+			continue;
+		if (rv == -1)
+			return -1;
+		off += rv;
+	}
+	return 0;
+}
+
+void client_ignore(int ci, int fd)
+{
+}
+
+struct lockspace *find_ls_id(uint32_t id)
+{
+	struct lockspace *ls;
+
+	list_for_each_entry(ls, &lockspaces, list) {
+		if (ls->global_id == id)
+			return ls;
+	}
+	return NULL;
+}
+
+/* action.c */
+
+void set_associated_id(uint32_t mg_id)
+{
+}
+
+/* openais ckpt: a single checkpoint kept in memory, shared by every
+   lockspace in the program */
+
+struct stub_section {
+	struct list_head list;
+	char id[64];
+	int id_len;
+	SaSizeT size;
+	char data[0];
+};
+
+static struct list_head stub_sections = { &stub_sections, &stub_sections };
+static int stub_ckpt_exists;
+static struct stub_section *stub_iter;
+
+SaAisErrorT saCkptInitialize(SaCkptHandleT *h, const SaCkptCallbacksT *cb,
+			     SaVersionT *v)
+{
+	return SA_AIS_OK;
+}
+
+SaAisErrorT saCkptFinalize(SaCkptHandleT h)
+{
+	return SA_AIS_OK;
+}
+
+SaAisErrorT saCkptCheckpointOpen(SaCkptHandleT h, const SaNameT *name,
+				 const SaCkptCheckpointCreationAttributesT *a,
+				 SaCkptCheckpointOpenFlagsT flags, SaTimeT t,
+				 SaCkptCheckpointHandleT *ch)
+{
+	if (flags & SA_CKPT_CHECKPOINT_CREATE) {
+		if (stub_ckpt_exists)
+			return SA_AIS_ERR_EXIST;
+		stub_ckpt_exists = 1;
+	} else if (!stub_ckpt_exists)
+		return SA_AIS_ERR_NOT_EXIST;
+
+	*ch = 1;
+	return SA_AIS_OK;
+}
+
+SaAisErrorT saCkptCheckpointClose(SaCkptCheckpointHandleT h)
+{
+	return SA_AIS_OK;
+}
+
+SaAisErrorT saCkptCheckpointUnlink(SaCkptHandleT h, const SaNameT *name)
+{
+	struct stub_section *ss, *safe;
+
+	if (!stub_ckpt_exists)
+		return SA_AIS_ERR_NOT_EXIST;
+
+	list_for_each_entry_safe(ss, safe, &stub_sections, list) {
+		list_del(&ss->list);
+		free(ss);
+	}
+	stub_ckpt_exists = 0;
+	return SA_AIS_OK;
+}
+
+SaAisErrorT saCkptCheckpointStatusGet(SaCkptCheckpointHandleT h,
+				      SaCkptCheckpointDescriptorT *s)
+{
+	return SA_AIS_ERR_NOT_EXIST;
+}
+
+static struct stub_section *find_section(const SaCkptSectionIdT *id)
+{
+	struct stub_section *ss;
+
+	list_for_each_entry(ss, &stub_sections, list) {
+		if (ss->id_len == id->idLen &&
+		    !memcmp(ss->id, id->id, id->idLen))
+			return ss;
+	}
+	return NULL;
+}
+
+SaAisErrorT saCkptSectionCreate(SaCkptCheckpointHandleT h,
+				SaCkptSectionCreationAttributesT *a,
+				const void *data, SaSizeT size)
+{
+	struct stub_section *ss;
+
+	if (a->sectionId->idLen > sizeof(ss->id))
+		return SA_AIS_ERR_INVALID_PARAM;
+	if (find_section(a->sectionId))
+		return SA_AIS_ERR_EXIST;
+
+	ss = malloc(sizeof(struct stub_section) + size);
+	if (!ss)
+		return SA_AIS_ERR_NO_MEMORY;
+	memcpy(ss->id, a->sectionId->id, a->sectionId->idLen);
+	ss->id_len = a->sectionId->idLen;
+	ss->size = size;
+	memcpy(ss->data, data, size);
+	list_add_tail(&ss->list, &stub_sections);
+	return SA_AIS_OK;
+}
+
+SaAisErrorT saCkptSectionIterationInitialize(SaCkptCheckpointHandleT h,
+					     SaCkptSectionsChosenT c,
+					     SaTimeT t,
+					     SaCkptSectionIterationHandleT *i)
+{
+	stub_iter = list_entry(&stub_sections, struct stub_section, list);
+	return SA_AIS_OK;
+}
+
+SaAisErrorT saCkptSectionIterationNext(SaCkptSectionIterationHandleT i,
+				       SaCkptSectionDescriptorT *d)
+{
+	if (stub_iter->list.next == &stub_sections)
+		return SA_AIS_ERR_NO_SECTIONS;
+
+	stub_iter = list_entry(stub_iter->list.next, struct stub_section,
+			       list);
+	memset(d, 0, sizeof(*d));
+	d->sectionId.id = (SaUint8T *)stub_iter->id;
+	d->sectionId.idLen = stub_iter->id_len;
+	d->sectionSize = stub_iter->size;
+	return SA_AIS_OK;
+}
+
+SaAisErrorT saCkptSectionIterationFinalize(SaCkptSectionIterationHandleT i)
+{
+	return SA_AIS_OK;
+}
+
+SaAisErrorT saCkptCheckpointRead(SaCkptCheckpointHandleT h,
+				 SaCkptIOVectorElementT *iov, SaUint32T n,
+				 SaUint32T *err)
+{
+	struct stub_section *ss;
+	SaSizeT len;
+
+	ss = find_section(&iov->sectionId);
+	if (!ss)
+		return SA_AIS_ERR_NOT_EXIST;
+	if (iov->dataOffset > ss->size)
+		return SA_AIS_ERR_INVALID_PARAM;
+
+	len = ss->size - iov->dataOffset;
+	if (len > iov->dataSize)
+		len = iov->dataSize;
+	memcpy(iov->dataBuffer, ss->data + iov->dataOffset, len);
+	iov->readSize = len;
+	return SA_AIS_OK;
+}
+
+/* cpg delivery */
+
+static void deliver_messages(void)
+{
+	struct sent_msg *sm, *safe;
+	struct dlm_header *hd;
+	struct lockspace *ls;
+	struct list_head list;
+
+	INIT_LIST_HEAD(&list);
+	pthread_mutex_lock(&sent_mutex);
+	list_splice_init(&sent_messages, &list);
+	pthread_mutex_unlock(&sent_mutex);
+
+	list_for_each_entry_safe(sm, safe, &list, list) {
+		list_del(&sm->list);
+		hd = (struct dlm_header *)sm->buf;
+
+		ls = find_ls_id(hd->global_id);
+		if (!ls) {
+			free(sm);
+			continue;
+		}
+
+		switch (hd->type) {
+		case DLM_MSG_PLOCK:
+			receive_plock(ls, hd, sm->len);
+			break;
+		case DLM_MSG_PLOCK_BATCH:
+			receive_plock_batch(ls, hd, sm->len);
+			break;
+		case DLM_MSG_PLOCK_OWN:
+			receive_own(ls, hd, sm->len);
+			break;
+		case DLM_MSG_PLOCK_DROP:
+			receive_drop(ls, hd, sm->len);
+			break;
+		case DLM_MSG_PLOCK_SYNC_LOCK:
+		case DLM_MSG_PLOCK_SYNC_WAITER:
+			receive_sync(ls, hd, sm->len);
+			break;
+		}
+		free(sm);
+	}
+}
+
+/* wait for the plock workers of all lockspaces to go idle */
+
+static inline void sync_workers(void)
+{
+	struct lockspace *ls;
+
+	list_for_each_entry(ls, &lockspaces, list)
+		plock_worker_sync(ls);
+}
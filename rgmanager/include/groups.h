@@ -31,6 +31,10 @@ void do_status_checks(void); /* Queue status checks for locally running
 
 int svc_exists(const char *svcname);
 int send_rg_states(msgctx_t *ctx, int fast);
+int send_rg_snapshot_states(msgctx_t *ctx, int fast, uint32_t since,
+			    uint32_t epoch);
+int rg_state_commit_cb(char *key, uint64_t viewno, void *data,
+		       uint32_t datalen);
 
 int check_depend_safe(const char *servicename);
 int group_migratory(const char *servicename, int lock);
@@ -54,6 +54,20 @@ typedef struct ALIGNED {
 	swab_rg_state_t(&((ptr)->rsm_state));\
 }
 
+/*
+ * Reply to RG_STATUS_SNAPSHOT.  gh_arg1 is the number of states which
+ * follow, gh_arg2 is 1 if they replace everything the client had.
+ * Messages are limited to 4k, so a reply is as many of these as it takes
+ * (at least one), followed by RG_SUCCESS with the snapshot view in
+ * gh_arg1 and its epoch in gh_arg2.
+ */
+#define RG_STATE_BATCH_MAX 32
+
+typedef struct ALIGNED {
+    generic_msg_hdr	rsb_hdr;
+    rg_state_t		rsb_states[RG_STATE_BATCH_MAX];
+} rg_state_batch_t;
+
 
 #define GENERIC_HDR_MAGIC   0x123abc00
 #define GENERIC_HDR_MAGICV2 0x123abc02
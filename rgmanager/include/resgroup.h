@@ -106,6 +106,7 @@ extern size_t rg_state_t_version_sizes[];
 #define RG_FREEZE	  23
 #define RG_UNFREEZE	  24
 #define RG_STATUS_INQUIRY 25
+#define RG_STATUS_SNAPSHOT 26	/* Batched/delta RG_STATUS */
 #define RG_NONE		  999
 
 const char *rg_req_str(int req);
@@ -168,6 +169,8 @@ int rt_enqueue_request(const char *resgroupname, int request,
 		       msgctx_t *resp_ctx,
        		       int max, uint32_t target, int arg0, int arg1);
 void dump_threads(FILE *fp);
+int rt_set_max_workers(int max);
+void rt_peer_wait(const char *resgroupname, int waiting);
 
 void send_response(int ret, int node, request_t *req);
 void send_ret(msgctx_t *ctx, char *name, int ret, int orig_request,
@@ -5,6 +5,7 @@
 #define __VF_H
 
 #include <stdint.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <msgsimple.h>
 
@@ -55,50 +56,52 @@ typedef int32_t (*vf_commit_cb_t)(char *, uint64_t, void *, uint32_t);
  
  /**
  * A view node.  This holds the data from a VF_JOIN_VIEW message until it
- * is committed.
+ * is committed.  It sits in its key's join-view heap and, by transaction
+ * ID, in a hash, so that commits and aborts find it directly.
  */
 typedef struct _view_node {
 	struct _view_node *
-			vn_next;	/**< Next pointer. */
+			vn_tnext;	/**< Next in transaction hash. */
+	struct _key_node *
+			vn_key;		/**< Key this view is for. */
 	uint32_t 	vn_transaction;	/**< Transaction ID */
 	uint32_t	vn_nodeid;	/**< Node ID of coordinator. */
 	struct timeval  vn_timeout;	/**< Expiration time. */
 	uint64_t	vn_viewno;	/**< View Number. */
 	uint32_t	vn_datalen;	/**< Length of included data. */
+	int		vn_index;	/**< Position in kn_jvheap. */
+	int		vn_committed;	/**< VF_VIEW_FORMED received. */
 	uint32_t	vn_pad;		/**< pad */
 	char		vn_data[0];	/**< Included data. */
 } view_node_t;
 
 
-/**
- * A commit node.  This holds a commit message until it is possible to
- * resolve it with its corresponding view_node_t.
- */
-typedef struct _commit_node {
-	struct _commit_node *
-			vc_next;	/**< Next pointer. */
-	uint32_t 	vc_transaction;	/**< Transaction ID */
-} commit_node_t;
-
-
 /**
  * A key node.  For each type of data used, a key node is created
  * and managed by the programmer.
  */
 typedef struct _key_node {
 	struct _key_node *kn_next;	/**< Next pointer. */
+	struct _key_node *kn_hnext;	/**< Next in key hash. */
 	char	 *kn_keyid;		/**< Key ID this key node refers to. */
 	uint32_t kn_pid;		/**< PID. Child process running
 					  View-Formation on this key. */
 	uint32_t kn_datalen;		/**< Current length of data. */
-	view_node_t *kn_jvlist;		/**< Buffered join-view list. */
-	commit_node_t *kn_clist;	/**< Buffered commit list. */
+	view_node_t **kn_jvheap;	/**< Buffered join-views, a heap
+					  ordered by view and node ID. */
+	int kn_jvcount;			/**< Join-views in kn_jvheap. */
+	int kn_jvsize;			/**< Size of kn_jvheap. */
+	int kn_commits;			/**< Join-views in kn_jvheap whose
+					  commit has arrived. */
 	uint64_t kn_viewno;		/**< Current view number of data. */
 	char *kn_data;			/**< Current data. */
 	int kn_tsec;			/**< Default timeout (in seconds */
 	int kn_pad;			/**< pad */
 	vf_vote_cb_t kn_vote_cb;	/**< Voting callback function */
 	vf_commit_cb_t kn_commit_cb;	/**< Commit callback function */
+	pthread_mutex_t kn_lock;	/**< Held by local readers/writers
+					  of this key around the cluster
+					  lock on it. */
 } key_node_t;
 
 
@@ -24,14 +24,26 @@
 #include <signals.h>
 #include <lock.h>
 
+#define VF_KEY_HASH_SIZE	1024	/* power of two */
+#define VF_TRANS_HASH_SIZE	256	/* power of two */
+
 static key_node_t *key_list = NULL;	/** List of key nodes. */
+static key_node_t *key_hash[VF_KEY_HASH_SIZE];	/** Key nodes by key ID. */
+static view_node_t *trans_hash[VF_TRANS_HASH_SIZE]; /** Views by transaction. */
 static int _node_id = (int)-1;/** Our node ID, set with vf_init. */
 static uint16_t _port = 0;		/** Our daemon ID, set with vf_init. */
 static int _vf_timeout = 10;
+static uint32_t _trans = 0;		/** Last transaction ID we used. */
 
 /*
- * TODO: We could make it thread safe, but this might be unnecessary work
- * Solution: Super-coarse-grained-bad-code-locking!
+ * key_list_mutex covers the key list, both hashes and the contents of the
+ * key nodes.
+ * vf_mutex covers the rest of the above.  Reads and writes of a key hold
+ * its kn_lock and a cluster lock named after the key (see vf_lock_name)
+ * for the whole of the exchange, so that they wait only for others on
+ * the same key.  They also hold the old cluster-wide lock, shared, to
+ * keep out nodes which still take it exclusively (see vf_lock_key).
+ * Key nodes are not freed until vf_shutdown().
  */
 #ifdef WRAP_LOCKS
 static pthread_mutex_t key_list_mutex = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;
@@ -55,6 +67,7 @@ static int vf_send_abort(msgctx_t *ctx, uint32_t trans);
 static int vf_send_commit(msgctx_t *ctx, uint32_t trans);
 static key_node_t * kn_find_key(const char *keyid);
 static key_node_t * kn_find_trans(uint32_t trans);
+static view_node_t * vn_find_trans(uint32_t trans);
 static int vf_handle_join_view_msg(msgctx_t *ctx, int nodeid, vf_msg_t * hdrp);
 static int vf_resolve_views(key_node_t *key_node);
 static int vf_unanimous(msgctx_t *ctx, int trans, int remain, int timeout);
@@ -65,17 +78,12 @@ static int vf_request_current(cluster_member_list_t *membership,
 			      void **data, uint32_t *datalen);
 static int _vf_purge(key_node_t *key_node, uint32_t *trans);
 
-/* Join-view buffer list functions */
+/* Join-view buffer functions */
 static int vn_cmp(view_node_t *left, view_node_t *right);
-static int vn_insert_sorted(view_node_t **head, view_node_t *node);
-static view_node_t * vn_remove(view_node_t **head, uint32_t trans);
+static int vn_insert(key_node_t *key_node, view_node_t *node);
+static void vn_remove(view_node_t *node);
 static int vf_buffer_join_msg(vf_msg_t *hdr,
 			      struct timeval *timeout);
-
-/* Commits buffer list functions */
-static int vc_cmp(commit_node_t *left, commit_node_t *right);
-static int vc_insert_sorted(commit_node_t **head, commit_node_t *node);
-static commit_node_t * vc_remove(commit_node_t **head, uint32_t trans);
 static int vf_buffer_commit(uint32_t trans);
 
 /* Simple functions which client calls to vote/abort */
@@ -94,6 +102,12 @@ int vf_process_msg(msgctx_t *ctx, int nodeid, generic_msg_hdr *msgp, int nbytes)
 /* Reply to request for current data */
 static int vf_send_current(msgctx_t *, const char *);
 
+/* Per-key locking */
+static key_node_t * kn_get_key(const char *keyid);
+static int vf_lock_key(key_node_t *key_node, struct dlm_lksb *lksb);
+static void vf_unlock_key(key_node_t *key_node, struct dlm_lksb *lksb);
+static void vf_wait_commit(key_node_t *key_node, uint32_t trans);
+
 
 struct vf_args {
 	msgctx_t *ctx;
@@ -139,12 +153,26 @@ vf_send_commit(msgctx_t *ctx, uint32_t trans)
 }
 
 
+static uint32_t
+kn_hash(const char *keyid)
+{
+	const unsigned char *p;
+	uint32_t hash = 5381;
+
+	for (p = (const unsigned char *)keyid; *p; p++)
+		hash = (hash * 33) + *p;
+
+	return hash;
+}
+
+
 static key_node_t *
 kn_find_key(const char *keyid)
 {
 	key_node_t *cur;
 
-	for (cur = key_list; cur; cur = cur->kn_next)
+	cur = key_hash[kn_hash(keyid) & (VF_KEY_HASH_SIZE - 1)];
+	for (; cur; cur = cur->kn_hnext)
 		if (!strcmp(cur->kn_keyid,keyid))
 			return cur;
 
@@ -152,21 +180,149 @@ kn_find_key(const char *keyid)
 }
 
 
+/**
+ * Find a key node, creating it if there isn't one yet.  Takes and
+ * releases key_list_mutex.
+ */
 static key_node_t *
-kn_find_trans(uint32_t trans)
+kn_get_key(const char *keyid)
 {
-	key_node_t *cur;
-	view_node_t *curvn;
+	key_node_t *key_node;
+
+	pthread_mutex_lock(&key_list_mutex);
+	key_node = kn_find_key(keyid);
+	if (!key_node) {
+		/* Drops key_list_mutex on failure */
+		if (vf_key_init_nt(keyid, 10, NULL, NULL) < 0)
+			return NULL;
+		key_node = kn_find_key(keyid);
+		assert(key_node);
+	}
+	pthread_mutex_unlock(&key_list_mutex);
+
+	return key_node;
+}
+
+
+/**
+ * Name of the cluster lock on a key.  DLM resource names are limited
+ * to DLM_RESNAME_MAXLEN, so long key IDs are hashed; two keys with the
+ * same hash just share a lock.
+ */
+static void
+vf_lock_name(const char *keyid, char *name, size_t len)
+{
+	if (snprintf(name, len, "usrm::vf::%s", keyid) <= DLM_RESNAME_MAXLEN)
+		return;
+
+	snprintf(name, len, "usrm::vf::#%08x", kn_hash(keyid));
+}
 
-	for (cur = key_list; cur; cur = cur->kn_next)
-		for (curvn = cur->kn_jvlist; curvn; curvn = curvn->vn_next)
-			if (curvn->vn_transaction == trans)
-				return cur;
+
+/**
+ * Lock a key against other readers and writers of it, here and on the
+ * other nodes.  lksb points to two lock status blocks.
+ *
+ * Older rgmanager takes "usrm::vf" exclusively around every read and
+ * write instead of the per-key locks.  We take it in protected read
+ * mode first, which we share with each other but not with them, so
+ * that a cluster being upgraded one node at a time stays consistent.
+ * Once no node runs the old code this costs one extra lock request.
+ */
+static int
+vf_lock_key(key_node_t *key_node, struct dlm_lksb *lksb)
+{
+	char lock_name[256];
+	int l;
+
+	pthread_mutex_lock(&key_node->kn_lock);
+
+	l = clu_lock(LKM_PRMODE, &lksb[1], 0, "usrm::vf");
+	if (l < 0) {
+		pthread_mutex_unlock(&key_node->kn_lock);
+		return l;
+	}
+
+	vf_lock_name(key_node->kn_keyid, lock_name, sizeof(lock_name));
+	l = clu_lock(LKM_EXMODE, &lksb[0], 0, lock_name);
+	if (l < 0) {
+		clu_unlock(&lksb[1]);
+		pthread_mutex_unlock(&key_node->kn_lock);
+	}
+
+	return l;
+}
+
+
+static void
+vf_unlock_key(key_node_t *key_node, struct dlm_lksb *lksb)
+{
+	clu_unlock(&lksb[0]);
+	clu_unlock(&lksb[1]);
+	pthread_mutex_unlock(&key_node->kn_lock);
+}
+
+
+/**
+ * Wait for our own VF thread to commit a view we have just formed.
+ * Until it has, kn_viewno is the old view, and the next writer of the
+ * key would offer the same view number again.
+ */
+static void
+vf_wait_commit(key_node_t *key_node, uint32_t trans)
+{
+	view_node_t *cur;
+	int tries;
+
+	for (tries = 0; tries < _vf_timeout * 1000; tries++) {
+		pthread_mutex_lock(&key_list_mutex);
+		cur = vn_find_trans(trans);
+		pthread_mutex_unlock(&key_list_mutex);
+
+		if (!cur)
+			return;
+		usleep(1000);
+	}
+}
+
+
+/*
+ * Transaction IDs are the coordinator's node ID in the top 16 bits and
+ * a counter in the bottom 16.
+ */
+static view_node_t **
+trans_bucket(uint32_t trans)
+{
+	return &trans_hash[(trans ^ (trans >> 16)) & (VF_TRANS_HASH_SIZE - 1)];
+}
+
+
+static view_node_t *
+vn_find_trans(uint32_t trans)
+{
+	view_node_t *cur;
+
+	for (cur = *trans_bucket(trans); cur; cur = cur->vn_tnext)
+		if (cur->vn_transaction == trans)
+			return cur;
 
 	return NULL;
 }
 
 
+static key_node_t *
+kn_find_trans(uint32_t trans)
+{
+	view_node_t *vn;
+
+	vn = vn_find_trans(trans);
+	if (!vn)
+		return NULL;
+
+	return vn->vn_key;
+}
+
+
 static int
 vf_handle_join_view_msg(msgctx_t *ctx, int nodeid, vf_msg_t * hdrp)
 {
@@ -397,73 +553,125 @@ vn_cmp(view_node_t *left, view_node_t *right)
 }
 
 
+/**
+ * Put a view node at position i of its key's join-view heap, or wherever
+ * above or below i it belongs.
+ */
+static void
+vn_heap_set(key_node_t *key_node, int i, view_node_t *node)
+{
+	view_node_t **heap = key_node->kn_jvheap;
+	int child;
+
+	while (i > 0 && vn_cmp(node, heap[(i - 1) / 2]) < 0) {
+		heap[i] = heap[(i - 1) / 2];
+		heap[i]->vn_index = i;
+		i = (i - 1) / 2;
+	}
+
+	while ((child = i * 2 + 1) < key_node->kn_jvcount) {
+		if (child + 1 < key_node->kn_jvcount &&
+		    vn_cmp(heap[child + 1], heap[child]) < 0)
+			child++;
+		if (vn_cmp(heap[child], node) >= 0)
+			break;
+		heap[i] = heap[child];
+		heap[i]->vn_index = i;
+		i = child;
+	}
+
+	heap[i] = node;
+	node->vn_index = i;
+}
+
+
+/**
+ * Look for a view with the same view and node ID as node, at or below
+ * position i of the heap.  Nothing below a larger view can match.
+ */
 static int
-vn_insert_sorted(view_node_t **head, view_node_t *node)
+vn_heap_find(key_node_t *key_node, int i, view_node_t *node)
 {
-	view_node_t *cur = *head, *back = NULL;
+	int cmp;
+
+	if (i >= key_node->kn_jvcount)
+		return 0;
 
-	/* only entry */
-	if (!cur) {
-		*head = node;
+	cmp = vn_cmp(node, key_node->kn_jvheap[i]);
+	if (cmp == 0)
 		return 1;
-	}
+	if (cmp < 0)
+		return 0;
 
-	while (cur) {
-		switch (vn_cmp(node, cur)) {
-		case 0:
-			/* duplicate */
-			return 0;
-		case -1:
-			if (back) {
-				/* middle */
-				node->vn_next = cur;
-				back->vn_next = node;
-				return 1;
-			}
+	return vn_heap_find(key_node, i * 2 + 1, node) ||
+	       vn_heap_find(key_node, i * 2 + 2, node);
+}
 
-			node->vn_next = *head;
-			*head = node;
-			return 1;
-		}
 
-		back = cur;
-		cur = cur->vn_next;
+/**
+ * Buffer a join-view on its key and in the transaction hash.
+ *
+ * @return		1 if it was added, 0 if it is a duplicate or
+ *			we ran out of memory.
+ */
+static int
+vn_insert(key_node_t *key_node, view_node_t *node)
+{
+	view_node_t **heap, **bucket;
+	int size;
+
+	if (vn_find_trans(node->vn_transaction) ||
+	    vn_heap_find(key_node, 0, node))
+		return 0;
+
+	if (key_node->kn_jvcount == key_node->kn_jvsize) {
+		size = key_node->kn_jvsize ? key_node->kn_jvsize * 2 : 4;
+		heap = realloc(key_node->kn_jvheap, size * sizeof(*heap));
+		if (!heap)
+			return 0;
+		key_node->kn_jvheap = heap;
+		key_node->kn_jvsize = size;
 	}
 
-	/* end */
-	back->vn_next = node;
-	node->vn_next = NULL;
+	node->vn_key = key_node;
+	key_node->kn_jvcount++;
+	vn_heap_set(key_node, key_node->kn_jvcount - 1, node);
+
+	bucket = trans_bucket(node->vn_transaction);
+	node->vn_tnext = *bucket;
+	*bucket = node;
 
 	return 1;
 }
 
 
-static view_node_t *
-vn_remove(view_node_t **head, uint32_t trans)
+/**
+ * Take a buffered join-view off its key and out of the transaction hash.
+ * The caller frees it.
+ */
+static void
+vn_remove(view_node_t *node)
 {
-	view_node_t *cur = *head, *back = NULL;
+	key_node_t *key_node = node->vn_key;
+	view_node_t **bucket, *last;
 
-	if (!cur)
-		return NULL;
+	last = key_node->kn_jvheap[--key_node->kn_jvcount];
+	if (last != node)
+		vn_heap_set(key_node, node->vn_index, last);
 
-	do {
-		if (cur->vn_transaction == trans) {
-			if (back) {
-				back->vn_next = cur->vn_next;
-				cur->vn_next = NULL;
-				return cur;
-			}
+	if (node->vn_committed)
+		key_node->kn_commits--;
 
-			*head = cur->vn_next;
-			cur->vn_next = NULL;
-			return cur;
+	for (bucket = trans_bucket(node->vn_transaction); *bucket;
+	     bucket = &(*bucket)->vn_tnext) {
+		if (*bucket == node) {
+			*bucket = node->vn_tnext;
+			break;
 		}
+	}
 
-		back = cur;
-		cur = cur->vn_next;
-	} while (cur);
-
-	return NULL;
+	node->vn_tnext = NULL;
+	node->vn_key = NULL;
 }
 
 
@@ -497,6 +705,8 @@ vf_buffer_join_msg(vf_msg_t *hdr, struct timeval *timeout)
 	newp = vn_new(hdr->vm_msg.vf_transaction, hdr->vm_msg.vf_coordinator,
 		      hdr->vm_msg.vf_view, 
 		      hdr->vm_msg.vf_data, hdr->vm_msg.vf_datalen);
+	if (!newp)
+		return 0;
 
 	if (timeout && (timeout->tv_sec || timeout->tv_usec)) {
 		if (getuptime(&newp->vn_timeout) == -1) {
@@ -509,7 +719,7 @@ vf_buffer_join_msg(vf_msg_t *hdr, struct timeval *timeout)
 		newp->vn_timeout.tv_usec += timeout->tv_usec;
 	}
 
-	rv = vn_insert_sorted(&key_node->kn_jvlist, newp);
+	rv = vn_insert(key_node, newp);
 	if (!rv)
 		free(newp);
 
@@ -517,92 +727,6 @@ vf_buffer_join_msg(vf_msg_t *hdr, struct timeval *timeout)
 }
 
 
-/*
- * XXX...
- */
-static int
-vc_cmp(commit_node_t *left, commit_node_t *right)
-{
-	if (left->vc_transaction < right->vc_transaction)
-		return -1;
-
-	if (left->vc_transaction == right->vc_transaction)
-		return 0;
-
-	return 1;
-}
-
-
-static int
-vc_insert_sorted(commit_node_t **head, commit_node_t *node)
-{
-	commit_node_t *cur = *head, *back = NULL;
-
-	/* only entry */
-	if (!cur) {
-		*head = node;
-		return 1;
-	}
-
-	while (cur) {
-		switch (vc_cmp(node, cur)) {
-		case 0:
-			/* duplicate */
-			return 0;
-		case -1:
-			if (back) {
-				/* middle */
-				node->vc_next = cur;
-				back->vc_next = node;
-				return 1;
-			}
-
-			node->vc_next = *head;
-			*head = node;
-			return 1;
-		}
-
-		back = cur;
-		cur = cur->vc_next;
-	}
-
-	/* end */
-	back->vc_next = node;
-	node->vc_next = NULL;
-
-	return 1;
-}
-
-
-static commit_node_t *
-vc_remove(commit_node_t **head, uint32_t trans)
-{
-	commit_node_t *cur = *head, *back = NULL;
-
-	if (!cur)
-		return NULL;
-
-	do {
-		if (cur->vc_transaction == trans) {
-			if (back) {
-				back->vc_next = cur->vc_next;
-				cur->vc_next = NULL;
-				return cur;
-			}
-
-			*head = cur->vc_next;
-			cur->vc_next = NULL;
-			return cur;
-		}
-
-		back = cur;
-		cur = cur->vc_next;
-	} while (cur);
-
-	return NULL;
-}
-
-
 /*
  * Buffer a commit message received on a file descriptor.  We don't need
  * to know the node id; since the file descriptor will still be open from
@@ -611,26 +735,16 @@ vc_remove(commit_node_t **head, uint32_t trans)
 static int
 vf_buffer_commit(uint32_t trans)
 {
-	key_node_t *key_node;
-	commit_node_t *newp;
-	int rv;
+	view_node_t *vn;
 
-	key_node = kn_find_trans(trans);
-	if (!key_node)
+	vn = vn_find_trans(trans);
+	if (!vn || vn->vn_committed)
 		return 0;
 
-	newp = malloc(sizeof(*newp));
-	if (!newp)
-		return 0;
-
-	newp->vc_next = NULL;
-	newp->vc_transaction = trans;
-
-	rv = vc_insert_sorted(&key_node->kn_clist, newp);
-	if (!rv)
-		free(newp);
+	vn->vn_committed = 1;
+	vn->vn_key->kn_commits++;
 
-	return rv;
+	return 1;
 }
 
 
@@ -653,17 +767,13 @@ vf_vote_no(msgctx_t *ctx, uint32_t trans)
 static int
 vf_abort(uint32_t trans)
 {
-	key_node_t *key_node;
 	view_node_t *cur;
 
-	key_node = kn_find_trans(trans);
-	if (!key_node)
-		return -1;
-
-	cur = vn_remove(&key_node->kn_jvlist, trans);
+	cur = vn_find_trans(trans);
 	if (!cur)
 		return -1;
 
+	vn_remove(cur);
 	free(cur);
 	return 0;
 }
@@ -735,33 +845,23 @@ static uint32_t
 vf_try_commit(key_node_t *key_node)
 {
 	view_node_t *vnp;
-	commit_node_t *cmp;
 	uint32_t trans = 0;
 
 	if (!key_node)
 		return 0;
 
-	if (!key_node->kn_jvlist)
+	if (!key_node->kn_jvcount)
 		return 0;
 
-	trans = key_node->kn_jvlist->vn_transaction;
-		
-	cmp = vc_remove(&key_node->kn_clist, trans);
-	if (!cmp) {
+	/* Views are committed in order; the lowest has to go first */
+	vnp = key_node->kn_jvheap[0];
+	if (!vnp->vn_committed) {
 		/*printf("VF: Commit for fd%d not received yet!", fd);*/
 		return 0;
 	}
 
-	free(cmp); /* no need for it any longer */
-		
-	vnp = vn_remove(&key_node->kn_jvlist, trans);
-	if (!vnp) {
-		/*
-		 * But, we know it was the first element on the list?!!
-		 */
-		fprintf(stderr,"VF: QUAAAAAAAAAAAAAACKKKK!");
-		raise(SIGSTOP);
-	}
+	trans = vnp->vn_transaction;
+	vn_remove(vnp);
 	
 #ifdef DEBUG
 	printf("VF: Commit Key %s #%d from member #%d\n",
@@ -926,34 +1026,39 @@ vf_init(int my_node_id, uint16_t my_port, vf_vote_cb_t vcb,
 }
 
 
-int
-vf_invalidate(void)
+static void
+kn_clear(key_node_t *c_key)
 {
-	key_node_t *c_key;
 	view_node_t *c_jv;
-	commit_node_t *c_cn;
 
-	pthread_mutex_lock(&key_list_mutex);
+	while (c_key->kn_jvcount) {
+		c_jv = c_key->kn_jvheap[c_key->kn_jvcount - 1];
+		vn_remove(c_jv);
+		free(c_jv);
+	}
 
-	while ((c_key = key_list) != NULL) {
+	if (c_key->kn_data)
+		free(c_key->kn_data);
+	c_key->kn_data = NULL;
+	c_key->kn_datalen = 0;
+	c_key->kn_viewno = 0;
+}
 
-		while ((c_jv = c_key->kn_jvlist) != NULL) {
-			key_list->kn_jvlist = c_jv->vn_next;
-			free(c_jv);
-		}
 
-		while ((c_cn = c_key->kn_clist) != NULL) {
-			c_key->kn_clist = c_cn->vc_next;
-			free(c_cn);
-		}
+/**
+ * Throw away everything we know about every key.  The key nodes are
+ * kept, since other threads may be reading or writing them; they look
+ * just like new ones until someone writes them again.
+ */
+int
+vf_invalidate(void)
+{
+	key_node_t *c_key;
 
-		key_list = c_key->kn_next;
+	pthread_mutex_lock(&key_list_mutex);
 
-		if (c_key->kn_data)
-			free(c_key->kn_data);
-		free(c_key->kn_keyid);
-		free(c_key);
-	}
+	for (c_key = key_list; c_key; c_key = c_key->kn_next)
+		kn_clear(c_key);
 
 	pthread_mutex_unlock(&key_list_mutex);
 	return 0;
@@ -966,6 +1071,8 @@ vf_invalidate(void)
 int
 vf_shutdown(void)
 {
+	key_node_t *c_key;
+
 	pthread_mutex_lock(&vf_mutex);
 	vf_thread_ready = 0;
 	pthread_cancel(vf_thread);
@@ -973,7 +1080,17 @@ vf_shutdown(void)
 	_port = 0;
 	_node_id = (int)-1;
 
-	vf_invalidate();
+	pthread_mutex_lock(&key_list_mutex);
+	while ((c_key = key_list) != NULL) {
+		key_list = c_key->kn_next;
+		kn_clear(c_key);
+		pthread_mutex_destroy(&c_key->kn_lock);
+		free(c_key->kn_jvheap);
+		free(c_key->kn_keyid);
+		free(c_key);
+	}
+	memset(key_hash, 0, sizeof(key_hash));
+	pthread_mutex_unlock(&key_list_mutex);
 
 	pthread_mutex_unlock(&vf_mutex);
 
@@ -1002,7 +1119,7 @@ static int
 vf_key_init_nt(const char *keyid, int timeout, vf_vote_cb_t vote_cb,
    	       vf_commit_cb_t commit_cb)
 {
-	key_node_t *newnode = NULL;
+	key_node_t *newnode = NULL, **bucket;
 	
 	newnode = kn_find_key(keyid);
 	if (newnode) {
@@ -1022,6 +1139,7 @@ vf_key_init_nt(const char *keyid, int timeout, vf_vote_cb_t vote_cb,
 	newnode->kn_data = NULL;
 	memset(newnode,0,sizeof(*newnode));
 	newnode->kn_keyid = strdup(keyid);
+	pthread_mutex_init(&newnode->kn_lock, NULL);
 
 	/* Set up callbacks */
 	if (vote_cb)
@@ -1044,6 +1162,10 @@ vf_key_init_nt(const char *keyid, int timeout, vf_vote_cb_t vote_cb,
 	newnode->kn_next = key_list;
 	key_list = newnode;
 
+	bucket = &key_hash[kn_hash(keyid) & (VF_KEY_HASH_SIZE - 1)];
+	newnode->kn_hnext = *bucket;
+	*bucket = newnode;
+
 	return 0;
 }
 
@@ -1120,39 +1242,40 @@ vf_write(cluster_member_list_t *membership, uint32_t flags,
 	msgctx_t everyone;
 	key_node_t *key_node;
 	vf_msg_t *join_view;
-	int remain = 0, x, y, rv = VFR_ERROR;
+	int remain = 0, x, rv = VFR_ERROR;
 	uint32_t totallen;
 #ifdef DEBUG
 	struct timeval start, end, dif;
 #endif
-	struct dlm_lksb lockp;
+	struct dlm_lksb lockp[2];
 	int l;
-	char lock_name[256];
-	static uint32_t trans = 0;
+	uint32_t trans;
 
 	if (!data || !datalen || !keyid || !strlen(keyid) || !membership)
 		return -1;
 
 	pthread_mutex_lock(&vf_mutex);
-	if (!trans) {
-		trans = _node_id << 16;
+	if (!_trans) {
+		_trans = _node_id << 16;
 	}
-	++trans;
+	trans = ++_trans;
+	pthread_mutex_unlock(&vf_mutex);
+
+	key_node = kn_get_key(keyid);
+	if (!key_node)
+		return -1;
 
 	/* Obtain cluster lock on it. */
-	snprintf(lock_name, sizeof(lock_name), "usrm::vf");
-	l = clu_lock(LKM_EXMODE, &lockp, 0, lock_name);
-	if (l < 0) {
-		pthread_mutex_unlock(&vf_mutex);
+	l = vf_lock_key(key_node, lockp);
+	if (l < 0)
 		return l;
-	}
 
 #ifdef DEBUG
 	getuptime(&start);
 #endif
 
 	remain = 0;
-	for (x = 0, y = 0; x < membership->cml_count; x++) {
+	for (x = 0; x < membership->cml_count; x++) {
 		if (membership->cml_members[x].cn_member) {
 			remain++;
 		}
@@ -1163,27 +1286,12 @@ vf_write(cluster_member_list_t *membership, uint32_t flags,
 #endif
 
 	pthread_mutex_lock(&key_list_mutex);
-	key_node = kn_find_key(keyid);
-	if (!key_node) {
-
-		if ((vf_key_init_nt(keyid, 10, NULL, NULL) < 0)) {
-			pthread_mutex_unlock(&key_list_mutex);
-			clu_unlock(&lockp);
-			pthread_mutex_unlock(&vf_mutex);
-			return -1;
-		}
-		key_node = kn_find_key(keyid);
-		assert(key_node);
-	}
-
 	join_view = build_vf_data_message(VF_JOIN_VIEW, keyid, data, datalen,
 					  key_node->kn_viewno+1, trans, &totallen);
-
 	pthread_mutex_unlock(&key_list_mutex);
 
 	if (!join_view) {
-		clu_unlock(&lockp);
-		pthread_mutex_unlock(&vf_mutex);
+		vf_unlock_key(key_node, lockp);
 		return -1;
 	}
 
@@ -1201,8 +1309,8 @@ vf_write(cluster_member_list_t *membership, uint32_t flags,
 	 */
 	if (msg_open(MSG_CLUSTER, 0, _port, &everyone, 0) < 0) {
 		printf("msg_open: fail: %s\n", strerror(errno));
-		clu_unlock(&lockp);
-		pthread_mutex_unlock(&vf_mutex);
+		free(join_view);
+		vf_unlock_key(key_node, lockp);
 		return -1;
 	}
 
@@ -1214,8 +1322,7 @@ vf_write(cluster_member_list_t *membership, uint32_t flags,
 #endif
 		msg_close(&everyone);
 		free(join_view);
-		clu_unlock(&lockp);
-		pthread_mutex_unlock(&vf_mutex);
+		vf_unlock_key(key_node, lockp);
 		return -1;
 	} 
 
@@ -1231,6 +1338,7 @@ vf_write(cluster_member_list_t *membership, uint32_t flags,
 #ifdef DEBUG
 		printf("VF: Consensus reached!\n");
 #endif
+		vf_wait_commit(key_node, trans);
 	} else {
 		vf_send_abort(&everyone, trans);
 #ifdef DEBUG
@@ -1244,8 +1352,7 @@ vf_write(cluster_member_list_t *membership, uint32_t flags,
 	 */
 	msg_close(&everyone);
 	free(join_view);
-	clu_unlock(&lockp);
-	pthread_mutex_unlock(&vf_mutex);
+	vf_unlock_key(key_node, lockp);
 
 #ifdef DEBUG
 	if (rv == VFR_OK) {
@@ -1291,16 +1398,16 @@ vf_write(cluster_member_list_t *membership, uint32_t flags,
 static int
 _vf_purge(key_node_t *key_node, uint32_t *trans)
 {
-	view_node_t *cur, *dead = NULL;
+	view_node_t *cur;
 	struct timeval tv;
+	int i;
 
 	*trans = 0;
 	
 	if (!key_node)
 		return VFR_NO;
 
-	cur = key_node->kn_jvlist;
-	if (!cur)
+	if (!key_node->kn_jvcount)
 		return VFR_NO;
 
 	if (getuptime(&tv) == -1) {
@@ -1308,13 +1415,14 @@ _vf_purge(key_node_t *key_node, uint32_t *trans)
 		return VFR_ERROR;
 	}
 
-	for (; cur; cur = cur->vn_next) {
+	for (i = 0; i < key_node->kn_jvcount; i++) {
+		cur = key_node->kn_jvheap[i];
 		if (tv_cmp(&tv, &cur->vn_timeout) < 0)
 			continue;
 
 		*trans = cur->vn_transaction;
-		dead = vn_remove(&key_node->kn_jvlist, *trans);
-		free(dead);
+		vn_remove(cur);
+		free(cur);
 
 		printf("VF: Killed transaction %08x\n", *trans);
 		/*
@@ -1437,69 +1545,53 @@ vf_read(cluster_member_list_t *membership, const char *keyid, uint64_t *view,
 	void **data, uint32_t *datalen)
 {
 	key_node_t *key_node;
-	char lock_name[256];
-	struct dlm_lksb lockp;
+	struct dlm_lksb lockp[2];
 	int l;
 
-	/* Obtain cluster lock on it. */
-	pthread_mutex_lock(&vf_mutex);
-	snprintf(lock_name, sizeof(lock_name), "usrm::vf");
-	l = clu_lock(LKM_EXMODE, &lockp, 0, lock_name);
-	if (l < 0) {
-		pthread_mutex_unlock(&vf_mutex);
-		return l;
+	key_node = kn_get_key(keyid);
+	if (!key_node) {
+		printf("Couldn't locate %s\n", keyid);
+		return VFR_ERROR;
 	}
 
-	do {
-		pthread_mutex_lock(&key_list_mutex);
+	/* Obtain cluster lock on it. */
+	l = vf_lock_key(key_node, lockp);
+	if (l < 0)
+		return l;
 
-		key_node = kn_find_key(keyid);
-		if (!key_node) {
-			if ((vf_key_init_nt(keyid, 10, NULL, NULL) < 0)) {
-				pthread_mutex_unlock(&key_list_mutex);
-				clu_unlock(&lockp);
-				pthread_mutex_unlock(&vf_mutex);
-				printf("Couldn't locate %s\n", keyid);
-				return VFR_ERROR;
-			}
-			
-			key_node = kn_find_key(keyid);
-			assert(key_node);
-		}
+	pthread_mutex_lock(&key_list_mutex);
 
-		/* XXX Don't allow reads during commits. */
-		if (key_node->kn_jvlist || key_node->kn_clist)  {
-			pthread_mutex_unlock(&key_list_mutex);
-			usleep(10000);
-			continue;
-		}
-	} while (0);
+	/* XXX Don't allow reads during commits. */
+	if (key_node->kn_jvcount)  {
+		pthread_mutex_unlock(&key_list_mutex);
+		usleep(10000);
+		pthread_mutex_lock(&key_list_mutex);
+	}
 
 	if (!key_node->kn_data || !key_node->kn_datalen) {
 		pthread_mutex_unlock(&key_list_mutex);
 
 		if (!membership) {
-			clu_unlock(&lockp);
+			vf_unlock_key(key_node, lockp);
 			//printf("Membership NULL, can't find %s\n", keyid);
-			pthread_mutex_unlock(&vf_mutex);
 			return VFR_ERROR;
 		}
 
 		l = vf_request_current(membership, keyid, view, data,
 				       datalen);
 	       	if (l == VFR_NODATA || l == VFR_ERROR) {
-			clu_unlock(&lockp);
+			vf_unlock_key(key_node, lockp);
 			//printf("Requesting current failed %s %d\n", keyid, l);
-			pthread_mutex_unlock(&vf_mutex);
 			return l;
 		}
+
+		pthread_mutex_lock(&key_list_mutex);
 	}
 
 	*data = malloc(key_node->kn_datalen);
 	if (! *data) {
 		pthread_mutex_unlock(&key_list_mutex);
-		clu_unlock(&lockp);
-		pthread_mutex_unlock(&vf_mutex);
+		vf_unlock_key(key_node, lockp);
 		printf("Couldn't malloc %s\n", keyid);
 		return VFR_ERROR;
 	}
@@ -1509,8 +1601,7 @@ vf_read(cluster_member_list_t *membership, const char *keyid, uint64_t *view,
 	*view = key_node->kn_viewno;
 
 	pthread_mutex_unlock(&key_list_mutex);
-	clu_unlock(&lockp);
-	pthread_mutex_unlock(&vf_mutex);
+	vf_unlock_key(key_node, lockp);
 
 	return VFR_OK;
 }
@@ -1521,27 +1612,23 @@ vf_read_local(const char *keyid, uint64_t *view, void **data, uint32_t *datalen)
 {
 	key_node_t *key_node = NULL;
 
-	pthread_mutex_lock(&vf_mutex);
 	pthread_mutex_lock(&key_list_mutex);
 
 	key_node = kn_find_key(keyid);
 	if (!key_node) {
 		pthread_mutex_unlock(&key_list_mutex);
-		pthread_mutex_unlock(&vf_mutex);
 		printf("no key for %s\n", keyid);
 		return VFR_NODATA;
 	}
 
 	if (!key_node->kn_data || !key_node->kn_datalen) {
 		pthread_mutex_unlock(&key_list_mutex);
-		pthread_mutex_unlock(&vf_mutex);
 		return VFR_NODATA;
 	}
 
 	*data = malloc(key_node->kn_datalen);
 	if (! *data) {
 		pthread_mutex_unlock(&key_list_mutex);
-		pthread_mutex_unlock(&vf_mutex);
 		printf("Couldn't malloc %s\n", keyid);
 		return VFR_ERROR;
 	}
@@ -1551,7 +1638,6 @@ vf_read_local(const char *keyid, uint64_t *view, void **data, uint32_t *datalen)
 	*view = key_node->kn_viewno;
 
 	pthread_mutex_unlock(&key_list_mutex);
-	pthread_mutex_unlock(&vf_mutex);
 
 	return VFR_OK;
 }
@@ -1785,10 +1871,10 @@ dump_vf_states(FILE *fp)
 		if (cur->kn_commit_cb != default_commit_cb) 
 			fprintf(fp, "      Commit callback: %p\n", cur->kn_commit_cb);
 
-		if (cur->kn_jvlist)
+		if (cur->kn_jvcount)
 			fprintf(fp, "        This key has unresolved "
 			        "new views pending\n");
- 		if (cur->kn_clist)
+ 		if (cur->kn_commits)
 			fprintf(fp, "        This key has unresolved "
 			        "commits pending\n");
 
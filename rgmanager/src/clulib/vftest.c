@@ -0,0 +1,719 @@
+/*
+ * Drive vf_write() and vf_read() from many threads at once, the way
+ * rgmanager does when a lot of services change state together, and
+ * report how long commits take.
+ *
+ * The messaging layer and the DLM are simulated: the local VF thread
+ * sees every join-view, commit and abort, and the other members vote
+ * yes after a (simulated) network round trip.  Cluster locks are
+ * plain named locks within this process.  With -g, every VF lock name
+ * maps to the one lock, taken exclusively, as it was before VF was
+ * locked per key.
+ *
+ * Every write which succeeds must be reflected in the key's view
+ * number at the end, with no join-views or commits left buffered;
+ * exits non-zero if any were lost.
+ */
+#include "vft.c"
+
+#include <members.h>
+#include <getopt.h>
+#include <time.h>
+
+struct sim_msg {
+	struct sim_msg *next;
+	uint64_t when;		/* usec; not delivered before this */
+	int len;
+	char data[0];
+};
+
+struct sim_queue {
+	struct sim_queue *next;	/* in writers */
+	struct sim_msg *head;
+	int server;
+};
+
+struct sim_lock {
+	struct sim_lock *next;
+	char *name;
+	int held;		/* exclusively */
+	int shared;		/* holders in protected read mode */
+	pthread_cond_t cond;
+};
+
+struct worker {
+	pthread_t thread;
+	int id;
+	int writes;
+	int failed;
+	uint64_t *latency;	/* usec, one per write */
+};
+
+static pthread_mutex_t sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_cond = PTHREAD_COND_INITIALIZER;
+static struct sim_queue *writers;	/* contexts waiting for votes */
+static struct sim_queue *server_q;	/* our VF thread's context */
+static struct sim_lock *locks;
+
+static int num_nodes = 16;
+static int num_keys = 300;
+static int num_threads = 8;
+static int num_writes = 200;
+static int rtt_usec = 500;
+static int lock_usec = 100;
+static int one_lock = 0;
+
+static int *key_writes;			/* successful writes to each key */
+static pthread_mutex_t key_writes_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static uint64_t
+now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/* Call with sim_mutex held */
+static void
+sim_queue_msg(struct sim_queue *q, const void *buf, int len, uint64_t when)
+{
+	struct sim_msg *m, **p;
+
+	m = malloc(sizeof(*m) + len);
+	if (!m) {
+		perror("malloc");
+		exit(1);
+	}
+	m->next = NULL;
+	m->when = when;
+	m->len = len;
+	memcpy(m->data, buf, len);
+
+	for (p = &q->head; *p && (*p)->when <= when; p = &(*p)->next)
+		;
+	m->next = *p;
+	*p = m;
+	pthread_cond_broadcast(&sim_cond);
+}
+
+
+/* Wait up to timeout seconds for a message which is due */
+static struct sim_msg *
+sim_wait(struct sim_queue *q, int timeout, int take)
+{
+	struct sim_msg *m;
+	struct timespec ts;
+	uint64_t now, end, until;
+
+	pthread_mutex_lock(&sim_mutex);
+	end = now_usec() + (uint64_t)timeout * 1000000;
+	while (1) {
+		now = now_usec();
+		m = q->head;
+		if (m && m->when <= now)
+			break;
+		if (now >= end) {
+			m = NULL;
+			break;
+		}
+
+		until = end;
+		if (m && m->when < until)
+			until = m->when;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		until = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 +
+			(until - now);
+		ts.tv_sec = until / 1000000;
+		ts.tv_nsec = (until % 1000000) * 1000;
+		pthread_cond_timedwait(&sim_cond, &sim_mutex, &ts);
+	}
+
+	if (m && take)
+		q->head = m->next;
+	pthread_mutex_unlock(&sim_mutex);
+	return m;
+}
+
+
+/*
+ * Messaging
+ */
+int
+msg_open(int type, int nodeid, int port, msgctx_t *ctx, int timeout)
+{
+	struct sim_queue *q;
+
+	/* Nobody else to ask for current data */
+	if (nodeid)
+		return -1;
+
+	q = calloc(1, sizeof(*q));
+	if (!q)
+		return -1;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->type = MSG_CLUSTER;
+	ctx->sp = q;
+
+	pthread_mutex_lock(&sim_mutex);
+	q->next = writers;
+	writers = q;
+	pthread_mutex_unlock(&sim_mutex);
+	return 0;
+}
+
+
+int
+msg_close(msgctx_t *ctx)
+{
+	struct sim_queue *q = ctx->sp, **p;
+	struct sim_msg *m;
+
+	pthread_mutex_lock(&sim_mutex);
+	for (p = &writers; *p; p = &(*p)->next) {
+		if (*p == q) {
+			*p = q->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sim_mutex);
+
+	while ((m = q->head)) {
+		q->head = m->next;
+		free(m);
+	}
+	free(q);
+	ctx->sp = NULL;
+	ctx->type = MSG_NONE;
+	return 0;
+}
+
+
+msgctx_t *
+msg_new_ctx(void)
+{
+	return calloc(1, sizeof(msgctx_t));
+}
+
+
+void
+msg_free_ctx(msgctx_t *ctx)
+{
+	free(ctx);
+}
+
+
+int
+msg_send(msgctx_t *ctx, void *msg, size_t len)
+{
+	struct sim_queue *q = ctx->sp, *w;
+	generic_msg_hdr hdr, vote;
+	uint64_t now = now_usec();
+	uint32_t trans;
+	int x;
+
+	if (len < sizeof(hdr))
+		return -1;
+	memcpy(&hdr, msg, sizeof(hdr));
+	swab_generic_msg_hdr(&hdr);
+
+	pthread_mutex_lock(&sim_mutex);
+	if (q->server) {
+		/* Our own vote; whoever is waiting for it will know */
+		for (w = writers; w; w = w->next)
+			sim_queue_msg(w, msg, len, now);
+		pthread_mutex_unlock(&sim_mutex);
+		return len;
+	}
+
+	/* From a writer to everyone: we get it straight away */
+	sim_queue_msg(server_q, msg, len, now);
+
+	if (vf_command(hdr.gh_arg1) == VF_JOIN_VIEW) {
+		/* and the others say yes after a round trip */
+		vote.gh_magic = GENERIC_HDR_MAGIC;
+		vote.gh_length = sizeof(vote);
+		vote.gh_command = VF_MESSAGE;
+		vote.gh_arg1 = VF_VOTE | VFMF_AFFIRM;
+		trans = ((vf_msg_t *)msg)->vm_msg.vf_transaction;
+		swab32(trans);
+		vote.gh_arg2 = trans;
+		swab_generic_msg_hdr(&vote);
+		for (x = 1; x < num_nodes; x++)
+			sim_queue_msg(q, &vote, sizeof(vote), now + rtt_usec);
+	}
+	pthread_mutex_unlock(&sim_mutex);
+	return len;
+}
+
+
+int
+msg_wait(msgctx_t *ctx, int timeout)
+{
+	return sim_wait(ctx->sp, timeout, 0) != NULL;
+}
+
+
+int
+msg_receive(msgctx_t *ctx, void *msg, size_t maxlen, int timeout)
+{
+	struct sim_msg *m;
+	int len;
+
+	m = sim_wait(ctx->sp, timeout, 1);
+	if (!m)
+		return 0;
+
+	len = m->len < maxlen ? m->len : maxlen;
+	memcpy(msg, m->data, len);
+	free(m);
+	return len;
+}
+
+
+int
+msg_receive_simple(msgctx_t *ctx, generic_msg_hdr **buf, int timeout)
+{
+	struct sim_msg *m;
+	int len;
+
+	m = sim_wait(ctx->sp, timeout, 1);
+	if (!m)
+		return 0;
+
+	*buf = malloc(m->len);
+	if (!*buf) {
+		free(m);
+		return -1;
+	}
+	memcpy(*buf, m->data, m->len);
+	len = m->len;
+	free(m);
+	return len;
+}
+
+
+/*
+ * Cluster locks
+ */
+int
+clu_lock(int mode, struct dlm_lksb *lksb, int options, const char *resource)
+{
+	struct sim_lock *l;
+
+	/* The old single lock */
+	if (one_lock && !strncmp(resource, "usrm::vf", 8)) {
+		if (mode != LKM_EXMODE) {
+			lksb->sb_lvbptr = NULL;
+			return 0;
+		}
+		resource = "usrm::vf";
+	}
+
+	/* Going to the lock master and back */
+	if (lock_usec)
+		usleep(lock_usec);
+
+	pthread_mutex_lock(&sim_mutex);
+	for (l = locks; l; l = l->next)
+		if (!strcmp(l->name, resource))
+			break;
+	if (!l) {
+		l = calloc(1, sizeof(*l));
+		if (!l || !(l->name = strdup(resource))) {
+			pthread_mutex_unlock(&sim_mutex);
+			return -1;
+		}
+		pthread_cond_init(&l->cond, NULL);
+		l->next = locks;
+		locks = l;
+	}
+
+	if (mode == LKM_EXMODE) {
+		while (l->held || l->shared)
+			pthread_cond_wait(&l->cond, &sim_mutex);
+		l->held = 1;
+	} else {
+		while (l->held)
+			pthread_cond_wait(&l->cond, &sim_mutex);
+		++l->shared;
+	}
+	pthread_mutex_unlock(&sim_mutex);
+
+	/* The mode we hold it in, for clu_unlock() */
+	lksb->sb_status = mode;
+
+	lksb->sb_lvbptr = (char *)l;
+	return 0;
+}
+
+
+int
+clu_unlock(struct dlm_lksb *lksb)
+{
+	struct sim_lock *l = (struct sim_lock *)lksb->sb_lvbptr;
+
+	if (!l)
+		return 0;
+
+	pthread_mutex_lock(&sim_mutex);
+	if (lksb->sb_status == LKM_EXMODE)
+		l->held = 0;
+	else
+		--l->shared;
+	pthread_cond_broadcast(&l->cond);
+	pthread_mutex_unlock(&sim_mutex);
+	return 0;
+}
+
+
+/*
+ * The test
+ */
+static void *
+worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	cluster_member_list_t *membership;
+	char keyid[64];
+	uint64_t begin, view;
+	uint32_t datalen;
+	void *data;
+	int payload[16];
+	int i, key, ret;
+
+	membership = member_list();
+
+	for (i = 0; i < num_writes; i++) {
+		/* Services are spread over the threads; with more
+		   threads than services, some share */
+		key = (w->id + i * num_threads) % num_keys;
+		snprintf(keyid, sizeof(keyid), "rg=\"service:svc%d\"", key);
+
+		memset(payload, 0, sizeof(payload));
+		payload[0] = w->id;
+		payload[1] = i;
+
+		begin = now_usec();
+		ret = vf_write(membership, VFF_IGN_CONN_ERRORS, keyid,
+			       payload, sizeof(payload));
+		w->latency[w->writes] = now_usec() - begin;
+		if (ret != VFR_OK) {
+			w->failed++;
+			continue;
+		}
+		w->writes++;
+
+		pthread_mutex_lock(&key_writes_mutex);
+		key_writes[key]++;
+		pthread_mutex_unlock(&key_writes_mutex);
+
+		if (vf_read(membership, keyid, &view, &data,
+			    &datalen) == VFR_OK)
+			free(data);
+	}
+
+	free_member_list(membership);
+	return NULL;
+}
+
+
+cluster_member_list_t *
+member_list(void)
+{
+	cluster_member_list_t *ml;
+	int x;
+
+	ml = calloc(1, sizeof(*ml));
+	if (!ml)
+		return NULL;
+	ml->cml_members = calloc(num_nodes, sizeof(cman_node_t));
+	if (!ml->cml_members) {
+		free(ml);
+		return NULL;
+	}
+
+	ml->cml_count = num_nodes;
+	for (x = 0; x < num_nodes; x++) {
+		ml->cml_members[x].cn_nodeid = x + 1;
+		ml->cml_members[x].cn_member = 1;
+	}
+	return ml;
+}
+
+
+void
+free_member_list(cluster_member_list_t *ml)
+{
+	free(ml->cml_members);
+	free(ml);
+}
+
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t l = *(const uint64_t *)a, r = *(const uint64_t *)b;
+
+	return (l > r) - (l < r);
+}
+
+
+static int
+check_views(void)
+{
+	key_node_t *kn;
+	char keyid[64];
+	int key, bad = 0;
+
+	pthread_mutex_lock(&key_list_mutex);
+	for (key = 0; key < num_keys; key++) {
+		snprintf(keyid, sizeof(keyid), "rg=\"service:svc%d\"", key);
+		kn = kn_find_key(keyid);
+		if (kn && (kn->kn_jvcount || kn->kn_commits)) {
+			if (!bad)
+				fprintf(stderr, "%s: %d views, %d commits "
+					"left over\n", keyid, kn->kn_jvcount,
+					kn->kn_commits);
+			bad++;
+			continue;
+		}
+		if ((kn ? (int)kn->kn_viewno : 0) == key_writes[key])
+			continue;
+		if (!bad)
+			fprintf(stderr, "%s: view %d after %d writes\n",
+				keyid, kn ? (int)kn->kn_viewno : 0,
+				key_writes[key]);
+		bad++;
+	}
+	pthread_mutex_unlock(&key_list_mutex);
+
+	return bad;
+}
+
+
+/*
+ * Buffer join-views on one key out of order, abort some, commit the rest
+ * in reverse, and check that they are applied in view order.
+ */
+static int
+check_buffers(void)
+{
+	key_node_t *kn;
+	view_node_t *vn;
+	uint32_t trans[64];
+	uint64_t last = 0;
+	int order[64], i, j, tmp, bad = 0;
+
+	for (i = 0; i < 64; i++)
+		order[i] = i;
+	for (i = 63; i > 0; i--) {
+		j = random() % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	kn = kn_get_key("vftest::buffers");
+	pthread_mutex_lock(&key_list_mutex);
+	for (i = 0; i < 64; i++) {
+		trans[i] = (order[i] % 4 + 1) << 16 | i;
+		vn = vn_new(trans[i], order[i] % 4 + 1, order[i] + 1, "", 0);
+		if (!vn_insert(kn, vn)) {
+			free(vn);
+			bad++;
+		}
+		vn = vn_new(trans[i] | 0x8000, order[i] % 4 + 1,
+			    order[i] + 1, "", 0);
+		if (vn_insert(kn, vn)) {
+			fprintf(stderr, "duplicate view %d buffered\n",
+				order[i] + 1);
+			bad++;
+		} else {
+			free(vn);
+		}
+	}
+
+	for (i = 0; i < 64; i++)
+		if (order[i] % 8 == 0 && vf_abort(trans[i]) < 0)
+			bad++;
+	for (i = 63; i >= 0; i--)
+		vf_buffer_commit(trans[i]);
+
+	while ((tmp = vf_try_commit(kn)) != 0) {
+		if (kn->kn_viewno <= last) {
+			fprintf(stderr, "view %d committed after %d\n",
+				(int)kn->kn_viewno, (int)last);
+			bad++;
+		}
+		last = kn->kn_viewno;
+		if (kn_find_trans(tmp))
+			bad++;
+	}
+
+	if (kn->kn_jvcount || kn->kn_commits || last != 64 ||
+	    kn_find_trans(trans[1])) {
+		fprintf(stderr, "buffers: %d views, %d commits left, "
+			"view %d\n", kn->kn_jvcount, kn->kn_commits,
+			(int)last);
+		bad++;
+	}
+	pthread_mutex_unlock(&key_list_mutex);
+
+	return bad;
+}
+
+
+static void
+usage(char *prog, FILE *file)
+{
+	fprintf(file, "Usage:\n");
+	fprintf(file, "%s [nktwrlgdh]\n", prog);
+	fprintf(file, "\n");
+	fprintf(file, "   -h           show this help information\n");
+	fprintf(file, "   -n <num>     cluster members (default 16)\n");
+	fprintf(file, "   -k <num>     services (default 300)\n");
+	fprintf(file, "   -t <num>     writer threads (default 8)\n");
+	fprintf(file, "   -w <num>     writes per thread (default 200)\n");
+	fprintf(file, "   -r <usec>    network round trip (default 500)\n");
+	fprintf(file, "   -l <usec>    time to take a cluster lock (default 100)\n");
+	fprintf(file, "   -g           one cluster-wide VF lock, as before\n");
+	fprintf(file, "   -d           dump the VF states at the end\n");
+	fprintf(file, "\n");
+}
+
+
+int
+main(int argc, char **argv)
+{
+	struct worker *workers;
+	struct vf_args *args;
+	msgctx_t *server_ctx;
+	generic_msg_hdr hdr;
+	uint64_t *all, begin, elapsed, total = 0;
+	int writes = 0, failed = 0, bad;
+	int optchar, i, j, dump = 0;
+
+	while ((optchar = getopt(argc, argv, "n:k:t:w:r:l:gdh")) != EOF) {
+		switch (optchar) {
+		case 'n':
+			num_nodes = atoi(optarg);
+			break;
+		case 'k':
+			num_keys = atoi(optarg);
+			break;
+		case 't':
+			num_threads = atoi(optarg);
+			break;
+		case 'w':
+			num_writes = atoi(optarg);
+			break;
+		case 'r':
+			rtt_usec = atoi(optarg);
+			break;
+		case 'l':
+			lock_usec = atoi(optarg);
+			break;
+		case 'g':
+			one_lock = 1;
+			break;
+		case 'd':
+			dump = 1;
+			break;
+		case 'h':
+			usage(argv[0], stdout);
+			return 0;
+		default:
+			usage(argv[0], stderr);
+			return 1;
+		}
+	}
+
+	if (num_nodes < 1 || num_keys < 1 || num_threads < 1 ||
+	    num_writes < 1 || rtt_usec < 0 || lock_usec < 0) {
+		usage(argv[0], stderr);
+		return 1;
+	}
+
+	workers = calloc(num_threads, sizeof(*workers));
+	key_writes = calloc(num_keys, sizeof(int));
+	all = malloc(sizeof(uint64_t) * num_threads * num_writes);
+	server_ctx = msg_new_ctx();
+	args = malloc(sizeof(*args));
+	if (!workers || !key_writes || !all || !server_ctx || !args) {
+		perror("malloc");
+		return 1;
+	}
+
+	/* As vf_init() does, but with our context for the VF thread */
+	_node_id = 1;
+	_port = RG_PORT;
+	msg_open(MSG_CLUSTER, 0, RG_PORT, server_ctx, 1);
+	server_q = server_ctx->sp;
+	server_q->server = 1;
+	args->ctx = server_ctx;
+	args->local_node_id = _node_id;
+	args->port = _port;
+	pthread_create(&vf_thread, NULL, vf_server, args);
+	vf_wait_ready();
+
+	printf("%d members, %d services, %d threads, %d writes each, "
+	       "%s\n", num_nodes, num_keys, num_threads, num_writes,
+	       one_lock ? "one VF lock" : "VF lock per key");
+
+	begin = now_usec();
+	for (i = 0; i < num_threads; i++) {
+		workers[i].id = i;
+		workers[i].latency = all + i * num_writes;
+		pthread_create(&workers[i].thread, NULL, worker_thread,
+			       &workers[i]);
+	}
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	elapsed = now_usec() - begin;
+
+	/* Pack the latencies of the writes which worked */
+	for (i = 0; i < num_threads; i++) {
+		for (j = 0; j < workers[i].writes; j++) {
+			all[writes] = workers[i].latency[j];
+			total += all[writes++];
+		}
+		failed += workers[i].failed;
+	}
+	qsort(all, writes, sizeof(uint64_t), cmp_u64);
+
+	printf("commits   failed  commits/s   mean us    p50 us    p99 us"
+	       "    max us\n");
+	if (writes)
+		printf("%7d %8d %10.0f %9.0f %9llu %9llu %9llu\n", writes,
+		       failed, writes / (elapsed / 1000000.0),
+		       (double)total / writes,
+		       (unsigned long long)all[writes / 2],
+		       (unsigned long long)all[(writes * 99) / 100],
+		       (unsigned long long)all[writes - 1]);
+
+	bad = check_views() + check_buffers();
+	if (dump)
+		dump_vf_states(stdout);
+
+	/* Stop the VF thread; anything which isn't VF wakes it up */
+	vf_thread_ready = 0;
+	memset(&hdr, 0, sizeof(hdr));
+	pthread_mutex_lock(&sim_mutex);
+	sim_queue_msg(server_q, &hdr, sizeof(hdr), 0);
+	pthread_mutex_unlock(&sim_mutex);
+	pthread_join(vf_thread, NULL);
+
+	vf_invalidate();
+	free(all);
+	free(key_writes);
+	free(workers);
+
+	printf("%d lost updates, %d failed writes\n", bad, failed);
+	return (bad || failed) ? 1 : 0;
+}
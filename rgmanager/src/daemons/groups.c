@@ -15,6 +15,8 @@
 #include <sets.h>
 #include <fo_domain.h>
 #include <groups.h>
+#include <msgsimple.h>
+#include <time.h>
 
 /* Use address field in this because we never use it internally,
    and there is no extra space in the cman_node_t type.
@@ -47,8 +49,41 @@ static int _group_property(const char *groupname, const char *property,
 struct status_arg {
 	msgctx_t *ctx;
 	int fast;
+	int snapshot;		/* RG_STATUS_SNAPSHOT; since and epoch */
+	uint32_t since;		/* are the view the client has */
+	uint32_t epoch;
 };
 
+/*
+ * Every service's state, kept up to date from committed VF views so
+ * that status requests don't have to read them one by one.  Each change
+ * bumps the snapshot view, and each entry remembers the view it last
+ * changed at, so clients can ask for what changed since the view they
+ * have.  The epoch changes when the daemon restarts; snap_base is the
+ * view at which services were last added or removed, and before that
+ * there is no delta to give.
+ */
+struct rg_snap_entry {
+	struct rg_snap_entry *se_next;	/* hash chain */
+	rg_state_t se_state;		/* host byte order */
+	uint64_t se_vfview;		/* VF view se_state came from */
+	uint32_t se_view;		/* snapshot view of last change */
+	int se_valid;			/* 0 until we have read or been sent
+					   the state */
+};
+
+#define RG_SNAP_HASH_SIZE 256	/* power of two */
+
+static struct rg_snap_entry *snap_entries = NULL;
+static struct rg_snap_entry *snap_hash[RG_SNAP_HASH_SIZE];
+static int snap_count = 0;
+static uint32_t snap_view = 0, snap_base = 0, snap_epoch = 0;
+#ifdef WRAP_LOCKS
+static pthread_mutex_t snap_mutex = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;
+#else
+static pthread_mutex_t snap_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 
 /**
    See if a given node ID should start a resource, given cluster membership
@@ -1120,6 +1155,295 @@ group_property(const char *groupname, const char *property,
 }
 	
 
+static struct rg_snap_entry **
+snap_bucket(const char *name)
+{
+	const unsigned char *p;
+	uint32_t hash = 5381;
+
+	for (p = (const unsigned char *)name; *p; p++)
+		hash = (hash * 33) + *p;
+
+	return &snap_hash[hash & (RG_SNAP_HASH_SIZE - 1)];
+}
+
+
+static struct rg_snap_entry *
+snap_find(const char *name)
+{
+	struct rg_snap_entry *se;
+
+	for (se = *snap_bucket(name); se; se = se->se_next)
+		if (!strcmp(se->se_state.rs_name, name))
+			return se;
+
+	return NULL;
+}
+
+
+/**
+  Store a service's state in the snapshot, if it is newer than what we
+  have.  Call with snap_mutex held.
+
+  @param svcblk		State, in host byte order.
+  @param vfview		VF view it came from, or 0 if we read it
+  			without knowing; that only fills in a state we
+			don't have yet.
+ */
+static void
+snap_store(rg_state_t *svcblk, uint64_t vfview)
+{
+	struct rg_snap_entry *se;
+
+	se = snap_find(svcblk->rs_name);
+	if (!se)
+		return;
+
+	if (se->se_valid && (!vfview || vfview <= se->se_vfview))
+		return;
+
+	se->se_vfview = vfview;
+	if (se->se_valid &&
+	    !memcmp(&se->se_state, svcblk, sizeof(*svcblk)))
+		return;
+
+	memcpy(&se->se_state, svcblk, sizeof(*svcblk));
+	se->se_valid = 1;
+	se->se_view = ++snap_view;
+}
+
+
+/**
+  Rebuild the snapshot from the service list.  States we already have
+  are carried over; new services start out unknown.  Call with
+  resource_lock held.
+ */
+static void
+rg_snapshot_rebuild(void)
+{
+	struct rg_snap_entry *entries = NULL, *old, *se, **bucket;
+	resource_node_t *node;
+	int count = 0, x;
+
+	list_do(&_tree, node) {
+		++count;
+	} while (!list_done(&_tree, node));
+
+	if (count) {
+		entries = calloc(count, sizeof(*entries));
+		if (!entries) {
+			logt_print(LOG_ERR, "%s: %s\n", __FUNCTION__,
+				   strerror(errno));
+			count = 0;
+		}
+	}
+
+	pthread_mutex_lock(&snap_mutex);
+
+	x = 0;
+	list_do(&_tree, node) {
+		if (x >= count)
+			break;
+		se = &entries[x++];
+		res_build_name(se->se_state.rs_name,
+			       sizeof(se->se_state.rs_name),
+			       node->rn_resource);
+		old = snap_find(se->se_state.rs_name);
+		if (old)
+			memcpy(se, old, sizeof(*se));
+		else
+			se->se_state.rs_state = RG_STATE_UNINITIALIZED;
+	} while (!list_done(&_tree, node));
+
+	free(snap_entries);
+	snap_entries = entries;
+	snap_count = count;
+	memset(snap_hash, 0, sizeof(snap_hash));
+	for (x = 0; x < count; x++) {
+		bucket = snap_bucket(entries[x].se_state.rs_name);
+		entries[x].se_next = *bucket;
+		*bucket = &entries[x];
+	}
+
+	if (!snap_epoch)
+		snap_epoch = (uint32_t)time(NULL);
+	snap_base = ++snap_view;
+
+	pthread_mutex_unlock(&snap_mutex);
+}
+
+
+/**
+  VF commit callback: keep the snapshot up to date with the rg="..."
+  keys.  Runs in the VF thread.
+ */
+int
+rg_state_commit_cb(char *key, uint64_t viewno, void *data, uint32_t datalen)
+{
+	rg_state_t svcblk;
+
+	if (strncmp(key, "rg=\"", 4) || datalen != sizeof(svcblk)) {
+		free(data);
+		return 0;
+	}
+
+	memcpy(&svcblk, data, sizeof(svcblk));
+	free(data);
+	swab_rg_state_t(&svcblk);
+
+	pthread_mutex_lock(&snap_mutex);
+	snap_store(&svcblk, viewno);
+	pthread_mutex_unlock(&snap_mutex);
+
+	return 0;
+}
+
+
+/**
+  Get a service's state from the snapshot.
+
+  @return		0 on success, -1 if we don't know it yet.
+ */
+static int
+rg_snapshot_get(const char *name, rg_state_t *svcblk)
+{
+	struct rg_snap_entry *se;
+	int ret = -1;
+
+	pthread_mutex_lock(&snap_mutex);
+	se = snap_find(name);
+	if (se && se->se_valid) {
+		memcpy(svcblk, &se->se_state, sizeof(*svcblk));
+		ret = 0;
+	}
+	pthread_mutex_unlock(&snap_mutex);
+
+	return ret;
+}
+
+
+/**
+  Read the states of the services the snapshot doesn't know about yet;
+  those which haven't changed since we joined.  From then on, VF tells
+  us about every change.
+ */
+static void
+rg_snapshot_fill(int fast)
+{
+	rg_state_t svcblk;
+	struct dlm_lksb lockp;
+	char rg[64];
+	int x = 0;
+
+	while (1) {
+		pthread_mutex_lock(&snap_mutex);
+		while (x < snap_count && snap_entries[x].se_valid)
+			x++;
+		if (x >= snap_count) {
+			pthread_mutex_unlock(&snap_mutex);
+			break;
+		}
+		strncpy(rg, snap_entries[x++].se_state.rs_name, sizeof(rg));
+		pthread_mutex_unlock(&snap_mutex);
+
+		if (get_rg_state_local(rg, &svcblk) != 0) {
+			if (fast)
+				continue;
+			if (rg_lock(rg, &lockp) < 0)
+				continue;
+			if (get_rg_state(rg, &svcblk) < 0) {
+				rg_unlock(&lockp);
+				continue;
+			}
+			rg_unlock(&lockp);
+		}
+
+		/*
+		 * Once set, an entry is kept current only by VF's commit
+		 * callback.  The OPENAIS build has no VF, so it never sets
+		 * them: the state read here would go stale.  Those services
+		 * are left out of the snapshot, and status requests read
+		 * their state each time instead.
+		 */
+#ifndef OPENAIS
+		pthread_mutex_lock(&snap_mutex);
+		snap_store(&svcblk, 0);
+		pthread_mutex_unlock(&snap_mutex);
+#endif
+	}
+}
+
+
+/**
+  Send the snapshot, or what has changed in it since the client's view,
+  in as few messages as we can.
+ */
+static void
+send_rg_snapshot(msgctx_t *ctx, int fast, uint32_t since, uint32_t epoch)
+{
+	rg_state_batch_t batch;
+	rg_state_t *states = NULL;
+	uint32_t view;
+	int count = 0, full, x, n, len;
+
+	rg_snapshot_fill(fast);
+
+	pthread_mutex_lock(&snap_mutex);
+	full = (epoch != snap_epoch || since < snap_base || since > snap_view);
+	if (snap_count) {
+		states = malloc(sizeof(rg_state_t) * snap_count);
+		if (!states) {
+			pthread_mutex_unlock(&snap_mutex);
+			msg_send_simple(ctx, RG_FAIL, RG_EAGAIN, 0);
+			return;
+		}
+	}
+	for (x = 0; x < snap_count; x++) {
+		if (!snap_entries[x].se_valid)
+			continue;
+		if (!full && snap_entries[x].se_view <= since)
+			continue;
+		memcpy(&states[count++], &snap_entries[x].se_state,
+		       sizeof(rg_state_t));
+	}
+	view = snap_view;
+	epoch = snap_epoch;
+	pthread_mutex_unlock(&snap_mutex);
+
+	/* Always at least one, so that the client sees 'full' */
+	x = 0;
+	do {
+		n = count - x;
+		if (n > RG_STATE_BATCH_MAX)
+			n = RG_STATE_BATCH_MAX;
+		len = sizeof(generic_msg_hdr) + n * sizeof(rg_state_t);
+
+		batch.rsb_hdr.gh_magic = GENERIC_HDR_MAGIC;
+		batch.rsb_hdr.gh_length = len;
+		batch.rsb_hdr.gh_command = RG_STATUS_SNAPSHOT;
+		batch.rsb_hdr.gh_arg1 = n;
+		batch.rsb_hdr.gh_arg2 = full;
+		batch.rsb_hdr.gh_arg3 = 0;
+		memcpy(batch.rsb_states, &states[x], n * sizeof(rg_state_t));
+
+		swab_generic_msg_hdr(&batch.rsb_hdr);
+		while (n--)
+			swab_rg_state_t(&batch.rsb_states[n]);
+
+		if (msg_send(ctx, &batch, len) < 0) {
+			perror("msg_send");
+			break;
+		}
+
+		x += RG_STATE_BATCH_MAX;
+	} while (x < count);
+
+	free(states);
+
+	msg_send_simple(ctx, RG_SUCCESS, view, epoch);
+}
+
+
 /**
   Send the state of a resource group to a given file descriptor.
 
@@ -1137,9 +1461,10 @@ send_rg_state(msgctx_t *ctx, char *rgname, int fast)
 	msgp->rsm_hdr.gh_length = sizeof(msg);
 	msgp->rsm_hdr.gh_command = RG_STATUS;
 
-	/* try fast read -- only if it fails and fast is not 
-	   specified should we do the full locked read */
-	if (get_rg_state_local(rgname, &msgp->rsm_state) != 0 &&
+	/* try the snapshot, then a fast read -- only if they fail and
+	   fast is not specified should we do the full locked read */
+	if (rg_snapshot_get(rgname, &msgp->rsm_state) != 0 &&
+	    get_rg_state_local(rgname, &msgp->rsm_state) != 0 &&
 	    !fast) {
 		if (rg_lock(rgname, &lockp) < 0)
 			return;
@@ -1164,8 +1489,9 @@ send_rg_state(msgctx_t *ctx, char *rgname, int fast)
 static void *
 status_check_thread(void *arg)
 {
-	msgctx_t *ctx = ((struct status_arg *)arg)->ctx;
-	int fast = ((struct status_arg *)arg)->fast;
+	struct status_arg sa = *(struct status_arg *)arg;
+	msgctx_t *ctx = sa.ctx;
+	int fast = sa.fast;
 	resource_node_t *node;
 	generic_msg_hdr hdr;
 	char rg[64];
@@ -1191,17 +1517,21 @@ status_check_thread(void *arg)
 	
 	/*send_master_state(ctx);*/
 
-	pthread_rwlock_rdlock(&resource_lock);
+	if (sa.snapshot) {
+		send_rg_snapshot(ctx, fast, sa.since, sa.epoch);
+	} else {
+		pthread_rwlock_rdlock(&resource_lock);
 
-	list_do(&_tree, node) {
+		list_do(&_tree, node) {
 
-		res_build_name(rg, sizeof(rg), node->rn_resource);
-		send_rg_state(ctx, rg, fast);
-	} while (!list_done(&_tree, node));
+			res_build_name(rg, sizeof(rg), node->rn_resource);
+			send_rg_state(ctx, rg, fast);
+		} while (!list_done(&_tree, node));
 
-	pthread_rwlock_unlock(&resource_lock);
+		pthread_rwlock_unlock(&resource_lock);
 
-	msg_send_simple(ctx, RG_SUCCESS, 0, 0);
+		msg_send_simple(ctx, RG_SUCCESS, 0, 0);
+	}
 
 	/* XXX wait for client to tell us it's done; I don't know why
 	   this is needed when doing fast I/O, but it is. */
@@ -1215,14 +1545,9 @@ status_check_thread(void *arg)
 }
 
 
-/**
-  Send all resource group states to a file descriptor
-
-  @param fd		File descriptor to send states to.
-  @return		0
- */
-int
-send_rg_states(msgctx_t *ctx, int fast)
+static int
+_send_rg_states(msgctx_t *ctx, int fast, int snapshot, uint32_t since,
+		uint32_t epoch)
 {
 	struct status_arg *arg;
 	pthread_t newthread;
@@ -1236,6 +1561,9 @@ send_rg_states(msgctx_t *ctx, int fast)
 
 	arg->ctx = ctx;
 	arg->fast = fast;
+	arg->snapshot = snapshot;
+	arg->since = since;
+	arg->epoch = epoch;
 
         pthread_attr_init(&attrs);
         pthread_attr_setinheritsched(&attrs, PTHREAD_INHERIT_SCHED);
@@ -1249,6 +1577,36 @@ send_rg_states(msgctx_t *ctx, int fast)
 }
 
 
+/**
+  Send all resource group states to a file descriptor
+
+  @param fd		File descriptor to send states to.
+  @return		0
+ */
+int
+send_rg_states(msgctx_t *ctx, int fast)
+{
+	return _send_rg_states(ctx, fast, 0, 0, 0);
+}
+
+
+/**
+  Send the resource group states which have changed since a client's
+  view of the snapshot, or all of them.
+
+  @param ctx		Context to send states to.
+  @param since		Snapshot view the client has; 0 for none.
+  @param epoch		Snapshot epoch the client's view is from.
+  @return		0
+ */
+int
+send_rg_snapshot_states(msgctx_t *ctx, int fast, uint32_t since,
+			uint32_t epoch)
+{
+	return _send_rg_states(ctx, fast, 1, since, epoch);
+}
+
+
 int
 svc_exists(const char *svcname)
 {
@@ -1338,7 +1696,8 @@ q_status_checks(void __attribute__ ((unused)) *arg)
 		res_build_name(rg, sizeof(rg), curr->rn_resource);
 
 		/* Local check - no one will make us take a service */
-		if (get_rg_state_local(rg, &svcblk) < 0) {
+		if (rg_snapshot_get(rg, &svcblk) < 0 &&
+		    get_rg_state_local(rg, &svcblk) < 0) {
 			if (rg_lock(rg, &lockp) != 0)
 				continue;
 			if (get_rg_state(rg, &svcblk) < 0) {
@@ -1757,6 +2116,7 @@ init_resource_groups(int reconfigure, int do_init)
 	if (master_event_table)
 		deconstruct_events(&master_event_table);
 	master_event_table = evt;
+	rg_snapshot_rebuild();
 	pthread_rwlock_unlock(&resource_lock);
 
 	if (reconfigure) {
@@ -1917,5 +2277,8 @@ kill_resource_groups(void)
 	destroy_resource_rules(&_rules);
 	deconstruct_domains(&_domains);
 
+	/* Forget the states too; they went with the VF cache */
+	rg_snapshot_rebuild();
+
 	pthread_rwlock_unlock(&resource_lock);
 }
@@ -396,6 +396,15 @@ dispatch_msg(msgctx_t *ctx, int nodeid, int need_close)
 			need_close = 0;
 		break;
 
+	case RG_STATUS_SNAPSHOT:
+		/* swab_generic_msg_hdr() leaves gh_arg3 alone */
+		swab32(msg_hdr->gh_arg3);
+		if (send_rg_snapshot_states(ctx, msg_hdr->gh_arg1,
+					    msg_hdr->gh_arg2,
+					    msg_hdr->gh_arg3) == 0)
+			need_close = 0;
+		break;
+
 	case RG_STATUS_NODE:
 		//log_printf(LOG_DEBUG, "Sending node states to CTX%p\n",ctx);
 		send_node_states(ctx);
@@ -793,6 +802,7 @@ configure_rgmanager(int ccsfd, int dbg, int *token_secs)
 	char *v;
 	char internal = 0;
 	int status_child_max = 0;
+	int worker_max = 0;
 	int tmp;
 
 	if (ccsfd < 0) {
@@ -857,6 +867,20 @@ configure_rgmanager(int ccsfd, int dbg, int *token_secs)
 		free(v);
 	}
 
+	if (ccs_get(ccsfd, "/cluster/rm/@worker_max", &v) == 0) {
+		worker_max = atoi(v);
+		if (worker_max >= 1) {
+			logt_print(LOG_NOTICE,
+			       "Worker Max set to %d\n", worker_max);
+			rt_set_max_workers(worker_max);
+		} else {
+			logt_print(LOG_WARNING, "Ignoring illegal "
+			       "worker_max of %s\n", v);
+		}
+		
+		free(v);
+	}
+
 	if (internal)
 		ccs_disconnect(ccsfd);
 
@@ -1074,7 +1098,8 @@ main(int argc, char **argv)
 
 	ds_key_init("rg_lockdown", 32, 10);
 #else
-	if (vf_init(me.cn_nodeid, port, NULL, NULL, cluster_timeout) != 0) {
+	if (vf_init(me.cn_nodeid, port, NULL, rg_state_commit_cb,
+		    cluster_timeout) != 0) {
 		logt_print(LOG_CRIT, "#11: Couldn't set up VF listen socket\n");
 		goto out_ls;
 	}
@@ -8,6 +8,7 @@
 #include <resgroup.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <list.h>
 #include <restart_counter.h>
 #include <reslist.h>
@@ -29,6 +30,7 @@ static inline int _res_op_internal(resource_node_t **tree, resource_t *first,
 /* XXX from reslist.c */
 void * act_dup(resource_act_t *acts);
 time_t get_time(char *action, int depth, resource_node_t *node);
+void res_build_name(char *, size_t, resource_t *);
 
 
 
@@ -57,6 +59,24 @@ _no_op_mode(int arg)
 #endif
 
 
+/**
+ * Timing trace entry: one for each run of a resource agent.
+ */
+typedef struct _res_trace {
+	char		tr_name[128];		/** type:name */
+	int		tr_op;			/** Operation */
+	int		tr_ret;			/** What the agent returned */
+	struct timeval	tr_start;
+	struct timeval	tr_end;
+} res_trace_t;
+
+static res_trace_t *res_trace = NULL;
+static int res_trace_len = 0, res_trace_size = 0;
+static int res_tracing = 0;
+static struct timeval res_trace_base;
+static pthread_mutex_t res_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
 /**
    ocf_strerror
  */
@@ -310,10 +330,10 @@ res_act_index(resource_node_t *node, const char *op_str, int depth)
    @param op		Operation to perform (stop/start/etc.)
    @param depth		OCF Check level/depth
    @return		Return value of script.
-   @see			build_env
+   @see			build_env res_exec
  */
-int
-res_exec(resource_node_t *node, int op, const char *arg, int depth)
+static int
+_res_exec(resource_node_t *node, int op, const char *arg, int depth)
 {
 	int childpid, pid;
 	int ret = 0;
@@ -465,6 +485,120 @@ res_exec(resource_node_t *node, int op, const char *arg, int depth)
 }
 
 
+/**
+   Start (or stop) recording how long each resource agent takes.
+   Either way, throws away what has been recorded so far.
+
+   @param enable	Nonzero to record from now on.
+   @see			dump_res_trace
+ */
+void
+res_trace_enable(int enable)
+{
+	pthread_mutex_lock(&res_trace_mutex);
+	free(res_trace);
+	res_trace = NULL;
+	res_trace_len = res_trace_size = 0;
+	gettimeofday(&res_trace_base, NULL);
+	res_tracing = enable;
+	pthread_mutex_unlock(&res_trace_mutex);
+}
+
+
+static void
+res_trace_add(resource_node_t *node, int op, int ret,
+	      struct timeval *start, struct timeval *end)
+{
+	res_trace_t *tr;
+
+	pthread_mutex_lock(&res_trace_mutex);
+	if (res_trace_len == res_trace_size) {
+		tr = realloc(res_trace, sizeof(*tr) *
+			     (res_trace_size ? res_trace_size * 2 : 32));
+		if (!tr) {
+			pthread_mutex_unlock(&res_trace_mutex);
+			return;
+		}
+		res_trace = tr;
+		res_trace_size = res_trace_size ? res_trace_size * 2 : 32;
+	}
+
+	tr = &res_trace[res_trace_len++];
+	res_build_name(tr->tr_name, sizeof(tr->tr_name), node->rn_resource);
+	tr->tr_op = op;
+	tr->tr_ret = ret;
+	tr->tr_start = *start;
+	tr->tr_end = *end;
+	pthread_mutex_unlock(&res_trace_mutex);
+}
+
+
+static double
+res_trace_secs(struct timeval *tv)
+{
+	return (double)(tv->tv_sec - res_trace_base.tv_sec) +
+	       (double)(tv->tv_usec - res_trace_base.tv_usec) / 1000000;
+}
+
+
+/**
+   Print the timing trace: when each resource agent was started relative
+   to res_trace_enable(), and how long it took, in seconds.
+ */
+void
+dump_res_trace(FILE *fp)
+{
+	res_trace_t *tr;
+	double end = 0;
+	int x;
+
+	pthread_mutex_lock(&res_trace_mutex);
+	fprintf(fp, "=== Resource Timing ===\n");
+	fprintf(fp, "   start  elapsed  ret  operation\n");
+	for (x = 0; x < res_trace_len; x++) {
+		tr = &res_trace[x];
+		fprintf(fp, "%8.3f %8.3f %4d  %s %s\n",
+			res_trace_secs(&tr->tr_start),
+			res_trace_secs(&tr->tr_end) -
+			res_trace_secs(&tr->tr_start),
+			tr->tr_ret, agent_op_str(tr->tr_op), tr->tr_name);
+		if (res_trace_secs(&tr->tr_end) > end)
+			end = res_trace_secs(&tr->tr_end);
+	}
+	fprintf(fp, "%8.3f total\n", end);
+	pthread_mutex_unlock(&res_trace_mutex);
+}
+
+
+/**
+   Execute a resource-specific agent for a resource node in the tree,
+   recording how long it took if the timing trace is on.
+
+   @param node		Resource tree node we're dealing with
+   @param op		Operation to perform (stop/start/etc.)
+   @param depth		OCF Check level/depth
+   @return		Return value of script.
+   @see			res_trace_enable
+ */
+int
+res_exec(resource_node_t *node, int op, const char *arg, int depth)
+{
+	struct timeval start, end;
+	int ret;
+
+	if (!res_tracing)
+		return _res_exec(node, op, arg, depth);
+
+	gettimeofday(&start, NULL);
+	ret = _res_exec(node, op, arg, depth);
+	gettimeofday(&end, NULL);
+
+	res_trace_add(node, op, ret, &start, &end);
+
+	return ret;
+}
+
+
 static inline void
 assign_restart_policy(resource_t *curres, resource_node_t *parent,
 		      resource_node_t *node)
@@ -508,6 +642,7 @@ do_load_resource(int ccsfd, char *base,
 {
 	char tok[512];
 	char *ref;
+	const char *val;
 	resource_node_t *node;
 	resource_t *curres;
 	time_t failure_expire = 0;
@@ -595,6 +730,16 @@ do_load_resource(int ccsfd, char *base,
 		free(ref);
 	}
 
+	/* Parallel start/stop is set on the service, and covers
+	   everything in it */
+	if (parent) {
+		node->rn_flags |= (parent->rn_flags & RF_PARALLEL);
+	} else {
+		val = res_attr_value(curres, "parallel");
+		if (val && (atoi(val) > 0 || strcasecmp(val, "yes") == 0))
+			node->rn_flags |= RF_PARALLEL;
+	}
+
 	snprintf(tok, sizeof(tok), "%s/@__enforce_timeouts", base);
 #ifndef NO_CCS
 	if (ccs_get(ccsfd, tok, &ref) == 0) {
@@ -926,6 +1071,8 @@ _print_resource_tree(FILE *fp, resource_node_t **tree, int level)
 				fprintf(fp, "DESTROY ");
 			if (node->rn_flags & RF_ENFORCE_TIMEOUTS)
 				fprintf(fp, "ENFORCE-TIMEOUTS ");
+			if (node->rn_flags & RF_PARALLEL)
+				fprintf(fp, "PARALLEL ");
 			fprintf(fp, "]");
 		}
 		fprintf(fp, " {\n");
@@ -964,6 +1111,163 @@ dump_resource_tree(FILE *fp, resource_node_t **tree)
 }
 
 
+/**
+   One child subtree being started or stopped on its own thread.
+ */
+typedef struct _par_op {
+	pthread_t	po_thread;
+	resource_node_t	*po_node;		/** Child to start/stop */
+	resource_t	*po_first;
+	void		*po_ret;
+	int		po_op;
+	int		po_rv;			/** _res_op_internal() result */
+	int		po_threaded;		/** po_thread needs joining */
+} par_op_t;
+
+
+static void *
+_par_op_thread(void *arg)
+{
+	par_op_t *po = (par_op_t *)arg;
+
+	po->po_rv = _res_op_internal(&po->po_node, po->po_first,
+				     po->po_node->rn_resource->r_rule->rr_type,
+				     po->po_ret, po->po_op, po->po_node);
+	return NULL;
+}
+
+
+/**
+   See if the children of a node should be started or stopped in
+   parallel.  Status checks and the conditional operations are always
+   done one at a time.
+ */
+static inline int
+do_parallel(resource_node_t *node, int op)
+{
+	if (!(node->rn_flags & RF_PARALLEL))
+		return 0;
+	if (op != RS_START && op != RS_STOP)
+		return 0;
+#ifdef NO_CCS
+	/* Keep no-op output in a fixed order for the tests */
+	if (_no_op_mode_)
+		return 0;
+#endif
+	return 1;
+}
+
+
+/**
+   See if a child is started/stopped at a given level of its parent's
+   child types.  Level 0 is the default level: children of types which
+   have no start or stop level, which go after (or before, when
+   stopping) the others.
+ */
+static int
+_child_at_level(resource_node_t *node, resource_node_t *child, int op,
+		int level)
+{
+	resource_rule_t *rule = node->rn_resource->r_rule;
+	int x, lev;
+
+	for (x = 0; rule->rr_childtypes &&
+	     rule->rr_childtypes[x].rc_name; x++) {
+		if (strcmp(child->rn_resource->r_rule->rr_type,
+			   rule->rr_childtypes[x].rc_name))
+			continue;
+
+		if (!level) {
+			if (rule->rr_childtypes[x].rc_startlevel ||
+			    rule->rr_childtypes[x].rc_stoplevel)
+				return 0;
+			continue;
+		}
+
+		if (op == RS_STOP)
+			lev = rule->rr_childtypes[x].rc_stoplevel;
+		else
+			lev = rule->rr_childtypes[x].rc_startlevel;
+
+		if (lev == level)
+			return 1;
+	}
+
+	return !level;
+}
+
+
+/**
+   Perform an operation on all of the children of a node at one level
+   at once, each subtree on its own thread, and wait for them all.
+   Nothing orders siblings at the same level, so this is what the serial
+   path does, less the waiting.  One difference: when a start fails,
+   siblings already under way are allowed to finish rather than never
+   being started.  The caller goes no further either way.
+
+   @param node		Parent node
+   @param first		Resource we're looking to perform the operation
+   			on, if one exists.
+   @param ret		Unused
+   @param op		RS_START or RS_STOP
+   @param level		Start/stop level of the children; 0 for those
+   			at the default level.
+   @return		Results of all the children ORed together.
+   @see			_do_child_levels _do_child_default_level
+ */
+static int
+_res_op_parallel(resource_node_t *node, resource_t *first, void *ret,
+		 int op, int level)
+{
+	resource_node_t *child;
+	par_op_t *ops;
+	int x, y, count = 0, rv = 0;
+
+	list_for(&node->rn_child, child, x) {
+		if (_child_at_level(node, child, op, level))
+			++count;
+	}
+
+	if (!count)
+		return 0;
+
+	ops = malloc(sizeof(*ops) * count);
+	if (!ops)
+		return SFL_FAILURE;
+	memset(ops, 0, sizeof(*ops) * count);
+
+	y = 0;
+	list_for(&node->rn_child, child, x) {
+		if (!_child_at_level(node, child, op, level))
+			continue;
+
+		ops[y].po_node = child;
+		ops[y].po_first = first;
+		ops[y].po_ret = ret;
+		ops[y].po_op = op;
+
+		/* The last one runs here; so does any we can't
+		   start a thread for */
+		if (y < count - 1 &&
+		    pthread_create(&ops[y].po_thread, NULL, _par_op_thread,
+				   &ops[y]) == 0)
+			ops[y].po_threaded = 1;
+		else
+			_par_op_thread(&ops[y]);
+		++y;
+	}
+
+	for (y = 0; y < count; y++) {
+		if (ops[y].po_threaded)
+			pthread_join(ops[y].po_thread, NULL);
+		rv |= ops[y].po_rv;
+	}
+
+	free(ops);
+	return rv;
+}
+
+
 static inline int
 _do_child_levels(resource_node_t **tree, resource_t *first, void *ret,
 		 int op)
@@ -975,6 +1279,13 @@ _do_child_levels(resource_node_t **tree, resource_t *first, void *ret,
 
 	for (l = 1; l <= RESOURCE_MAX_LEVELS; l++) {
 
+		if (do_parallel(node, op)) {
+			rv |= _res_op_parallel(node, first, ret, op, l);
+			if (rv != 0 && op != RS_STOP)
+				return rv;
+			continue;
+		}
+
 		for (x = 0; rule->rr_childtypes &&
 		     rule->rr_childtypes[x].rc_name; x++) {
 
@@ -1041,6 +1352,9 @@ _do_child_default_level(resource_node_t **tree, resource_t *first,
 	resource_node_t *node = *tree, *child;
 	int y, rv = 0;
 
+	if (do_parallel(node, op))
+		return _res_op_parallel(node, first, ret, op, 0);
+
 	if (op == RS_START || op == RS_STATUS) {
 		list_for(&node->rn_child, child, y) {
 			rv |= _xx_child_internal(node, first, child, ret, op);
@@ -1086,8 +1400,11 @@ _res_op_by_level(resource_node_t **tree, resource_t *first, void *ret,
 	resource_rule_t *rule = res->r_rule;
 	int rv = 0;
 
-	if (!rule->rr_childtypes)
+	if (!rule->rr_childtypes) {
+		if (do_parallel(node, op))
+			return _res_op_parallel(node, first, ret, op, 0);
 		return _res_op(&node->rn_child, first, NULL, ret, op);
+	}
 
 	if (op == RS_START || op == RS_STATUS) {
 		rv |= _do_child_levels(tree, first, ret, op);
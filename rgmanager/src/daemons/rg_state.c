@@ -957,6 +957,8 @@ get_new_owner(const char *svcName)
 
 	swab_SmMessageSt(&msgp);
 
+	/* The other nodes answer on their workers */
+	rt_peer_wait(svcName, 1);
 	membership = member_list();
 	for (x = 0; x < membership->cml_count && ret < 0; x++) {
 
@@ -992,6 +994,7 @@ cont:
 
 out:
 	free_member_list(membership);
+	rt_peer_wait(svcName, 0);
 	
 	return ret;
 }
@@ -1577,7 +1580,9 @@ svc_start_remote(const char *svcName, int request, uint32_t target)
 
 	logt_print(LOG_DEBUG, "Sent remote-start request to %d\n", (int)target);
 
-	/* Check the response */
+	/* Check the response; the other node starts it on one of its
+	   workers, so don't hold one of ours against rgmanager's limit */
+	rt_peer_wait(svcName, 1);
 	do {
 		msg_ret = msg_receive(&ctx, &msg_relo,
 					      sizeof (SmMessageSt), 10);
@@ -1592,6 +1597,7 @@ svc_start_remote(const char *svcName, int request, uint32_t target)
 		if (rg_locked()) {
 			logt_print(LOG_WARNING,
 			       "#XX: Cancelling relocation: Shutting down\n");
+			rt_peer_wait(svcName, 0);
 			msg_close(&ctx);
 			return RG_NO;
 		}
@@ -1605,9 +1611,11 @@ svc_start_remote(const char *svcName, int request, uint32_t target)
 		logt_print(LOG_WARNING,
 		       "#XX: Cancelling relocation: Target node down\n");
 		free_member_list(ml);
+		rt_peer_wait(svcName, 0);
 		msg_close(&ctx);
 		return RG_EFAIL;
 	} while (1);
+	rt_peer_wait(svcName, 0);
 
 	if (msg_ret != sizeof (SmMessageSt)) {
 		/* 
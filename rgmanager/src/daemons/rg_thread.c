@@ -11,33 +11,53 @@
 #include <members.h>
 
 /**
- * Resource thread list entry.
+ * Resource thread list entry.  There is one for each resource group
+ * with requests queued or running.  Its requests are run one at a time,
+ * in order, by whichever worker thread picks it off the run queue; it
+ * goes away when its queue is empty.
  */
 typedef struct __resthread {
 	list_head();
-	pthread_t	rt_thread;		/** Thread identifier */
+	struct __resthread *rt_hnext;		/** Next in resthread_hash */
+	struct __resthread *rt_rnext;		/** Next on the run queue */
+	pthread_t	rt_thread;		/** Worker running a request */
 	int		rt_request;		/** Current pending operation */
-	int		rt_status;		/** Used for init */
+	int		rt_status;		/** STOPPING once exiting */
+	int		rt_queued;		/** On the run queue, or running */
+	int		rt_peerwait;		/** Worker waiting on a peer */
 	char		rt_name[256];		/** RG name */
-	request_t	**rt_queue;		/** RG event queue */
-	pthread_mutex_t	*rt_queue_mutex;	/** Mutex for event queue */
-	pthread_cond_t	*rt_queue_cond;		/** pthread cond */
+	request_t	*rt_queue;		/** RG event queue */
 } resthread_t;
 
+#define RT_HASH_SIZE		256	/* power of two */
+#define RT_WORKERS_DEFAULT	16
+#define RT_WORKER_IDLE		10	/* seconds before an idle worker exits */
 
 /**
- * Resource thread queue head.
+ * Resource thread queue head, and the same entries hashed by name.
  */
 static resthread_t *resthread_list = NULL;
+static resthread_t *resthread_hash[RT_HASH_SIZE];
 
+/**
+ * Resource threads waiting for a worker, and the workers.  Workers
+ * in rt_peerwait are waiting for another node to act on a request,
+ * and don't count against rt_max_workers (see rt_peer_wait).
+ */
+static resthread_t *run_head = NULL, *run_tail = NULL;
+static int run_len = 0;
+static int rt_workers = 0, rt_idle = 0, rt_peerwait = 0;
+static int rt_max_workers = RT_WORKERS_DEFAULT;
+
+/* reslist_mutex covers all of the above, including the request queues */
 #ifdef WRAP_LOCKS
 static pthread_mutex_t reslist_mutex = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;
 #else
 static pthread_mutex_t reslist_mutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
+static pthread_cond_t run_cond = PTHREAD_COND_INITIALIZER;
 
 static resthread_t *find_resthread_byname(const char *resgroupname);
-static int spawn_if_needed(const char *resgroupname);
 
 int central_events_enabled(void);
 
@@ -54,6 +74,9 @@ dump_threads(FILE *fp)
 
 	fprintf(fp, "Resource Group Threads \n");
 	pthread_mutex_lock(&reslist_mutex);
+	fprintf(fp, "  Workers: %d (%d idle, %d on other nodes, max %d), "
+		"%d waiting\n", rt_workers, rt_idle, rt_peerwait,
+		rt_max_workers, run_len);
 	list_for(&resthread_list, rt, x) {
 		fprintf(fp, "  %s id:%d (@ %p) processing %s request (%d)\n",
 		        rt->rt_name,
@@ -63,7 +86,7 @@ dump_threads(FILE *fp)
 			rt->rt_request);
 		if (rt->rt_queue) {
 			fprintf(fp, "    Pending requests: \n");
-			list_for(rt->rt_queue, req, y) {
+			list_for(&rt->rt_queue, req, y) {
 				fprintf(fp, "      %s tgt:%d  ctx:%p  a0:%d  a1:%d\n",
 				        rg_req_str(req->rr_request),
 					req->rr_target,
@@ -82,30 +105,23 @@ dump_threads(FILE *fp)
 }
 
 
-static int 
-wait_initialize(const char *name)
+/**
+  Set the most worker threads we will run resource group requests on.
+ */
+int
+rt_set_max_workers(int max)
 {
-	resthread_t *t;
+	int old;
 
-	while (1) {
-		pthread_mutex_lock(&reslist_mutex);
-		t = find_resthread_byname(name);
+	if (max < 1)
+		max = 1;
 
-		if (!t) {
-			pthread_mutex_unlock(&reslist_mutex);
-			return -1;
-		}
-
-		if (t->rt_status != RG_STATE_UNINITIALIZED)  {
-			pthread_mutex_unlock(&reslist_mutex);
-			return 0;
-		}
-
-		pthread_mutex_unlock(&reslist_mutex);
-		usleep(50000);
-	}
+	pthread_mutex_lock(&reslist_mutex);
+	old = rt_max_workers;
+	rt_max_workers = max;
+	pthread_mutex_unlock(&reslist_mutex);
 
-	assert(0);
+	return old;
 }
 
 
@@ -165,470 +181,548 @@ purge_all(request_t **list)
 }
 
 
-static void *
-resgroup_thread_main(void *arg)
+static resthread_t **
+resthread_bucket(const char *resgroupname)
 {
-	pthread_mutex_t my_queue_mutex;
-	pthread_cond_t my_queue_cond;
-	request_t *my_queue = NULL;
-	int newowner = 0;
-	char myname[256];
-	resthread_t *myself;
-	request_t *req;
-	int ret = RG_EFAIL, error = 0, mystatus;
-
-	rg_inc_threads();
+	const unsigned char *p;
+	uint32_t hash = 5381;
 
-	strncpy(myname, arg, 256);
-	dbg_printf("Thread %s (tid %d) starting\n",myname,gettid());
+	for (p = (const unsigned char *)resgroupname; *p; p++)
+		hash = (hash * 33) + *p;
 
-	pthread_mutex_init(&my_queue_mutex, NULL);
-	pthread_mutex_lock(&my_queue_mutex);
-	pthread_cond_init(&my_queue_cond, NULL);
+	return &resthread_hash[hash & (RT_HASH_SIZE - 1)];
+}
 
-	/*
-	 * Wait until we're inserted.  The code herein should never be 
-	 * reached.
-	 */
-	while (1) {
-		pthread_mutex_lock(&reslist_mutex);
 
-		myself = find_resthread_byname(myname);
-		if (myself)
-			break;
+/**
+ * Call with mutex locked.
+ */
+static resthread_t *
+find_resthread_byname(const char *resgroupname)
+{
+	resthread_t *curr;
 
-		pthread_mutex_unlock(&reslist_mutex);
-		usleep(250000);
+	for (curr = *resthread_bucket(resgroupname); curr;
+	     curr = curr->rt_hnext) {
+		if (!strncmp(resgroupname, curr->rt_name,
+		    sizeof(curr->rt_name)))
+			return curr;
 	}
 
-	myself->rt_queue = &my_queue;
-	myself->rt_queue_mutex = &my_queue_mutex;
-	myself->rt_queue_cond = &my_queue_cond;
-	myself->rt_status = RG_STATE_STARTED; /* Ok, we're ready to go */
-	rg_sighandler_setup();
+	return NULL;
+}
 
-	/* Wait for first event */
-	pthread_mutex_unlock(&reslist_mutex);
 
-	/* My mutex is still held */
-	pthread_cond_wait(&my_queue_cond, &my_queue_mutex);
-	pthread_mutex_unlock(&my_queue_mutex);
+/**
+ * Set up a resource thread entry.  Call with mutex locked.
+ */
+static resthread_t *
+new_resthread(const char *name)
+{
+	resthread_t *rt, **bucket;
 
-	while(1) {
-		pthread_mutex_lock(&reslist_mutex);
- 		pthread_mutex_lock(&my_queue_mutex);
-		if ((req = rq_next_request(&my_queue)) == NULL) {
-			/* We're done.  No more requests.
-			   We're about to kill our thread, so exit the
-			   loop with the lock held. */
-			break;
-		}
-		pthread_mutex_unlock(&my_queue_mutex);
-		pthread_mutex_unlock(&reslist_mutex);
+	rt = malloc(sizeof(*rt));
+	if (!rt)
+		return NULL;
+	memset(rt, 0, sizeof(*rt));
 
-		ret = RG_FAIL;
-		error = 0;
+	rt->rt_request = RG_NONE;
+	rt->rt_status = RG_STATE_STARTED;
+	strncpy(rt->rt_name, name, sizeof(rt->rt_name) - 1);
 
-		dbg_printf("Processing request %s, resource group %s\n",
-			rg_req_str(req->rr_request), myname);
+	bucket = resthread_bucket(rt->rt_name);
+	rt->rt_hnext = *bucket;
+	*bucket = rt;
+	list_insert(&resthread_list, rt);
 
-		/* find ourselves. */
-		pthread_mutex_lock(&reslist_mutex);
-		myself = find_resthread_byname(myname);
-		assert(myself);
-		myself->rt_request = req->rr_request;
-		if (req->rr_request == RG_STOP_EXITING)
-			myself->rt_status = RG_STATE_STOPPING;
-		pthread_mutex_unlock(&reslist_mutex);
+	/* rg_wait_threads() waits for the queues to drain */
+	rg_inc_threads();
 
-		switch(req->rr_request) {
-		case RG_START_REMOTE:
-		case RG_START_RECOVER:
-			error = handle_start_remote_req(myname,
-							req->rr_request);
+	return rt;
+}
+
+
+/**
+ * Done with a resource thread entry; its queue is empty.  Call with
+ * mutex locked.
+ */
+static void
+free_resthread(resthread_t *rt)
+{
+	resthread_t **bucket;
+
+	for (bucket = resthread_bucket(rt->rt_name); *bucket;
+	     bucket = &(*bucket)->rt_hnext) {
+		if (*bucket == rt) {
+			*bucket = rt->rt_hnext;
 			break;
+		}
+	}
+	list_remove(&resthread_list, rt);
 
-		case RG_ENABLE:
-			if (req->rr_target != 0 &&
-			    req->rr_target != (unsigned)my_id()) {
-				error = RG_EFORWARD;
-				ret = RG_NONE;
-				break;
-			}
-		case RG_START:
-			if (req->rr_arg0) {
-				error = handle_fd_start_req(myname,
-						req->rr_request,
-						&newowner);
-			} else {
-				error = handle_start_req(myname,
-						req->rr_request,
-						&newowner);
-			}
+	dbg_printf("RGth %s: No more requests; exiting.\n", rt->rt_name);
+	free(rt);
+
+	rg_dec_threads();
+}
+
+
+/**
+ * Run one request for a resource group, and reply to it.
+ */
+static void
+resgroup_run_request(resthread_t *rt, request_t *req)
+{
+	char *myname = rt->rt_name;
+	int newowner = 0;
+	int ret = RG_FAIL, error = 0;
+
+	dbg_printf("Processing request %s, resource group %s\n",
+		rg_req_str(req->rr_request), myname);
+
+	switch(req->rr_request) {
+	case RG_START_REMOTE:
+	case RG_START_RECOVER:
+		error = handle_start_remote_req(myname,
+						req->rr_request);
+		break;
+
+	case RG_ENABLE:
+		if (req->rr_target != 0 &&
+		    req->rr_target != (unsigned)my_id()) {
+			error = RG_EFORWARD;
+			ret = RG_NONE;
 			break;
+		}
+	case RG_START:
+		if (req->rr_arg0) {
+			error = handle_fd_start_req(myname,
+					req->rr_request,
+					&newowner);
+		} else {
+			error = handle_start_req(myname,
+					req->rr_request,
+					&newowner);
+		}
+		break;
 
-		case RG_RELOCATE:
-			/* Relocate requests are user requests and must be
-			   forwarded */
-			error = handle_relocate_req(myname, RG_START_REMOTE,
+	case RG_RELOCATE:
+		/* Relocate requests are user requests and must be
+		   forwarded */
+		error = handle_relocate_req(myname, RG_START_REMOTE,
    						    req->rr_target,
    						    &newowner);
-			if (error == RG_EFORWARD)
-				ret = RG_NONE;
-			break;
+		if (error == RG_EFORWARD)
+			ret = RG_NONE;
+		break;
 
-		case RG_MIGRATE:
-			error = svc_migrate(myname, req->rr_target);
+	case RG_MIGRATE:
+		error = svc_migrate(myname, req->rr_target);
 
-			if (error == 0) {
-				ret = RG_SUCCESS;
+		if (error == 0) {
+			ret = RG_SUCCESS;
 
-				pthread_mutex_lock(&my_queue_mutex);
-				purge_status_checks(&my_queue);
-				pthread_mutex_unlock(&my_queue_mutex);
-			} else if (error == RG_EFORWARD) {
-				ret = RG_NONE;
-				break;
-			} else {
-				/*
-				 * Bad news. 
-				 */
-				ret = RG_EFAIL;
-			}
+			pthread_mutex_lock(&reslist_mutex);
+			purge_status_checks(&rt->rt_queue);
+			pthread_mutex_unlock(&reslist_mutex);
+		} else if (error == RG_EFORWARD) {
+			ret = RG_NONE;
 			break;
+		} else {
+			/*
+			 * Bad news. 
+			 */
+			ret = RG_EFAIL;
+		}
+		break;
 
-		case RG_INIT:
-			/* Stop without changing shared state of it */
-			error = group_op(myname, RG_STOP);
+	case RG_INIT:
+		/* Stop without changing shared state of it */
+		error = group_op(myname, RG_STOP);
 
-			pthread_mutex_lock(&my_queue_mutex);
-			purge_all(&my_queue);
-			pthread_mutex_unlock(&my_queue_mutex);
+		pthread_mutex_lock(&reslist_mutex);
+		purge_all(&rt->rt_queue);
+		pthread_mutex_unlock(&reslist_mutex);
 
-			if (error == 0)
-				ret = RG_SUCCESS;
-			else
-				ret = RG_EFAIL;
+		if (error == 0)
+			ret = RG_SUCCESS;
+		else
+			ret = RG_EFAIL;
+		break;
+
+	case RG_CONDSTOP:
+		/* CONDSTOP doesn't change RG state by itself */
+		group_op(myname, RG_CONDSTOP);
+		break;
+
+	case RG_CONDSTART:
+		/* CONDSTART doesn't change RG state by itself */
+		group_op(myname, RG_CONDSTART);
+		break;
+
+	case RG_STOP:
+	case RG_STOP_USER:
+		/* Disable and user stop requests need to be
+		   forwarded; they're user requests */
+		error = svc_stop(myname, req->rr_request);
+
+		if (error == 0) {
+			ret = RG_SUCCESS;
+
+			pthread_mutex_lock(&reslist_mutex);
+			purge_status_checks(&rt->rt_queue);
+			pthread_mutex_unlock(&reslist_mutex);
+		} else if (error == RG_EFORWARD) {
+			ret = RG_NONE;
 			break;
+		} else {
+			/*
+			 * Bad news. 
+			 */
+			ret = RG_EFAIL;
+		}
 
-		case RG_CONDSTOP:
-			/* CONDSTOP doesn't change RG state by itself */
-			group_op(myname, RG_CONDSTOP);
-			break;
+		break;
+
+	case RG_STOP_EXITING:
+		/* We're out of here. Don't allow starts anymore */
+		error = svc_stop(myname, RG_STOP);
 
-		case RG_CONDSTART:
-			/* CONDSTART doesn't change RG state by itself */
-			group_op(myname, RG_CONDSTART);
+		if (error == 0) {
+			ret = RG_SUCCESS;
+
+		} else if (error == RG_EFORWARD) {
+			ret = RG_NONE;
 			break;
+		} else {
+			/*
+			 * Bad news. 
+			 */
+			ret = RG_EFAIL;
+		}
 
-		case RG_STOP:
-		case RG_STOP_USER:
-			/* Disable and user stop requests need to be
-			   forwarded; they're user requests */
-			error = svc_stop(myname, req->rr_request);
+		pthread_mutex_lock(&reslist_mutex);
+		purge_all(&rt->rt_queue);
+		pthread_mutex_unlock(&reslist_mutex);
 
-			if (error == 0) {
-				ret = RG_SUCCESS;
+		break;
 
-				pthread_mutex_lock(&my_queue_mutex);
-				purge_status_checks(&my_queue);
-				pthread_mutex_unlock(&my_queue_mutex);
-			} else if (error == RG_EFORWARD) {
-				ret = RG_NONE;
-				break;
-			} else {
-				/*
-				 * Bad news. 
-				 */
-				ret = RG_EFAIL;
-			}
 
+	case RG_DISABLE:
+		/* Disable and user stop requests need to be
+		   forwarded; they're user requests */
+		error = svc_disable(myname);
+
+		if (error == 0) {
+			ret = RG_SUCCESS;
+
+			pthread_mutex_lock(&reslist_mutex);
+			purge_status_checks(&rt->rt_queue);
+			pthread_mutex_unlock(&reslist_mutex);
+		} else if (error == RG_EFORWARD) {
+			ret = RG_NONE;
 			break;
+		} else {
+			/*
+			 * Bad news. 
+			 */
+			ret = RG_EFAIL;
+		}
 
-		case RG_STOP_EXITING:
-			/* We're out of here. Don't allow starts anymore */
-			error = svc_stop(myname, RG_STOP);
+		break;
 
-			if (error == 0) {
-				ret = RG_SUCCESS;
+	case RG_RESTART:
+		error = svc_stop(myname, RG_STOP_USER);
 
-			} else if (error == RG_EFORWARD) {
-				ret = RG_NONE;
-				break;
-			} else {
-				/*
-				 * Bad news. 
-				 */
-				ret = RG_EFAIL;
-			}
+		if (error == 0) {
+			pthread_mutex_lock(&reslist_mutex);
+			purge_status_checks(&rt->rt_queue);
+			pthread_mutex_unlock(&reslist_mutex);
 
-			pthread_mutex_lock(&my_queue_mutex);
-			purge_all(&my_queue);
-			pthread_mutex_unlock(&my_queue_mutex);
+			error = handle_start_req(myname,
+						 req->rr_request,
+						 &newowner);
+			break;
 
+		} else if (error == RG_EFORWARD) {
+			ret = RG_NONE;
 			break;
+		} else {
+			/*
+			 * Bad news. 
+			 */
+			ret = RG_EFAIL;
+		}
 
+		break;
 
-		case RG_DISABLE:
-			/* Disable and user stop requests need to be
-			   forwarded; they're user requests */
-			error = svc_disable(myname);
+	case RG_STATUS:
+		if (!(rg_initialized()&FL_CONFIG)) {
+			ret = RG_SUCCESS;
+			break;
+		}
+		/* Need to make sure we don't check status of
+		   resource groups we don't own */
+		error = svc_status(myname);
 
-			if (error == 0) {
-				ret = RG_SUCCESS;
+		/* Recover dead service */
+		if (error == 0) {
+			ret = RG_SUCCESS;
+			break;
+		}
 
-				pthread_mutex_lock(&my_queue_mutex);
-				purge_status_checks(&my_queue);
-				pthread_mutex_unlock(&my_queue_mutex);
-			} else if (error == RG_EFORWARD) {
-				ret = RG_NONE;
+		error = svc_stop(myname, RG_STOP_RECOVER);
+		if (error == 0) {
+			/* Stop generates an event - whatever the
+			   result.  If central events are enabled
+			   don't bother trying to recover */
+			if (central_events_enabled())
 				break;
-			} else {
-				/*
-				 * Bad news. 
-				 */
-				ret = RG_EFAIL;
-			}
+			error = handle_recover_req(myname, &newowner);
+			if (error == 0)
+				ret = RG_SUCCESS;
+		}
 
-			break;
+		break;
+
+	case RG_FREEZE:
+		error = svc_freeze(myname);
+		if (error != 0)
+			ret = RG_EFAIL;
+		break;
+
+	case RG_UNFREEZE:
+		error = svc_unfreeze(myname);
+		if (error != 0)
+			ret = RG_EFAIL;
+		break;
+
+	case RG_STATUS_INQUIRY:
+		error = svc_status_inquiry(myname);
+
+		if (error == 0) {
+			ret = RG_SUCCESS;
+			newowner = my_id();
+		} else {
+			ret = RG_EFAIL;
+			newowner = -1;
+		}
 
-		case RG_RESTART:
-			error = svc_stop(myname, RG_STOP_USER);
+		break;
 
-			if (error == 0) {
-				pthread_mutex_lock(&my_queue_mutex);
-				purge_status_checks(&my_queue);
-				pthread_mutex_unlock(&my_queue_mutex);
+	default:
+		printf("Unhandled request %d\n", req->rr_request);
+		ret = RG_NONE;
+		break;
+	}
 
-				error = handle_start_req(myname,
-							 req->rr_request,
-							 &newowner);
-				break;
+	pthread_mutex_lock(&reslist_mutex);
+	rt->rt_request = RG_NONE;
+	pthread_mutex_unlock(&reslist_mutex);
 
-			} else if (error == RG_EFORWARD) {
-				ret = RG_NONE;
-				break;
-			} else {
-				/*
-				 * Bad news. 
-				 */
-				ret = RG_EFAIL;
-			}
+	if (error == RG_EFORWARD) {
+		/* Forward_request frees this and closes the
+		   file descriptor, so we can just move on
+		   with life. */
+		forward_request(req);
+		return;
+	}
 
-			break;
+	if (ret != RG_NONE && rg_initialized() &&
+	    (req->rr_resp_ctx)) {
+		send_response(error, newowner, req);
+		msg_close(req->rr_resp_ctx);
+		msg_free_ctx(req->rr_resp_ctx);
+	}
+	
+	rq_free(req);
+}
 
-		case RG_STATUS:
-			if (!(rg_initialized()&FL_CONFIG)) {
-				ret = RG_SUCCESS;
-				break;
-			}
-			/* Need to make sure we don't check status of
-			   resource groups we don't own */
-			error = svc_status(myname);
 
-			/* Recover dead service */
-			if (error == 0) {
-				ret = RG_SUCCESS;
-				break;
-			}
+static void rt_wake(void);
 
-			error = svc_stop(myname, RG_STOP_RECOVER);
-			if (error == 0) {
-				/* Stop generates an event - whatever the
-				   result.  If central events are enabled
-				   don't bother trying to recover */
-				if (central_events_enabled())
-					break;
-				error = handle_recover_req(myname, &newowner);
-				if (error == 0)
-					ret = RG_SUCCESS;
-			}
 
-			break;
+/**
+ * Called with waiting set before a request for a resource group waits
+ * for another node to act on it, which the other node does on one of
+ * its own workers, and with waiting clear afterward.  Relocations (and
+ * starts and recoveries which fall back to relocating) do so until the
+ * other node has started the service.  If the waiting workers counted
+ * against rt_max_workers, two nodes relocating enough services to each
+ * other would each wait for the other forever.
+ *
+ * Does nothing unless the caller is the worker running the request,
+ * so other threads may call it too.
+ */
+void
+rt_peer_wait(const char *resgroupname, int waiting)
+{
+	resthread_t *rt;
 
-		case RG_FREEZE:
-			error = svc_freeze(myname);
-			if (error != 0)
-				ret = RG_EFAIL;
-			break;
+	pthread_mutex_lock(&reslist_mutex);
+	rt = find_resthread_byname(resgroupname);
+	if (!rt || !rt->rt_thread ||
+	    !pthread_equal(rt->rt_thread, pthread_self()) ||
+	    rt->rt_peerwait == !!waiting) {
+		pthread_mutex_unlock(&reslist_mutex);
+		return;
+	}
 
-		case RG_UNFREEZE:
-			error = svc_unfreeze(myname);
-			if (error != 0)
-				ret = RG_EFAIL;
-			break;
+	rt->rt_peerwait = !!waiting;
+	if (waiting) {
+		++rt_peerwait;
+		/* Let someone else have our place */
+		if (run_head)
+			rt_wake();
+	} else {
+		--rt_peerwait;
+	}
+	pthread_mutex_unlock(&reslist_mutex);
+}
 
-		case RG_STATUS_INQUIRY:
-			error = svc_status_inquiry(myname);
 
-			if (error == 0) {
-				ret = RG_SUCCESS;
-				newowner = my_id();
-			} else {
-				ret = RG_EFAIL;
-				newowner = -1;
-			}
+static void *
+rt_worker_main(void __attribute__ ((unused)) *arg)
+{
+	resthread_t *rt;
+	request_t *req;
+	struct timespec ts;
+	int ret;
 
-			break;
+	dbg_printf("Worker (tid %d) starting\n", gettid());
+	rg_sighandler_setup();
 
-		default:
-			printf("Unhandled request %d\n", req->rr_request);
-			ret = RG_NONE;
-			break;
-		}
+	pthread_mutex_lock(&reslist_mutex);
+	while (1) {
+		while (!run_head) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += RT_WORKER_IDLE;
 
-		pthread_mutex_lock(&reslist_mutex);
-		myself = find_resthread_byname(myname);
-		myself->rt_request = RG_NONE;
-		pthread_mutex_unlock(&reslist_mutex);
+			++rt_idle;
+			ret = pthread_cond_timedwait(&run_cond, &reslist_mutex,
+						     &ts);
+			--rt_idle;
 
-		if (error == RG_EFORWARD) {
-			/* Forward_request frees this and closes the
-			   file descriptor, so we can just move on
-			   with life. */
-			forward_request(req);
-			continue;
+			if (ret == ETIMEDOUT && !run_head)
+				goto out;
 		}
 
-		if (ret != RG_NONE && rg_initialized() &&
-		    (req->rr_resp_ctx)) {
-			send_response(error, newowner, req);
-			msg_close(req->rr_resp_ctx);
-			msg_free_ctx(req->rr_resp_ctx);
+		rt = run_head;
+		run_head = rt->rt_rnext;
+		if (!run_head)
+			run_tail = NULL;
+		rt->rt_rnext = NULL;
+		--run_len;
+
+		req = rq_next_request(&rt->rt_queue);
+		if (!req) {
+			/* Purged while it was waiting */
+			free_resthread(rt);
+			continue;
 		}
-		
-		rq_free(req);
-	}
 
-	/* reslist_mutex and my_queue_mutex held */
-	myself = find_resthread_byname(myname);
+		rt->rt_thread = pthread_self();
+		rt->rt_request = req->rr_request;
+		if (req->rr_request == RG_STOP_EXITING)
+			rt->rt_status = RG_STATE_STOPPING;
+		pthread_mutex_unlock(&reslist_mutex);
 
-	if (!myself) {
-		dbg_printf("I don't exist...\n");
-		raise(SIGSEGV);
-	}
+		resgroup_run_request(rt, req);
 
-	mystatus = pthread_mutex_destroy(&my_queue_mutex);
-	if (mystatus != 0)
-	{
-		if (mystatus == EBUSY) {
-			pthread_mutex_unlock(&my_queue_mutex);
+		pthread_mutex_lock(&reslist_mutex);
+		if (rt->rt_peerwait) {
+			/* Missing rt_peer_wait(name, 0) */
+			rt->rt_peerwait = 0;
+			--rt_peerwait;
 		}
-
-		mystatus = pthread_mutex_destroy(&my_queue_mutex);
-		if (mystatus != 0) {
-			fprintf (stderr, "mutex_destroy=%d err=%d %p\n", 
-			    mystatus, errno, &my_queue_mutex);
-
-			fflush (stderr);
+		rt->rt_thread = 0;
+		if (!rt->rt_queue) {
+			free_resthread(rt);
+			continue;
 		}
-	}
 
-	list_remove(&resthread_list, myself);
-	free(myself);
+		/* More to do; go to the back so others get a turn */
+		if (run_tail)
+			run_tail->rt_rnext = rt;
+		else
+			run_head = rt;
+		run_tail = rt;
+		++run_len;
+	}
 
+out:
+	--rt_workers;
 	pthread_mutex_unlock(&reslist_mutex);
 
-	dbg_printf("RGth %s (tid %d): No more requests"
-		"; exiting.\n", myname, gettid());
-
-	/* Thread's outta here */
-	rg_dec_threads();
-	pthread_exit((void *)NULL);
+	dbg_printf("Worker (tid %d) idle; exiting.\n", gettid());
+	pthread_exit(NULL);
 }
 
 
 /**
- * Start a resgroup thread.
+ * Start another worker.  Call with mutex locked.
  */
 static int
-spawn_resgroup_thread(const char *name)
+spawn_worker(void)
 {
         pthread_attr_t attrs;
-	resthread_t *newthread = NULL;
-	int ret = 0;
+	pthread_t thread;
+	int ret;
 
         pthread_attr_init(&attrs);
         pthread_attr_setinheritsched(&attrs, PTHREAD_INHERIT_SCHED);
         pthread_attr_setdetachstate(&attrs, PTHREAD_CREATE_DETACHED);
 
-	newthread = malloc(sizeof(*newthread));
-	if (!newthread)
-		return -1;
-	memset(newthread, 0, sizeof(*newthread));
-
-	newthread->rt_status = RG_STATE_UNINITIALIZED;
-	strncpy(newthread->rt_name, name, sizeof(newthread->rt_name));
-
-	ret = pthread_create(&newthread->rt_thread, &attrs,
-			     resgroup_thread_main, (void *)name);
+	ret = pthread_create(&thread, &attrs, rt_worker_main, NULL);
 	pthread_attr_destroy(&attrs);
 
-	if (ret != 0) {
-		free(newthread);
-		return ret;
-	}
+	if (ret == 0)
+		++rt_workers;
 
-	list_insert(&resthread_list, newthread);
-
-	return 0;
+	return ret;
 }
 
 
 /**
-  Spawn a resource group thread if necessary
+ * Make sure there is a worker to pick up what is on the run queue,
+ * within rt_max_workers.  Call with mutex locked.
  */
-int
-spawn_if_needed(const char *resgroupname)
+static void
+rt_wake(void)
 {
-	int ret;
-	resthread_t *resgroup = NULL;
-
-retry:
-	resgroup = NULL;
-	pthread_mutex_lock(&reslist_mutex);
-	while (resgroup == NULL) {
-		resgroup = find_resthread_byname(resgroupname);
-		if (resgroup != NULL)
-			break;
-
-		ret = spawn_resgroup_thread(resgroupname);
-		if (ret == 0)
-			continue;
-		pthread_mutex_unlock(&reslist_mutex);
-
-		return ret;
-	}
-
-	ret = (resgroup->rt_status == RG_STATE_STOPPING);
-
-	pthread_mutex_unlock(&reslist_mutex);
-	if (!ret && wait_initialize(resgroupname) < 0) {
-		goto retry;
-	}
+	if (rt_idle)
+		pthread_cond_signal(&run_cond);
+	if (run_len <= rt_idle ||
+	    rt_workers - rt_peerwait >= rt_max_workers)
+		return;
 
-	return ret;
+	if (spawn_worker() != 0 && !rt_workers)
+		/* The next one to queue a request will try again */
+		fprintf(stderr, "Failed to start a worker: %s\n",
+			strerror(errno));
 }
 
 
 /**
- * Call with mutex locked.
+ * Put a resource thread on the run queue, if it isn't there or running
+ * already, and make sure there is a worker to pick it up.  Call with
+ * mutex locked.
  */
-static resthread_t *
-find_resthread_byname(const char *resgroupname)
+static void
+rt_schedule(resthread_t *rt)
 {
-	resthread_t *curr = NULL;
-
-	if (!resthread_list)
-		return NULL;
+	if (rt->rt_queued)
+		return;
 
-	list_do(&resthread_list, curr) {
-		if (!strncmp(resgroupname, curr->rt_name,
-		    sizeof(curr->rt_name)))
-			return curr;
-	} while (!list_done(&resthread_list, curr));
+	rt->rt_queued = 1;
+	if (run_tail)
+		run_tail->rt_rnext = rt;
+	else
+		run_head = rt;
+	run_tail = rt;
+	++run_len;
 
-	return NULL;
+	rt_wake();
 }
 
 
@@ -654,20 +748,24 @@ rt_enqueue_request(const char *resgroupname, int request,
    		   int max, uint32_t target, int arg0, int arg1)
 {
 	request_t *curr;
-	int count = 0, ret;
+	int count = 0, ret, created = 0;
 	resthread_t *resgroup;
 
-	if (spawn_if_needed(resgroupname) != 0) {
-		/* Usually, we get here if the thread is killing
-		   stuff.  This prevents us from queueing START requests
-		   while we're exiting */
-		return -1;
-	}
-
 	pthread_mutex_lock(&reslist_mutex);
 	resgroup = find_resthread_byname(resgroupname);
 	if (resgroup == NULL) {
-		/* DOOOOM */
+		resgroup = new_resthread(resgroupname);
+		if (resgroup == NULL) {
+			/* DOOOOM */
+			pthread_mutex_unlock(&reslist_mutex);
+			return -1;
+		}
+		created = 1;
+	}
+
+	if (resgroup->rt_status == RG_STATE_STOPPING) {
+		/* This prevents us from queueing START requests
+		   while we're exiting */
 		pthread_mutex_unlock(&reslist_mutex);
 		return -1;
 	}
@@ -676,21 +774,18 @@ rt_enqueue_request(const char *resgroupname, int request,
 	if (resgroup->rt_request == request)
 		count++;
 
-	pthread_mutex_lock(resgroup->rt_queue_mutex);
-
 	if (request == RG_INIT) {
 		/* If we're initializing it, zap the queue if there
 		   is one */
-		purge_all(resgroup->rt_queue);
+		purge_all(&resgroup->rt_queue);
 	} else {
 		if (max) {
-			list_do(resgroup->rt_queue, curr) {
+			list_do(&resgroup->rt_queue, curr) {
 				if ((int)curr->rr_request == request)
 					count++;
-			} while (!list_done(resgroup->rt_queue, curr));
+			} while (!list_done(&resgroup->rt_queue, curr));
 	
 			if (count >= max) {
-				pthread_mutex_unlock(resgroup->rt_queue_mutex);
 				pthread_mutex_unlock(&reslist_mutex);
 				/*
 				 * Maximum reached.
@@ -717,16 +812,18 @@ rt_enqueue_request(const char *resgroupname, int request,
 		}
 		fprintf(stderr, "Failed to queue request: Would block\n");
 		/* EWOULDBLOCK */
-		pthread_mutex_unlock(resgroup->rt_queue_mutex);
 		pthread_mutex_unlock(&reslist_mutex);
 		return ret;
 	}
 
-	ret = rq_queue_request(resgroup->rt_queue, resgroup->rt_name,
+	ret = rq_queue_request(&resgroup->rt_queue, resgroup->rt_name,
 			       request, 0, 0, response_ctx, 0, target,
 			       arg0, arg1);
-	pthread_cond_broadcast(resgroup->rt_queue_cond);
-	pthread_mutex_unlock(resgroup->rt_queue_mutex);
+	if (ret == 0)
+		rt_schedule(resgroup);
+	else if (created && !resgroup->rt_queue)
+		/* Nothing will ever run it, or free it */
+		free_resthread(resgroup);
 	pthread_mutex_unlock(&reslist_mutex);
 
 	if (ret < 0)
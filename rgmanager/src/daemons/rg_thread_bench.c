@@ -0,0 +1,482 @@
+/*
+ * Drive rt_enqueue_request() with storms of status checks, starts and
+ * stops across a lot of services at once, the way groups.c does when
+ * the status poll comes around or a node joins or leaves, and report
+ * how long queueing and draining take.
+ *
+ * The service operations are simulated: each one sleeps for a while.
+ * Requests for one service must never run at the same time, and must
+ * run in the order they were queued; every request which was queued
+ * must run exactly once.  Exits non-zero if any did not.
+ *
+ * A relocation waits for a start queued as "peer:<service>", standing
+ * in for the one the target node runs on its own workers, as
+ * svc_start_remote() does.  If the relocations could use up every
+ * worker, the relocate storm would never finish; nor would the storm
+ * of starts which fail and fall back to relocating.
+ */
+#include "rg_thread.c"
+
+#include <getopt.h>
+#include <time.h>
+
+static pthread_mutex_t bench_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bench_cond = PTHREAD_COND_INITIALIZER;
+static int threads;		/* resource thread entries, as rg_locks.c */
+
+static int num_services = 400;
+static int op_usec = 200;
+static int storms = 10;
+
+static int *running;		/* per service; must never pass 1 */
+static int *last_op;		/* per service; last request run */
+static int *peer_started;	/* per service; by the "other node" */
+static int processed, overlaps, peak_workers;
+static int fail_starts;		/* starts fall back to relocating */
+
+/* rg_locks.c */
+int
+rg_inc_threads(void)
+{
+	pthread_mutex_lock(&bench_mutex);
+	++threads;
+	pthread_mutex_unlock(&bench_mutex);
+	return 0;
+}
+
+
+int
+rg_dec_threads(void)
+{
+	pthread_mutex_lock(&bench_mutex);
+	if (--threads == 0)
+		pthread_cond_broadcast(&bench_cond);
+	pthread_mutex_unlock(&bench_mutex);
+	return 0;
+}
+
+
+int
+rg_wait_threads(void)
+{
+	pthread_mutex_lock(&bench_mutex);
+	while (threads)
+		pthread_cond_wait(&bench_cond, &bench_mutex);
+	pthread_mutex_unlock(&bench_mutex);
+	return 0;
+}
+
+
+int
+rg_initialized(void)
+{
+	return FL_INIT | FL_CONFIG;
+}
+
+
+int
+my_id(void)
+{
+	return 1;
+}
+
+
+int
+central_events_enabled(void)
+{
+	return 0;
+}
+
+
+void
+send_response(int ret, int node, request_t *req)
+{
+}
+
+
+void
+send_ret(msgctx_t *ctx, char *name, int ret, int orig_request,
+	 int new_owner)
+{
+}
+
+
+void
+forward_request(request_t *req)
+{
+	rq_free(req);
+}
+
+
+int
+msg_close(msgctx_t *ctx)
+{
+	return 0;
+}
+
+
+void
+msg_free_ctx(msgctx_t *ctx)
+{
+}
+
+
+static int
+simulate(const char *name, int op)
+{
+	int svc = atoi(name + 8);	/* "service:%d" */
+
+	pthread_mutex_lock(&bench_mutex);
+	if (++running[svc] > 1)
+		++overlaps;
+	pthread_mutex_unlock(&bench_mutex);
+
+	pthread_mutex_lock(&reslist_mutex);
+	if (rt_workers > peak_workers)
+		peak_workers = rt_workers;
+	pthread_mutex_unlock(&reslist_mutex);
+
+	if (op_usec)
+		usleep(op_usec);
+
+	pthread_mutex_lock(&bench_mutex);
+	--running[svc];
+	last_op[svc] = op;
+	++processed;
+	pthread_mutex_unlock(&bench_mutex);
+
+	return 0;
+}
+
+
+/* As svc_start_remote(): wait for the "other node" to start it */
+static int
+start_remote(char *svcName)
+{
+	char name[64];
+	int svc = atoi(svcName + 8);
+
+	snprintf(name, sizeof(name), "peer:%s", svcName);
+	if (rt_enqueue_request(name, RG_START_REMOTE, NULL, 0, 0, 0, 0) < 0)
+		return RG_EFAIL;
+
+	rt_peer_wait(svcName, 1);
+	pthread_mutex_lock(&bench_mutex);
+	while (!peer_started[svc])
+		pthread_cond_wait(&bench_cond, &bench_mutex);
+	peer_started[svc] = 0;
+	pthread_mutex_unlock(&bench_mutex);
+	rt_peer_wait(svcName, 0);
+
+	return 0;
+}
+
+
+/* service_op.c, rg_state.c, groups.c */
+int
+handle_start_req(char *svcName, int req, int *new_owner)
+{
+	int ret;
+
+	*new_owner = my_id();
+	ret = simulate(svcName, RG_START);
+	if (fail_starts)
+		/* Failed here; relocate it */
+		return start_remote(svcName);
+	return ret;
+}
+
+
+int
+handle_fd_start_req(char *svcName, int req, int *new_owner)
+{
+	return handle_start_req(svcName, req, new_owner);
+}
+
+
+int
+handle_recover_req(char *svcName, int *new_owner)
+{
+	return handle_start_req(svcName, RG_START_RECOVER, new_owner);
+}
+
+
+int
+handle_start_remote_req(char *svcName, int req)
+{
+	if (strncmp(svcName, "peer:", 5))
+		return simulate(svcName, RG_START);
+
+	pthread_mutex_lock(&bench_mutex);
+	peer_started[atoi(svcName + 13)] = 1;	/* "peer:service:%d" */
+	pthread_cond_broadcast(&bench_cond);
+	pthread_mutex_unlock(&bench_mutex);
+	return 0;
+}
+
+
+int
+handle_relocate_req(char *svcName, int request, int preferred_target,
+		    int *new_owner)
+{
+	if (start_remote(svcName) != 0)
+		return RG_EFAIL;
+
+	*new_owner = preferred_target;
+	return simulate(svcName, RG_RELOCATE);
+}
+
+
+int
+group_op(const char *rgname, int op)
+{
+	return simulate(rgname, op);
+}
+
+
+int
+svc_stop(const char *svcName, int error)
+{
+	return simulate(svcName, RG_STOP);
+}
+
+
+int
+svc_status(const char *svcName)
+{
+	return simulate(svcName, RG_STATUS);
+}
+
+
+int
+svc_status_inquiry(const char *svcName)
+{
+	return simulate(svcName, RG_STATUS_INQUIRY);
+}
+
+
+int
+svc_disable(const char *svcName)
+{
+	return simulate(svcName, RG_DISABLE);
+}
+
+
+int
+svc_freeze(const char *svcName)
+{
+	return simulate(svcName, RG_FREEZE);
+}
+
+
+int
+svc_unfreeze(const char *svcName)
+{
+	return simulate(svcName, RG_UNFREEZE);
+}
+
+
+int
+svc_migrate(const char *svcName, int target)
+{
+	return simulate(svcName, RG_MIGRATE);
+}
+
+
+static uint64_t
+now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * Queue one request of the given type for every service, times times,
+ * and wait for the lot to run.  Returns the number of requests queued.
+ */
+static int
+storm(const char *what, int request, int max, int times)
+{
+	char name[64];
+	int i, n, ret, queued = 0, dropped = 0;
+	uint64_t begin, enqueued, done;
+
+	pthread_mutex_lock(&bench_mutex);
+	processed = 0;
+	pthread_mutex_unlock(&bench_mutex);
+
+	begin = now_nsec();
+	for (n = 0; n < times; n++) {
+		for (i = 0; i < num_services; i++) {
+			snprintf(name, sizeof(name), "service:%d", i);
+			ret = rt_enqueue_request(name, request, NULL, max,
+						 0, 0, 0);
+			if (ret == 0)
+				++queued;
+			else if (ret == 1)
+				++dropped;
+		}
+	}
+	enqueued = now_nsec();
+	rg_wait_threads();
+	done = now_nsec();
+
+	printf("%-12s %8d %8d %10.1f %10.3f\n", what, queued, dropped,
+	       (double)(enqueued - begin) / (queued + dropped),
+	       (double)(done - begin) / 1000000000);
+	return queued;
+}
+
+
+static void
+usage(char *prog, FILE *file)
+{
+	fprintf(file, "Usage:\n");
+	fprintf(file, "%s [sonwdh]\n", prog);
+	fprintf(file, "\n");
+	fprintf(file, "   -h           show this help information\n");
+	fprintf(file, "   -s <num>     number of services (default 400)\n");
+	fprintf(file, "   -o <usec>    time each operation takes (default 200)\n");
+	fprintf(file, "   -n <num>     status checks queued per service (default 10)\n");
+	fprintf(file, "   -w <num>     most worker threads (default %d)\n",
+		RT_WORKERS_DEFAULT);
+	fprintf(file, "   -d           dump the threads while the last storm runs\n");
+	fprintf(file, "\n");
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	char name[64];
+	int optchar, dump = 0, bad = 0;
+	int i, queued;
+
+	while ((optchar = getopt(argc, argv, "s:o:n:w:dh")) != EOF) {
+		switch (optchar) {
+		case 's':
+			num_services = atoi(optarg);
+			break;
+		case 'o':
+			op_usec = atoi(optarg);
+			break;
+		case 'n':
+			storms = atoi(optarg);
+			break;
+		case 'w':
+			rt_set_max_workers(atoi(optarg));
+			break;
+		case 'd':
+			dump = 1;
+			break;
+		case 'h':
+			usage(argv[0], stdout);
+			exit(0);
+		default:
+			usage(argv[0], stderr);
+			exit(1);
+		}
+	}
+
+	if (num_services < 1 || op_usec < 0 || storms < 1) {
+		usage(argv[0], stderr);
+		exit(1);
+	}
+
+	running = calloc(num_services, sizeof(int));
+	last_op = calloc(num_services, sizeof(int));
+	peer_started = calloc(num_services, sizeof(int));
+	if (!running || !last_op || !peer_started) {
+		perror("calloc");
+		return 1;
+	}
+
+	printf("%d services, %d usec per operation, %d workers max\n",
+	       num_services, op_usec, rt_max_workers);
+	printf("storm          queued  dropped    ns/call    drain s\n");
+
+	/* Only one status check is ever waiting for a service */
+	queued = storm("status", RG_STATUS, 1, storms);
+	if (processed != queued) {
+		fprintf(stderr, "status: %d queued, %d run\n",
+			queued, processed);
+		++bad;
+	}
+
+	queued = storm("start", RG_START, 0, 1);
+	if (processed != queued) {
+		fprintf(stderr, "start: %d queued, %d run\n",
+			queued, processed);
+		++bad;
+	}
+
+	queued = storm("stop", RG_STOP, 0, 1);
+	if (processed != queued) {
+		fprintf(stderr, "stop: %d queued, %d run\n",
+			queued, processed);
+		++bad;
+	}
+
+	/* Needs more workers than the most we run, for the peer starts */
+	queued = storm("relocate", RG_RELOCATE, 0, 1);
+	if (processed != queued) {
+		fprintf(stderr, "relocate: %d queued, %d run\n",
+			queued, processed);
+		++bad;
+	}
+
+	fail_starts = 1;
+	queued = storm("failed start", RG_START, 0, 1);
+	fail_starts = 0;
+	if (processed != queued) {
+		fprintf(stderr, "failed start: %d queued, %d run\n",
+			queued, processed);
+		++bad;
+	}
+
+	/* Starts, status checks and stops queued together run in order */
+	pthread_mutex_lock(&bench_mutex);
+	processed = 0;
+	pthread_mutex_unlock(&bench_mutex);
+	queued = 0;
+	for (i = 0; i < num_services; i++) {
+		snprintf(name, sizeof(name), "service:%d", i);
+		queued += !rt_enqueue_request(name, RG_START, NULL, 0, 0, 0, 0);
+		queued += !rt_enqueue_request(name, RG_STATUS, NULL, 1, 0, 0, 0);
+		queued += !rt_enqueue_request(name, RG_STOP, NULL, 0, 0, 0, 0);
+	}
+	if (dump)
+		dump_threads(stdout);
+	rg_wait_threads();
+
+	if (processed != queued) {
+		fprintf(stderr, "mixed: %d queued, %d run\n",
+			queued, processed);
+		++bad;
+	}
+	for (i = 0; i < num_services; i++) {
+		if (last_op[i] != RG_STOP) {
+			fprintf(stderr, "service:%d: last ran %s, not stop\n",
+				i, rg_req_str(last_op[i]));
+			++bad;
+			break;
+		}
+	}
+
+	if (overlaps) {
+		fprintf(stderr, "%d requests ran alongside another for "
+			"the same service\n", overlaps);
+		++bad;
+	}
+
+	printf("peak workers %d\n", peak_workers);
+	printf("%d errors\n", bad);
+
+	free(peer_started);
+	free(last_op);
+	free(running);
+	return bad ? 1 : 0;
+}
@@ -78,6 +78,11 @@ out_unlock:
 	"\t\tstop <type> <resource>\n" \
 	"\n"
 
+#define USAGE_TIME \
+	"\ttime <configfile> [args..]\n" \
+	"\t\tAs test, then print how long each resource agent took\n" \
+	"\n"
+
 #define USAGE_DELTA \
 	"\tdelta <configfile1> <configfile2>\n\n"
 
@@ -385,6 +390,7 @@ usage(char *arg0)
 {
 	printf("usage: %s [agent_path] <args..>\n\n", arg0);
 	printf(USAGE_TEST);
+	printf(USAGE_TIME);
 	printf(USAGE_DELTA);
 	printf(USAGE_RULES);
 
@@ -410,6 +416,13 @@ main(int argc, char **argv)
 			shift();
 			ret = test_func(argc, argv);
 			goto out;
+		} else if (!strcmp(argv[1], "time")) {
+			shift();
+			res_trace_enable(1);
+			ret = test_func(argc, argv);
+			dump_res_trace(stdout);
+			res_trace_enable(0);
+			goto out;
 		} else if (!strcmp(argv[1], "noop")) {
 			shift();
 			_no_op_mode(1);
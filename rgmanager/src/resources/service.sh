@@ -212,6 +212,24 @@ meta_data()
 	    <content type="integer" default="0"/>
 	</parameter>
 
+	<parameter name="parallel">
+	    <longdesc lang="en">
+		If set, resources in this service which have no ordering
+		between them are started and stopped at the same time
+		instead of one after another.  Resources are still started
+		and stopped in the order given by their types (file systems
+		before NFS exports before IP addresses, and so on), and
+		children are still started after, and stopped before,
+		their parents.  Only use this if the resources of the same
+		type at the same place in the tree do not depend on one
+		another.
+	    </longdesc>
+	    <shortdesc lang="en">
+		Start and stop independent resources in parallel
+	    </shortdesc>
+	    <content type="boolean"/>
+	</parameter>
+
     </parameters>
 
     <actions>
@@ -163,8 +163,11 @@ flag_rgmanager_nodes(cluster_member_list_t *cml)
 }
 
 
+/**
+  Get the service states the old way: one RG_STATUS message per service.
+ */
 static rg_state_list_t *
-rg_state_list(int local_node_id, int fast)
+rg_state_list_each(int local_node_id, int fast)
 {
 	msgctx_t ctx;
 	int max = 0, n, x;
@@ -284,6 +287,190 @@ rg_state_list(int local_node_id, int fast)
 }
 
 
+/* What rgmanager last told us, and the snapshot view it is from */
+static rg_state_list_t *rg_cache = NULL;
+static uint32_t rg_cache_view = 0, rg_cache_epoch = 0;
+
+
+/**
+  Merge a batch of states into rg_cache.  The first rg_cache->rgl_count
+  entries are sorted by name; see rg_state_list().
+ */
+static int
+rg_cache_merge(rg_state_batch_t *batch, int count, int sorted)
+{
+	rg_state_list_t *rsl;
+	rg_state_t *rs, *found;
+	int x;
+
+	rsl = realloc(rg_cache, sizeof(rg_state_list_t) +
+		      sizeof(rg_state_t) * (rg_cache->rgl_count + count));
+	if (!rsl)
+		return -1;
+	rg_cache = rsl;
+
+	for (x = 0; x < count; x++) {
+		rs = &batch->rsb_states[x];
+		swab_rg_state_t(rs);
+
+		found = bsearch(rs, rsl->rgl_states, sorted,
+				sizeof(rg_state_t), rg_name_sort);
+		if (!found)
+			found = &rsl->rgl_states[rsl->rgl_count++];
+		memcpy(found, rs, sizeof(rg_state_t));
+	}
+
+	return 0;
+}
+
+
+/**
+  Get the service states with one RG_STATUS_SNAPSHOT request.  When
+  refreshing (-i), only what has changed since last time is sent.
+
+  @return		0 on success, 1 if rgmanager doesn't do
+			snapshots, -1 on failure.
+ */
+static int
+rg_state_snapshot(int fast)
+{
+	msgctx_t ctx;
+	generic_msg_hdr hdr, *msgp = NULL;
+	int n, sorted = 0, replies = 0, ret = -1;
+
+	if (msg_open(MSG_SOCKET, 0, 0, &ctx, 10) < 0)
+		return -1;
+
+	if (!rg_cache) {
+		rg_cache = malloc(sizeof(rg_state_list_t));
+		if (!rg_cache) {
+			printf("Try again, out of memory\n");
+			exit(0);
+		}
+		rg_cache->rgl_count = 0;
+		rg_cache_view = 0;
+	}
+	sorted = rg_cache->rgl_count;
+
+	hdr.gh_magic = GENERIC_HDR_MAGIC;
+	hdr.gh_length = sizeof(hdr);
+	hdr.gh_command = RG_STATUS_SNAPSHOT;
+	hdr.gh_arg1 = fast;
+	hdr.gh_arg2 = rg_cache_view;
+	hdr.gh_arg3 = rg_cache_epoch;
+	swab_generic_msg_hdr(&hdr);
+	swab32(hdr.gh_arg3);
+	if (msg_send(&ctx, &hdr, sizeof(hdr)) < (int)sizeof(hdr)) {
+		msg_close(&ctx);
+		return -1;
+	}
+
+	while (1) {
+		n = msg_receive_simple(&ctx, &msgp, 10);
+		if (n < 0) {
+			if (errno == EAGAIN) {
+				fprintf(stderr, "Timed out waiting for a "
+					"response from Resource Group "
+					"Manager\n");
+				break;
+			}
+			/* Older rgmanagers just hang up */
+			if (!replies)
+				ret = 1;
+			break;
+		}
+		++replies;
+
+		if (n < (int)sizeof(generic_msg_hdr) || !msgp) {
+			printf("Error: Malformed message\n");
+			break;
+		}
+
+		swab_generic_msg_hdr(msgp);
+
+		if (msgp->gh_command == RG_FAIL) {
+			printf("Service states unavailable: %s\n", 
+			       rg_strerror(msgp->gh_arg1));
+			break;
+		}
+
+		if (msgp->gh_command == RG_SUCCESS) {
+			rg_cache_view = msgp->gh_arg1;
+			rg_cache_epoch = msgp->gh_arg2;
+			ret = 0;
+			break;
+		}
+
+		if (msgp->gh_command != RG_STATUS_SNAPSHOT ||
+		    msgp->gh_arg1 > RG_STATE_BATCH_MAX ||
+		    n < (int)(sizeof(generic_msg_hdr) +
+			      sizeof(rg_state_t) * msgp->gh_arg1)) {
+			printf("Error: Malformed message\n");
+			break;
+		}
+
+		/* Everything, not what changed; forget what we had */
+		if (msgp->gh_arg2 && replies == 1)
+			rg_cache->rgl_count = sorted = 0;
+
+		if (rg_cache_merge((rg_state_batch_t *)msgp,
+				   msgp->gh_arg1, sorted) < 0) {
+			printf("Try again; out of RAM\n");
+			exit(1);
+		}
+
+		free(msgp);
+		msgp = NULL;
+	}
+
+	if (msgp)
+		free(msgp);
+
+	if (ret == 0)
+		msg_send_simple(&ctx, RG_SUCCESS, 0, 0);
+	else
+		rg_cache_view = 0;
+	msg_close(&ctx);
+
+	qsort(rg_cache->rgl_states, rg_cache->rgl_count, sizeof(rg_state_t),
+	      rg_name_sort);
+
+	return ret;
+}
+
+
+static rg_state_list_t *
+rg_state_list(int local_node_id, int fast)
+{
+	rg_state_list_t *rsl;
+	size_t len;
+
+	switch (rg_state_snapshot(fast)) {
+	case 0:
+		break;
+	case 1:
+		return rg_state_list_each(local_node_id, fast);
+	default:
+		return NULL;
+	}
+
+	if (!rg_cache->rgl_count)
+		return NULL;
+
+	/* The caller frees it; we keep ours for next time */
+	len = sizeof(rg_state_list_t) +
+	      sizeof(rg_state_t) * rg_cache->rgl_count;
+	rsl = malloc(len);
+	if (!rsl) {
+		printf("Try again; out of RAM\n");
+		exit(1);
+	}
+	memcpy(rsl, rg_cache, len);
+
+	return rsl;
+}
+
+
 static cluster_member_list_t *ccs_member_list(void)
 {
 	int desc;